@@ -0,0 +1,175 @@
+/*
+   Arduino sketch comparing float and fixed-point control kernels on the board
+
+   Runs Pid::compute(), the quadcopter mixer, and the 6DOF Madgwick
+   quaternion filter in float and in fixed point, and prints CPU cycles
+   per call for each, along with the largest difference between the two
+   paths.  On a board without an FPU, like the ESP8266 on the SuperFly,
+   this tells you whether building with HACKFLIGHT_FIXED_POINT pays off.
+   Needs no sensors or receiver.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include <filters.hpp>
+#include <pidcontroller.hpp>
+#include <mixers/quadxap.hpp>
+
+static const uint16_t ITERATIONS = 1000;
+
+// Exposes the protected mixing kernels
+class BenchMixer : public hf::MixerQuadXAP {
+
+    public:
+
+        using hf::Mixer::mix;
+        using hf::Mixer::mixFixed;
+};
+
+static uint32_t cycles(void)
+{
+#if defined(ESP8266) || defined(ESP32)
+    return ESP.getCycleCount();
+#else
+    return micros() * (F_CPU / 1000000);
+#endif
+}
+
+static void report(const char * name, uint32_t floatCycles, uint32_t fixedCycles, float maxError)
+{
+    Serial.print(name);
+    Serial.print(": float ");
+    Serial.print(floatCycles / ITERATIONS);
+    Serial.print("  fixed ");
+    Serial.print(fixedCycles / ITERATIONS);
+    Serial.print(" cycles/call  max difference ");
+    Serial.println(maxError, 6);
+}
+
+static void benchPid(void)
+{
+    hf::FloatPid floatPid;
+    hf::FixedPid fixedPid;
+    floatPid.init(0.05f, 0.01f, 0.01f, 6.0f);
+    fixedPid.init(0.05f, 0.01f, 0.01f, 6.0f);
+
+    float maxError = 0;
+    float floatOut = 0;
+    float fixedOut = 0;
+    uint32_t floatCycles = 0;
+    uint32_t fixedCycles = 0;
+
+    for (uint16_t k=0; k<ITERATIONS; ++k) {
+
+        float target = 0.3f * sinf(k * 0.01f);
+        float actual = target + 0.05f * sinf(k * 0.37f);
+
+        uint32_t start = cycles();
+        floatOut = floatPid.compute(target, actual);
+        floatCycles += cycles() - start;
+
+        start = cycles();
+        fixedOut = fixedPid.compute(target, actual);
+        fixedCycles += cycles() - start;
+
+        maxError = max(maxError, fabsf(floatOut - fixedOut));
+    }
+
+    report("Pid::compute()", floatCycles, fixedCycles, maxError);
+}
+
+static void benchMixer(void)
+{
+    BenchMixer mixer;
+
+    float maxError = 0;
+    uint32_t floatCycles = 0;
+    uint32_t fixedCycles = 0;
+
+    for (uint16_t k=0; k<ITERATIONS; ++k) {
+
+        hf::demands_t demands = {sinf(k * 0.01f), 0.5f * sinf(k * 0.03f), 0.5f * sinf(k * 0.05f), 0.2f * sinf(k * 0.07f)};
+
+        float floatMotors[4];
+        float fixedMotors[4];
+
+        uint32_t start = cycles();
+        mixer.mix(demands, floatMotors);
+        floatCycles += cycles() - start;
+
+        start = cycles();
+        mixer.mixFixed(demands, fixedMotors);
+        fixedCycles += cycles() - start;
+
+        for (uint8_t i=0; i<4; ++i) {
+            maxError = max(maxError, fabsf(floatMotors[i] - fixedMotors[i]));
+        }
+    }
+
+    report("Mixer::mix()", floatCycles, fixedCycles, maxError);
+}
+
+static void benchMadgwick(void)
+{
+    float beta = sqrtf(3.0f / 4.0f) * hf::Filter::deg2rad(40);
+
+    hf::MadgwickQuaternionFilter6DOF floatFilter(beta, 0);
+    hf::FixedMadgwickQuaternionFilter6DOF fixedFilter(beta, 0);
+
+    float maxError = 0;
+    uint32_t floatCycles = 0;
+    uint32_t fixedCycles = 0;
+
+    for (uint16_t k=0; k<ITERATIONS; ++k) {
+
+        // Gently rocking, with gravity mostly down
+        float gx = 0.5f * sinf(k * 0.02f);
+        float gy = 0.3f * cosf(k * 0.03f);
+        float ax = 0.1f * sinf(k * 0.02f);
+        float ay = 0.1f * cosf(k * 0.03f);
+
+        uint32_t start = cycles();
+        floatFilter.update(ax, ay, 1, gx, gy, 0, 0.005f);
+        floatCycles += cycles() - start;
+
+        start = cycles();
+        fixedFilter.update(ax, ay, 1, gx, gy, 0, 0.005f);
+        fixedCycles += cycles() - start;
+
+        maxError = max(maxError, fabsf(floatFilter.q1 - fixedFilter.q1));
+    }
+
+    report("Madgwick 6DOF", floatCycles, fixedCycles, maxError);
+}
+
+void setup(void)
+{
+    Serial.begin(115200);
+}
+
+void loop(void)
+{
+    benchPid();
+    benchMixer();
+    benchMadgwick();
+
+    Serial.println();
+
+    delay(1000);
+}
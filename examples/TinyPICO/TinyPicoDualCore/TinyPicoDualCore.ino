@@ -0,0 +1,98 @@
+/*
+   Hackflight sketch for TinyPICO with DSMX receiver, using both ESP32 cores
+
+   The gyro/PID/mixer loop runs by itself in loop() on core 1, where the
+   Arduino core puts it.  A task pinned to core 0 decodes the receiver and
+   handles serial comms and optional sensors.  The cores exchange vehicle
+   state and receiver demands through lock-free snapshots, so nothing on
+   core 0 can hold up the control loop.
+
+   Additional libraries needed:
+
+       https://github.com/simondlevy/EM7180
+       https://github.com/simondlevy/CrossPlatformDataBus
+       https://github.com/simondlevy/SpektrumDSM 
+
+       https://github.com/plerup/espsoftwareserial
+
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hackflight.hpp"
+#include "boards/arduino/tinypico.hpp"
+#include "receivers/arduino/dsmx.hpp"
+#include "mixers/quadxcf.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+
+static const uint8_t SERIAL1_RX = 32;
+static const uint8_t SERIAL1_TX = 33; // unused
+
+static const uint8_t COMMS_CORE = 0;
+
+static constexpr uint8_t CHANNEL_MAP[6] = {0, 1, 2, 3, 6, 4};
+
+static constexpr float DEMAND_SCALE = 8.0f;
+
+hf::Hackflight h;
+
+hf::DSMX_Receiver rc = hf::DSMX_Receiver(CHANNEL_MAP, DEMAND_SCALE);  
+
+hf::MixerQuadXCF mixer;
+
+hf::RatePid ratePid = hf::RatePid(0.05f, 0.00f, 0.00f, 0.10f, 0.01f); 
+
+hf::LevelPid levelPid = hf::LevelPid(0.20f);
+
+// Receiver, serial comms, and optional sensors
+static void commsTask(void * params)
+{
+    while (true) {
+
+        while (Serial1.available()) {
+            rc.handleSerialEvent(Serial1.read(), micros());
+        }
+
+        h.updateComms();
+
+        delay(1);
+    }
+}
+
+void setup(void)
+{
+    // Start receiver on Serial1
+    Serial1.begin(115000, SERIAL_8N1, SERIAL1_RX, SERIAL1_TX);
+
+    // Initialize Hackflight firmware
+    h.init(new hf::TinyPico(), &rc, &mixer);
+
+    // Add Rate and Level PID controllers
+    h.addPidController(&levelPid);
+    h.addPidController(&ratePid);
+
+    // Split the loop across the two cores
+    h.useDualCore();
+
+    // Start the comms task on the other core
+    TaskHandle_t task;
+    xTaskCreatePinnedToCore(commsTask, "Comms", 10000, NULL, 1, &task, COMMS_CORE);
+}
+
+void loop(void)
+{
+    h.updateControl();
+}
@@ -0,0 +1,561 @@
+/*
+   Self-check and timing for DShot encoding and output
+
+   Checks the pulse timing for each DShot speed, and that encoding with the
+   table gives the same pulses as working through the bits one at a time,
+   for every value with and without the telemetry bit.  Checks a known
+   frame, the throttle range, and that commands go out in place of the
+   throttle for as many frames as the ESC needs, and then stop.
+
+   Then runs a quadcopter mixer on a board that sends its motors through
+   DShotOutput to a fake RMT, through both the abstract Board and the
+   concrete class, at an 8 kHz loop.  Checks that every motor gets exactly
+   one frame per loop, even when the mix doesn't change, that each frame
+   carries the mixed throttle, and that no frame is still going out when
+   the next loop starts.
+
+   Last, runs Hackflight itself on a Linux board whose motors go out over
+   DShot, through both Hackflight and HackflightCore, and checks that the
+   motors get a frame every loop while disarmed, armed with the throttle
+   down, flying, and after a failsafe, carrying zero throttle whenever the
+   motors are stopped.  Reports the cycles to encode a frame each way, and
+   exits with a nonzero status on any failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "hackflight.hpp"
+#include "boards/linux/linux.hpp"
+#include "receivers/linux.hpp"
+#include "mixers/quadxap.hpp"
+#include "motors/dshot.hpp"
+
+#include "fakermt.hpp"
+
+#include "selfcheck.hpp"
+
+static const float TICK = 12.5; // nanoseconds, as the ESP32 RMT is set up
+
+static const float TOLERANCE = 0.02; // of the bit period
+
+static const uint32_t LOOPS = 1000;
+
+static const double LOOP_NANOSECONDS = 125000; // 8 kHz
+
+static const uint32_t ITERATIONS = 1000000;
+
+static const uint32_t PHASE_LOOPS = 200;
+
+static constexpr uint8_t CHANNEL_MAP[6] = {0, 1, 2, 3, 4, 5};
+
+// Pulses for a frame a bit at a time, as the output task used to make them, with DShot600 at 12.5 ns ticks
+static void encodeBits(uint16_t packet, uint32_t items[16])
+{
+    for (uint8_t i=0; i<16; i++) {
+        items[i] = (packet & 0x8000) ? (100 | (1 << 15) | (33 << 16)) : (50 | (1 << 15) | (83 << 16));
+        packet <<= 1;
+    }
+}
+
+// Frame as the output task used to make it, with the checksum worked out a nibble at a time
+static uint16_t frameBits(uint16_t value, bool telemetry)
+{
+    uint16_t packet = (value << 1) | (telemetry ? 1 : 0);
+
+    int csum = 0;
+    int csum_data = packet;
+    for (int i = 0; i < 3; i++) {
+        csum ^=  csum_data;
+        csum_data >>= 4;
+    }
+    csum &= 0xf;
+
+    return (packet << 4) | csum;
+}
+
+static FakeRmt::frame_t toFrame(const uint32_t items[16])
+{
+    FakeRmt::frame_t frame = {};
+    for (uint8_t k=0; k<16; ++k) {
+        frame.items[k] = items[k];
+    }
+    frame.count = 16;
+    return frame;
+}
+
+static void testTiming(void)
+{
+    printf("Pulse timing\n");
+
+    static const hf::DShot::speed_t speeds[4] = {
+        hf::DShot::DSHOT150, hf::DShot::DSHOT300, hf::DShot::DSHOT600, hf::DShot::DSHOT1200
+    };
+
+    char what[100];
+
+    for (uint8_t s=0; s<4; ++s) {
+
+        hf::DShot dshot(speeds[s], TICK);
+
+        // All ones and all zeros, which between them have every pulse there is
+        bool ok = true;
+        float worst = 0;
+        uint16_t frames[2] = {0xffff, 0x0000};
+        for (uint8_t f=0; f<2; ++f) {
+            uint32_t items[16];
+            dshot.encode(frames[f], items);
+            uint16_t bits = 0;
+            float error = 0;
+            ok = ok && FakeRmt::decode(toFrame(items), TICK, speeds[s], TOLERANCE, bits, error) && bits == frames[f];
+            worst = fmaxf(worst, error);
+        }
+
+        float frameMicroseconds = 16 * dshot.getBitTicks() * TICK / 1000;
+
+        sprintf(what, "DShot%-4u %5.1f us per frame, pulses within %.1f%%", speeds[s], frameMicroseconds, 100*worst);
+        check(ok, what);
+    }
+}
+
+static void testEncoding(void)
+{
+    printf("\nEncoding\n");
+
+    hf::DShot dshot(hf::DShot::DSHOT600, TICK);
+
+    bool sameFrames = true;
+    bool samePulses = true;
+    bool roundTrip = true;
+
+    for (uint16_t value=0; value<2048; ++value) {
+        for (uint8_t telemetry=0; telemetry<2; ++telemetry) {
+
+            uint16_t frame = hf::DShot::frame(value, telemetry);
+
+            sameFrames = sameFrames && frame == frameBits(value, telemetry);
+
+            uint32_t items[16];
+            uint32_t reference[16];
+            dshot.encode(frame, items);
+            encodeBits(frame, reference);
+
+            for (uint8_t k=0; k<16; ++k) {
+                samePulses = samePulses && items[k] == reference[k];
+            }
+
+            uint16_t bits = 0;
+            float error = 0;
+            roundTrip = roundTrip && FakeRmt::decode(toFrame(items), TICK, 600, TOLERANCE, bits, error) &&
+                bits >> 5 == value && ((bits >> 4) & 1) == telemetry;
+        }
+    }
+
+    check(sameFrames, "Frames and checksums same as a nibble at a time");
+    check(samePulses, "Pulses from the table same as a bit at a time");
+    check(roundTrip, "Every frame decodes to its value and telemetry bit");
+    check(hf::DShot::frame(1046, false) == 0x82c6, "Throttle 1046 is 0x82C6");
+
+    check(hf::DShot::throttle(0) == 48 && hf::DShot::throttle(1) == 2047 &&
+            hf::DShot::throttle(-0.5f) == 48 && hf::DShot::throttle(1.5f) == 2047, "Motor values [0,1] are throttle 48-2047");
+
+    // Timing, best of five
+    uint64_t bestBits = UINT64_MAX;
+    uint64_t bestTable = UINT64_MAX;
+    uint32_t sum = 0;
+
+    for (uint8_t pass=0; pass<5; ++pass) {
+
+        uint32_t items[16];
+
+        uint64_t start = cycles();
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            encodeBits(frameBits(k & 0x7ff, false), items);
+            sum += items[k & 0xf];
+        }
+        uint64_t elapsed = cycles() - start;
+        bestBits = elapsed < bestBits ? elapsed : bestBits;
+
+        start = cycles();
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            dshot.encode(hf::DShot::frame(k & 0x7ff, false), items);
+            sum += items[k & 0xf];
+        }
+        elapsed = cycles() - start;
+        bestTable = elapsed < bestTable ? elapsed : bestTable;
+    }
+
+    double bits = (double)bestBits / ITERATIONS;
+    double table = (double)bestTable / ITERATIONS;
+
+    printf("%-40s %8.1f cycles/frame\n", "A bit at a time", bits);
+    printf("%-40s %8.1f cycles/frame\n", "From the table", table);
+
+    check(table < bits, "Table is cheaper");
+
+    // Keep the compiler from discarding the work
+    if (sum == 1) {
+        printf("%u\n", sum);
+    }
+}
+
+// Value and telemetry bit of the last frame on a channel
+static bool lastFrame(const FakeRmt & rmt, uint8_t channel, uint16_t & value, bool & telemetry)
+{
+    uint16_t bits = 0;
+    float error = 0;
+    bool ok = FakeRmt::decode(rmt.getFrame(channel), TICK, 600, TOLERANCE, bits, error);
+    value = bits >> 5;
+    telemetry = (bits >> 4) & 1;
+    return ok && (bits & 0xf) == (hf::DShot::frame(value, telemetry) & 0xf);
+}
+
+static void testCommands(void)
+{
+    printf("\nCommands\n");
+
+    hf::DShotOutput<FakeRmt> output(hf::DShot::DSHOT600, TICK);
+    output.addMotor(25);
+    output.addMotor(26);
+    output.begin();
+
+    float motors[2] = {0.5f, 0.5f};
+
+    output.command(0, hf::DShot::SPIN_DIRECTION_REVERSED);
+
+    uint8_t sent = 0;
+    bool others = true;
+    bool telemetry = true;
+    for (uint8_t k=0; k<20; ++k) {
+        output.writeMotors(motors, 2);
+        uint16_t value = 0;
+        bool bit = false;
+        lastFrame(output.getRmt(), 0, value, bit);
+        if (value == hf::DShot::SPIN_DIRECTION_REVERSED) {
+            sent++;
+            telemetry = telemetry && bit;
+        }
+        lastFrame(output.getRmt(), 1, value, bit);
+        others = others && value == hf::DShot::throttle(0.5f);
+    }
+
+    uint16_t value = 0;
+    bool bit = false;
+    lastFrame(output.getRmt(), 0, value, bit);
+
+    char what[100];
+
+    sprintf(what, "Spin direction command sent %u times, with telemetry bit", sent);
+    check(sent == 10 && telemetry, what);
+    check(value == hf::DShot::throttle(0.5f) && !output.commandPending(0), "  then the throttle again");
+    check(others, "  and only to its own motor");
+
+    output.command(1, hf::DShot::BEEP1);
+    output.writeMotors(motors, 2);
+    lastFrame(output.getRmt(), 1, value, bit);
+    bool beeped = value == hf::DShot::BEEP1;
+    output.writeMotors(motors, 2);
+    lastFrame(output.getRmt(), 1, value, bit);
+    check(beeped && value == hf::DShot::throttle(0.5f), "Beep sent once");
+
+    uint32_t writes = output.getRmt().getWrites(0);
+    output.writeMotor(0, 0.25f);
+    output.writeMotor(1, 0.75f);
+    bool held = output.getRmt().getWrites(0) == writes;
+    output.flush();
+    uint16_t second = 0;
+    lastFrame(output.getRmt(), 0, value, bit);
+    lastFrame(output.getRmt(), 1, second, bit);
+    check(held && output.getRmt().getWrites(0) == writes + 1 && output.getRmt().getWrites(1) == writes + 1 &&
+            value == hf::DShot::throttle(0.25f) && second == hf::DShot::throttle(0.75f),
+            "writeMotor() holds each value for one flush()");
+}
+
+// A board that sends its motors over DShot every time the mixer writes them
+class DShotBoard : public hf::Board {
+
+    friend class hf::Dispatch;
+
+    public:
+
+        hf::DShotOutput<FakeRmt> output = hf::DShotOutput<FakeRmt>(hf::DShot::DSHOT600, TICK);
+
+        DShotBoard(void)
+        {
+            for (uint8_t k=0; k<4; ++k) {
+                output.addMotor(25 + k);
+            }
+            output.begin();
+        }
+
+    protected:
+
+        virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz) override
+        {
+            (void)qw; (void)qx; (void)qy; (void)qz;
+            return false;
+        }
+
+        virtual bool getGyrometer(float & gx, float & gy, float & gz) override
+        {
+            (void)gx; (void)gy; (void)gz;
+            return false;
+        }
+
+        virtual uint32_t getMicros(void) override
+        {
+            return 0;
+        }
+
+        virtual void writeMotor(uint8_t index, float value) override
+        {
+            output.writeMotor(index, value);
+        }
+
+        virtual void writeMotors(const float * values, uint8_t count) override
+        {
+            output.writeMotors(values, count);
+        }
+
+        virtual bool motorsNeedRefresh(void) override
+        {
+            return true;
+        }
+};
+
+class TestMixer : public hf::MixerQuadXAP {
+
+    public:
+
+        using hf::MixerQuadXAP::mix;
+        using hf::MixerQuadXAP::runArmed;
+};
+
+template <typename BoardPointerT>
+static void testLoop(const char * name)
+{
+    DShotBoard board;
+    TestMixer mixer;
+
+    BoardPointerT pointer = &board;
+
+    FakeRmt & rmt = board.output.getRmt();
+
+    bool throttles = true;
+
+    for (uint32_t k=0; k<LOOPS; ++k) {
+
+        // Same demand for the second half, so the mix stops changing
+        hf::demands_t demands = {};
+        float t = k < LOOPS/2 ? k / (float)LOOPS : 0.5f;
+        demands.throttle = t - 0.5f;
+        demands.roll = 0.1f * t;
+
+        rmt.setTime(k * LOOP_NANOSECONDS);
+
+        mixer.runArmed(pointer, demands);
+
+        float motors[4];
+        mixer.mix(demands, motors);
+
+        for (uint8_t i=0; i<4; ++i) {
+            uint16_t value = 0;
+            bool telemetry = false;
+            throttles = throttles && lastFrame(rmt, i, value, telemetry) &&
+                value == hf::DShot::throttle(motors[i]) && !telemetry;
+        }
+    }
+
+    bool oncePerLoop = true;
+    bool noOverruns = true;
+    bool pins = true;
+    double spread = 0;
+    for (uint8_t i=0; i<4; ++i) {
+        oncePerLoop = oncePerLoop && rmt.getWrites(i) == LOOPS;
+        noOverruns = noOverruns && rmt.getOverruns(i) == 0;
+        pins = pins && rmt.isInitialized(i) && rmt.getPin(i) == 25 + i;
+        spread = fmax(spread, rmt.getFrame(i).startNanoseconds - rmt.getFrame(0).startNanoseconds);
+    }
+
+    char what[100];
+
+    sprintf(what, "%s: one frame per motor per loop", name);
+    check(oncePerLoop && pins, what);
+
+    check(throttles, "  each carrying the mixed throttle");
+
+    sprintf(what, "  each done %.1f us into the %.0f us loop", rmt.getFrame(0).endNanoseconds / 1000 -
+            (LOOPS - 1) * LOOP_NANOSECONDS / 1000, LOOP_NANOSECONDS / 1000);
+    check(noOverruns && spread == 0, what);
+}
+
+// A Linux board whose motors go out over DShot, as an ESP32 board with Esp32DShot600 would send them
+class DShotLinuxBoard : public hf::LinuxBoard {
+
+    friend class hf::Dispatch;
+
+    public:
+
+        hf::DShotOutput<FakeRmt> output = hf::DShotOutput<FakeRmt>(hf::DShot::DSHOT600, TICK);
+
+        DShotLinuxBoard(void)
+        {
+            for (uint8_t k=0; k<4; ++k) {
+                output.addMotor(25 + k);
+            }
+            output.begin();
+        }
+
+    protected:
+
+        virtual void writeMotors(const float * values, uint8_t count) override
+        {
+            output.writeMotors(values, count);
+        }
+
+        virtual bool motorsNeedRefresh(void) override
+        {
+            return true;
+        }
+};
+
+typedef hf::HackflightCore<DShotLinuxBoard, hf::LinuxReceiver, hf::MixerQuadXAP, 1, 0> StaticHackflight;
+
+// Runs Hackflight for a while in one state, and reports the fewest and most frames any motor got in a loop,
+// the most on any loop but the first (when the receiver may also stop the motors), and whether every frame
+// carried zero throttle
+template <typename HackflightT>
+static void runPhase(HackflightT & h, DShotLinuxBoard & board, uint32_t & loop,
+        uint32_t & fewest, uint32_t & most, uint32_t & mostAfterFirst, bool & stopped)
+{
+    FakeRmt & rmt = board.output.getRmt();
+
+    fewest = UINT32_MAX;
+    most = 0;
+    mostAfterFirst = 0;
+    stopped = true;
+
+    for (uint32_t k=0; k<PHASE_LOOPS; ++k) {
+
+        uint32_t before[4];
+        for (uint8_t i=0; i<4; ++i) {
+            before[i] = rmt.getWrites(i);
+        }
+
+        rmt.setTime(loop++ * LOOP_NANOSECONDS);
+
+        // A gyrometer sample every loop, and a quaternion every other one
+        board.setGyrometer(0, 0, 0);
+        if (k % 2 == 0) {
+            board.setQuaternion(1, 0, 0, 0);
+        }
+
+        h.update();
+
+        for (uint8_t i=0; i<4; ++i) {
+
+            uint32_t frames = rmt.getWrites(i) - before[i];
+            fewest = frames < fewest ? frames : fewest;
+            most = frames > most ? frames : most;
+            if (k > 0) {
+                mostAfterFirst = frames > mostAfterFirst ? frames : mostAfterFirst;
+            }
+
+            uint16_t value = 0;
+            bool telemetry = false;
+            stopped = stopped && lastFrame(rmt, i, value, telemetry) && value == hf::DShot::throttle(0);
+        }
+    }
+}
+
+template <typename HackflightT, typename BoardT, typename ReceiverT, typename MixerT>
+static void testHackflight(const char * name)
+{
+    HackflightT h;
+    DShotLinuxBoard board;
+    hf::LinuxReceiver rc(CHANNEL_MAP);
+    hf::MixerQuadXAP mixer;
+
+    h.init((BoardT *)&board, (ReceiverT *)&rc, (MixerT *)&mixer);
+
+    printf("%s\n", name);
+
+    static const char * phases[5] = {
+        "Disarmed", "Armed, throttle down", "Flying", "Throttle down again", "After failsafe"
+    };
+
+    uint32_t loop = 0;
+    bool armed[5] = {false};
+    bool stopped[5] = {false};
+
+    for (uint8_t p=0; p<5; ++p) {
+
+        // Each state starts with a receiver frame, and then the receiver says nothing new
+        switch (p) {
+            case 0:
+                rc.setChannel(5, -1);   // aux2 down
+                break;
+            case 1:
+                rc.setChannel(5, +1);   // aux2 up with throttle down, to arm
+                break;
+            case 2:
+                rc.setChannel(0, 0);    // throttle to the middle
+                break;
+            case 3:
+                rc.setChannel(0, -1);
+                break;
+            case 4:
+                rc.setChannel(0, 0);
+                rc.setLostSignal(true);
+        }
+
+        uint32_t fewest = 0, most = 0, mostAfterFirst = 0;
+        runPhase(h, board, loop, fewest, most, mostAfterFirst, stopped[p]);
+        armed[p] = board.getLed();
+
+        char what[100];
+        sprintf(what, "  %s: %u to %u frames per loop", phases[p], fewest, most);
+        check(fewest >= 1 && most <= 2 && mostAfterFirst == 1, what);
+    }
+
+    check(!armed[0] && armed[1] && armed[2] && armed[3] && !armed[4], "  armed and disarmed as expected");
+    check(stopped[0] && stopped[1] && !stopped[2] && stopped[3] && stopped[4],
+            "  zero throttle except when flying");
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    testTiming();
+    testEncoding();
+    testCommands();
+
+    printf("\nMixer to DShot at 8 kHz\n");
+    testLoop<hf::Board *>("Board");
+    testLoop<DShotBoard *>("DShotBoard");
+
+    printf("\nHackflight to DShot, every loop in every state\n");
+    testHackflight<hf::Hackflight, hf::Board, hf::Receiver, hf::Mixer>("Hackflight");
+    testHackflight<StaticHackflight, DShotLinuxBoard, hf::LinuxReceiver, hf::MixerQuadXAP>("HackflightCore");
+
+    return finish();
+}
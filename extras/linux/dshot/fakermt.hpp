@@ -0,0 +1,166 @@
+/*
+   Stand-in for the ESP32's RMT peripheral, for running DShotOutput on Linux
+
+   Keeps the last frame written to each channel, and works out when it
+   would have gone out on the wire from a clock that the caller sets: a
+   frame starts when it is written, or when the one before it on the same
+   channel finishes if that is later, which counts as an overrun.  decode()
+   turns a frame back into its sixteen bits, checking each pulse against
+   the DShot timing as it goes.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+class FakeRmt {
+
+    public:
+
+        static const uint8_t MAX_CHANNELS = 8;
+
+        typedef struct {
+
+            uint32_t items[64];
+            uint8_t  count;
+            double   startNanoseconds;
+            double   endNanoseconds;
+
+        } frame_t;
+
+    private:
+
+        uint8_t _pins[MAX_CHANNELS] = {0};
+        bool    _initialized[MAX_CHANNELS] = {false};
+        float   _tickNanoseconds = 0;
+
+        frame_t  _frames[MAX_CHANNELS] = {};
+        uint32_t _writes[MAX_CHANNELS] = {0};
+        uint32_t _overruns[MAX_CHANNELS] = {0};
+
+        double _now = 0;
+
+    public:
+
+        bool init(uint8_t channel, uint8_t pin, float tickNanoseconds)
+        {
+            _pins[channel] = pin;
+            _initialized[channel] = true;
+            _tickNanoseconds = tickNanoseconds;
+
+            return true;
+        }
+
+        void write(uint8_t channel, const uint32_t * items, uint8_t count)
+        {
+            frame_t & frame = _frames[channel];
+
+            double start = _now;
+            if (_writes[channel] > 0 && frame.endNanoseconds > _now) {
+                start = frame.endNanoseconds;
+                _overruns[channel]++;
+            }
+
+            double ticks = 0;
+            for (uint8_t k=0; k<count; ++k) {
+                frame.items[k] = items[k];
+                ticks += (items[k] & 0x7fff) + ((items[k] >> 16) & 0x7fff);
+            }
+
+            frame.count = count;
+            frame.startNanoseconds = start;
+            frame.endNanoseconds = start + ticks * _tickNanoseconds;
+
+            _writes[channel]++;
+        }
+
+        void setTime(double nanoseconds)
+        {
+            _now = nanoseconds;
+        }
+
+        const frame_t & getFrame(uint8_t channel) const
+        {
+            return _frames[channel];
+        }
+
+        uint32_t getWrites(uint8_t channel) const
+        {
+            return _writes[channel];
+        }
+
+        uint32_t getOverruns(uint8_t channel) const
+        {
+            return _overruns[channel];
+        }
+
+        uint8_t getPin(uint8_t channel) const
+        {
+            return _pins[channel];
+        }
+
+        bool isInitialized(uint8_t channel) const
+        {
+            return _initialized[channel];
+        }
+
+        /**
+         * The bits of a frame, if every pulse is high then low, and lasts the bit period within the
+         * tolerance, high for 3/8 of it for a zero and 3/4 for a one.  Also gives the worst error, as a
+         * fraction of the bit period.
+         */
+        static bool decode(const frame_t & frame, float tickNanoseconds, uint16_t speed, float tolerance,
+                uint16_t & bits, float & worst)
+        {
+            float period = 1e6f / speed;
+
+            bits = 0;
+            worst = 0;
+
+            if (frame.count != 16) {
+                return false;
+            }
+
+            for (uint8_t k=0; k<16; ++k) {
+
+                uint32_t item = frame.items[k];
+
+                bool highFirst = (item >> 15) & 1;
+                bool lowSecond = !((item >> 31) & 1);
+                float high = (item & 0x7fff) * tickNanoseconds;
+                float low  = ((item >> 16) & 0x7fff) * tickNanoseconds;
+
+                if (!highFirst || !lowSecond) {
+                    return false;
+                }
+
+                bool one = high > period / 2;
+                float duty = one ? 0.75f : 0.375f;
+
+                worst = fmaxf(worst, fabsf(high + low - period) / period);
+                worst = fmaxf(worst, fabsf(high - duty * period) / period);
+
+                bits = (bits << 1) | (one ? 1 : 0);
+            }
+
+            return worst <= tolerance;
+        }
+
+}; // class FakeRmt
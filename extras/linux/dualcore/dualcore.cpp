@@ -0,0 +1,332 @@
+/*
+   Host build of the dual-core loop split, with stress tests for torn reads
+
+   First hammers a Seqlock<state_t> from a writer thread while the main
+   thread reads it, checking that no read ever mixes two writes.  Then
+   runs Hackflight split across two threads, as it would be across the
+   ESP32's two cores: one thread calls updateControl() as fast as it can,
+   injecting gyrometer and quaternion values, and the other calls
+   updateComms() once per millisecond, driving the receiver through arming,
+   flight, and loss of signal.  A PID controller on the control thread and
+   an optional sensor on the comms thread check that every snapshot they
+   see from the other thread is whole.  Exits with a nonzero status on any
+   failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include <thread>
+
+#include "hackflight.hpp"
+#include "seqlock.hpp"
+#include "boards/linux/linux.hpp"
+#include "receivers/linux.hpp"
+#include "mixers/quadxap.hpp"
+
+#include "selfcheck.hpp"
+
+static const uint32_t SEQLOCK_WRITES = 2000000;
+
+// Comms-thread schedule, in milliseconds
+static const uint32_t ARM_MSEC       = 20;
+static const uint32_t THROTTLE_MSEC  = 40;
+static const uint32_t LOST_MSEC      = 1500;
+static const uint32_t STOP_MSEC      = 1700;
+
+static const uint8_t CHANNEL_MAP[6] = {0, 1, 2, 3, 4, 5};
+
+static void sleepMicros(uint32_t usec)
+{
+    struct timespec ts;
+    ts.tv_sec  = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+// Every field of write k holds k, so a read that mixes two writes shows up as a mismatch
+static void fillState(hf::state_t & state, uint32_t k)
+{
+    float f = (float)(k & 0xFFFFFF);
+
+    state.armed = k & 1;
+
+    state.cache.setQuaternion(f, f, f, f);
+    state.cache.setAngularVelocity(f, f, f);
+
+    for (uint8_t j=0; j<3; ++j) {
+        state.cache.setLocation(j, f);
+        state.bodyAccel[j]   = f;
+        state.bodyVel[j]     = f;
+        state.inertialVel[j] = f;
+    }
+}
+
+static bool stateIsWhole(const hf::state_t & state)
+{
+    const float * location = state.cache.getLocation();
+    const float * quaternion = state.cache.getQuaternion();
+    const float * angularVel = state.cache.getAngularVelocity();
+
+    float f = location[0];
+
+    if (state.armed != (((uint32_t)f & 1) == 1)) {
+        return false;
+    }
+
+    for (uint8_t j=0; j<4; ++j) {
+        if (quaternion[j] != f) {
+            return false;
+        }
+    }
+
+    for (uint8_t j=0; j<3; ++j) {
+        if (location[j] != f || angularVel[j] != f || state.bodyAccel[j] != f || state.bodyVel[j] != f || state.inertialVel[j] != f) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void testSeqlock(void)
+{
+    hf::Seqlock<hf::state_t> seqlock;
+
+    bool done = false;
+
+    std::thread writer([&seqlock, &done]() {
+        hf::state_t state;
+        for (uint32_t k=1; k<=SEQLOCK_WRITES; ++k) {
+            fillState(state, k);
+            seqlock.write(state);
+        }
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    });
+
+    uint32_t reads = 0;
+    uint32_t retries = 0;
+    uint32_t torn = 0;
+    uint32_t backward = 0;
+    float last = 0;
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+
+        hf::state_t state;
+
+        if (!seqlock.tryRead(state)) {
+            retries++;
+            continue;
+        }
+
+        reads++;
+
+        if (!stateIsWhole(state)) {
+            torn++;
+        }
+
+        if (state.cache.getLocation()[0] < last) {
+            backward++;
+        }
+
+        last = state.cache.getLocation()[0];
+    }
+
+    writer.join();
+
+    printf("Seqlock: %u writes, %u reads, %u retried\n\n", SEQLOCK_WRITES, reads, retries);
+
+    check(torn == 0, "no torn reads");
+    check(backward == 0, "reads never go back in time");
+    check(seqlock.count() == SEQLOCK_WRITES, "write count");
+}
+
+// Runs on the control thread, checking the fields it gets from the comms thread
+class ControlCheck : public hf::PidController {
+
+    public:
+
+        uint32_t calls = 0;
+        uint32_t torn = 0;
+        uint32_t armedCalls = 0;
+
+    protected:
+
+        virtual void modifyDemands(hf::state_t & state, hf::demands_t & demands) override
+        {
+            (void)demands;
+
+            calls++;
+
+            if (state.armed) {
+                armedCalls++;
+            }
+
+            const float * location = state.cache.getLocation();
+
+            float f = location[0];
+
+            for (uint8_t j=0; j<3; ++j) {
+                if (location[j] != f || state.bodyAccel[j] != f || state.bodyVel[j] != f ||
+                        state.inertialVel[j] != f) {
+                    torn++;
+                }
+            }
+        }
+
+}; // class ControlCheck
+
+// Runs on the comms thread, checking the fields it gets from the control thread, and writing
+// its own fields for ControlCheck
+class CommsCheck : public hf::Sensor {
+
+    public:
+
+        uint32_t calls = 0;
+        uint32_t torn = 0;
+
+    protected:
+
+        virtual bool ready(uint64_t usec) override
+        {
+            (void)usec;
+            return true;
+        }
+
+        virtual void modifyState(hf::state_t & state, uint64_t usec) override
+        {
+            (void)usec;
+
+            calls++;
+
+            // Gyrometer negates Y and Z
+            const float * angularVel = state.cache.getAngularVelocity();
+            float g = angularVel[0];
+            if (angularVel[1] != -g || angularVel[2] != -g) {
+                torn++;
+            }
+
+            float f = (float)(calls & 0xFFFFFF);
+            for (uint8_t j=0; j<3; ++j) {
+                state.cache.setLocation(j, f);
+                state.bodyAccel[j]   = f;
+                state.bodyVel[j]     = f;
+                state.inertialVel[j] = f;
+            }
+        }
+
+}; // class CommsCheck
+
+static void testSplit(void)
+{
+    hf::Hackflight h;
+    hf::LinuxBoard board;
+    hf::LinuxReceiver rc(CHANNEL_MAP);
+    hf::MixerQuadXAP mixer;
+    ControlCheck controlCheck;
+    CommsCheck commsCheck;
+
+    h.init(&board, &rc, &mixer);
+    h.addPidController(&controlCheck);
+    h.addSensor(&commsCheck);
+    h.useDualCore();
+
+    bool done = false;
+    float flyingMotor = 0;
+
+    std::thread comms([&]() {
+
+        for (uint32_t msec=0; msec<STOP_MSEC; ++msec) {
+
+            // Aux2 down, then up with throttle down, to arm
+            if (msec == 0) {
+                rc.setChannel(5, -1);
+                rc.setChannel(0, -1);
+            }
+            if (msec == ARM_MSEC) {
+                rc.setChannel(5, +1);
+            }
+            if (msec == THROTTLE_MSEC) {
+                rc.setChannel(0, 0);
+            }
+            if (msec == LOST_MSEC - 1) {
+                flyingMotor = board.getMotor(0);
+            }
+            if (msec == LOST_MSEC) {
+                rc.setLostSignal(true);
+            }
+
+            h.updateComms();
+
+            sleepMicros(1000);
+        }
+
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    });
+
+    uint32_t loops = 0;
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+
+        // Same value on each axis, so CommsCheck can spot a torn snapshot
+        float g = (float)(loops & 0xFFFFF);
+        board.setGyrometer(g, g, g);
+
+        if (loops % 5 == 0) {
+            board.setQuaternion(1, 0, 0, 0);
+        }
+
+        h.updateControl();
+
+        loops++;
+
+        // Let the comms thread run if it shares our core
+        if (loops % 64 == 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    comms.join();
+
+    // Let the control thread see the final state
+    h.updateControl();
+
+    printf("\nSplit: %u control loops, %u comms passes\n\n", loops, commsCheck.calls);
+
+    check(controlCheck.torn == 0, "control thread saw no torn comms snapshots");
+    check(commsCheck.torn == 0, "comms thread saw no torn control snapshots");
+    check(controlCheck.armedCalls > 0, "arming reached control thread");
+    check(flyingMotor > 0, "control thread ran motors when armed");
+    check(board.getMotor(0) == 0, "control thread stopped motors on loss of signal");
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    // micros() latches its start time on first call; do that before any thread can race for it
+    micros();
+
+    testSeqlock();
+
+    testSplit();
+
+    return finish();
+}
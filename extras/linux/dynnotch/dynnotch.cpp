@@ -0,0 +1,329 @@
+/*
+   Self-check and timing for the dynamic notch filter
+
+   Feeds DynamicNotch synthetic gyrometer signals at 8 kHz: slow vehicle
+   motion plus motor-noise tones on each axis, fixed and then sweeping as
+   if the motors were spinning up.  Checks that the notches find the
+   tones, that the tones are attenuated while the motion passes through,
+   and that the sample rate is measured correctly when none is given.
+   Then reports the cost of apply() per call, mean and for the most
+   expensive step of the analysis, next to the cost of a whole three-axis
+   analysis done at once.  Exits with a nonzero status on any failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "dynamicnotch.hpp"
+
+#include "selfcheck.hpp"
+
+static const float SAMPLE_HZ = 8000;
+static const uint32_t PERIOD_USEC = 125;
+
+static const float MOTION_HZ = 5;
+
+static double nanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Amplitude of one frequency in a stretch of signal, by correlation
+class Tone {
+
+    private:
+
+        double _re = 0;
+        double _im = 0;
+        uint32_t _count = 0;
+
+    public:
+
+        void add(float x, float hz, uint32_t k)
+        {
+            double phase = 2 * M_PI * hz * k / SAMPLE_HZ;
+            _re += x * cos(phase);
+            _im += x * sin(phase);
+            _count++;
+        }
+
+        float amplitude(void)
+        {
+            return 2 * sqrt(_re * _re + _im * _im) / _count;
+        }
+};
+
+// Slow motion on every axis, plus tones of the given frequencies
+static void signal(uint32_t k, const float hz[3][2], float g[3])
+{
+    float t = k / SAMPLE_HZ;
+
+    for (uint8_t axis=0; axis<3; ++axis) {
+        g[axis] = sinf(2 * M_PI * MOTION_HZ * t + axis);
+        for (uint8_t j=0; j<2; ++j) {
+            if (hz[axis][j] > 0) {
+                g[axis] += 0.3f * sinf(2 * M_PI * hz[axis][j] * t);
+            }
+        }
+    }
+}
+
+static void testFixedTones(void)
+{
+    printf("Fixed tones\n");
+
+    // One tone on x and y, two on z
+    static const float HZ[3][2] = { {180, 0}, {250, 0}, {150, 320} };
+
+    hf::DynamicNotch notch(2, 80, 400, 3.5f);
+    notch.begin(SAMPLE_HZ);
+
+    check(fabsf(notch.getResolution() - 12.5f) < 1e-3f, "Analysis at 800 Hz, 12.5 Hz per bin");
+
+    static const uint32_t SAMPLES = 2 * SAMPLE_HZ;
+
+    Tone toneIn[3][2];
+    Tone toneOut[3][2];
+    Tone motionIn[3];
+    Tone motionOut[3];
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        float g[3];
+        signal(k, HZ, g);
+
+        float in[3] = {g[0], g[1], g[2]};
+
+        notch.apply(g[0], g[1], g[2], (uint64_t)k * PERIOD_USEC);
+
+        // Measure over the last half second
+        if (k >= SAMPLES - SAMPLE_HZ/2) {
+            for (uint8_t axis=0; axis<3; ++axis) {
+                for (uint8_t j=0; j<2; ++j) {
+                    if (HZ[axis][j] > 0) {
+                        toneIn[axis][j].add(in[axis], HZ[axis][j], k);
+                        toneOut[axis][j].add(g[axis], HZ[axis][j], k);
+                    }
+                }
+                motionIn[axis].add(in[axis], MOTION_HZ, k);
+                motionOut[axis].add(g[axis], MOTION_HZ, k);
+            }
+        }
+    }
+
+    char what[100];
+
+    for (uint8_t axis=0; axis<3; ++axis) {
+
+        for (uint8_t j=0; j<2; ++j) {
+
+            if (HZ[axis][j] == 0) {
+                continue;
+            }
+
+            float center = notch.getCenter(axis, j);
+            sprintf(what, "Axis %d notch at %5.1f Hz for %3.0f Hz tone", axis, center, HZ[axis][j]);
+            check(fabsf(center - HZ[axis][j]) < 3, what);
+
+            float db = 20 * log10f(toneOut[axis][j].amplitude() / toneIn[axis][j].amplitude());
+            sprintf(what, "  attenuated %5.1f dB", db);
+            check(db < -20, what);
+        }
+
+        float gain = motionOut[axis].amplitude() / motionIn[axis].amplitude();
+        sprintf(what, "  %.0f Hz motion passed with gain %.3f", MOTION_HZ, gain);
+        check(fabsf(gain - 1) < 0.01f, what);
+    }
+}
+
+static void testSweep(void)
+{
+    printf("\nSweeping tone\n");
+
+    // Motors spinning up from 120 to 300 Hz over two seconds, then holding
+    static const float START_HZ = 120;
+    static const float END_HZ = 300;
+    static const uint32_t SWEEP_SAMPLES = 2 * SAMPLE_HZ;
+    static const uint32_t SAMPLES = SWEEP_SAMPLES + SAMPLE_HZ/2;
+
+    hf::DynamicNotch notch(1, 80, 400, 3.5f);
+    notch.begin(SAMPLE_HZ);
+
+    float phase = 0;
+    float worstLag = 0;
+    Tone toneIn;
+    Tone toneOut;
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        float hz = k < SWEEP_SAMPLES ? START_HZ + (END_HZ - START_HZ) * k / SWEEP_SAMPLES : END_HZ;
+
+        phase += 2 * M_PI * hz / SAMPLE_HZ;
+
+        float g[3] = {0.3f * sinf(phase), 0, 0};
+        float in = g[0];
+
+        notch.apply(g[0], g[1], g[2], (uint64_t)k * PERIOD_USEC);
+
+        // Once it has locked on, the notch should keep up with the tone
+        if (k > SAMPLE_HZ/4) {
+            float lag = fabsf(notch.getCenter(0, 0) - hz);
+            if (lag > worstLag) {
+                worstLag = lag;
+            }
+        }
+
+        if (k >= SAMPLES - SAMPLE_HZ/4) {
+            toneIn.add(in, END_HZ, k);
+            toneOut.add(g[0], END_HZ, k);
+        }
+    }
+
+    char what[100];
+
+    sprintf(what, "Notch stayed within %.1f Hz of tone", worstLag);
+    check(worstLag < 15, what);
+
+    float db = 20 * log10f(toneOut.amplitude() / toneIn.amplitude());
+    sprintf(what, "Tone attenuated %.1f dB after sweep", db);
+    check(db < -20, what);
+}
+
+static void testMeasuredRate(void)
+{
+    printf("\nMeasured sample rate\n");
+
+    static const float HZ[3][2] = { {200, 0}, {200, 0}, {200, 0} };
+
+    hf::DynamicNotch notch(1, 80, 400, 3.5f);
+    notch.begin();
+
+    // Start the clock somewhere other than zero
+    uint64_t usec = 123456789;
+
+    float worstPassThrough = 0;
+
+    for (uint32_t k=0; k<SAMPLE_HZ; ++k) {
+
+        float g[3];
+        signal(k, HZ, g);
+
+        float in = g[0];
+
+        bool ready = notch.ready();
+
+        notch.apply(g[0], g[1], g[2], usec);
+
+        if (!ready && fabsf(g[0] - in) > worstPassThrough) {
+            worstPassThrough = fabsf(g[0] - in);
+        }
+
+        usec += PERIOD_USEC;
+    }
+
+    check(worstPassThrough == 0, "Samples passed through while measuring");
+    check(notch.ready(), "Ready after measuring");
+    check(fabsf(notch.getResolution() - 12.5f) < 0.1f, "Measured rate gives 12.5 Hz per bin");
+}
+
+static void testTiming(void)
+{
+    printf("\nCost per call\n");
+
+    static const float HZ[3][2] = { {180, 0}, {250, 0}, {150, 320} };
+
+    static const uint32_t SAMPLES = 20 * SAMPLE_HZ;
+
+    static const uint8_t STEPS = hf::DynamicNotch::STEP_COUNT;
+
+    check(hf::DynamicNotch::stepsPerUpdate() == 3 * STEPS, "Analysis of all three axes spread over 27 calls");
+
+    hf::DynamicNotch notch(3, 80, 400, 3.5f);
+    notch.begin(SAMPLE_HZ);
+
+    // Steps follow each other one per call, so calls k apart by a multiple of the cycle do the same step
+    static const uint8_t CYCLE = 3 * STEPS;
+    std::vector<float> times[CYCLE];
+
+    double total = 0;
+    double sum = 0;
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        float g[3];
+        signal(k, HZ, g);
+
+        double start = nanoseconds();
+        notch.apply(g[0], g[1], g[2], (uint64_t)k * PERIOD_USEC);
+        double ns = nanoseconds() - start;
+
+        total += ns;
+        times[k % CYCLE].push_back(ns);
+
+        sum += g[0] + g[1] + g[2];
+    }
+
+    // Median for each step, so that the host OS preempting us now and then doesn't count against the filter
+    float worst = 0;
+    for (uint8_t k=0; k<CYCLE; ++k) {
+        std::vector<float> & t = times[k];
+        std::nth_element(t.begin(), t.begin() + t.size()/2, t.end());
+        worst = std::max(worst, t[t.size()/2]);
+    }
+
+    // The same work done all at once: one call per step, back to back, for every axis
+    double whole = 0;
+    for (uint32_t j=0; j<100; ++j) {
+        double start = nanoseconds();
+        for (uint8_t k=0; k<hf::DynamicNotch::stepsPerUpdate(); ++k) {
+            float g[3] = {0, 0, 0};
+            notch.apply(g[0], g[1], g[2], 0);
+            sum += g[0];
+        }
+        whole += nanoseconds() - start;
+    }
+
+    printf("%-40s %8.1f ns\n", "Mean per call", total / SAMPLES);
+    printf("%-40s %8.1f ns\n", "Most expensive step (median)", worst);
+    printf("%-40s %8.1f ns\n", "Whole three-axis analysis in one call", whole / 100);
+
+    // Keep the compiler from discarding the work
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    testFixedTones();
+    testSweep();
+    testMeasuredRate();
+    testTiming();
+
+    return finish();
+}
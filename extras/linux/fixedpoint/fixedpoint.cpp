@@ -0,0 +1,492 @@
+/*
+   Accuracy and cost of the fixed-point control path against float
+
+   Checks the saturating Fixed arithmetic, then runs each kernel that has
+   a fixed-point version -- Pid::compute(), Mixer::runArmed()'s mixing,
+   the receiver's expo curves, and the 6DOF Madgwick quaternion filter --
+   on the same inputs in float and in fixed point, and reports the largest
+   difference and the cycles per call for each.  On a workstation, with
+   its FPU, float will usually win; the cycle counts that matter for a
+   board without one come from running the FixedPointBench sketch on it.
+   Exits with a nonzero status if any difference is out of bounds.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fixedpoint.hpp"
+#include "filters.hpp"
+#include "pidcontroller.hpp"
+#include "receiver.hpp"
+#include "mixers/quadxap.hpp"
+
+#include "selfcheck.hpp"
+
+static const uint32_t ITERATIONS = 1000000;
+
+// Uniform in [lo, hi], repeatable across runs
+static float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static void report(const char * name, float maxError, float bound, double floatCycles, double fixedCycles)
+{
+    char what[100];
+    sprintf(what, "%-20s max error %.2e %7.1f / %7.1f cycles", name, maxError, floatCycles, fixedCycles);
+    check(maxError < bound, what);
+}
+
+// Exposes the protected mixing and expo kernels
+class TestMixer : public hf::MixerQuadXAP {
+
+    public:
+
+        using hf::Mixer::mix;
+        using hf::Mixer::mixFixed;
+};
+
+class TestReceiver : public hf::Receiver {
+
+    protected:
+
+        virtual bool gotNewFrame(void) override { return false; }
+        virtual void readRawvals(void) override { }
+
+    public:
+
+        TestReceiver(const uint8_t channelMap[6])
+            : Receiver(channelMap)
+        {
+        }
+
+        float cyclic(float x)
+        {
+            return rcFun(x, 0.65f, 0.90f);
+        }
+
+        float cyclicFixed(float x)
+        {
+            return rcFunFixed(hf::q15_t(x), hf::q15_t::fromRaw(CYCLIC_EXPO_FIXED), hf::q15_t::fromRaw(CYCLIC_RATE_FIXED)).toFloat();
+        }
+
+        float throttle(float x)
+        {
+            return throttleFun(x);
+        }
+
+        float throttleFixed(float x)
+        {
+            return throttleFunFixed(hf::q15_t(x)).toFloat();
+        }
+
+        // The raw fixed-point constants against the float expo values they stand for
+        bool constantsMatch(void)
+        {
+            return
+                hf::q15_t(0.65f).toRaw() == CYCLIC_EXPO_FIXED &&
+                hf::q15_t(0.90f).toRaw() == CYCLIC_RATE_FIXED &&
+                hf::q15_t(0.20f).toRaw() == THROTTLE_EXPO_FIXED;
+        }
+};
+
+static void testArithmetic(void)
+{
+    printf("Arithmetic\n");
+
+    hf::q15_t a(0.75f);
+    hf::q15_t b(0.5f);
+
+    check((a + a).toRaw() == INT16_MAX, "q15 sum saturates high");
+    check((-a - a).toRaw() == INT16_MIN, "q15 difference saturates low");
+    check(fabsf((a * b).toFloat() - 0.375f) < 1e-4f, "q15 product");
+    check((a * 2).toRaw() == INT16_MAX, "q15 integer product saturates");
+    check(hf::q15_t::fromInt(1).toRaw() == INT16_MAX, "q15 one saturates to largest value");
+
+    hf::q24_t c(100.0f);
+    hf::q24_t d(-3.25f);
+
+    check((c * c).toRaw() == INT32_MAX, "q24 product saturates high");
+    check((c * -c).toRaw() == INT32_MIN, "q24 product saturates low");
+    check(fabsf((c / d).toFloat() + 30.769231f) < 1e-5f, "q24 quotient");
+    check((c / hf::q24_t()).toRaw() == INT32_MAX, "q24 division by zero saturates");
+    check(hf::q24_t(1e9f).toRaw() == INT32_MAX, "q24 conversion saturates");
+    check(hf::q24_t(-1.5f).toFloat() == -1.5f, "q24 conversion is exact for dyadic values");
+    check((d >> 1).toFloat() == -1.625f, "q24 halving");
+
+    hf::q24_t v[4] = {hf::q24_t(100.0f), hf::q24_t(-100.0f), hf::q24_t(100.0f), hf::q24_t(-100.0f)};
+    hf::q24_t::normalize(v, 4);
+    check(fabsf(v[0].toFloat() - 0.5f) < 1e-6f && fabsf(v[1].toFloat() + 0.5f) < 1e-6f, "q24 normalize near full scale");
+
+    hf::q24_t z[3];
+    check(!hf::q24_t::normalize(z, 3), "q24 normalize rejects zero vector");
+}
+
+static void testPid(void)
+{
+    // Rate-PID gains, with a windup limit like _AngularVelocityPid's
+    hf::FloatPid floatPid;
+    hf::FixedPid fixedPid;
+    floatPid.init(0.05f, 0.01f, 0.01f, 6.0f);
+    fixedPid.init(0.05f, 0.01f, 0.01f, 6.0f);
+
+    float target = 0;
+    float actual = 0;
+    float maxError = 0;
+
+    static float targets[ITERATIONS];
+    static float actuals[ITERATIONS];
+
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+
+        // Stick wandering around, vehicle following with noise
+        target = hf::Filter::constrainAbs(target + uniform(-0.01f, +0.01f), 0.5f);
+        actual += 0.05f * (4 * target - actual) + uniform(-0.05f, +0.05f);
+
+        targets[k] = target;
+        actuals[k] = actual;
+
+        float error = fabsf(floatPid.compute(target, actual) - fixedPid.compute(target, actual));
+        if (error > maxError) {
+            maxError = error;
+        }
+    }
+
+    float sum = 0;
+
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        sum += floatPid.compute(targets[k], actuals[k]);
+    }
+    double floatCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        sum += fixedPid.compute(targets[k], actuals[k]);
+    }
+    double fixedCycles = (double)(cycles() - start) / ITERATIONS;
+
+    report("Pid::compute()", maxError, 1e-4f, floatCycles, fixedCycles);
+
+    // Keep the compiler from discarding the work
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+static void testMixer(void)
+{
+    static const uint32_t COUNT = 1000;
+
+    TestMixer mixer;
+
+    static hf::demands_t demands[COUNT];
+
+    float maxError = 0;
+
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        // Wide enough to hit both the airmode shift and the clamp
+        demands[k].throttle = uniform(-1, +1);
+        demands[k].roll     = uniform(-1, +1);
+        demands[k].pitch    = uniform(-1, +1);
+        demands[k].yaw      = uniform(-1, +1);
+
+        float floatMotors[4];
+        float fixedMotors[4];
+        mixer.mix(demands[k], floatMotors);
+        mixer.mixFixed(demands[k], fixedMotors);
+
+        for (uint8_t i=0; i<4; ++i) {
+            float error = fabsf(floatMotors[i] - fixedMotors[i]);
+            if (error > maxError) {
+                maxError = error;
+            }
+        }
+    }
+
+    float motors[4];
+    float sum = 0;
+
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        mixer.mix(demands[k%COUNT], motors);
+        sum += motors[0];
+    }
+    double floatCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        mixer.mixFixed(demands[k%COUNT], motors);
+        sum += motors[0];
+    }
+    double fixedCycles = (double)(cycles() - start) / ITERATIONS;
+
+    report("Mixer::mix()", maxError, 1e-6f, floatCycles, fixedCycles);
+
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+static void testReceiver(void)
+{
+    static const uint32_t COUNT = 10001;
+
+    static const uint8_t CHANNEL_MAP[6] = {0, 1, 2, 3, 4, 5};
+
+    TestReceiver receiver(CHANNEL_MAP);
+
+    check(receiver.constantsMatch(), "Fixed-point expo constants match the float ones");
+
+    float cyclicError = 0;
+    float throttleError = 0;
+
+    // The cyclic curve sees the magnitude of the stick; the throttle curve sees all of it
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        float x = -1 + 2.0f * k / (COUNT-1);
+
+        float error = fabsf(receiver.cyclic(fabsf(x)) - receiver.cyclicFixed(fabsf(x)));
+        if (error > cyclicError) {
+            cyclicError = error;
+        }
+
+        error = fabsf(receiver.throttle(x) - receiver.throttleFixed(x));
+        if (error > throttleError) {
+            throttleError = error;
+        }
+    }
+
+    float sum = 0;
+
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        float x = (k % COUNT) / (float)COUNT;
+        sum += receiver.cyclic(x) + receiver.throttle(x);
+    }
+    double floatCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        float x = (k % COUNT) / (float)COUNT;
+        sum += receiver.cyclicFixed(x) + receiver.throttleFixed(x);
+    }
+    double fixedCycles = (double)(cycles() - start) / ITERATIONS;
+
+    report("Receiver expo", cyclicError > throttleError ? cyclicError : throttleError, 2e-4f, floatCycles, fixedCycles);
+
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+// Angle between two attitude quaternions, in degrees
+// From the rotation between the two, a* b, since acos() of their dot product can't resolve small angles
+static float angleBetween(const hf::QuaternionFilter & a, const hf::QuaternionFilter & b)
+{
+    double w = (double)a.q1*b.q1 + (double)a.q2*b.q2 + (double)a.q3*b.q3 + (double)a.q4*b.q4;
+    double x = (double)a.q1*b.q2 - (double)a.q2*b.q1 - (double)a.q3*b.q4 + (double)a.q4*b.q3;
+    double y = (double)a.q1*b.q3 + (double)a.q2*b.q4 - (double)a.q3*b.q1 - (double)a.q4*b.q2;
+    double z = (double)a.q1*b.q4 - (double)a.q2*b.q3 + (double)a.q3*b.q2 - (double)a.q4*b.q1;
+    return hf::Filter::rad2deg(2 * atan2(sqrt(x*x + y*y + z*z), fabs(w)));
+}
+
+static void testMadgwick(void)
+{
+    // Same parameters as SoftwareQuaternionBoard, updating at its correction rate
+    static const float DT = 0.005f;
+    static const uint32_t COUNT = 60 / DT;
+
+    float beta = sqrtf(3.0f / 4.0f) * hf::Filter::deg2rad(40);
+
+    hf::MadgwickQuaternionFilter6DOF floatFilter(beta, 0);
+    hf::FixedMadgwickQuaternionFilter6DOF fixedFilter(beta, 0);
+
+    static float imu[COUNT][6];
+
+    float maxError = 0;
+
+    // True attitude, as a quaternion, rocking about all three axes
+    float w = 1, x = 0, y = 0, z = 0;
+
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        float t = k * DT;
+        float gx = 1.5f * sinf(2 * M_PI * 0.3f * t);
+        float gy = 1.0f * sinf(2 * M_PI * 0.5f * t + 1);
+        float gz = 0.5f * cosf(2 * M_PI * 0.2f * t);
+
+        // Integrate truth
+        float dw = 0.5f * (-x*gx - y*gy - z*gz);
+        float dx = 0.5f * ( w*gx + y*gz - z*gy);
+        float dy = 0.5f * ( w*gy - x*gz + z*gx);
+        float dz = 0.5f * ( w*gz + x*gy - y*gx);
+        w += dw * DT;
+        x += dx * DT;
+        y += dy * DT;
+        z += dz * DT;
+        float n = sqrtf(w*w + x*x + y*y + z*z);
+        w /= n;
+        x /= n;
+        y /= n;
+        z /= n;
+
+        // Gravity in the body frame, plus some vibration
+        float ax = 2 * (x*z - w*y) + uniform(-0.05f, +0.05f);
+        float ay = 2 * (w*x + y*z) + uniform(-0.05f, +0.05f);
+        float az = (w*w - x*x - y*y + z*z) + uniform(-0.05f, +0.05f);
+
+        float * s = imu[k];
+        s[0] = ax; s[1] = ay; s[2] = az; s[3] = gx; s[4] = gy; s[5] = gz;
+
+        floatFilter.update(ax, ay, az, gx, gy, gz, DT);
+        fixedFilter.update(ax, ay, az, gx, gy, gz, DT);
+
+        float error = angleBetween(floatFilter, fixedFilter);
+        if (error > maxError) {
+            maxError = error;
+        }
+    }
+
+    float sum = 0;
+
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        float * s = imu[k % COUNT];
+        floatFilter.update(s[0], s[1], s[2], s[3], s[4], s[5], DT);
+        sum += floatFilter.q1;
+    }
+    double floatCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        float * s = imu[k % COUNT];
+        fixedFilter.update(s[0], s[1], s[2], s[3], s[4], s[5], DT);
+        sum += fixedFilter.q1;
+    }
+    double fixedCycles = (double)(cycles() - start) / ITERATIONS;
+
+    // Reported in degrees of attitude.  Float's own rounding moves the attitude by a few hundredths of
+    // a degree over this run, compared with the same filter in double precision, so the two can
+    // differ by about that much.
+    report("Madgwick 6DOF (deg)", maxError, 0.2f, floatCycles, fixedCycles);
+
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+// The same filters split as SoftwareQuaternionBoard runs them: each 1 msec gyrometer sample integrated with
+// coning correction, and an accelerometer correction every fifth sample
+static void testMadgwickSplit(void)
+{
+    static const float DT = 0.001f;
+    static const uint32_t COUNT = 60 / DT;
+
+    float beta = sqrtf(3.0f / 4.0f) * hf::Filter::deg2rad(40);
+
+    hf::MadgwickQuaternionFilter6DOF floatFilter(beta, 0);
+    hf::FixedMadgwickQuaternionFilter6DOF fixedFilter(beta, 0);
+    floatFilter.useConingCorrection();
+    fixedFilter.useConingCorrection();
+
+    float maxError = 0;
+
+    float w = 1, x = 0, y = 0, z = 0;
+
+    uint64_t floatCycles = 0;
+    uint64_t fixedCycles = 0;
+
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        // Rocking, plus vibration about roll and pitch
+        float t = k * DT;
+        float gx = 1.5f * sinf(2 * M_PI * 0.3f * t) + 2 * cosf(2 * M_PI * 40 * t);
+        float gy = 1.0f * sinf(2 * M_PI * 0.5f * t + 1) + 2 * sinf(2 * M_PI * 40 * t);
+        float gz = 0.5f * cosf(2 * M_PI * 0.2f * t);
+
+        float dw = 0.5f * (-x*gx - y*gy - z*gz);
+        float dx = 0.5f * ( w*gx + y*gz - z*gy);
+        float dy = 0.5f * ( w*gy - x*gz + z*gx);
+        float dz = 0.5f * ( w*gz + x*gy - y*gx);
+        w += dw * DT;
+        x += dx * DT;
+        y += dy * DT;
+        z += dz * DT;
+        float n = sqrtf(w*w + x*x + y*y + z*z);
+        w /= n;
+        x /= n;
+        y /= n;
+        z /= n;
+
+        uint64_t start = cycles();
+        floatFilter.propagate(gx, gy, gz, DT);
+        floatCycles += cycles() - start;
+
+        start = cycles();
+        fixedFilter.propagate(gx, gy, gz, DT);
+        fixedCycles += cycles() - start;
+
+        if (k % 5 == 4) {
+
+            float ax = 2 * (x*z - w*y) + uniform(-0.05f, +0.05f);
+            float ay = 2 * (w*x + y*z) + uniform(-0.05f, +0.05f);
+            float az = (w*w - x*x - y*y + z*z) + uniform(-0.05f, +0.05f);
+
+            start = cycles();
+            floatFilter.correct(ax, ay, az, 5 * DT);
+            floatCycles += cycles() - start;
+
+            start = cycles();
+            fixedFilter.correct(ax, ay, az, 5 * DT);
+            fixedCycles += cycles() - start;
+        }
+
+        float error = angleBetween(floatFilter, fixedFilter);
+        if (error > maxError) {
+            maxError = error;
+        }
+    }
+
+    // Cycles per gyrometer sample, including a fifth of a correction
+    report("Madgwick split (deg)", maxError, 0.2f, (double)floatCycles / COUNT, (double)fixedCycles / COUNT);
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    srand(0);
+
+    testArithmetic();
+
+    printf("\nFloat vs. fixed point%45s\n", "float / fixed");
+
+    testPid();
+    testMixer();
+    testReceiver();
+    testMadgwick();
+    testMadgwickSplit();
+
+    return finish();
+}
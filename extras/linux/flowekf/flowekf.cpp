@@ -0,0 +1,1308 @@
+/*
+   Self-check and timing for the optical-flow EKF and the matrices it uses
+
+   Checks the compile-time-sized linalg::Matrix operations on small cases,
+   and that mismatched shapes can't be multiplied.  Then runs FlowEkf, with
+   dense covariance, next to a copy of the code it replaced, which used a
+   runtime-sized matrix with room for 10x10 in every instance, on the same
+   synthetic stream of flow readings.  Checks that the two give the same
+   state and covariance, and reports the matrix memory and the cycles per
+   update of each.  Then does the same for the packed symmetric covariance
+   against the dense one, which it should match to rounding, with the
+   cycles per scalar measurement update, and for the UD-factored covariance
+   against a double-precision reference.  Last, simulates a 1 kHz IMU,
+   100 Hz flow frames, and a 25 Hz rangefinder, and checks that predicting
+   at the IMU rate tracks the true velocity more closely and more smoothly
+   than predicting once per frame or not at all, with the cycles per
+   prediction and per frame of corrections.  Exits with a nonzero status on
+   any failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <utility>
+
+#include "boards/linux/linux.hpp"
+#include "linalg.hpp"
+#include "sensors/opticalflow/flowekf.hpp"
+
+#include "selfcheck.hpp"
+
+using hf::linalg::Matrix;
+using hf::FlowEkf;
+
+static const uint32_t STEPS = 2000;
+
+static const float DT = 0.01f;
+
+// The estimator as it was, with its matrix class; the matrix constructor and set() are
+// fixed so that it compiles and clears the whole array, and the sensor is left out
+namespace legacy {
+
+    class Matrix {
+
+        private:
+
+            // avoid dynamic memory allocation
+            static const uint8_t MAXSIZE = 10;
+
+            uint8_t _rows = 0;
+            uint8_t _cols = 0;
+
+            float _vals[MAXSIZE][MAXSIZE];
+
+        public:
+
+            Matrix(uint8_t rows, uint8_t cols) 
+            {
+                _rows = rows;
+                _cols = cols;
+                memset(_vals, 0, sizeof(_vals));
+            }
+
+            float get(uint8_t j, uint8_t k) const
+            {
+                return _vals[j][k];
+            }
+
+            void set(uint8_t j, uint8_t k, float val)
+            {
+                _vals[j][k] = val;
+            }
+
+            static void trans(Matrix & a, Matrix & at)
+            {
+                for (uint8_t j=0; j<a._rows; ++j) {
+                    for (uint8_t k=0; k<a._cols; ++k) {
+                        at._vals[k][j] = a._vals[j][k];
+                    }
+                }
+            }
+
+            static void mult(Matrix & a, Matrix & b, Matrix & c)
+            {
+                for(uint8_t i=0; i<a._rows; ++i) {
+                    for(uint8_t j=0; j<b._cols; ++j) {
+                        c._vals[i][j] = 0;
+                        for(uint8_t k=0; k<a._cols; ++k) {
+                            c._vals[i][j] += a._vals[i][k] *b._vals[k][j];
+                        }
+                    }
+                }
+            }
+
+    };  // class Matrix
+
+    // Matrices kept in static storage: the covariance and the temporaries below
+    static const uint8_t STATIC_MATRICES = 1 + 3 + 6;
+
+    class FlowEkf {
+
+        private:
+
+            static constexpr float FLOW_SCALE    = 100.f;
+
+            static constexpr float MAX_COVARIANCE = 100.f;
+            static constexpr float MIN_COVARIANCE = 1e-6f;
+            static constexpr float MAX_POSITION   = 100.f; //meters
+            static constexpr float MAX_VELOCITY   = 10.f;  //meters per second
+
+            float R[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
+
+            typedef enum
+            {
+                STATE_X,  // Position
+                STATE_Y, 
+                STATE_Z, 
+                STATE_PX, // Velocity
+                STATE_PY, 
+                STATE_PZ, 
+                STATE_D0, // Attitude error
+                STATE_D1, 
+                STATE_D2, 
+                STATE_DIM
+            } stateIdx_t;
+
+            float S[STATE_DIM] = {0.f};
+
+            hf::qmath::quaternion_t q = {1,0,0,0};
+
+            static constexpr float STDDEV = 0.25f;
+
+            float Npix = 30.0;
+            float thetapix = hf::Filter::deg2rad(4.2f);
+
+            void stateEstimatorAssertNotNaN() {
+
+                for(int i=0; i<STATE_DIM; i++) {
+                    if (std::isnan(S[i])) {
+                        reset();
+                        return;
+                    }
+                    for(int j=0; j<STATE_DIM; j++) {
+                        if (std::isnan(Pm.get(i,j))) {
+                            reset();
+                            return;
+                        }
+                    }
+                }
+            }
+
+            void stateEstimatorFinalize(void)
+            {
+                static Matrix Am(STATE_DIM, STATE_DIM);
+                static Matrix tmpNN1m(STATE_DIM, STATE_DIM);
+                static Matrix tmpNN2m(STATE_DIM, STATE_DIM);
+
+                float v0 = S[STATE_D0];
+                float v1 = S[STATE_D1];
+                float v2 = S[STATE_D2];
+
+                if ((fabsf(v0) > 0.1e-3f || fabsf(v1) > 0.1e-3f || fabsf(v2) > 0.1e-3f) && (fabsf(v0) < 10 && fabsf(v1) < 10 && fabsf(v2) < 10)) {
+
+                    float angle = sqrt(v0*v0 + v1*v1 + v2*v2);
+                    float ca = cos(angle / 2.0f);
+                    float sa = sin(angle / 2.0f);
+                    hf::qmath::quaternion_t dq = {ca, sa * v0 / angle, sa * v1 / angle, sa * v2 / angle};
+
+                    q = hf::qmath::multiply(q, dq);
+                    hf::qmath::normalize(q);
+
+                    float d0 = v0/2;
+                    float d1 = v1/2;
+                    float d2 = v2/2;
+
+                    Am.set(STATE_X,STATE_X, 1);
+                    Am.set(STATE_Y,STATE_Y, 1);
+                    Am.set(STATE_Z,STATE_Z, 1);
+
+                    Am.set(STATE_PX,STATE_PX, 1);
+                    Am.set(STATE_PY,STATE_PY, 1);
+                    Am.set(STATE_PZ,STATE_PZ, 1);
+
+                    Am.set(STATE_D0,STATE_D0,  1 - d1*d1/2 - d2*d2/2);
+                    Am.set(STATE_D0,STATE_D1,  d2 + d0*d1/2);
+                    Am.set(STATE_D0,STATE_D2, -d1 + d0*d2/2);
+
+                    Am.set(STATE_D1,STATE_D0, -d2 + d0*d1/2);
+                    Am.set(STATE_D1,STATE_D1,  1 - d0*d0/2 - d2*d2/2);
+                    Am.set(STATE_D1,STATE_D2,  d0 + d1*d2/2);
+
+                    Am.set(STATE_D2,STATE_D0,  d1 + d0*d2/2);
+                    Am.set(STATE_D2,STATE_D1, -d0 + d1*d2/2);
+                    Am.set(STATE_D2,STATE_D2, 1 - d0*d0/2 - d1*d1/2);
+
+                    Matrix::trans(Am, tmpNN1m); // A'
+                    Matrix::mult(Am, Pm, tmpNN2m); // AP
+                    Matrix::mult(tmpNN2m, tmpNN1m, Pm); //APA'
+                }
+
+                hf::qmath::toRotationMatrix(q, R);
+
+                S[STATE_D0] = 0;
+                S[STATE_D1] = 0;
+                S[STATE_D2] = 0;
+
+                for (int i=0; i<3; i++)
+                {
+                    if (S[STATE_X+i] < -MAX_POSITION) { S[STATE_X+i] = -MAX_POSITION; }
+                    else if (S[STATE_X+i] > MAX_POSITION) { S[STATE_X+i] = MAX_POSITION; }
+
+                    if (S[STATE_PX+i] < -MAX_VELOCITY) { S[STATE_PX+i] = -MAX_VELOCITY; }
+                    else if (S[STATE_PX+i] > MAX_VELOCITY) { S[STATE_PX+i] = MAX_VELOCITY; }
+                }
+
+                for (int i=0; i<STATE_DIM; i++) {
+                    for (int j=i; j<STATE_DIM; j++) {
+                        float p = 0.5f*Pm.get(i,j) + 0.5f*Pm.get(j,i);
+                        if (std::isnan(p) || p > MAX_COVARIANCE) {
+                            Pm.set(i, j, MAX_COVARIANCE);
+                            Pm.set(j, i, MAX_COVARIANCE);
+                        } else if ( i==j && p < MIN_COVARIANCE ) {
+                            Pm.set(i, j, MIN_COVARIANCE);
+                            Pm.set(j, i, MIN_COVARIANCE);
+                        } else {
+                            Pm.set(i, j, p);
+                            Pm.set(j, i, p);
+                        }
+                    }
+                }
+            }
+
+            void stateEstimatorScalarUpdate(Matrix & Hm, float error, float stdMeasNoise)
+            {
+                static Matrix Km(STATE_DIM, 1);
+                static Matrix tmpNN1m(STATE_DIM, STATE_DIM);
+                static Matrix tmpNN2m(STATE_DIM, STATE_DIM);
+                static Matrix tmpNN3m(STATE_DIM, STATE_DIM);
+                static Matrix HTm(STATE_DIM, 1);
+                static Matrix PHTm(STATE_DIM, 1);
+
+                Matrix::trans(Hm, HTm);
+
+                Matrix::mult(Pm, HTm, PHTm); // PH'
+                float R = stdMeasNoise*stdMeasNoise;
+                float HPHR = R; // HPH' + R
+
+                for (int i=0; i<STATE_DIM; i++) {
+                    HPHR += Hm.get(0,i)*PHTm.get(i,0);
+                }
+
+                for (int i=0; i<STATE_DIM; i++) {
+                    Km.set(i,0, PHTm.get(i,0)/HPHR);
+                    S[i] += Km.get(i,0) * error;
+                }
+                stateEstimatorAssertNotNaN();
+
+                Matrix::mult(Km, Hm, tmpNN1m); // KH
+                for (int i=0; i<STATE_DIM; i++) { 
+                    tmpNN1m.set(i,i, tmpNN1m.get(i,i)-1);// KH - I
+                }
+                Matrix::trans(tmpNN1m, tmpNN2m); // (KH - I)'
+                Matrix::mult(tmpNN1m, Pm, tmpNN3m); // (KH - I)*P
+                Matrix::mult(tmpNN3m, tmpNN2m, Pm); // (KH - I)*P*(KH - I)'
+
+                for (int i=0; i<STATE_DIM; i++) {
+                    for (int j=i; j<STATE_DIM; j++) {
+                        float v = Km.get(i,0) * R * Km.get(j,0);
+                        float p = 0.5f*Pm.get(i,j) + 0.5f*Pm.get(j,i) + v;
+                        if (std::isnan(p) || p > MAX_COVARIANCE) {
+                            Pm.set(i,j, MAX_COVARIANCE);
+                            Pm.set(j,i, MAX_COVARIANCE);
+                        } else if ( i==j && p < MIN_COVARIANCE ) {
+                            Pm.set(i,j, MIN_COVARIANCE);
+                            Pm.set(j,i, MIN_COVARIANCE);
+                        } else {
+                            Pm.set(i,j, p);
+                            Pm.set(j,i, p);
+                        }
+                    }
+                }
+
+                stateEstimatorAssertNotNaN();
+            }
+
+            Matrix Pm = Matrix(STATE_DIM, STATE_DIM);
+
+        public:
+
+            void reset(void)
+            {
+                for (uint8_t j=0; j<STATE_DIM; ++j) {
+                    S[j] = 0;
+                    for (uint8_t k=0; k<STATE_DIM; ++k) {
+                        Pm.set(j,k,0);
+                    }
+                }
+            }
+
+            void update(float deltaTime, int16_t dpixelx, int16_t dpixely, float omegax, float omegay, float z, float vz)
+            {
+                S[STATE_Z] = z;
+                S[STATE_PZ] = vz;
+
+                float dx_g = S[STATE_PX];
+                float dy_g = S[STATE_PY];
+
+                float z_g = S[STATE_Z] < 0.1f ?  0.1f : S[STATE_Z];
+
+                float omegaFactor = 1.25f;
+                Matrix Hx(1, STATE_DIM);
+                float predictedNX = (deltaTime * Npix / thetapix ) * ((dx_g * R[2][2] / z_g) - omegaFactor * omegay);
+                float measuredNX = (float)dpixelx * FLOW_SCALE;
+
+                Hx.set(0, STATE_Z,  (Npix * deltaTime / thetapix) * ((R[2][2] * dx_g) / (-z_g * z_g)));
+                Hx.set(0, STATE_PX, (Npix * deltaTime / thetapix) * (R[2][2] / z_g));
+
+                stateEstimatorScalarUpdate(Hx, measuredNX-predictedNX, STDDEV);
+
+                Matrix Hy(1, STATE_DIM);
+                float predictedNY = (deltaTime * Npix / thetapix ) * ((dy_g * R[2][2] / z_g) + omegaFactor * omegax);
+                float measuredNY = (float)dpixely * FLOW_SCALE;
+
+                Hy.set(0, STATE_Z,  (Npix * deltaTime / thetapix) * ((R[2][2] * dy_g) / (-z_g * z_g)));
+                Hy.set(0, STATE_PY, (Npix * deltaTime / thetapix) * (R[2][2] / z_g));
+
+                stateEstimatorScalarUpdate(Hy, measuredNY-predictedNY, STDDEV);
+
+                stateEstimatorFinalize();
+            }
+
+            const float * getState(void) const
+            {
+                return S;
+            }
+
+            float getCovariance(uint8_t i, uint8_t j) const
+            {
+                return Pm.get(i, j);
+            }
+
+    }; // class FlowEkf
+
+} // namespace legacy
+
+// True when mult(a, b, c) compiles for these shapes
+template <typename A, typename B, typename C>
+static constexpr auto canMultiply(int) -> decltype(hf::linalg::mult(std::declval<const A &>(), std::declval<const B &>(), std::declval<C &>()), bool())
+{
+    return true;
+}
+
+template <typename A, typename B, typename C>
+static constexpr bool canMultiply(...)
+{
+    return false;
+}
+
+static_assert(canMultiply<Matrix<9,9>, Matrix<9,1>, Matrix<9,1>>(0), "9x9 times 9x1 is 9x1");
+static_assert(!canMultiply<Matrix<9,9>, Matrix<1,9>, Matrix<9,9>>(0), "9x9 times 1x9 doesn't compile");
+static_assert(!canMultiply<Matrix<9,9>, Matrix<9,1>, Matrix<1,9>>(0), "9x9 times 9x1 isn't 1x9");
+
+static void testMatrix(void)
+{
+    printf("Matrix operations\n");
+
+    Matrix<2,3> a;
+    Matrix<3,2> b;
+    for (uint8_t j=0; j<2; ++j) {
+        for (uint8_t k=0; k<3; ++k) {
+            a.set(j, k, 1 + j*3 + k);       // 1 2 3 / 4 5 6
+            b.set(k, j, 1 + j*3 + k);       // its transpose
+        }
+    }
+
+    Matrix<3,2> at;
+    hf::linalg::trans(a, at);
+    bool same = true;
+    for (uint8_t k=0; k<3; ++k) {
+        for (uint8_t j=0; j<2; ++j) {
+            same = same && at.get(k, j) == b.get(k, j);
+        }
+    }
+    check(same, "trans()");
+
+    Matrix<2,2> c;
+    hf::linalg::mult(a, b, c);
+    check(c.get(0,0) == 14 && c.get(0,1) == 32 && c.get(1,0) == 32 && c.get(1,1) == 77, "mult()");
+
+    Matrix<2,2> d;
+    hf::linalg::multTransposed(a, a, d);
+    check(d.get(0,0) == 14 && d.get(0,1) == 32 && d.get(1,0) == 32 && d.get(1,1) == 77, "multTransposed()");
+
+    Matrix<3,1> u;
+    Matrix<1,2> v;
+    u.set(0, 0, 1); u.set(1, 0, 2); u.set(2, 0, 3);
+    v.set(0, 0, 4); v.set(0, 1, 5);
+    Matrix<3,2> uv;
+    hf::linalg::outer(u, v, uv);
+    check(uv.get(0,0) == 4 && uv.get(2,1) == 15 && uv.get(1,0) == 8, "outer()");
+
+    check(sizeof(Matrix<9,1>) == 9*sizeof(float) && sizeof(Matrix<9,9>) == 81*sizeof(float),
+            "Each matrix takes exactly its own shape");
+}
+
+typedef struct {
+
+    int16_t dpixelx;
+    int16_t dpixely;
+    float omegax;
+    float omegay;
+    float z;
+    float vz;
+
+} reading_t;
+
+// A vehicle drifting about at one to two meters, with a pixel of noise in each flow count
+static void simulate(reading_t readings[])
+{
+    uint32_t seed = 12345;
+
+    for (uint32_t k=0; k<STEPS; ++k) {
+
+        float t = k * DT;
+
+        int16_t noise[2] = {0};
+        for (uint8_t i=0; i<2; ++i) {
+            seed = seed * 1664525 + 1013904223;
+            noise[i] = (int16_t)(seed >> 30) - 1;
+        }
+
+        readings[k].dpixelx = (int16_t)lroundf(2 * sinf(0.7f * t)) + noise[0];
+        readings[k].dpixely = (int16_t)lroundf(2 * cosf(0.4f * t)) + noise[1];
+        readings[k].omegax = 0.1f * sinf(3 * t);
+        readings[k].omegay = 0.1f * cosf(2 * t);
+        readings[k].z = 1.5f + 0.5f * sinf(0.2f * t);
+        readings[k].vz = 0.1f * cosf(0.2f * t);
+    }
+}
+
+template <typename EkfT>
+static void run(EkfT & ekf, const reading_t readings[])
+{
+    ekf.reset();
+    for (uint32_t k=0; k<STEPS; ++k) {
+        const reading_t & r = readings[k];
+        ekf.update(DT, r.dpixelx, r.dpixely, r.omegax, r.omegay, r.z, r.vz);
+    }
+}
+
+template <typename EkfT>
+static double time(EkfT & ekf, const reading_t readings[])
+{
+    uint64_t best = UINT64_MAX;
+
+    for (uint8_t pass=0; pass<5; ++pass) {
+        uint64_t start = cycles();
+        run(ekf, readings);
+        uint64_t elapsed = cycles() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+
+    return (double)best / STEPS;
+}
+
+typedef FlowEkf<hf::DenseCovariance> DenseEkf;
+typedef FlowEkf<hf::PackedCovariance> PackedEkf;
+
+static const uint8_t STATE_DIM = DenseEkf::STATE_DIM;
+
+template <typename EkfA, typename EkfB>
+static void compare(const EkfA & a, const EkfB & b, float & stateDifference, float & covarianceDifference)
+{
+    for (uint8_t i=0; i<STATE_DIM; ++i) {
+        stateDifference = fmaxf(stateDifference, fabsf(a.getState()[i] - b.getState()[i]));
+        for (uint8_t j=0; j<STATE_DIM; ++j) {
+            covarianceDifference = fmaxf(covarianceDifference, fabsf(a.getCovariance(i,j) - b.getCovariance(i,j)));
+        }
+    }
+}
+
+static void testEkf(const reading_t readings[])
+{
+    printf("\nFlowEkf against the code it replaced, %u flow readings\n", STEPS);
+
+    static legacy::FlowEkf legacyEkf;
+    static DenseEkf ekf;
+
+    run(legacyEkf, readings);
+    run(ekf, readings);
+
+    float stateDifference = 0;
+    float covarianceDifference = 0;
+    compare(ekf, legacyEkf, stateDifference, covarianceDifference);
+
+    char what[100];
+
+    sprintf(what, "Same state as before (%.1e)", stateDifference);
+    check(stateDifference == 0, what);
+
+    sprintf(what, "Same covariance as before (%.1e)", covarianceDifference);
+    check(covarianceDifference == 0, what);
+
+    // Matrix storage, held for the life of the program and on the stack during an update
+    size_t legacyStatic = legacy::STATIC_MATRICES * sizeof(legacy::Matrix);
+    size_t legacyStack = 2 * sizeof(legacy::Matrix);
+    size_t currentStatic = sizeof(Matrix<STATE_DIM,STATE_DIM>);
+    size_t currentStack = 2 * sizeof(Matrix<1,STATE_DIM>) +
+        2 * sizeof(Matrix<STATE_DIM,1>) + 2 * sizeof(Matrix<STATE_DIM,STATE_DIM>);
+
+    printf("\n%-40s %8s %8s\n", "Matrix storage, bytes", "before", "after");
+    printf("%-40s %8zu %8zu\n", "  static", legacyStatic, currentStatic);
+    printf("%-40s %8zu %8zu\n", "  stack, at most", legacyStack, currentStack);
+    printf("%-40s %8zu %8zu\n", "  total", legacyStatic + legacyStack, currentStatic + currentStack);
+
+    double legacyCycles = time(legacyEkf, readings);
+    double currentCycles = time(ekf, readings);
+
+    printf("\n%-40s %8.1f cycles/update\n", "Runtime-sized matrices", legacyCycles);
+    printf("%-40s %8.1f cycles/update\n", "Compile-time-sized matrices", currentCycles);
+
+    check(currentStatic + currentStack < legacyStatic + legacyStack, "Less matrix storage");
+    check(currentCycles < legacyCycles, "Fewer cycles per update");
+}
+
+// Innovation variance, gain, and covariance correction for one scalar measurement
+template <typename CovarianceT>
+static float measure(CovarianceT & P, const Matrix<1,STATE_DIM> & H, float R)
+{
+    Matrix<STATE_DIM,1> PHt;
+    float HPHR = P.innovationVariance(H, R, PHt);
+
+    Matrix<STATE_DIM,1> K;
+    for (uint8_t i=0; i<STATE_DIM; ++i) {
+        K.set(i, 0, PHt.get(i,0) / HPHR);
+    }
+
+    P.correct(H, K, PHt, HPHR, R);
+
+    return HPHR;
+}
+
+static float uniform(uint32_t & seed, float lo, float hi)
+{
+    seed = seed * 1664525 + 1013904223;
+    return lo + (hi - lo) * (seed >> 8) / 16777216.f;
+}
+
+// P + KK', which both backends do when H and PH' are zero and R is 1
+template <typename CovarianceT>
+static void addOuter(CovarianceT & P, const Matrix<STATE_DIM,1> & K)
+{
+    Matrix<1,STATE_DIM> H;
+    Matrix<STATE_DIM,1> PHt;
+    P.correct(H, K, PHt, 1, 1);
+}
+
+template <typename CovarianceT>
+static float largest(const CovarianceT & P)
+{
+    float p = 0;
+    for (uint8_t i=0; i<STATE_DIM; ++i) {
+        for (uint8_t j=0; j<STATE_DIM; ++j) {
+            p = fmaxf(p, fabsf(P.get(i,j)));
+        }
+    }
+    return p;
+}
+
+// The flow stream drives every variance to its lower bound, so check the updates from a full covariance too
+static void testCovariance(void)
+{
+    printf("\nPacked symmetric covariance against dense, from a full covariance\n");
+
+    hf::DenseCovariance<STATE_DIM> dense;
+    hf::PackedCovariance<STATE_DIM> packed;
+
+    uint32_t seed = 54321;
+
+    float worstMeasure = 0;
+    float worstRotate = 0;
+
+    for (uint8_t trial=0; trial<50; ++trial) {
+
+        dense.reset();
+        packed.reset();
+
+        for (uint8_t k=0; k<2*STATE_DIM; ++k) {
+            Matrix<STATE_DIM,1> K;
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                K.set(i, 0, uniform(seed, -1, +1));
+            }
+            addOuter(dense, K);
+            addOuter(packed, K);
+        }
+
+        for (uint8_t k=0; k<STATE_DIM; ++k) {
+
+            Matrix<1,STATE_DIM> H;
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                H.set(0, i, uniform(seed, -1, +1));
+            }
+            float R = uniform(seed, 0.01f, 1);
+
+            measure(dense, H, R);
+            measure(packed, H, R);
+
+            float worst = 0;
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                for (uint8_t j=0; j<STATE_DIM; ++j) {
+                    worst = fmaxf(worst, fabsf(packed.get(i,j) - dense.get(i,j)));
+                }
+            }
+            worstMeasure = fmaxf(worstMeasure, worst / largest(dense));
+        }
+
+        float d[3] = {uniform(seed, -0.01f, +0.01f), uniform(seed, -0.01f, +0.01f), uniform(seed, -0.01f, +0.01f)};
+        float a[3][3] = {
+            { 1 - d[1]*d[1]/2 - d[2]*d[2]/2,  d[2] + d[0]*d[1]/2,            -d[1] + d[0]*d[2]/2},
+            {-d[2] + d[0]*d[1]/2,             1 - d[0]*d[0]/2 - d[2]*d[2]/2,  d[0] + d[1]*d[2]/2},
+            { d[1] + d[0]*d[2]/2,            -d[0] + d[1]*d[2]/2,             1 - d[0]*d[0]/2 - d[1]*d[1]/2}
+        };
+
+        dense.rotate(DenseEkf::STATE_D0, a);
+        dense.bound();
+        packed.rotate(DenseEkf::STATE_D0, a);
+        packed.bound();
+
+        float worst = 0;
+        for (uint8_t i=0; i<STATE_DIM; ++i) {
+            for (uint8_t j=0; j<STATE_DIM; ++j) {
+                worst = fmaxf(worst, fabsf(packed.get(i,j) - dense.get(i,j)));
+            }
+        }
+        worstRotate = fmaxf(worstRotate, worst / largest(dense));
+    }
+
+    char what[100];
+
+    sprintf(what, "Scalar updates within %.1e of dense, relative", worstMeasure);
+    check(worstMeasure < 1e-4f, what);
+
+    sprintf(what, "Attitude rotation within %.1e of dense, relative", worstRotate);
+    check(worstRotate < 1e-4f, what);
+}
+
+template <typename CovarianceT>
+static double timeMeasure(const Matrix<1,STATE_DIM> rows[], float & sum)
+{
+    static const uint32_t MEASUREMENTS = 20000;
+
+    CovarianceT P;
+
+    uint64_t best = UINT64_MAX;
+
+    for (uint8_t pass=0; pass<5; ++pass) {
+        P.reset();
+        uint64_t start = cycles();
+        for (uint32_t k=0; k<MEASUREMENTS; ++k) {
+            sum += measure(P, rows[k%2], 0.0625f);
+        }
+        uint64_t elapsed = cycles() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+
+    return (double)best / MEASUREMENTS;
+}
+
+static void testPacked(const reading_t readings[])
+{
+    printf("\nPacked symmetric covariance against dense, %u flow readings\n", STEPS);
+
+    static DenseEkf dense;
+    static PackedEkf packed;
+
+    dense.reset();
+    packed.reset();
+
+    float worstVelocity = 0;
+    float largestVelocity = 0;
+
+    for (uint32_t k=0; k<STEPS; ++k) {
+        const reading_t & r = readings[k];
+        dense.update(DT, r.dpixelx, r.dpixely, r.omegax, r.omegay, r.z, r.vz);
+        packed.update(DT, r.dpixelx, r.dpixely, r.omegax, r.omegay, r.z, r.vz);
+        for (uint8_t i=DenseEkf::STATE_PX; i<=DenseEkf::STATE_PY; ++i) {
+            worstVelocity = fmaxf(worstVelocity, fabsf(packed.getState()[i] - dense.getState()[i]));
+            largestVelocity = fmaxf(largestVelocity, fabsf(dense.getState()[i]));
+        }
+    }
+
+    float stateDifference = 0;
+    float covarianceDifference = 0;
+    compare(packed, dense, stateDifference, covarianceDifference);
+
+    float largestVariance = 0;
+    for (uint8_t i=0; i<STATE_DIM; ++i) {
+        largestVariance = fmaxf(largestVariance, dense.getCovariance(i,i));
+    }
+
+    char what[100];
+
+    sprintf(what, "Velocity within %.1e of dense (largest %.2f m/s)", worstVelocity, largestVelocity);
+    check(worstVelocity < 1e-4f * largestVelocity, what);
+
+    sprintf(what, "Final covariance within %.1e of dense (largest %.2e)", covarianceDifference, largestVariance);
+    check(covarianceDifference < 1e-4f * largestVariance, what);
+
+    // Both flow measurement rows, with typical values
+    Matrix<1,STATE_DIM> rows[2];
+    rows[0].set(0, DenseEkf::STATE_Z, -0.8f);
+    rows[0].set(0, DenseEkf::STATE_PX, 2.7f);
+    rows[1].set(0, DenseEkf::STATE_Z, 0.3f);
+    rows[1].set(0, DenseEkf::STATE_PY, 2.7f);
+
+    float sum = 0;
+    double denseMeasure = timeMeasure<hf::DenseCovariance<STATE_DIM>>(rows, sum);
+    double packedMeasure = timeMeasure<hf::PackedCovariance<STATE_DIM>>(rows, sum);
+
+    double denseCycles = time(dense, readings);
+    double packedCycles = time(packed, readings);
+
+    printf("\n%-40s %8s %8s\n", "", "dense", "packed");
+    printf("%-40s %8zu %8zu\n", "Covariance, bytes", sizeof(hf::DenseCovariance<STATE_DIM>),
+            sizeof(hf::PackedCovariance<STATE_DIM>));
+    printf("%-40s %8zu %8zu\n", "Temporary matrices, bytes", 2 * sizeof(Matrix<STATE_DIM,STATE_DIM>),
+            sizeof(Matrix<STATE_DIM,STATE_DIM>));
+    printf("%-40s %8.1f %8.1f\n", "Cycles per scalar covariance update", denseMeasure, packedMeasure);
+    printf("%-40s %8.1f %8.1f\n", "Cycles per FlowEkf::update()", denseCycles, packedCycles);
+
+    check(packedMeasure < denseMeasure, "Packed scalar update is cheaper");
+    check(packedCycles < denseCycles, "  and so is the whole update");
+
+    // Keep the compiler from discarding the work
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+typedef FlowEkf<hf::UDCovariance> UDEkf;
+
+// The same covariance updates in double precision, with no bounds
+class ReferenceCovariance {
+
+    private:
+
+        double _P[STATE_DIM][STATE_DIM];
+
+    public:
+
+        void reset(void)
+        {
+            memset(_P, 0, sizeof(_P));
+        }
+
+        float get(uint8_t i, uint8_t j) const
+        {
+            return (float)_P[i][j];
+        }
+
+        void addVariance(uint8_t i, float q)
+        {
+            _P[i][i] += q;
+        }
+
+        // P - PH'HP / (HPH' + R)
+        void measure(const Matrix<1,STATE_DIM> & H, float R)
+        {
+            double u[STATE_DIM] = {0};
+            double s = R;
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                for (uint8_t k=0; k<STATE_DIM; ++k) {
+                    u[i] += _P[i][k] * H.get(0,k);
+                }
+                s += H.get(0,i) * u[i];
+            }
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                for (uint8_t j=0; j<STATE_DIM; ++j) {
+                    _P[i][j] -= u[i] * u[j] / s;
+                }
+            }
+        }
+
+        // APA', for A the identity but for the block a starting at first
+        void rotate(uint8_t first, const float a[3][3])
+        {
+            double A[STATE_DIM][STATE_DIM] = {{0}};
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                A[i][i] = 1;
+            }
+            for (uint8_t i=0; i<3; ++i) {
+                for (uint8_t j=0; j<3; ++j) {
+                    A[first+i][first+j] = a[i][j];
+                }
+            }
+
+            double AP[STATE_DIM][STATE_DIM] = {{0}};
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                for (uint8_t j=0; j<STATE_DIM; ++j) {
+                    for (uint8_t k=0; k<STATE_DIM; ++k) {
+                        AP[i][j] += A[i][k] * _P[k][j];
+                    }
+                }
+            }
+            for (uint8_t i=0; i<STATE_DIM; ++i) {
+                for (uint8_t j=0; j<STATE_DIM; ++j) {
+                    _P[i][j] = 0;
+                    for (uint8_t k=0; k<STATE_DIM; ++k) {
+                        _P[i][j] += AP[i][k] * A[j][k];
+                    }
+                }
+            }
+        }
+
+}; // class ReferenceCovariance
+
+// A sequence of process noise, scalar measurements, and attitude rotations, recorded once and replayed into each
+typedef struct {
+
+    uint8_t kind;   // 0 = process noise, 1 = measurement, 2 = rotation
+    uint8_t state;
+    float value;
+    Matrix<1,STATE_DIM> H;
+    float a[3][3];
+
+} event_t;
+
+static const uint32_t EVENTS = 4000;
+
+static void record(event_t events[])
+{
+    uint32_t seed = 24680;
+
+    for (uint32_t k=0; k<EVENTS; ++k) {
+
+        event_t & e = events[k];
+
+        uint32_t step = k % 20;
+
+        // Some process noise on every state, then measurements of one or two states each, more accurate
+        // than the process noise, with an occasional attitude rotation
+        if (step < STATE_DIM) {
+            e.kind = 0;
+            e.state = step;
+            e.value = k < 20 ? uniform(seed, 1, 10) : uniform(seed, 1e-4f, 1e-3f);
+        }
+        else if (step < 19) {
+            e.kind = 1;
+            e.H = Matrix<1,STATE_DIM>();
+            uint8_t i = (uint8_t)(uniform(seed, 0, STATE_DIM - 0.01f));
+            uint8_t j = (uint8_t)(uniform(seed, 0, STATE_DIM - 0.01f));
+            e.H.set(0, i, uniform(seed, 0.5f, 3));
+            e.H.set(0, j, e.H.get(0,j) + uniform(seed, -1, +1));
+            e.value = uniform(seed, 1e-4f, 1e-2f);
+        }
+        else {
+            e.kind = 2;
+            float d[3] = {uniform(seed, -0.01f, +0.01f), uniform(seed, -0.01f, +0.01f), uniform(seed, -0.01f, +0.01f)};
+            float a[3][3] = {
+                { 1 - d[1]*d[1]/2 - d[2]*d[2]/2,  d[2] + d[0]*d[1]/2,            -d[1] + d[0]*d[2]/2},
+                {-d[2] + d[0]*d[1]/2,             1 - d[0]*d[0]/2 - d[2]*d[2]/2,  d[0] + d[1]*d[2]/2},
+                { d[1] + d[0]*d[2]/2,            -d[0] + d[1]*d[2]/2,             1 - d[0]*d[0]/2 - d[1]*d[1]/2}
+            };
+            memcpy(e.a, a, sizeof(a));
+        }
+    }
+}
+
+static void replay(ReferenceCovariance & P, const event_t & e)
+{
+    switch (e.kind) {
+        case 0:
+            P.addVariance(e.state, e.value);
+            break;
+        case 1:
+            P.measure(e.H, e.value);
+            break;
+        default:
+            P.rotate(DenseEkf::STATE_D0, e.a);
+    }
+}
+
+template <typename CovarianceT>
+static void replay(CovarianceT & P, const event_t & e)
+{
+    switch (e.kind) {
+        case 0:
+            P.addVariance(e.state, e.value);
+            break;
+        case 1:
+            measure(P, e.H, e.value);
+            break;
+        default:
+            P.rotate(DenseEkf::STATE_D0, e.a);
+            P.bound();
+    }
+}
+
+// Largest difference from the double-precision covariance, relative to its diagonal, after each event
+template <typename CovarianceT>
+static float replayError(const event_t events[])
+{
+    static ReferenceCovariance reference;
+    static CovarianceT P;
+
+    reference.reset();
+    P.reset();
+
+    float worst = 0;
+
+    for (uint32_t k=0; k<EVENTS; ++k) {
+        replay(reference, events[k]);
+        replay(P, events[k]);
+        for (uint8_t i=0; i<STATE_DIM; ++i) {
+            for (uint8_t j=0; j<STATE_DIM; ++j) {
+                float scale = sqrtf(reference.get(i,i) * reference.get(j,j));
+                worst = fmaxf(worst, fabsf(P.get(i,j) - reference.get(i,j)) / scale);
+            }
+        }
+    }
+
+    return worst;
+}
+
+static void testUD(const reading_t readings[])
+{
+    printf("\nUD-factored covariance against dense and packed\n");
+
+    static event_t events[EVENTS];
+    record(events);
+
+    float denseError = replayError<hf::DenseCovariance<STATE_DIM>>(events);
+    float packedError = replayError<hf::PackedCovariance<STATE_DIM>>(events);
+    float udError = replayError<hf::UDCovariance<STATE_DIM>>(events);
+
+    printf("\nLargest covariance error from double precision, relative to the standard deviations,\n");
+    printf("over %u events of process noise, scalar measurements, and attitude rotations\n", EVENTS);
+    printf("%-40s %10.2e\n", "  dense", denseError);
+    printf("%-40s %10.2e\n", "  packed", packedError);
+    printf("%-40s %10.2e\n", "  UD", udError);
+
+    check(udError < 1e-5f, "UD covariance stays close to double precision");
+    check(udError < 2 * denseError, "  as close as dense");
+    check(packedError < 1e-5f, "Packed covariance stays close to double precision");
+
+    // The flow stream, replayed into both
+    static DenseEkf dense;
+    static UDEkf ud;
+
+    dense.reset();
+    ud.reset();
+
+    float worstVelocity = 0;
+    float largestVelocity = 0;
+
+    for (uint32_t k=0; k<STEPS; ++k) {
+        const reading_t & r = readings[k];
+        dense.update(DT, r.dpixelx, r.dpixely, r.omegax, r.omegay, r.z, r.vz);
+        ud.update(DT, r.dpixelx, r.dpixely, r.omegax, r.omegay, r.z, r.vz);
+        for (uint8_t i=DenseEkf::STATE_PX; i<=DenseEkf::STATE_PY; ++i) {
+            worstVelocity = fmaxf(worstVelocity, fabsf(ud.getState()[i] - dense.getState()[i]));
+            largestVelocity = fmaxf(largestVelocity, fabsf(dense.getState()[i]));
+        }
+    }
+
+    // The flow stream holds every variance at its lower bound, which UD applies to D rather than to the
+    // diagonal of P, so the two settle on slightly different gains
+    char what[100];
+    sprintf(what, "Flow velocity within %.1e of dense (largest %.2f m/s)", worstVelocity, largestVelocity);
+    check(worstVelocity < 0.05f * largestVelocity, what);
+
+    // Both flow measurement rows, with typical values
+    Matrix<1,STATE_DIM> rows[2];
+    rows[0].set(0, DenseEkf::STATE_Z, -0.8f);
+    rows[0].set(0, DenseEkf::STATE_PX, 2.7f);
+    rows[1].set(0, DenseEkf::STATE_Z, 0.3f);
+    rows[1].set(0, DenseEkf::STATE_PY, 2.7f);
+
+    float sum = 0;
+    double denseMeasure = timeMeasure<hf::DenseCovariance<STATE_DIM>>(rows, sum);
+    double packedMeasure = timeMeasure<hf::PackedCovariance<STATE_DIM>>(rows, sum);
+    double udMeasure = timeMeasure<hf::UDCovariance<STATE_DIM>>(rows, sum);
+
+    static PackedEkf packed;
+    double denseCycles = time(dense, readings);
+    double packedCycles = time(packed, readings);
+    double udCycles = time(ud, readings);
+
+    printf("\n%-40s %8s %8s %8s\n", "", "dense", "packed", "UD");
+    printf("%-40s %8zu %8zu %8zu\n", "Covariance, bytes", sizeof(hf::DenseCovariance<STATE_DIM>),
+            sizeof(hf::PackedCovariance<STATE_DIM>), sizeof(hf::UDCovariance<STATE_DIM>));
+    printf("%-40s %8.1f %8.1f %8.1f\n", "Cycles per scalar covariance update", denseMeasure, packedMeasure, udMeasure);
+    printf("%-40s %8.1f %8.1f %8.1f\n", "Cycles per FlowEkf::update()", denseCycles, packedCycles, udCycles);
+
+    check(udMeasure < denseMeasure, "UD scalar update is cheaper than dense");
+
+    // Keep the compiler from discarding the work
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+// Multi-rate: a 1 kHz IMU, 100 Hz flow frames, and a 25 Hz rangefinder
+static const uint32_t IMU_HZ = 1000;
+static const uint32_t FLOW_EVERY = 10;
+static const uint32_t RANGE_EVERY = 40;
+static const uint32_t IMU_STEPS = 20000;
+static const float IMU_DT = 1.f / IMU_HZ;
+static const float GRAVITY = 9.81f;
+
+// Flow sensor model, as in FlowEkf
+static const float FLOW_SCALE = 100.f;
+static const float FLOW_NPIX = 30.f;
+static const float FLOW_THETAPIX = 4.2f * M_PI / 180;
+static const float FLOW_OMEGA_FACTOR = 1.25f;
+
+typedef struct {
+
+    // What the sensors report
+    float gyro[3];      // rad/sec
+    float accel[3];     // Gs
+    float dpixelx;      // this frame, if the step ends one
+    float dpixely;
+    float range;        // meters, tilt-compensated, if the step has a reading
+
+    // What they should report
+    float vel[2];       // body-frame x, y
+
+} imustep_t;
+
+// A vehicle rocking and weaving at a meter or two, with noisy sensors, integrated at the IMU rate
+static void simulateImu(imustep_t steps[])
+{
+    uint32_t seed = 54321;
+
+    float q[4] = {1, 0, 0, 0};
+    float z = 1.5f;
+
+    for (uint32_t k=0; k<IMU_STEPS; ++k) {
+
+        float t = k * IMU_DT;
+
+        float g[3] = {0.8f * sinf(4.1f * t), 0.8f * cosf(3.7f * t), 0.3f * sinf(0.3f * t)};
+
+        float v[3]  = {0.6f * sinf(5.0f * t),        0.5f * cosf(4.0f * t),         0.1f * sinf(0.4f * t)};
+        float dv[3] = {0.6f * 5.0f * cosf(5.0f * t), -0.5f * 4.0f * sinf(4.0f * t), 0.1f * 0.4f * cosf(0.4f * t)};
+
+        // Third row of the rotation from body to world
+        float r20 = 2 * (q[1]*q[3] - q[0]*q[2]);
+        float r21 = 2 * (q[2]*q[3] + q[0]*q[1]);
+        float r22 = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+
+        // Specific force: dv/dt + omega x v + gravity, in the body frame
+        float a[3] = {
+            dv[0] + g[1]*v[2] - g[2]*v[1] + GRAVITY*r20,
+            dv[1] + g[2]*v[0] - g[0]*v[2] + GRAVITY*r21,
+            dv[2] + g[0]*v[1] - g[1]*v[0] + GRAVITY*r22
+        };
+
+        imustep_t & s = steps[k];
+
+        for (uint8_t i=0; i<3; ++i) {
+            s.gyro[i] = g[i] + uniform(seed, -0.01f, +0.01f);
+            s.accel[i] = a[i] / GRAVITY + uniform(seed, -0.01f, +0.01f);
+        }
+
+        s.vel[0] = v[0];
+        s.vel[1] = v[1];
+
+        s.dpixelx = 0;
+        s.dpixely = 0;
+        s.range = 0;
+
+        // Flow over the frame just ended, in the units FlowEkf expects, with a fraction of a count of noise
+        if ((k+1) % FLOW_EVERY == 0) {
+            float frame = FLOW_EVERY * IMU_DT;
+            float scale = frame * FLOW_NPIX / FLOW_THETAPIX;
+            s.dpixelx = (scale * (v[0] * r22 / z - FLOW_OMEGA_FACTOR * g[1]) + uniform(seed, -0.1f, +0.1f)) / FLOW_SCALE;
+            s.dpixely = (scale * (v[1] * r22 / z + FLOW_OMEGA_FACTOR * g[0]) + uniform(seed, -0.1f, +0.1f)) / FLOW_SCALE;
+        }
+
+        if ((k+1) % RANGE_EVERY == 0) {
+            s.range = z + uniform(seed, -0.02f, +0.02f);
+        }
+
+        // Move on to the next step
+        z += IMU_DT * (r20*v[0] + r21*v[1] + r22*v[2]);
+
+        float h[3] = {g[0]*IMU_DT/2, g[1]*IMU_DT/2, g[2]*IMU_DT/2};
+        float p[4] = {
+            q[0] - q[1]*h[0] - q[2]*h[1] - q[3]*h[2],
+            q[1] + q[0]*h[0] + q[2]*h[2] - q[3]*h[1],
+            q[2] + q[0]*h[1] - q[1]*h[2] + q[3]*h[0],
+            q[3] + q[0]*h[2] + q[1]*h[1] - q[2]*h[0]
+        };
+        float n = sqrtf(p[0]*p[0] + p[1]*p[1] + p[2]*p[2] + p[3]*p[3]);
+        for (uint8_t i=0; i<4; ++i) {
+            q[i] = p[i] / n;
+        }
+    }
+}
+
+typedef struct {
+
+    float rms;
+    float jump;
+    double predictCycles;
+    double correctCycles;
+    double correctMax;
+
+} multirate_t;
+
+// Scored from a second in, once the filters have settled from their zero covariance
+static void score(uint32_t k, const imustep_t & s, const float * S, float previous[2], double & squares, float & jump)
+{
+    for (uint8_t i=0; i<2; ++i) {
+        float v = S[FlowEkf<>::STATE_PX+i];
+        float e = v - s.vel[i];
+        if (k >= IMU_HZ) {
+            squares += e*e;
+            jump = fmaxf(jump, fabsf(v - previous[i]));
+        }
+        previous[i] = v;
+    }
+}
+
+// Predicts on every IMU sample and corrects as each flow frame or range reading comes in
+static multirate_t runMultiRate(const imustep_t steps[])
+{
+    static FlowEkf<> ekf;
+    ekf.reset();
+    ekf.correctRange(1.5f);
+
+    multirate_t result = {};
+    double squares = 0;
+    float previous[2] = {0};
+    uint64_t predictTotal = 0;
+    uint64_t correctTotal = 0;
+    uint64_t correctMax = 0;
+
+    for (uint32_t k=0; k<IMU_STEPS; ++k) {
+
+        const imustep_t & s = steps[k];
+
+        uint64_t start = cycles();
+        ekf.predict(IMU_DT, s.gyro, s.accel);
+        predictTotal += cycles() - start;
+
+        if ((k+1) % FLOW_EVERY == 0) {
+            start = cycles();
+            if ((k+1) % RANGE_EVERY == 0) {
+                ekf.correctRange(s.range);
+            }
+            ekf.correctFlow(FLOW_EVERY * IMU_DT, s.dpixelx, s.dpixely, s.gyro[0], s.gyro[1]);
+            uint64_t elapsed = cycles() - start;
+            correctTotal += elapsed;
+            correctMax = elapsed > correctMax ? elapsed : correctMax;
+        }
+
+        score(k, s, ekf.getState(), previous, squares, result.jump);
+    }
+
+    result.rms = sqrt(squares / (2 * (IMU_STEPS - IMU_HZ)));
+    result.predictCycles = (double)predictTotal / IMU_STEPS;
+    result.correctCycles = (double)correctTotal / (IMU_STEPS / FLOW_EVERY);
+    result.correctMax = (double)correctMax;
+
+    return result;
+}
+
+// Predicts once per flow frame, from the IMU sample that comes with it
+static multirate_t runPerFrame(const imustep_t steps[])
+{
+    static FlowEkf<> ekf;
+    ekf.reset();
+    ekf.correctRange(1.5f);
+
+    multirate_t result = {};
+    double squares = 0;
+    float previous[2] = {0};
+
+    for (uint32_t k=0; k<IMU_STEPS; ++k) {
+
+        const imustep_t & s = steps[k];
+
+        if ((k+1) % FLOW_EVERY == 0) {
+            ekf.predict(FLOW_EVERY * IMU_DT, s.gyro, s.accel);
+            if ((k+1) % RANGE_EVERY == 0) {
+                ekf.correctRange(s.range);
+            }
+            ekf.correctFlow(FLOW_EVERY * IMU_DT, s.dpixelx, s.dpixely, s.gyro[0], s.gyro[1]);
+        }
+
+        score(k, s, ekf.getState(), previous, squares, result.jump);
+    }
+
+    result.rms = sqrt(squares / (2 * (IMU_STEPS - IMU_HZ)));
+
+    return result;
+}
+
+// The single-rate update() the sensor used to call, with altitude and climb rate from the rangefinder
+static multirate_t runUpdate(const imustep_t steps[])
+{
+    static FlowEkf<> ekf;
+    ekf.reset();
+
+    multirate_t result = {};
+    double squares = 0;
+    float previous[2] = {0};
+
+    float z = 1.5f;
+    float vz = 0;
+
+    for (uint32_t k=0; k<IMU_STEPS; ++k) {
+
+        const imustep_t & s = steps[k];
+
+        if ((k+1) % RANGE_EVERY == 0) {
+            vz = (s.range - z) / (RANGE_EVERY * IMU_DT);
+            z = s.range;
+        }
+
+        if ((k+1) % FLOW_EVERY == 0) {
+            ekf.update(FLOW_EVERY * IMU_DT, s.dpixelx, s.dpixely, s.gyro[0], s.gyro[1], z, vz);
+        }
+
+        score(k, s, ekf.getState(), previous, squares, result.jump);
+    }
+
+    result.rms = sqrt(squares / (2 * (IMU_STEPS - IMU_HZ)));
+
+    return result;
+}
+
+static void testMultiRate(void)
+{
+    printf("\nPrediction at %u Hz, flow at %u Hz, and range at %u Hz\n", IMU_HZ, IMU_HZ/FLOW_EVERY, IMU_HZ/RANGE_EVERY);
+
+    static imustep_t steps[IMU_STEPS];
+    simulateImu(steps);
+
+    multirate_t multi = runMultiRate(steps);
+    multirate_t frame = runPerFrame(steps);
+    multirate_t single = runUpdate(steps);
+
+    // Timing from a warm cache, best of five
+    for (uint8_t pass=0; pass<4; ++pass) {
+        multirate_t again = runMultiRate(steps);
+        multi.predictCycles = fmin(multi.predictCycles, again.predictCycles);
+        multi.correctCycles = fmin(multi.correctCycles, again.correctCycles);
+        multi.correctMax = fmin(multi.correctMax, again.correctMax);
+    }
+
+    printf("\nBody-frame x,y velocity against the truth at every IMU sample, m/s\n");
+    printf("%-40s %8s %8s\n", "", "RMS", "jump");
+    printf("%-40s %8.3f %8.3f\n", "  predict at IMU rate", multi.rms, multi.jump);
+    printf("%-40s %8.3f %8.3f\n", "  predict once per flow frame", frame.rms, frame.jump);
+    printf("%-40s %8.3f %8.3f\n", "  update() with no process model", single.rms, single.jump);
+
+    printf("\n%-40s %8.1f\n", "Cycles per predict()", multi.predictCycles);
+    printf("%-40s %8.1f\n", "Cycles per flow frame of corrections", multi.correctCycles);
+    printf("%-40s %8.1f\n", "  at most", multi.correctMax);
+
+    char what[100];
+
+    sprintf(what, "Multi-rate velocity within %.3f m/s RMS of the truth", multi.rms);
+    check(multi.rms < 0.03f, what);
+    check(multi.rms < frame.rms && multi.rms < single.rms, "  closer than predicting once per frame, or not at all");
+    check(multi.jump < frame.jump, "  and smoother between frames");
+    check(multi.predictCycles < multi.correctCycles / 4, "Prediction costs a fraction of a frame's corrections");
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    static reading_t readings[STEPS];
+    simulate(readings);
+
+    testMatrix();
+    testEkf(readings);
+    testPacked(readings);
+    testCovariance();
+    testUD(readings);
+    testMultiRate();
+
+    return finish();
+}
@@ -0,0 +1,263 @@
+/*
+   Self-check for the interrupt-driven gyrometer pipeline
+
+   Exercises SpscRing on its own, then with a producer thread standing in
+   for the gyro data-ready interrupt, then end to end: a thread calls
+   LinuxBoard::gyrometerInterrupt() at about 8 kHz while the main thread
+   runs Hackflight::update() with random stalls, and a PID controller
+   checks that it sees every queued sample, in order.  Exits with a
+   nonzero status on any failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <thread>
+
+#include "hackflight.hpp"
+#include "spscring.hpp"
+#include "boards/linux/linux.hpp"
+#include "receivers/linux.hpp"
+#include "mixers/quadxap.hpp"
+
+#include "selfcheck.hpp"
+
+static const uint32_t STRESS_COUNT = 10000000;
+
+static const uint32_t ISR_PERIOD_USEC = 125;   // 8 kHz
+static const uint32_t ISR_SAMPLES     = 40000; // five seconds
+static const uint32_t MAX_STALL_USEC  = 1000;  // well inside the 2 msec a 16-sample queue holds at 8 kHz
+static const uint32_t LONG_STALL_USEC = 5000;  // long enough to overflow the queue
+
+static const uint8_t CHANNEL_MAP[6] = {0, 1, 2, 3, 4, 5};
+
+static void sleepMicros(uint32_t usec)
+{
+    struct timespec ts;
+    ts.tv_sec  = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+// Full, empty, FIFO order, and wraparound of the free-running indices, on one thread
+static void testSingleThread(void)
+{
+    hf::SpscRing<uint32_t, 8> ring;
+
+    uint32_t value = 0;
+
+    bool ok = ring.capacity() == 8 && ring.count() == 0 && !ring.pop(value);
+    check(ok, "empty ring");
+
+    ok = true;
+    for (uint32_t k=0; k<8; ++k) {
+        ok = ok && ring.push(k);
+    }
+    ok = ok && ring.count() == 8 && !ring.push(99);
+    check(ok, "full ring refuses push");
+
+    ok = true;
+    for (uint32_t k=0; k<8; ++k) {
+        ok = ok && ring.pop(value) && value == k;
+    }
+    ok = ok && !ring.pop(value);
+    check(ok, "FIFO order");
+
+    // Enough pushes and pops to wrap the byte indices many times over, at varying fill levels
+    uint32_t next = 0;
+    uint32_t expected = 0;
+    ok = true;
+    for (uint32_t k=0; k<10000; ++k) {
+        uint32_t pushes = k % 9;
+        for (uint32_t j=0; j<pushes; ++j) {
+            if (ring.push(next)) {
+                next++;
+            }
+        }
+        uint32_t pops = (k * 7) % 9;
+        for (uint32_t j=0; j<pops; ++j) {
+            if (ring.pop(value)) {
+                ok = ok && value == expected;
+                expected++;
+            }
+        }
+    }
+    while (ring.pop(value)) {
+        ok = ok && value == expected;
+        expected++;
+    }
+    ok = ok && expected == next && next > 10000;
+    check(ok, "wraparound");
+}
+
+// A producer thread and the consumer race on a small ring; nothing may be lost, duplicated, or reordered
+static void testTwoThreads(void)
+{
+    hf::SpscRing<hf::gyroSample_t, 16> ring;
+
+    std::thread producer([&ring]() {
+        for (uint32_t k=0; k<STRESS_COUNT; ) {
+            // Sequence number in every field, so a torn slot would show up as a mismatch
+            hf::gyroSample_t sample = {(float)(k & 0xFFFFFF), (float)(k & 0xFFFFFF), (float)(k & 0xFFFFFF), k};
+            if (ring.push(sample)) {
+                k++;
+            }
+            // Let the consumer run if it shares our core
+            else {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint32_t expected = 0;
+    bool ok = true;
+
+    while (expected < STRESS_COUNT) {
+        hf::gyroSample_t sample;
+        if (ring.pop(sample)) {
+            float f = (float)(expected & 0xFFFFFF);
+            if (sample.usec != expected || sample.x != f || sample.y != f || sample.z != f) {
+                ok = false;
+                break;
+            }
+            expected++;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+
+    producer.join();
+
+    char what[80];
+    snprintf(what, sizeof(what), "%u samples across threads, in order and intact", STRESS_COUNT);
+    check(ok && ring.count() == 0, what);
+}
+
+// Records the sequence numbers that reach the PID stage
+class SequencePid : public hf::PidController {
+
+    public:
+
+        uint32_t received = 0;
+        uint32_t missing = 0;
+        uint32_t last = 0;
+        bool ordered = true;
+
+    protected:
+
+        virtual void modifyDemands(hf::state_t & state, hf::demands_t & demands) override
+        {
+            (void)demands;
+
+            uint32_t seq = (uint32_t)state.cache.getAngularVelocity()[0];
+
+            if (received > 0) {
+                if (seq <= last) {
+                    ordered = false;
+                }
+                else {
+                    missing += seq - last - 1;
+                }
+            }
+            else {
+                missing += seq;
+            }
+
+            last = seq;
+            received++;
+        }
+
+}; // class SequencePid
+
+static void testHackflight(void)
+{
+    hf::Hackflight h;
+    hf::LinuxBoard board;
+    hf::LinuxReceiver rc(CHANNEL_MAP);
+    hf::MixerQuadXAP mixer;
+    SequencePid pid;
+
+    h.init(&board, &rc, &mixer);
+    h.addPidController(&pid);
+
+    bool done = false;
+    bool stalling = false;
+    uint32_t droppedBeforeStall = 0;
+
+    // Stand-in for the gyro data-ready interrupt
+    std::thread isr([&board, &done]() {
+        for (uint32_t k=0; k<ISR_SAMPLES; ++k) {
+            board.gyrometerInterrupt(k, 0, 0);
+            sleepMicros(ISR_PERIOD_USEC);
+        }
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    });
+
+    srand(0);
+
+    uint32_t loops = 0;
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+
+        h.update();
+        loops++;
+
+        // One long stall midway through, so the queue overflows
+        if (loops == 2000) {
+            droppedBeforeStall = board.getGyrometerDropped();
+            stalling = true;
+            sleepMicros(LONG_STALL_USEC);
+        }
+        else {
+            sleepMicros(rand() % MAX_STALL_USEC);
+        }
+    }
+
+    isr.join();
+
+    // Pick up whatever the interrupt queued after the last pass
+    h.update();
+
+    uint32_t dropped = board.getGyrometerDropped();
+
+    printf("\n%u loops, %u samples processed, %u dropped (%u before long stall)\n\n",
+            loops, pid.received, dropped, droppedBeforeStall);
+
+    check(pid.ordered, "samples processed in order");
+    check(pid.received + dropped == ISR_SAMPLES, "every sample processed or counted as dropped");
+    check(pid.missing + (ISR_SAMPLES - 1 - pid.last) == dropped, "gaps in sequence match drop count");
+    check(stalling && dropped > droppedBeforeStall, "long stall overflows queue");
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    // micros() latches its start time on first call; do that before any thread can race for it
+    micros();
+
+    testSingleThread();
+    testTwoThreads();
+    testHackflight();
+
+    return finish();
+}
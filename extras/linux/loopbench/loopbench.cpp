@@ -0,0 +1,445 @@
+/*
+   Host benchmark for the Hackflight core loop
+
+   Times Hackflight::update(), MadgwickQuaternionFilter6DOF::update() and
+   MspParser::parse() on a Linux workstation, using LinuxBoard and
+   LinuxReceiver to inject IMU data and stick values.  Also runs the
+   control loop under the task scheduler for one second and reports
+   per-task statistics, and compares the virtual-dispatch Hackflight class
+   with HackflightCore instantiated on the concrete board, receiver, and
+   mixer types over alternating passes, reporting the best, median, and
+   worst cycles per call of each, and times the gyro filter chain against a one-axis-at-a-
+   time version of the same filters.  When built with HACKFLIGHT_PROFILE,
+   also reports per-stage loop timing.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "hackflight.hpp"
+#include "boards/linux/linux.hpp"
+#include "receivers/linux.hpp"
+#include "mixers/quadxap.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+#include "gyrofilter.hpp"
+
+#include "selfcheck.hpp"
+
+static const uint32_t ITERATIONS = 1000000;
+
+static constexpr uint8_t CHANNEL_MAP[6] = {0, 1, 2, 3, 4, 5};
+
+// Exposes the protected parser methods for timing
+class BenchParser : public hf::MspParser {
+
+    public:
+
+        void begin(void)
+        {
+            MspParser::init();
+        }
+
+        bool feed(uint8_t c)
+        {
+            return MspParser::parse(c);
+        }
+
+        uint8_t drain(void)
+        {
+            uint8_t sum = 0;
+            while (MspParser::availableBytes() > 0) {
+                sum += MspParser::readByte();
+            }
+            return sum;
+        }
+};
+
+static double nanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char * name, double start, uint32_t count)
+{
+    printf("%-32s %8.1f ns/call\n", name, (nanoseconds() - start) / count);
+}
+
+static void reportStages(hf::Hackflight & h)
+{
+    static const char * names[hf::Profiler::STAGE_COUNT] = 
+        {"receiver", "gyrometer", "quaternion", "mixer", "serial", "dynnotch", "pid0", "pid1", "pid2", "pid3"};
+
+    hf::Profiler * profiler = h.getProfiler();
+
+    // Profiling disabled
+    if (!profiler->getStage(0)) {
+        return;
+    }
+
+    printf("\n%-12s %8s %6s %6s %10s   %s\n", "Stage", "Count", "Min", "Max", "Mean (ns)", "Histogram (0, 1, 2-3, 4-7, ... usec)");
+
+    for (uint8_t k=0; k<hf::Profiler::STAGE_COUNT; ++k) {
+        const hf::Profiler::stage_t * stage = profiler->getStage(k);
+        if (stage->count == 0) {
+            continue;
+        }
+        printf("%-12s %8u %6u %6u %10.1f  ", names[k], stage->count, stage->minimum, stage->maximum, 
+                1000. * stage->total / stage->count);
+        for (uint8_t j=0; j<hf::Profiler::HISTOGRAM_BINS; ++j) {
+            printf(" %u", stage->histogram[j]);
+        }
+        printf("\n");
+    }
+}
+
+// Injects gyro every loop, quaternion and receiver at lower rates
+static void inject(hf::LinuxBoard & board, hf::LinuxReceiver & rc, uint32_t k)
+{
+    float t = k * 1e-3f;
+    board.setGyrometer(0.1f*sinf(t), 0.1f*cosf(t), 0.01f);
+    if (k % 5 == 0) {
+        board.setQuaternion(1, 0.01f*sinf(t), 0.01f*cosf(t), 0);
+    }
+    if (k % 20 == 0) {
+        rc.setChannel(0, 0.2f);
+        rc.setChannel(1, 0.1f*sinf(t));
+    }
+}
+
+static void benchHackflight(bool scheduled)
+{
+    hf::Hackflight h;
+    hf::LinuxBoard board;
+    hf::LinuxReceiver rc(CHANNEL_MAP);
+    hf::MixerQuadXAP mixer;
+    hf::RatePid ratePid(0.05f, 0.00f, 0.00f, 0.10f, 0.01f);
+    hf::LevelPid levelPid(0.20f);
+
+    h.init(&board, &rc, &mixer);
+    h.addPidController(&levelPid);
+    h.addPidController(&ratePid);
+
+    // Aux2 down, then up with throttle down, to arm
+    rc.setChannel(5, -1);
+    h.update();
+    rc.setChannel(5, +1);
+    h.update();
+
+    if (!scheduled) {
+
+        double start = nanoseconds();
+
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            inject(board, rc, k);
+            h.update();
+        }
+
+        report("Hackflight::update()", start, ITERATIONS);
+
+        reportStages(h);
+    }
+
+    else {
+
+        h.useScheduler();
+
+        double start = nanoseconds();
+
+        for (uint32_t k=0; nanoseconds()-start < 1e9; ++k) {
+            inject(board, rc, k);
+            h.update();
+        }
+
+        hf::Scheduler * scheduler = h.getScheduler();
+
+        printf("\n%-12s %8s %8s %8s %12s %12s\n", "Task", "Runs", "Late", "Overrun", "Latency (us)", "Duration (us)");
+
+        for (uint8_t k=0; k<scheduler->getTaskCount(); ++k) {
+            const hf::Scheduler::task_t & task = scheduler->getTask(k);
+            printf("%-12s %8u %8u %8u %12u %12u\n", task.name, task.runs, task.lateStarts, task.overruns, 
+                    task.maxLatency, task.maxDuration);
+        }
+
+        printf("\n");
+    }
+
+    printf("%-32s %+6.3f %+6.3f %+6.3f %+6.3f\n", "Final motor values", 
+            board.getMotor(0), board.getMotor(1), board.getMotor(2), board.getMotor(3));
+}
+
+// Same loop as benchHackflight(false), for either dispatch scheme, one pass at a time
+template <typename HackflightT>
+class DispatchBench {
+
+    private:
+
+        HackflightT h;
+        hf::LinuxBoard board;
+        hf::LinuxReceiver rc = hf::LinuxReceiver(CHANNEL_MAP);
+        hf::MixerQuadXAP mixer;
+        hf::RatePid ratePid = hf::RatePid(0.05f, 0.00f, 0.00f, 0.10f, 0.01f);
+        hf::LevelPid levelPid = hf::LevelPid(0.20f);
+
+    public:
+
+        DispatchBench(void)
+        {
+            h.init(&board, &rc, &mixer);
+            h.addPidController(&levelPid);
+            h.addPidController(&ratePid);
+
+            rc.setChannel(5, -1);
+            h.update();
+            rc.setChannel(5, +1);
+            h.update();
+        }
+
+        // Cycles per call over one pass
+        double pass(void)
+        {
+            uint64_t start = cycles();
+
+            for (uint32_t k=0; k<ITERATIONS; ++k) {
+                inject(board, rc, k);
+                h.update();
+            }
+
+            return (double)(cycles() - start) / ITERATIONS;
+        }
+};
+
+static void reportPasses(const char * name, double passes[], uint8_t count)
+{
+    std::sort(passes, passes+count);
+
+    printf("%-32s %8.1f %8.1f %8.1f\n", name, passes[0], passes[count/2], passes[count-1]);
+}
+
+// The two dispatch schemes in alternating passes, so that anything else on the host affects both alike
+static void benchDispatch(void)
+{
+    static const uint8_t PASSES = 9;
+
+    static DispatchBench<hf::Hackflight> dynamic;
+    static DispatchBench<hf::HackflightCore<hf::LinuxBoard, hf::LinuxReceiver, hf::MixerQuadXAP, 2, 0> > fixed;
+
+    double dynamicPasses[PASSES];
+    double fixedPasses[PASSES];
+
+    for (uint8_t k=0; k<PASSES; ++k) {
+        dynamicPasses[k] = dynamic.pass();
+        fixedPasses[k] = fixed.pass();
+    }
+
+    char title[40];
+    sprintf(title, "Cycles per call, %u passes", PASSES);
+
+    printf("\n%-32s %8s %8s %8s\n", title, "best", "median", "worst");
+    reportPasses("Hackflight (virtual)", dynamicPasses, PASSES);
+    reportPasses("HackflightCore (static)", fixedPasses, PASSES);
+    printf("\n");
+}
+
+static void benchMadgwick(void)
+{
+    hf::MadgwickQuaternionFilter6DOF filter(0.1f, 0.0f);
+
+    double start = nanoseconds();
+
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        float t = k * 1e-3f;
+        filter.update(0.01f*sinf(t), 0.01f*cosf(t), 1, 0.1f, -0.1f, 0.01f, 1e-3f);
+    }
+
+    report("MadgwickQuaternionFilter6DOF", start, ITERATIONS);
+
+    // Keep the compiler from discarding the work
+    if (filter.q1 > 2) {
+        printf("%f\n", filter.q1);
+    }
+}
+
+// Plain one-axis DF2T biquad, for comparison with GyroFilter's three-axis kernel
+class ScalarBiquad {
+
+    private:
+
+        float _b0 = 1, _b1 = 0, _b2 = 0, _a1 = 0, _a2 = 0;
+        float _z1 = 0, _z2 = 0;
+
+    public:
+
+        void init(float b0, float b1, float b2, float a1, float a2)
+        {
+            _b0 = b0; _b1 = b1; _b2 = b2; _a1 = a1; _a2 = a2;
+            _z1 = 0; _z2 = 0;
+        }
+
+        float apply(float x)
+        {
+            float y = _b0 * x + _z1;
+            _z1 = _b1 * x - _a1 * y + _z2;
+            _z2 = _b2 * x - _a2 * y;
+            return y;
+        }
+};
+
+static void benchGyroFilter(void)
+{
+    static const float SAMPLE_HZ = 8000;
+
+    // PT1, Butterworth lowpass, and two notches: a full chain
+    hf::GyroFilter filter;
+    filter.addPt1(250);
+    filter.addLowpass(150);
+    filter.addNotch(200, 3);
+    filter.addNotch(400, 3);
+    filter.begin(SAMPLE_HZ);
+
+    // Same chain, one axis at a time, with coefficients from the same formulas
+    ScalarBiquad scalar[3][4];
+    for (uint8_t axis=0; axis<3; ++axis) {
+        float k = (1/SAMPLE_HZ) / (1/(2*M_PI*250) + 1/SAMPLE_HZ);
+        scalar[axis][0].init(k, 0, 0, k-1, 0);
+        float hz[3] = {150, 200, 400};
+        float q[3] = {0.7071068f, 3, 3};
+        for (uint8_t j=0; j<3; ++j) {
+            float w0 = 2 * M_PI * hz[j] / SAMPLE_HZ;
+            float cs = cosf(w0);
+            float alpha = sinf(w0) / (2 * q[j]);
+            float a0 = 1 + alpha;
+            float b = (1 - cs) / 2;
+            if (j == 0) {
+                scalar[axis][j+1].init(b/a0, 2*b/a0, b/a0, -2*cs/a0, (1-alpha)/a0);
+            }
+            else {
+                scalar[axis][j+1].init(1/a0, -2*cs/a0, 1/a0, -2*cs/a0, (1-alpha)/a0);
+            }
+        }
+    }
+
+    // Precompute input so we time only the filters
+    static const uint32_t INPUTS = 1024;
+    static float input[INPUTS][3];
+    for (uint32_t k=0; k<INPUTS; ++k) {
+        float t = k / SAMPLE_HZ;
+        input[k][0] = sinf(2*M_PI*30*t) + 0.2f*sinf(2*M_PI*200*t);
+        input[k][1] = cosf(2*M_PI*20*t) + 0.2f*sinf(2*M_PI*400*t);
+        input[k][2] = 0.1f*sinf(2*M_PI*5*t);
+    }
+
+    float sum = 0;
+    float maxDiff = 0;
+
+    double start = nanoseconds();
+
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        const float * in = input[k % INPUTS];
+        float gx = in[0], gy = in[1], gz = in[2];
+        filter.apply(gx, gy, gz, 0);
+        sum += gx + gy + gz;
+    }
+
+    report("GyroFilter per 3-axis sample", start, ITERATIONS);
+
+    start = nanoseconds();
+
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        const float * in = input[k % INPUTS];
+        float out[3];
+        for (uint8_t axis=0; axis<3; ++axis) {
+            float x = in[axis];
+            for (uint8_t j=0; j<4; ++j) {
+                x = scalar[axis][j].apply(x);
+            }
+            out[axis] = x;
+        }
+        sum -= out[0] + out[1] + out[2];
+    }
+
+    report("  same, one axis at a time", start, ITERATIONS);
+
+    // Run both once more from where they are and check that they agree
+    for (uint32_t k=0; k<INPUTS; ++k) {
+        float g[3] = {input[k][0], input[k][1], input[k][2]};
+        filter.apply(g[0], g[1], g[2], 0);
+        for (uint8_t axis=0; axis<3; ++axis) {
+            float x = input[k][axis];
+            for (uint8_t j=0; j<4; ++j) {
+                x = scalar[axis][j].apply(x);
+            }
+            maxDiff = fmaxf(maxDiff, fabsf(x - g[axis]));
+        }
+    }
+
+    printf("%-32s %8.1e\n", "  largest difference", maxDiff);
+
+    // Keep the compiler from discarding the work
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+static void benchParser(void)
+{
+    BenchParser parser;
+    parser.begin();
+
+    uint8_t bytes[6] = {0};
+    uint8_t n = hf::MspParser::serialize_ATTITUDE_RADIANS_Request(bytes);
+
+    uint32_t sum = 0;
+
+    double start = nanoseconds();
+
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        for (uint8_t j=0; j<n; ++j) {
+            parser.feed(bytes[j]);
+        }
+        sum += parser.drain();
+    }
+
+    report("MspParser::parse() per message", start, ITERATIONS);
+
+    // Keep the compiler from discarding the work
+    if (sum == 0) {
+        printf("no reply from parser\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    benchHackflight(false);
+    benchHackflight(true);
+    benchDispatch();
+    benchMadgwick();
+    benchGyroFilter();
+    benchParser();
+
+    return 0;
+}
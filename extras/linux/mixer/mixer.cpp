@@ -0,0 +1,669 @@
+/*
+   Self-check and timing for the matrix mixers
+
+   Checks that the matrices the quadcopter mixers now compute from their
+   motor layouts are the tables they used to have, and that the octocopter
+   matrix matches the same geometry worked out with the math library.
+   Runs each of the four mixers on random demands, next to a copy of the
+   mixer the quadcopters had before, which kept its motor directions as
+   integers and shifted the motors down when one went over the top.
+   Checks that the two agree wherever neither had to desaturate, and that
+   the new one keeps every motor in [0,1], keeps the differences between
+   motors that carry roll, pitch, and yaw whenever they fit, and otherwise
+   scales them all by the same amount.  Checks the mix against a plain
+   scalar product, and the fixed-point mix against the floating-point one.
+
+   Then builds a lopsided hexacopter, whose rear arms are longer than the
+   others, and checks that each column of its matrix moves the vehicle
+   about its own axis only, and that the mix keeps the roll, pitch, and yaw
+   moments in proportion to the demand while every motor stays in [0,1].
+   Reports the cycles per mix of old and new.
+
+   Last, runs a mixer against a board that sets all its motors at once and
+   one that only sets them one at a time, through both the abstract Board
+   and the concrete class.  Checks that the first gets a single call per
+   mix and the second one call per motor, with the same values either way,
+   and that nothing is written when the values don't change.  Reports the
+   cycles per mix and write for each, and exits with a nonzero status on
+   any failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mixers/quadxap.hpp"
+#include "mixers/quadxcf.hpp"
+#include "mixers/quadplusap.hpp"
+#include "mixers/octoxap.hpp"
+
+#include "selfcheck.hpp"
+
+static const uint32_t COUNT = 10000;
+
+static const uint32_t ITERATIONS = 1000000;
+
+// Uniform in [lo, hi], repeatable across runs
+static float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+namespace legacy {
+
+    // The mixer as it was: integer directions, converted on every call, and three passes over the motors
+    class Mixer {
+
+        public:
+
+            typedef struct motorMixer_t {
+                int8_t throttle; // T
+                int8_t roll;     // A
+                int8_t pitch;    // E
+                int8_t yaw;      // R
+            } motorMixer_t;
+
+            static const uint8_t MAXMOTORS = 20;
+
+            motorMixer_t motorDirections[MAXMOTORS];
+
+            uint8_t nmotors;
+
+            Mixer(uint8_t _nmotors)
+            {
+                nmotors = _nmotors;
+
+                for (uint8_t i = 0; i < MAXMOTORS; i++) {
+                    motorDirections[i] = {0, 0, 0, 0};
+                }
+            }
+
+            void mix(hf::demands_t demands, float motors[])
+            {
+                // Map throttle demand from [-1,+1] to [0,1]
+                demands.throttle = (demands.throttle + 1) / 2;
+
+                for (uint8_t i = 0; i < nmotors; i++) {
+
+                    motors[i] =
+                        (demands.throttle * motorDirections[i].throttle +
+                         demands.roll     * motorDirections[i].roll +
+                         demands.pitch    * motorDirections[i].pitch +
+                         demands.yaw      * motorDirections[i].yaw);
+                }
+
+                float maxMotor = motors[0];
+
+                for (uint8_t i = 1; i < nmotors; i++)
+                    if (motors[i] > maxMotor)
+                        maxMotor = motors[i];
+
+                for (uint8_t i = 0; i < nmotors; i++) {
+
+                    // This is a way to still have good gyro corrections if at least one motor reaches its max
+                    if (maxMotor > 1) {
+                        motors[i] -= maxMotor - 1;
+                    }
+
+                    // Keep motor values in interval [0,1]
+                    motors[i] = hf::Filter::constrainMinMax(motors[i], 0, 1);
+                }
+            }
+
+    }; // class Mixer
+
+} // namespace legacy
+
+// A hexacopter whose rear pair of arms is half again as long as the others, so the front motors carry more
+class MixerLopsidedHex : public hf::MatrixMixer<6> {
+
+    public:
+
+        static constexpr hf::geometry::motor_t motors[6] = {
+            hf::geometry::motor(  +30, 1.0, hf::geometry::CW),
+            hf::geometry::motor(  +90, 1.0, hf::geometry::CCW),
+            hf::geometry::motor( +150, 1.5, hf::geometry::CW),
+            hf::geometry::motor( -150, 1.5, hf::geometry::CCW),
+            hf::geometry::motor(  -90, 1.0, hf::geometry::CW),
+            hf::geometry::motor(  -30, 1.0, hf::geometry::CCW)
+        };
+
+        MixerLopsidedHex(void)
+        {
+            static constexpr hf::geometry::matrix_t<6> matrix = hf::geometry::matrix(motors);
+
+            setMotorDirections(matrix);
+        }
+};
+
+constexpr hf::geometry::motor_t MixerLopsidedHex::motors[6];
+
+// Counts the calls it gets; sets its motors one at a time unless a subclass says otherwise
+class CountingBoard : public hf::Board {
+
+    friend class hf::Dispatch;
+
+    public:
+
+        float motors[8] = {0};
+        uint32_t singleCalls = 0;
+        uint32_t batchCalls = 0;
+
+    protected:
+
+        virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz) override
+        {
+            (void)qw; (void)qx; (void)qy; (void)qz;
+            return false;
+        }
+
+        virtual bool getGyrometer(float & gx, float & gy, float & gz) override
+        {
+            (void)gx; (void)gy; (void)gz;
+            return false;
+        }
+
+        virtual uint32_t getMicros(void) override
+        {
+            return 0;
+        }
+
+        virtual void writeMotor(uint8_t index, float value) override
+        {
+            motors[index] = value;
+            singleCalls++;
+        }
+};
+
+class SingleBoard : public CountingBoard {
+
+    friend class hf::Dispatch;
+};
+
+class BatchBoard : public CountingBoard {
+
+    friend class hf::Dispatch;
+
+    protected:
+
+        virtual void writeMotors(const float * values, uint8_t count) override
+        {
+            for (uint8_t i=0; i<count; ++i) {
+                motors[i] = values[i];
+            }
+            batchCalls++;
+        }
+};
+
+// Exposes the protected mixing kernels and matrix, and the directions as the old mixer had them
+template <typename MixerT, uint8_t NMOTORS>
+class TestMixer : public MixerT {
+
+    public:
+
+        static const uint8_t MOTORS = NMOTORS;
+
+        using MixerT::mix;
+        using MixerT::mixFixed;
+        using MixerT::runArmed;
+        using MixerT::cutMotors;
+
+        float _throttle[NMOTORS];
+        float _roll[NMOTORS];
+        float _pitch[NMOTORS];
+        float _yaw[NMOTORS];
+
+        legacy::Mixer old = legacy::Mixer(NMOTORS);
+
+        TestMixer(const int8_t directions[][3])
+        {
+            for (uint8_t i=0; i<NMOTORS; ++i) {
+                MixerT::getMotorDirection(i, _throttle[i], _roll[i], _pitch[i], _yaw[i]);
+            }
+
+            for (uint8_t i=0; directions && i<NMOTORS; ++i) {
+                old.motorDirections[i].throttle = +1;
+                old.motorDirections[i].roll = directions[i][0];
+                old.motorDirections[i].pitch = directions[i][1];
+                old.motorDirections[i].yaw = directions[i][2];
+            }
+        }
+};
+
+// The tables the quadcopter mixers used to have
+static const int8_t QUADXAP[4][3]    = { {-1, -1, -1}, {+1, +1, -1}, {+1, -1, +1}, {-1, +1, +1} };
+static const int8_t QUADXCF[4][3]    = { {-1, +1, +1}, {-1, -1, -1}, {+1, +1, -1}, {+1, -1, +1} };
+static const int8_t QUADPLUSAP[4][3] = { { 0, -1, +1}, {-1,  0, -1}, { 0, +1, +1}, {+1,  0, -1} };
+
+// Arm angles and spins of the octocopter, for working out its matrix with the math library
+static const float OCTOXAP_ANGLES[8] = { +22.5, -157.5, +67.5, +157.5, -22.5, -112.5, -67.5, +112.5 };
+static const float OCTOXAP_SPINS[8]  = { +1, +1, -1, -1, -1, -1, +1, +1 };
+
+// Roll, pitch, and yaw for equal arms: the moments themselves, each column scaled to a largest entry of 1
+static void octoDirections(float directions[8][3])
+{
+    float largestRoll = 0, largestPitch = 0;
+
+    for (uint8_t i=0; i<8; ++i) {
+        directions[i][0] = -sin(OCTOXAP_ANGLES[i] * M_PI / 180);
+        directions[i][1] = -cos(OCTOXAP_ANGLES[i] * M_PI / 180);
+        directions[i][2] = OCTOXAP_SPINS[i];
+        largestRoll = fmaxf(largestRoll, fabsf(directions[i][0]));
+        largestPitch = fmaxf(largestPitch, fabsf(directions[i][1]));
+    }
+
+    for (uint8_t i=0; i<8; ++i) {
+        directions[i][0] /= largestRoll;
+        directions[i][1] /= largestPitch;
+    }
+}
+
+static hf::demands_t demands[COUNT];
+
+static void makeDemands(void)
+{
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        // Mostly gentle, sometimes enough to need desaturating at either end of the throttle
+        float reach = (k % 4 == 0) ? 1.0f : 0.25f;
+
+        demands[k].throttle = uniform(-1, +1);
+        demands[k].roll     = uniform(-reach, +reach);
+        demands[k].pitch    = uniform(-reach, +reach);
+        demands[k].yaw      = uniform(-reach, +reach);
+    }
+}
+
+// Times one mixer, and the old one alongside if it has one
+template <typename TestMixerT>
+static void timeMixer(TestMixerT & mixer, bool hasOld)
+{
+    static const uint8_t N = TestMixerT::MOTORS;
+
+    uint64_t bestOld = UINT64_MAX;
+    uint64_t bestNew = UINT64_MAX;
+    float sum = 0;
+
+    for (uint8_t pass=0; pass<5; ++pass) {
+
+        float motors[N];
+
+        uint64_t start = cycles();
+        for (uint32_t k=0; hasOld && k<ITERATIONS; ++k) {
+            mixer.old.mix(demands[k%COUNT], motors);
+            sum += motors[k%N];
+        }
+        uint64_t elapsed = cycles() - start;
+        bestOld = elapsed < bestOld ? elapsed : bestOld;
+
+        start = cycles();
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            mixer.mix(demands[k%COUNT], motors);
+            sum += motors[k%N];
+        }
+        elapsed = cycles() - start;
+        bestNew = elapsed < bestNew ? elapsed : bestNew;
+    }
+
+    if (hasOld) {
+        printf("%-40s %8.1f cycles/mix\n", "Old mixer", (double)bestOld / ITERATIONS);
+    }
+    printf("%-40s %8.1f cycles/mix\n", "Matrix mixer", (double)bestNew / ITERATIONS);
+
+    // Keep the compiler from discarding the work
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+template <typename TestMixerT>
+static void testMixer(const char * name, const float directions[][3], const int8_t table[][3])
+{
+    static const uint8_t N = TestMixerT::MOTORS;
+
+    printf("\n%s\n", name);
+
+    TestMixerT mixer(table);
+
+    char what[100];
+
+    // The matrix computed from the layout, against the table it replaced or the same geometry in libm
+    float worstMatrix = 0;
+    for (uint8_t i=0; i<N; ++i) {
+        worstMatrix = fmaxf(worstMatrix, fabsf(mixer._throttle[i] - 1));
+        worstMatrix = fmaxf(worstMatrix, fabsf(mixer._roll[i] - directions[i][0]));
+        worstMatrix = fmaxf(worstMatrix, fabsf(mixer._pitch[i] - directions[i][1]));
+        worstMatrix = fmaxf(worstMatrix, fabsf(mixer._yaw[i] - directions[i][2]));
+    }
+
+    if (table) {
+        check(worstMatrix == 0, "Matrix from the motor layout is the old table");
+    }
+    else {
+        sprintf(what, "Matrix from the motor layout as computed with libm (%.1e)", worstMatrix);
+        check(worstMatrix < 1e-6f, what);
+    }
+
+    float worstUnsaturated = 0;
+    float worstScalar = 0;
+    float worstFixed = 0;
+    float worstShape = 0;
+    uint32_t unsaturated = 0;
+    uint32_t shifted = 0;
+    uint32_t scaled = 0;
+    bool inRange = true;
+
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        const hf::demands_t & d = demands[k];
+
+        float motors[N];
+        float fixed[N];
+        float old[N];
+        mixer.mix(d, motors);
+        mixer.mixFixed(d, fixed);
+        if (table) {
+            mixer.old.mix(d, old);
+        }
+
+        // Roll, pitch, and yaw for each motor, the plain way
+        float rpy[N];
+        float lo = +1e9, hi = -1e9;
+        for (uint8_t i=0; i<N; ++i) {
+            rpy[i] = d.roll * directions[i][0] + d.pitch * directions[i][1] + d.yaw * directions[i][2];
+            lo = fminf(lo, rpy[i]);
+            hi = fmaxf(hi, rpy[i]);
+        }
+
+        float throttle = (d.throttle + 1) / 2;
+        bool fits = throttle + lo >= 0 && throttle + hi <= 1;
+
+        // Each motor as a scaled, shifted copy of roll, pitch, and yaw
+        float scale = hi - lo > 1 ? 1 / (hi - lo) : 1;
+        float shift = motors[0] - scale * rpy[0];
+
+        for (uint8_t i=0; i<N; ++i) {
+
+            inRange = inRange && motors[i] >= 0 && motors[i] <= 1;
+
+            worstFixed = fmaxf(worstFixed, fabsf(fixed[i] - motors[i]));
+
+            worstShape = fmaxf(worstShape, fabsf(motors[i] - (scale * rpy[i] + shift)));
+
+            if (fits && table) {
+                worstUnsaturated = fmaxf(worstUnsaturated, fabsf(motors[i] - old[i]));
+            }
+
+            if (fits) {
+                worstScalar = fmaxf(worstScalar, fabsf(motors[i] - (throttle + rpy[i])));
+            }
+        }
+
+        unsaturated += fits;
+        shifted += !fits && scale == 1;
+        scaled += scale < 1;
+    }
+
+    printf("%u of %u demands fit, %u needed the throttle moved, %u needed scaling\n",
+            unsaturated, COUNT, shifted, scaled);
+
+    if (table) {
+        sprintf(what, "Same as the old mixer where nothing saturates (%.1e)", worstUnsaturated);
+        check(worstUnsaturated < 1e-6f, what);
+    }
+
+    sprintf(what, "Same as a scalar product (%.1e)", worstScalar);
+    check(worstScalar < 1e-6f, what);
+
+    check(inRange, "Every motor in [0,1]");
+
+    sprintf(what, "Roll, pitch, and yaw kept, or scaled together (%.1e)", worstShape);
+    check(worstShape < 1e-5f, what);
+
+    sprintf(what, "Fixed point within %.1e", worstFixed);
+    check(worstFixed < 1e-5f, what);
+
+    timeMixer(mixer, table != NULL);
+}
+
+// Thrust, roll, pitch, and yaw moments of the motor speeds, worked out with libm
+template <uint8_t N>
+static void moments(const hf::geometry::motor_t motors[N], const float speeds[N], double out[4])
+{
+    for (uint8_t row=0; row<4; ++row) {
+        out[row] = 0;
+    }
+
+    for (uint8_t i=0; i<N; ++i) {
+        const hf::geometry::motor_t & m = motors[i];
+        out[0] += m.thrust * speeds[i];
+        out[1] -= m.thrust * m.arm * sin(m.angle * M_PI / 180) * speeds[i];
+        out[2] -= m.thrust * m.arm * cos(m.angle * M_PI / 180) * speeds[i];
+        out[3] += m.spin * m.torque * speeds[i];
+    }
+}
+
+static void testLopsided(void)
+{
+    static const uint8_t N = 6;
+
+    printf("\nLopsided hexacopter\n");
+
+    TestMixer<MixerLopsidedHex, N> mixer(NULL);
+
+    const hf::geometry::motor_t * layout = MixerLopsidedHex::motors;
+
+    const float * columns[4] = { mixer._throttle, mixer._roll, mixer._pitch, mixer._yaw };
+
+    // Each column should move the vehicle about its own axis and no other
+    double worstCross = 0;
+    for (uint8_t c=0; c<4; ++c) {
+        double m[4] = {0};
+        moments<N>(layout, columns[c], m);
+        for (uint8_t row=0; row<4; ++row) {
+            if (row != c) {
+                worstCross = fmax(worstCross, fabs(m[row] / m[c]));
+            }
+        }
+    }
+
+    float least = 1;
+    for (uint8_t i=0; i<N; ++i) {
+        least = fminf(least, mixer._throttle[i]);
+    }
+
+    char what[100];
+
+    sprintf(what, "Rear motors take %.2f of the throttle", least);
+    check(least < 0.9f, what);
+
+    sprintf(what, "Each column moves only its own axis (%.1e)", worstCross);
+    check(worstCross < 1e-6, what);
+
+    float worstScalar = 0;
+    float worstFixed = 0;
+    double worstMoments = 0;
+    uint32_t unsaturated = 0;
+    bool inRange = true;
+
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        const hf::demands_t & d = demands[k];
+
+        float motors[N];
+        float fixed[N];
+        mixer.mix(d, motors);
+        mixer.mixFixed(d, fixed);
+
+        float rpy[N];
+        float throttle = (d.throttle + 1) / 2;
+        bool fits = true;
+        for (uint8_t i=0; i<N; ++i) {
+            rpy[i] = d.roll * mixer._roll[i] + d.pitch * mixer._pitch[i] + d.yaw * mixer._yaw[i];
+            float motor = throttle * mixer._throttle[i] + rpy[i];
+            fits = fits && motor >= 0 && motor <= 1;
+        }
+
+        for (uint8_t i=0; i<N; ++i) {
+            inRange = inRange && motors[i] >= 0 && motors[i] <= 1;
+            worstFixed = fmaxf(worstFixed, fabsf(fixed[i] - motors[i]));
+            if (fits) {
+                worstScalar = fmaxf(worstScalar, fabsf(motors[i] - (throttle * mixer._throttle[i] + rpy[i])));
+            }
+        }
+
+        unsaturated += fits;
+
+        // Roll, pitch, and yaw moments made, against those demanded, should differ only by a factor in [0,1]
+        double made[4] = {0};
+        double wanted[4] = {0};
+        moments<N>(layout, motors, made);
+        moments<N>(layout, rpy, wanted);
+
+        double dot = 0, norm = 0;
+        for (uint8_t row=1; row<4; ++row) {
+            dot += made[row] * wanted[row];
+            norm += wanted[row] * wanted[row];
+        }
+
+        double scale = norm > 0 ? dot / norm : 1;
+        worstMoments = fmax(worstMoments, scale > 1 + 1e-5 || scale < 0 ? 1 : 0);
+        for (uint8_t row=1; row<4; ++row) {
+            worstMoments = fmax(worstMoments, fabs(made[row] - scale * wanted[row]));
+        }
+    }
+
+    printf("%u of %u demands fit\n", unsaturated, COUNT);
+
+    sprintf(what, "Same as a scalar product (%.1e)", worstScalar);
+    check(worstScalar < 1e-6f, what);
+
+    check(inRange, "Every motor in [0,1]");
+
+    sprintf(what, "Roll, pitch, and yaw moments kept, or scaled together (%.1e)", worstMoments);
+    check(worstMoments < 1e-5, what);
+
+    sprintf(what, "Fixed point within %.1e", worstFixed);
+    check(worstFixed < 1e-5f, what);
+
+    timeMixer(mixer, false);
+}
+
+// Runs the mixer on every demand through the given type of board pointer, and checks what the board got
+template <typename BoardPointerT, typename BoardT>
+static void testWrites(const char * name, BoardT & board, bool batched)
+{
+    static const uint8_t N = 4;
+
+    TestMixer<hf::MixerQuadXAP, N> mixer(NULL);
+
+    BoardPointerT pointer = &board;
+
+    bool same = true;
+
+    for (uint32_t k=0; k<COUNT; ++k) {
+        float motors[N];
+        mixer.mix(demands[k], motors);
+        mixer.runArmed(pointer, demands[k]);
+        for (uint8_t i=0; i<N; ++i) {
+            same = same && board.motors[i] == motors[i];
+        }
+    }
+
+    uint32_t singleCalls = board.singleCalls;
+    uint32_t batchCalls = board.batchCalls;
+
+    // Again with the last demand, which shouldn't write anything
+    mixer.runArmed(pointer, demands[COUNT-1]);
+    bool repeated = board.singleCalls == singleCalls && board.batchCalls == batchCalls;
+
+    mixer.cutMotors(pointer);
+    bool cut = true;
+    for (uint8_t i=0; i<N; ++i) {
+        cut = cut && board.motors[i] == 0;
+    }
+
+    char what[100];
+
+    sprintf(what, "%s: motors get the mix", name);
+    check(same, what);
+
+    sprintf(what, "  %s", batched ? "one call per mix" : "one call per motor");
+    check(batched ? batchCalls == COUNT && singleCalls == 0 : singleCalls == N*COUNT && batchCalls == 0, what);
+
+    check(repeated, "  nothing written when nothing changes");
+
+    check(cut, "  cutMotors() stops them all");
+
+    // Timing, best of five; alternating demands so that every mix writes
+    uint64_t best = UINT64_MAX;
+    for (uint8_t pass=0; pass<5; ++pass) {
+        uint64_t start = cycles();
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            mixer.runArmed(pointer, demands[k%COUNT]);
+        }
+        uint64_t elapsed = cycles() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+
+    printf("%-40s %8.1f cycles/mix\n", "  mix and write", (double)best / ITERATIONS);
+}
+
+static void testMotorWrites(void)
+{
+    printf("\nMotor writes\n");
+
+    SingleBoard single1, single2;
+    BatchBoard batch1, batch2;
+
+    testWrites<hf::Board *>("Board, one motor at a time", single1, false);
+    testWrites<hf::Board *>("Board, all motors at once", batch1, true);
+    testWrites<SingleBoard *>("SingleBoard, one motor at a time", single2, false);
+    testWrites<BatchBoard *>("BatchBoard, all motors at once", batch2, true);
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    makeDemands();
+
+    float quadxap[4][3], quadxcf[4][3], quadplusap[4][3], octoxap[8][3];
+    for (uint8_t i=0; i<4; ++i) {
+        for (uint8_t j=0; j<3; ++j) {
+            quadxap[i][j] = QUADXAP[i][j];
+            quadxcf[i][j] = QUADXCF[i][j];
+            quadplusap[i][j] = QUADPLUSAP[i][j];
+        }
+    }
+    octoDirections(octoxap);
+
+    testMixer<TestMixer<hf::MixerQuadXAP, 4>>("MixerQuadXAP", quadxap, QUADXAP);
+    testMixer<TestMixer<hf::MixerQuadXCF, 4>>("MixerQuadXCF", quadxcf, QUADXCF);
+    testMixer<TestMixer<hf::MixerQuadPlusAP, 4>>("MixerQuadPlusAP", quadplusap, QUADPLUSAP);
+    testMixer<TestMixer<hf::MixerOctoXAP, 8>>("MixerOctoXAP", octoxap, NULL);
+
+    testLopsided();
+
+    testMotorWrites();
+
+    return finish();
+}
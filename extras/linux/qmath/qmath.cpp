@@ -0,0 +1,909 @@
+/*
+   Accuracy and cost of the qmath kernels and the filters built on them
+
+   Checks every qmath variant that this machine can run -- scalar, dsp,
+   and sse or neon -- against a double-precision reference, checks that
+   rotate() and toRotationMatrix() agree with q v q*, and checks the error
+   of fastRsqrt().  Then runs the Madgwick and Mahony quaternion filters
+   and the optical-flow EKF's attitude update next to copies of the code
+   they replaced, on the same simulated IMU stream, and reports how far
+   apart the attitudes are and the cycles per update for each.  Build
+   with HACKFLIGHT_FAST_RSQRT defined (the qmath_fast target) to see the
+   fast reciprocal square root in the filters.  Exits with a nonzero
+   status if any difference is out of bounds.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "qmath.hpp"
+#include "filters.hpp"
+
+#include "selfcheck.hpp"
+
+using hf::qmath::quaternion_t;
+
+static const uint32_t ITERATIONS = 1000000;
+
+// Uniform in [lo, hi], repeatable across runs
+static float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+static quaternion_t randomQuaternion(void)
+{
+    quaternion_t q = {uniform(-1, +1), uniform(-1, +1), uniform(-1, +1), uniform(-1, +1)};
+    return q;
+}
+
+// Angle in degrees between the attitudes two quaternions represent, whatever their lengths
+static double angleBetween(double aw, double ax, double ay, double az, double bw, double bx, double by, double bz)
+{
+    double dot = aw * bw + ax * bx + ay * by + az * bz;
+    double norms = sqrt((aw * aw + ax * ax + ay * ay + az * az) * (bw * bw + bx * bx + by * by + bz * bz));
+    double c = fabs(dot) / norms;
+    return 2 * acos(c > 1 ? 1 : c) * 180 / M_PI;
+}
+
+// The same kernels from one namespace, so that each variant can be tested and timed the same way
+#define VARIANT(NAME)                                                                               \
+    struct NAME {                                                                                   \
+        static const char * name(void) { return #NAME; }                                            \
+        static quaternion_t multiply(const quaternion_t & a, const quaternion_t & b)                \
+        {                                                                                           \
+            return hf::qmath::NAME::multiply(a, b);                                                 \
+        }                                                                                           \
+        static quaternion_t rate(const quaternion_t & q, float gx, float gy, float gz)              \
+        {                                                                                           \
+            return hf::qmath::NAME::rate(q, gx, gy, gz);                                            \
+        }                                                                                           \
+        static bool normalize(quaternion_t & q)                                                     \
+        {                                                                                           \
+            return hf::qmath::NAME::normalize(q);                                                   \
+        }                                                                                           \
+    };
+
+namespace variants {
+
+    VARIANT(scalar)
+    VARIANT(dsp)
+#if defined(__SSE__)
+    VARIANT(sse)
+#endif
+#if defined(__ARM_NEON)
+    VARIANT(neon)
+#endif
+
+} // namespace variants
+
+template <typename V>
+static void testVariant(void)
+{
+    static const uint32_t COUNT = 10000;
+
+    printf("\n%s\n", V::name());
+
+    double multiplyError = 0;
+    double rateError = 0;
+    double normalizeError = 0;
+
+    for (uint32_t k=0; k<COUNT; ++k) {
+
+        quaternion_t a = randomQuaternion();
+        quaternion_t b = randomQuaternion();
+
+        // Hamilton product in double
+        double rw = (double)a.w * b.w - (double)a.x * b.x - (double)a.y * b.y - (double)a.z * b.z;
+        double rx = (double)a.w * b.x + (double)a.x * b.w + (double)a.y * b.z - (double)a.z * b.y;
+        double ry = (double)a.w * b.y - (double)a.x * b.z + (double)a.y * b.w + (double)a.z * b.x;
+        double rz = (double)a.w * b.z + (double)a.x * b.y - (double)a.y * b.x + (double)a.z * b.w;
+
+        quaternion_t r = V::multiply(a, b);
+        multiplyError = fmax(multiplyError, fmax(fmax(fabs(r.w - rw), fabs(r.x - rx)), fmax(fabs(r.y - ry), fabs(r.z - rz))));
+
+        // Rate is half the product with (0, g)
+        quaternion_t g = {0, b.x, b.y, b.z};
+        quaternion_t qdot = V::rate(a, b.x, b.y, b.z);
+        quaternion_t product = hf::qmath::scalar::multiply(a, g);
+        rateError = fmax(rateError, fmax(fmax(fabs(qdot.w - product.w / 2), fabs(qdot.x - product.x / 2)),
+                                         fmax(fabs(qdot.y - product.y / 2), fabs(qdot.z - product.z / 2))));
+
+        double norm = sqrt((double)a.w * a.w + (double)a.x * a.x + (double)a.y * a.y + (double)a.z * a.z);
+        quaternion_t n = a;
+        V::normalize(n);
+        normalizeError = fmax(normalizeError, fmax(fmax(fabs(n.w - a.w / norm), fabs(n.x - a.x / norm)),
+                                                   fmax(fabs(n.y - a.y / norm), fabs(n.z - a.z / norm))));
+    }
+
+    char what[100];
+
+    sprintf(what, "  multiply()  max error %.2e", multiplyError);
+    check(multiplyError < 1e-6, what);
+
+    sprintf(what, "  rate()      max error %.2e", rateError);
+    check(rateError < 1e-6, what);
+
+    sprintf(what, "  normalize() max error %.2e", normalizeError);
+    check(normalizeError < 1e-5, what);
+
+    quaternion_t zero = {0, 0, 0, 0};
+    check(!V::normalize(zero) && zero.w == 0, "  normalize() refuses a zero quaternion");
+
+    // Cost per call, on a stream of inputs so that the loop can't be hoisted
+    static const uint32_t N = 1024;
+    static quaternion_t qs[N];
+    for (uint32_t k=0; k<N; ++k) {
+        qs[k] = randomQuaternion();
+    }
+
+    quaternion_t acc = {1, 0, 0, 0};
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        acc = V::multiply(qs[k%N], acc);
+        acc.w *= 0.5f;
+    }
+    double multiplyCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        quaternion_t q = qs[k%N];
+        V::normalize(q);
+        acc.x += q.x;
+    }
+    double normalizeCycles = (double)(cycles() - start) / ITERATIONS;
+
+    printf("  %.1f cycles per multiply(), %.1f per normalize()\n", multiplyCycles, normalizeCycles);
+
+    // Keep the compiler from discarding the work
+    if (acc.x + acc.w > 1e30) {
+        printf("%f\n", acc.x);
+    }
+}
+
+static void testRotation(void)
+{
+    printf("\nRotation\n");
+
+    double rotateError = 0;
+    double matrixError = 0;
+
+    for (uint32_t k=0; k<10000; ++k) {
+
+        quaternion_t q = randomQuaternion();
+        hf::qmath::scalar::normalize(q);
+
+        float v[3] = {uniform(-10, +10), uniform(-10, +10), uniform(-10, +10)};
+
+        // q v q*, the long way
+        quaternion_t qv = {0, v[0], v[1], v[2]};
+        quaternion_t qconj = {q.w, -q.x, -q.y, -q.z};
+        quaternion_t expected = hf::qmath::scalar::multiply(hf::qmath::scalar::multiply(q, qv), qconj);
+
+        float out[3];
+        hf::qmath::rotate(q, v, out);
+
+        float R[3][3];
+        hf::qmath::toRotationMatrix(q, R);
+
+        float e[3] = {expected.x, expected.y, expected.z};
+
+        for (uint8_t i=0; i<3; ++i) {
+            rotateError = fmax(rotateError, fabs(out[i] - e[i]));
+            matrixError = fmax(matrixError, fabs(R[i][0] * v[0] + R[i][1] * v[1] + R[i][2] * v[2] - e[i]));
+        }
+    }
+
+    char what[100];
+
+    sprintf(what, "  rotate() matches q v q*, max error %.2e", rotateError);
+    check(rotateError < 1e-4, what);
+
+    sprintf(what, "  toRotationMatrix() matches q v q*, max error %.2e", matrixError);
+    check(matrixError < 1e-4, what);
+}
+
+static void testRsqrt(void)
+{
+    printf("\nReciprocal square root\n");
+
+    double worst = 0;
+
+    // Every binade from 1e-6 to 1e6
+    for (float x=1e-6f; x<1e6f; x*=1.0001f) {
+        double exact = 1 / sqrt((double)x);
+        worst = fmax(worst, fabs(hf::qmath::fastRsqrt(x) - exact) / exact);
+    }
+
+    char what[100];
+    sprintf(what, "  fastRsqrt() max relative error %.2e", worst);
+    check(worst < 5e-6, what);
+
+    static const uint32_t N = 1024;
+    static float xs[N];
+    for (uint32_t k=0; k<N; ++k) {
+        xs[k] = uniform(0.5f, 2);
+    }
+
+    float sum = 0;
+
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        sum += 1.0f / sqrtf(xs[k%N]);
+    }
+    double exactCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        sum += hf::qmath::fastRsqrt(xs[k%N]);
+    }
+    double fastCycles = (double)(cycles() - start) / ITERATIONS;
+
+    printf("  %.1f cycles per 1/sqrtf(), %.1f per fastRsqrt()\n", exactCycles, fastCycles);
+
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+// The filters as they were before qmath, for comparison
+namespace legacy {
+
+    class MadgwickQuaternionFilter9DOF {
+
+        private:
+
+            float _beta = 0;
+
+        public:
+
+            float q1 = 1;
+            float q2 = 0;
+            float q3 = 0;
+            float q4 = 0;
+
+            MadgwickQuaternionFilter9DOF(float beta)
+            {
+                _beta = beta;
+            }
+
+            void update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float deltat)
+            {
+                float norm;
+                float hx, hy, _2bx, _2bz;
+                float s1, s2, s3, s4;
+                float qDot1, qDot2, qDot3, qDot4;
+
+                // Auxiliary variables to avoid repeated arithmetic
+                float _2q1mx;
+                float _2q1my;
+                float _2q1mz;
+                float _2q2mx;
+                float _4bx;
+                float _4bz;
+                float _2q1 = 2.0f * q1;
+                float _2q2 = 2.0f * q2;
+                float _2q3 = 2.0f * q3;
+                float _2q4 = 2.0f * q4;
+                float _2q1q3 = 2.0f * q1 * q3;
+                float _2q3q4 = 2.0f * q3 * q4;
+                float q1q1 = q1 * q1;
+                float q1q2 = q1 * q2;
+                float q1q3 = q1 * q3;
+                float q1q4 = q1 * q4;
+                float q2q2 = q2 * q2;
+                float q2q3 = q2 * q3;
+                float q2q4 = q2 * q4;
+                float q3q3 = q3 * q3;
+                float q3q4 = q3 * q4;
+                float q4q4 = q4 * q4;
+
+                // Normalise accelerometer measurement
+                norm = sqrtf(ax * ax + ay * ay + az * az);
+                if (norm == 0.0f) return; // handle NaN
+                norm = 1.0f/norm;
+                ax *= norm;
+                ay *= norm;
+                az *= norm;
+
+                // Normalise magnetometer measurement
+                norm = sqrtf(mx * mx + my * my + mz * mz);
+                if (norm == 0.0f) return; // handle NaN
+                norm = 1.0f/norm;
+                mx *= norm;
+                my *= norm;
+                mz *= norm;
+
+                // Reference direction of Earth's magnetic field
+                _2q1mx = 2.0f * q1 * mx;
+                _2q1my = 2.0f * q1 * my;
+                _2q1mz = 2.0f * q1 * mz;
+                _2q2mx = 2.0f * q2 * mx;
+                hx = mx * q1q1 - _2q1my * q4 + _2q1mz * q3 + mx * q2q2 + _2q2 * my * q3 + _2q2 * mz * q4 - mx * q3q3 - mx * q4q4;
+                hy = _2q1mx * q4 + my * q1q1 - _2q1mz * q2 + _2q2mx * q3 - my * q2q2 + my * q3q3 + _2q3 * mz * q4 - my * q4q4;
+                _2bx = sqrtf(hx * hx + hy * hy);
+                _2bz = -_2q1mx * q3 + _2q1my * q2 + mz * q1q1 + _2q2mx * q4 - mz * q2q2 + _2q3 * my * q4 - mz * q3q3 + mz * q4q4;
+                _4bx = 2.0f * _2bx;
+                _4bz = 2.0f * _2bz;
+
+                // Gradient decent algorithm corrective step
+                s1 = -_2q3 * (2.0f * q2q4 - _2q1q3 - ax) + 
+                    _2q2 * (2.0f * q1q2 + _2q3q4 - ay) - 
+                    _2bz * q3 * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + 
+                    (-_2bx * q4 + _2bz * q2) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + 
+                    _2bx * q3 * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+                s2 = _2q4 * (2.0f * q2q4 - _2q1q3 - ax) + 
+                    _2q1 * (2.0f * q1q2 + _2q3q4 - ay) - 
+                    4.0f * q2 * (1.0f - 2.0f * q2q2 - 2.0f * q3q3 - az) + 
+                    _2bz * q4 * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + 
+                    (_2bx * q3 + _2bz * q1) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + 
+                    (_2bx * q4 - _4bz * q2) * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+                s3 = -_2q1 * (2.0f * q2q4 - _2q1q3 - ax) + 
+                    _2q4 * (2.0f * q1q2 + _2q3q4 - ay) - 
+                    4.0f * q3 * (1.0f - 2.0f * q2q2 - 2.0f * q3q3 - az) + 
+                    (-_4bx * q3 - _2bz * q1) * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + 
+                    (_2bx * q2 + _2bz * q4) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + 
+                    (_2bx * q1 - _4bz * q3) * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+                s4 = _2q2 * (2.0f * q2q4 - _2q1q3 - ax) + 
+                    _2q3 * (2.0f * q1q2 + _2q3q4 - ay) + 
+                    (-_4bx * q4 + _2bz * q2) * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + 
+                    (-_2bx * q1 + _2bz * q3) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + 
+                    _2bx * q2 * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+
+                // Normalize step magnitude
+                norm = sqrtf(s1 * s1 + s2 * s2 + s3 * s3 + s4 * s4);    
+                norm = 1.0f/norm;
+                s1 *= norm;
+                s2 *= norm;
+                s3 *= norm;
+                s4 *= norm;
+
+                // Compute rate of change of quaternion
+                qDot1 = 0.5f * (-q2 * gx - q3 * gy - q4 * gz) - _beta * s1;
+                qDot2 = 0.5f * (q1 * gx + q3 * gz - q4 * gy) - _beta * s2;
+                qDot3 = 0.5f * (q1 * gy - q2 * gz + q4 * gx) - _beta * s3;
+                qDot4 = 0.5f * (q1 * gz + q2 * gy - q3 * gx) - _beta * s4;
+
+                // Integrate to yield quaternion
+                q1 += qDot1 * deltat;
+                q2 += qDot2 * deltat;
+                q3 += qDot3 * deltat;
+                q4 += qDot4 * deltat;
+                norm = sqrtf(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);    // normalise quaternion
+                norm = 1.0f/norm;
+            }
+
+    }; // class MadgwickQuaternionFilter9DOF
+
+    class MadgwickQuaternionFilter6DOF {
+
+        private:
+
+            float _beta = 0;
+            float _zeta = 0;
+
+        public:
+
+            float q1 = 1;
+            float q2 = 0;
+            float q3 = 0;
+            float q4 = 0;
+
+            MadgwickQuaternionFilter6DOF(float beta, float zeta)
+            {
+                _beta = beta;
+                _zeta = zeta;
+            }
+
+            void update(float ax, float ay, float az, float gx, float gy, float gz, float deltat)
+            {
+                static float gbiasx, gbiasy, gbiasz;        // gyro bias error
+
+                // Auxiliary variables to avoid repeated arithmetic
+                float _halfq1 = 0.5f * q1;
+                float _halfq2 = 0.5f * q2;
+                float _halfq3 = 0.5f * q3;
+                float _halfq4 = 0.5f * q4;
+                float _2q1 = 2.0f * q1;
+                float _2q2 = 2.0f * q2;
+                float _2q3 = 2.0f * q3;
+                float _2q4 = 2.0f * q4;
+                //float _2q1q3 = 2.0f * q1 * q3;
+                //float _2q3q4 = 2.0f * q3 * q4;
+
+                // Normalise accelerometer measurement
+                float norm = sqrt(ax * ax + ay * ay + az * az);
+                if (norm == 0.0f) return; // handle NaN
+                norm = 1.0f/norm;
+                ax *= norm;
+                ay *= norm;
+                az *= norm;
+
+                // Compute the objective function and Jacobian
+                float f1 = _2q2 * q4 - _2q1 * q3 - ax;
+                float f2 = _2q1 * q2 + _2q3 * q4 - ay;
+                float f3 = 1.0f - _2q2 * q2 - _2q3 * q3 - az;
+                float J_11or24 = _2q3;
+                float J_12or23 = _2q4;
+                float J_13or22 = _2q1;
+                float J_14or21 = _2q2;
+                float J_32 = 2.0f * J_14or21;
+                float J_33 = 2.0f * J_11or24;
+
+                // Compute the gradient (matrix multiplication)
+                float hatDot1 = J_14or21 * f2 - J_11or24 * f1;
+                float hatDot2 = J_12or23 * f1 + J_13or22 * f2 - J_32 * f3;
+                float hatDot3 = J_12or23 * f2 - J_33 *f3 - J_13or22 * f1;
+                float hatDot4 = J_14or21 * f1 + J_11or24 * f2;
+
+                // Normalize the gradient
+                norm = sqrt(hatDot1 * hatDot1 + hatDot2 * hatDot2 + hatDot3 * hatDot3 + hatDot4 * hatDot4);
+                hatDot1 /= norm;
+                hatDot2 /= norm;
+                hatDot3 /= norm;
+                hatDot4 /= norm;
+
+                // Compute estimated gyroscope biases
+                float gerrx = _2q1 * hatDot2 - _2q2 * hatDot1 - _2q3 * hatDot4 + _2q4 * hatDot3;
+                float gerry = _2q1 * hatDot3 + _2q2 * hatDot4 - _2q3 * hatDot1 - _2q4 * hatDot2;
+                float gerrz = _2q1 * hatDot4 - _2q2 * hatDot3 + _2q3 * hatDot2 - _2q4 * hatDot1;
+
+                // Compute and remove gyroscope biases
+                gbiasx += gerrx * deltat * _zeta;
+                gbiasy += gerry * deltat * _zeta;
+                gbiasz += gerrz * deltat * _zeta;
+                gx -= gbiasx;
+                gy -= gbiasy;
+                gz -= gbiasz;
+
+                // Compute the quaternion derivative
+                float qDot1 = -_halfq2 * gx - _halfq3 * gy - _halfq4 * gz;
+                float qDot2 =  _halfq1 * gx + _halfq3 * gz - _halfq4 * gy;
+                float qDot3 =  _halfq1 * gy - _halfq2 * gz + _halfq4 * gx;
+                float qDot4 =  _halfq1 * gz + _halfq2 * gy - _halfq3 * gx;
+
+                // Compute then integrate estimated quaternion derivative
+                q1 += (qDot1 -(_beta * hatDot1)) * deltat;
+                q2 += (qDot2 -(_beta * hatDot2)) * deltat;
+                q3 += (qDot3 -(_beta * hatDot3)) * deltat;
+                q4 += (qDot4 -(_beta * hatDot4)) * deltat;
+
+                // Normalize the quaternion
+                norm = sqrt(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);    // normalise quaternion
+                norm = 1.0f/norm;
+                q1 *= norm;
+                q2 *= norm;
+                q3 *= norm;
+                q4 *= norm;
+            }
+
+    }; // class MadgwickQuaternionFilter6DOF
+
+    class MahonyQuaternionFilter9DOF {
+
+        private:
+
+            const float Kp  = 2.0f * 5.0f;
+            const float Ki = 0.0f;
+
+            float _eInt[3] = {0};
+
+        public:
+
+            float q1 = 1;
+            float q2 = 0;
+            float q3 = 0;
+            float q4 = 0;
+
+            void update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float deltat)
+            {
+                float norm;
+                float hx, hy, bx, bz;
+                float vx, vy, vz, wx, wy, wz;
+                float ex, ey, ez;
+                float pa, pb, pc;
+
+                // Auxiliary variables to avoid repeated arithmetic
+                float q1q1 = q1 * q1;
+                float q1q2 = q1 * q2;
+                float q1q3 = q1 * q3;
+                float q1q4 = q1 * q4;
+                float q2q2 = q2 * q2;
+                float q2q3 = q2 * q3;
+                float q2q4 = q2 * q4;
+                float q3q3 = q3 * q3;
+                float q3q4 = q3 * q4;
+                float q4q4 = q4 * q4;   
+
+                // Normalise accelerometer measurement
+                norm = sqrtf(ax * ax + ay * ay + az * az);
+                if (norm == 0.0f) return; // handle NaN
+                norm = 1.0f / norm;        // use reciprocal for division
+                ax *= norm;
+                ay *= norm;
+                az *= norm;
+
+                // Normalise magnetometer measurement
+                norm = sqrtf(mx * mx + my * my + mz * mz);
+                if (norm == 0.0f) return; // handle NaN
+                norm = 1.0f / norm;        // use reciprocal for division
+                mx *= norm;
+                my *= norm;
+                mz *= norm;
+
+                // Reference direction of Earth's magnetic field
+                hx = 2.0f * mx * (0.5f - q3q3 - q4q4) + 2.0f * my * (q2q3 - q1q4) + 2.0f * mz * (q2q4 + q1q3);
+                hy = 2.0f * mx * (q2q3 + q1q4) + 2.0f * my * (0.5f - q2q2 - q4q4) + 2.0f * mz * (q3q4 - q1q2);
+                bx = sqrtf((hx * hx) + (hy * hy));
+                bz = 2.0f * mx * (q2q4 - q1q3) + 2.0f * my * (q3q4 + q1q2) + 2.0f * mz * (0.5f - q2q2 - q3q3);
+
+                // Estimated direction of gravity and magnetic field
+                vx = 2.0f * (q2q4 - q1q3);
+                vy = 2.0f * (q1q2 + q3q4);
+                vz = q1q1 - q2q2 - q3q3 + q4q4;
+                wx = 2.0f * bx * (0.5f - q3q3 - q4q4) + 2.0f * bz * (q2q4 - q1q3);
+                wy = 2.0f * bx * (q2q3 - q1q4) + 2.0f * bz * (q1q2 + q3q4);
+                wz = 2.0f * bx * (q1q3 + q2q4) + 2.0f * bz * (0.5f - q2q2 - q3q3);  
+
+                // Error is cross product between estimated direction and measured direction of gravity
+                ex = (ay * vz - az * vy) + (my * wz - mz * wy);
+                ey = (az * vx - ax * vz) + (mz * wx - mx * wz);
+                ez = (ax * vy - ay * vx) + (mx * wy - my * wx);
+                if (Ki > 0.0f)
+                {
+                    _eInt[0] += ex;      // accumulate integral error
+                    _eInt[1] += ey;
+                    _eInt[2] += ez;
+                }
+                else
+                {
+                    _eInt[0] = 0.0f;     // prevent integral wind up
+                    _eInt[1] = 0.0f;
+                    _eInt[2] = 0.0f;
+                }
+
+                // Apply feedback terms
+                gx = gx + Kp * ex + Ki * _eInt[0];
+                gy = gy + Kp * ey + Ki * _eInt[1];
+                gz = gz + Kp * ez + Ki * _eInt[2];
+
+                // Integrate rate of change of quaternion
+                pa = q2;
+                pb = q3;
+                pc = q4;
+                q1 = q1 + (-q2 * gx - q3 * gy - q4 * gz) * (0.5f * deltat);
+                q2 = pa + (q1 * gx + pb * gz - pc * gy) * (0.5f * deltat);
+                q3 = pb + (q1 * gy - pa * gz + pc * gx) * (0.5f * deltat);
+                q4 = pc + (q1 * gz + pa * gy - pb * gx) * (0.5f * deltat);
+
+                // Normalise quaternion
+                norm = sqrtf(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);
+                norm = 1.0f / norm;
+                q1 *= norm;
+                q2 *= norm;
+                q3 *= norm;
+                q4 *= norm;
+            }
+
+    }; // class MahonyQuaternionFilter9DOF
+
+    // The attitude update at the end of the optical-flow EKF's finalization step
+    static void ekfAttitude(float q[4], float v0, float v1, float v2, float R[3][3])
+    {
+        float angle = sqrt(v0*v0 + v1*v1 + v2*v2);
+        float ca = cos(angle / 2.0f);
+        float sa = sin(angle / 2.0f);
+        float dq[4] = {ca, sa * v0 / angle, sa * v1 / angle, sa * v2 / angle};
+
+        float tmpq0 = dq[0] * q[0] - dq[1] * q[1] - dq[2] * q[2] - dq[3] * q[3];
+        float tmpq1 = dq[1] * q[0] + dq[0] * q[1] + dq[3] * q[2] - dq[2] * q[3];
+        float tmpq2 = dq[2] * q[0] - dq[3] * q[1] + dq[0] * q[2] + dq[1] * q[3];
+        float tmpq3 = dq[3] * q[0] + dq[2] * q[1] - dq[1] * q[2] + dq[0] * q[3];
+
+        float norm = sqrt(tmpq0 * tmpq0 + tmpq1 * tmpq1 + tmpq2 * tmpq2 + tmpq3 * tmpq3);
+        q[0] = tmpq0 / norm;
+        q[1] = tmpq1 / norm;
+        q[2] = tmpq2 / norm;
+        q[3] = tmpq3 / norm;
+
+        R[0][0] = q[0] * q[0] + q[1] * q[1] - q[2] * q[2] - q[3] * q[3];
+        R[0][1] = 2 * q[1] * q[2] - 2 * q[0] * q[3];
+        R[0][2] = 2 * q[1] * q[3] + 2 * q[0] * q[2];
+
+        R[1][0] = 2 * q[1] * q[2] + 2 * q[0] * q[3];
+        R[1][1] = q[0] * q[0] - q[1] * q[1] + q[2] * q[2] - q[3] * q[3];
+        R[1][2] = 2 * q[2] * q[3] - 2 * q[0] * q[1];
+
+        R[2][0] = 2 * q[1] * q[3] - 2 * q[0] * q[2];
+        R[2][1] = 2 * q[2] * q[3] + 2 * q[0] * q[1];
+        R[2][2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+    }
+
+} // namespace legacy
+
+// Simulated IMU stream: a vehicle rocking about all three axes, with gravity and the Earth's field
+// seen in the body frame
+static const float DT = 0.002f;
+static const uint32_t SAMPLES = 10000;
+
+typedef struct {
+
+    float a[3];
+    float g[3];
+    float m[3];
+    double q[4];    // true attitude
+
+} sample_t;
+
+// v in the body frame, q* v q, for the attitude q
+static void toBody(const double q[4], const double v[3], float out[3])
+{
+    double w = q[0], x = -q[1], y = -q[2], z = -q[3];
+
+    double tx = 2 * (y * v[2] - z * v[1]);
+    double ty = 2 * (z * v[0] - x * v[2]);
+    double tz = 2 * (x * v[1] - y * v[0]);
+
+    out[0] = v[0] + w * tx + y * tz - z * ty;
+    out[1] = v[1] + w * ty + z * tx - x * tz;
+    out[2] = v[2] + w * tz + x * ty - y * tx;
+}
+
+static void simulate(sample_t samples[])
+{
+    static const double GRAVITY[3] = {0, 0, 1};
+    static const double FIELD[3] = {cos(M_PI / 3), 0, sin(M_PI / 3)};
+
+    double q[4] = {1, 0, 0, 0};
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        double t = k * DT;
+
+        double g[3] = {0.8 * sin(2 * M_PI * 0.5 * t), 0.6 * sin(2 * M_PI * 0.3 * t + 1), 0.4 * sin(2 * M_PI * 0.2 * t + 2)};
+
+        sample_t & s = samples[k];
+
+        toBody(q, GRAVITY, s.a);
+        toBody(q, FIELD, s.m);
+
+        for (uint8_t i=0; i<3; ++i) {
+            s.a[i] += uniform(-0.01f, +0.01f);
+            s.m[i] += uniform(-0.01f, +0.01f);
+            s.g[i] = g[i] + uniform(-0.01f, +0.01f);
+            s.q[i] = q[i];
+        }
+        s.q[3] = q[3];
+
+        // Integrate qdot = q (0, g) / 2
+        double qw = q[0], qx = q[1], qy = q[2], qz = q[3];
+        double h = DT / 2;
+        q[0] = qw + h * (-qx * g[0] - qy * g[1] - qz * g[2]);
+        q[1] = qx + h * ( qw * g[0] + qy * g[2] - qz * g[1]);
+        q[2] = qy + h * ( qw * g[1] - qx * g[2] + qz * g[0]);
+        q[3] = qz + h * ( qw * g[2] + qx * g[1] - qy * g[0]);
+        double norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (uint8_t i=0; i<4; ++i) {
+            q[i] /= norm;
+        }
+    }
+}
+
+template <typename F>
+static void update6(F & filter, const sample_t & s)
+{
+    filter.update(s.a[0], s.a[1], s.a[2], s.g[0], s.g[1], s.g[2], DT);
+}
+
+template <typename F>
+static void update9(F & filter, const sample_t & s)
+{
+    filter.update(s.a[0], s.a[1], s.a[2], s.g[0], s.g[1], s.g[2], s.m[0], s.m[1], s.m[2], DT);
+}
+
+template <typename F>
+static double truthError(const F & filter, const sample_t & s)
+{
+    return angleBetween(filter.q1, filter.q2, filter.q3, filter.q4, s.q[0], s.q[1], s.q[2], s.q[3]);
+}
+
+template <typename L, typename C>
+static void compareFilters(const char * name, L & legacy, C & current,
+        void (*updateLegacy)(L &, const sample_t &), void (*updateCurrent)(C &, const sample_t &),
+        const sample_t samples[], double bound)
+{
+    printf("\n%s\n", name);
+
+    double difference = 0;
+    double legacyError = 0;
+    double currentError = 0;
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        updateLegacy(legacy, samples[k]);
+        updateCurrent(current, samples[k]);
+
+        difference = fmax(difference, angleBetween(legacy.q1, legacy.q2, legacy.q3, legacy.q4,
+                                                   current.q1, current.q2, current.q3, current.q4));
+
+        // Once both have converged, see how well each tracks the truth
+        if (k > SAMPLES / 10) {
+            legacyError = fmax(legacyError, truthError(legacy, samples[k]));
+            currentError = fmax(currentError, truthError(current, samples[k]));
+        }
+    }
+
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        updateLegacy(legacy, samples[k%SAMPLES]);
+    }
+    double legacyCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        updateCurrent(current, samples[k%SAMPLES]);
+    }
+    double currentCycles = (double)(cycles() - start) / ITERATIONS;
+
+    printf("  %.1f cycles per update before, %.1f with qmath\n", legacyCycles, currentCycles);
+
+    char what[100];
+
+    sprintf(what, "  worst error from truth %.3f deg, %.3f deg before", currentError, legacyError);
+    check(currentError < legacyError + 0.01, what);
+
+    // A bound of zero means the old code was wrong, so only the comparison with the truth counts
+    if (bound > 0) {
+        sprintf(what, "  attitude within %.2e deg of the code it replaced", difference);
+        check(difference < bound, what);
+    }
+
+    // Keep the compiler from discarding the work
+    if (legacy.q1 + current.q1 > 1e30) {
+        printf("%f\n", current.q1);
+    }
+}
+
+static void testFilters(void)
+{
+    static sample_t samples[SAMPLES];
+    simulate(samples);
+
+    float beta = sqrtf(3.0f / 4.0f) * hf::Filter::deg2rad(40);
+
+    legacy::MadgwickQuaternionFilter6DOF legacyMadgwick6(beta, 0);
+    hf::MadgwickQuaternionFilter6DOF madgwick6(beta, 0);
+    compareFilters("Madgwick 6DOF", legacyMadgwick6, madgwick6,
+            update6<legacy::MadgwickQuaternionFilter6DOF>, update6<hf::MadgwickQuaternionFilter6DOF>, samples, 0.01);
+
+    legacy::MadgwickQuaternionFilter9DOF legacyMadgwick9(beta);
+    hf::MadgwickQuaternionFilter9DOF madgwick9(beta);
+    // The old update() computed the quaternion's norm but never applied it, so it drifted off the truth
+    compareFilters("Madgwick 9DOF", legacyMadgwick9, madgwick9,
+            update9<legacy::MadgwickQuaternionFilter9DOF>, update9<hf::MadgwickQuaternionFilter9DOF>, samples, 0);
+
+    legacy::MahonyQuaternionFilter9DOF legacyMahony;
+    hf::MahonyQuaternionFilter9DOF mahony;
+    compareFilters("Mahony 9DOF", legacyMahony, mahony,
+            update9<legacy::MahonyQuaternionFilter9DOF>, update9<hf::MahonyQuaternionFilter9DOF>, samples, 0.01);
+}
+
+static void testEkfAttitude(void)
+{
+    printf("\nEKF attitude update\n");
+
+    static const uint32_t N = 1024;
+    static float vs[N][3];
+    for (uint32_t k=0; k<N; ++k) {
+        for (uint8_t i=0; i<3; ++i) {
+            vs[k][i] = uniform(-0.01f, +0.01f);
+        }
+    }
+
+    float legacyQ[4] = {1, 0, 0, 0};
+    float legacyR[3][3];
+    quaternion_t q = {1, 0, 0, 0};
+    float R[3][3];
+
+    double difference = 0;
+
+    for (uint32_t k=0; k<10000; ++k) {
+
+        const float * v = vs[k%N];
+
+        legacy::ekfAttitude(legacyQ, v[0], v[1], v[2], legacyR);
+
+        // As in FlowEkf::stateEstimatorFinalize()
+        float angle = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        float ca = cos(angle / 2.0f);
+        float sa = sin(angle / 2.0f);
+        quaternion_t dq = {ca, sa * v[0] / angle, sa * v[1] / angle, sa * v[2] / angle};
+        q = hf::qmath::multiply(q, dq);
+        hf::qmath::normalize(q);
+        hf::qmath::toRotationMatrix(q, R);
+
+        for (uint8_t i=0; i<3; ++i) {
+            for (uint8_t j=0; j<3; ++j) {
+                difference = fmax(difference, fabs(R[i][j] - legacyR[i][j]));
+            }
+        }
+    }
+
+    uint64_t start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        const float * v = vs[k%N];
+        legacy::ekfAttitude(legacyQ, v[0], v[1], v[2], legacyR);
+    }
+    double legacyCycles = (double)(cycles() - start) / ITERATIONS;
+
+    start = cycles();
+    for (uint32_t k=0; k<ITERATIONS; ++k) {
+        const float * v = vs[k%N];
+        float angle = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        float ca = cos(angle / 2.0f);
+        float sa = sin(angle / 2.0f);
+        quaternion_t dq = {ca, sa * v[0] / angle, sa * v[1] / angle, sa * v[2] / angle};
+        q = hf::qmath::multiply(q, dq);
+        hf::qmath::normalize(q);
+        hf::qmath::toRotationMatrix(q, R);
+    }
+    double currentCycles = (double)(cycles() - start) / ITERATIONS;
+
+    printf("  %.1f cycles per update before, %.1f with qmath\n", legacyCycles, currentCycles);
+
+    char what[100];
+    sprintf(what, "  rotation matrix within %.2e of the code it replaced", difference);
+    check(difference < 1e-4, what);
+
+    if (R[0][0] + legacyR[0][0] > 1e30) {
+        printf("%f\n", R[0][0]);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    checkWidth = 72;
+
+#ifdef HACKFLIGHT_FAST_RSQRT
+    printf("Normalizing with fastRsqrt()\n");
+#else
+    printf("Normalizing with 1/sqrtf()\n");
+#endif
+
+    testVariant<variants::scalar>();
+    testVariant<variants::dsp>();
+#if defined(__SSE__)
+    testVariant<variants::sse>();
+#endif
+#if defined(__ARM_NEON)
+    testVariant<variants::neon>();
+#endif
+
+    testRotation();
+    testRsqrt();
+    testFilters();
+    testEkfAttitude();
+
+    return finish();
+}
@@ -0,0 +1,356 @@
+/*
+   Self-check and timing for the quaternion-native Level-mode controller
+
+   Checks QuaternionLevelPid against LevelPid over a grid of attitudes,
+   headings, and stick demands, checks that the error for a single axis is
+   exactly 2*sin(angle/2), and that nothing blows up upside down.  Then
+   checks that Hackflight still computes Euler angles for telemetry and
+   the arming check when no PID controller needs them, and reports the
+   cycles per loop saved by flying Level mode without them.  Exits with a
+   nonzero status on any failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "hackflight.hpp"
+#include "boards/linux/linux.hpp"
+#include "receivers/linux.hpp"
+#include "mixers/quadxap.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+#include "pidcontrollers/quatlevel.hpp"
+
+#include "selfcheck.hpp"
+
+static const float KP = 0.20f;
+
+static const uint32_t ITERATIONS = 200000;
+
+static constexpr uint8_t CHANNEL_MAP[6] = {0, 1, 2, 3, 4, 5};
+
+// Exposes the protected update
+class TestQuaternionLevelPid : public hf::QuaternionLevelPid {
+
+    public:
+
+        TestQuaternionLevelPid(float Kp) : hf::QuaternionLevelPid(Kp) { }
+
+        using hf::QuaternionLevelPid::modifyDemands;
+};
+
+// Exposes the telemetry request
+template <typename HackflightT>
+class TestHackflight : public HackflightT {
+
+    public:
+
+        void attitude(float & roll, float & pitch, float & yaw)
+        {
+            HackflightT::handle_ATTITUDE_RADIANS_Request(roll, pitch, yaw);
+        }
+};
+
+typedef hf::HackflightCore<hf::LinuxBoard, hf::LinuxReceiver, hf::MixerQuadXAP, 2, 0> StaticHackflight;
+
+// Quaternion for the given Euler angles, in the convention of Quaternion::computeEulerAngles()
+static void fromEuler(float roll, float pitch, float yaw, float q[4])
+{
+    // Our pitch is the negative of the usual one
+    float cr = cosf(roll/2),  sr = sinf(roll/2);
+    float cp = cosf(-pitch/2), sp = sinf(-pitch/2);
+    float cy = cosf(yaw/2),   sy = sinf(yaw/2);
+
+    q[0] = cr*cp*cy + sr*sp*sy;
+    q[1] = sr*cp*cy - cr*sp*sy;
+    q[2] = cr*sp*cy + sr*cp*sy;
+    q[3] = cr*cp*sy - sr*sp*cy;
+}
+
+static void setState(hf::state_t & state, float roll, float pitch, float yaw)
+{
+    float q[4] = {0};
+    fromEuler(roll, pitch, yaw, q);
+
+    state.cache.reset();
+    state.cache.setQuaternion(q[0], q[1], q[2], q[3]);
+}
+
+static void testController(void)
+{
+    printf("QuaternionLevelPid against LevelPid\n");
+
+    static const float DEG = M_PI / 180;
+
+    hf::LevelPid level(KP);
+    TestQuaternionLevelPid quat(KP);
+
+    float worstEuler = 0;
+    float worstDifference = 0;
+    float worstHeading = 0;
+
+    // Attitudes within 20 degrees of level, demands of up to 18 degrees, any heading
+    for (int16_t r=-20; r<=20; r+=5) {
+        for (int16_t p=-20; p<=20; p+=5) {
+            for (int16_t d=-2; d<=2; ++d) {
+
+                float headingRoll = 0;
+                float headingPitch = 0;
+
+                for (int16_t y=0; y<360; y+=45) {
+
+                    hf::state_t state = {};
+                    setState(state, r*DEG, p*DEG, y*DEG);
+
+                    const float * euler = state.cache.getEulerAngles();
+                    worstEuler = fmaxf(worstEuler, fmaxf(fabsf(euler[0] - r*DEG), fabsf(euler[1] - p*DEG)));
+
+                    hf::demands_t demands = {0, 0.1f*d, -0.05f*d, 0};
+                    hf::demands_t expected = demands;
+
+                    level.modifyDemands(state, expected);
+                    quat.modifyDemands(state, demands);
+
+                    worstDifference = fmaxf(worstDifference, fmaxf(fabsf(demands.roll - expected.roll),
+                                fabsf(demands.pitch - expected.pitch)));
+
+                    if (y == 0) {
+                        headingRoll = demands.roll;
+                        headingPitch = demands.pitch;
+                    }
+
+                    worstHeading = fmaxf(worstHeading, fmaxf(fabsf(demands.roll - headingRoll), fabsf(demands.pitch - headingPitch)));
+                }
+            }
+        }
+    }
+
+    char what[100];
+
+    sprintf(what, "Test attitudes come back from Euler angles within %.1e rad", worstEuler);
+    check(worstEuler < 1.5e-3f, what);
+
+    // Errors of up to 38 degrees, where the two ways of measuring them part company at second order
+    sprintf(what, "Within %.4f of LevelPid (%.1f deg at P = %.2f)", worstDifference, worstDifference / KP / DEG, KP);
+    check(worstDifference / KP < 3 * DEG, what);
+
+    sprintf(what, "Same output at any heading, within %.1e", worstHeading);
+    check(worstHeading < 1e-5f, what);
+
+    // With board trim, the same as LevelPid sees in the trimmed Euler angles
+    float worstTrimmed = 0;
+    for (int16_t r=-10; r<=10; r+=5) {
+        for (int16_t p=-10; p<=10; p+=5) {
+
+            hf::state_t state = {};
+            setState(state, r*DEG, p*DEG, 0);
+            state.cache.setRollPitchTrim(3*DEG, -2*DEG);
+
+            hf::demands_t demands = {0, 0.05f, -0.05f, 0};
+            hf::demands_t expected = demands;
+
+            level.modifyDemands(state, expected);
+            quat.modifyDemands(state, demands);
+
+            worstTrimmed = fmaxf(worstTrimmed, fmaxf(fabsf(demands.roll - expected.roll),
+                        fabsf(demands.pitch - expected.pitch)));
+        }
+    }
+    sprintf(what, "Trimmed, within %.4f of LevelPid", worstTrimmed);
+    check(worstTrimmed / KP < 0.5f * DEG, what);
+
+    // Exactly 2*sin(error/2) for errors about one axis
+    float worstSingle = 0;
+    for (int16_t k=-45; k<=45; k+=5) {
+        for (uint8_t axis=0; axis<2; ++axis) {
+            hf::state_t state = {};
+            setState(state, axis == 0 ? k*DEG : 0, axis == 1 ? k*DEG : 0, 1);
+            hf::demands_t demands = {0, 0, 0, 0};
+            quat.modifyDemands(state, demands);
+            float output = axis == 0 ? demands.roll : demands.pitch;
+            worstSingle = fmaxf(worstSingle, fabsf(output - KP * 2 * sinf(-k*DEG/2)));
+        }
+    }
+    sprintf(what, "Single-axis error is 2*sin(angle/2), within %.1e", worstSingle);
+    check(worstSingle < 1e-5f, what);
+
+    // Upside down, and nearly so
+    bool finite = true;
+    const float upsideDown[3][4] = { {0, 1, 0, 0}, {0, 0, 1, 0}, {1e-4f, 0.6f, 0.8f, 0} };
+    for (uint8_t k=0; k<3; ++k) {
+        hf::state_t state = {};
+        state.cache.reset();
+        state.cache.setQuaternion(upsideDown[k][0], upsideDown[k][1], upsideDown[k][2], upsideDown[k][3]);
+        hf::demands_t demands = {0, 0.1f, 0.1f, 0};
+        quat.modifyDemands(state, demands);
+        finite = finite && isfinite(demands.roll) && isfinite(demands.pitch);
+    }
+    check(finite, "Finite output upside down");
+}
+
+// Arms with the given quaternion, then reports whether it armed and the attitude sent to telemetry
+template <typename LevelT>
+static bool armAndReport(const float q[4], float euler[3])
+{
+    TestHackflight<StaticHackflight> h;
+    hf::LinuxBoard board;
+    hf::LinuxReceiver rc(CHANNEL_MAP);
+    hf::MixerQuadXAP mixer;
+    hf::RatePid ratePid(0.05f, 0.00f, 0.00f, 0.10f, 0.01f);
+    LevelT levelPid(KP);
+
+    h.init(&board, &rc, &mixer);
+    h.addPidController(&levelPid);
+    h.addPidController(&ratePid);
+
+    board.setQuaternion(q[0], q[1], q[2], q[3]);
+    h.update();
+
+    // Aux2 down, then up with throttle down, to arm
+    rc.setChannel(5, -1);
+    h.update();
+    rc.setChannel(5, +1);
+    h.update();
+
+    h.attitude(euler[0], euler[1], euler[2]);
+
+    return board.getLed();
+}
+
+static void testEulerOnRequest(void)
+{
+    printf("\nEuler angles on request\n");
+
+    static const float DEG = M_PI / 180;
+
+    float q[4] = {0};
+    fromEuler(10*DEG, -15*DEG, -60*DEG, q);
+
+    float expected[3] = {0};
+    float levelEuler[3] = {0};
+    float quatEuler[3] = {0};
+
+    hf::Quaternion::computeEulerAngles(q[0], q[1], q[2], q[3], expected);
+    expected[2] += 2*M_PI;
+
+    bool levelArmed = armAndReport<hf::LevelPid>(q, levelEuler);
+    bool quatArmed  = armAndReport<hf::QuaternionLevelPid>(q, quatEuler);
+
+    check(levelEuler[0] == expected[0] && levelEuler[1] == expected[1] && levelEuler[2] == expected[2],
+            "Telemetry attitude with LevelPid");
+    check(quatEuler[0] == expected[0] && quatEuler[1] == expected[1] && quatEuler[2] == expected[2],
+            "Telemetry attitude with QuaternionLevelPid");
+    check(levelArmed && quatArmed, "Arms at 10 deg roll, 15 deg pitch with either controller");
+
+    fromEuler(30*DEG, 0, 0, q);
+    levelArmed = armAndReport<hf::LevelPid>(q, levelEuler);
+    quatArmed  = armAndReport<hf::QuaternionLevelPid>(q, quatEuler);
+    check(!levelArmed && !quatArmed, "Won't arm at 30 deg roll with either controller");
+}
+
+// Gyro every loop, receiver every 20, quaternion every quaternionLoops
+template <typename LevelT>
+static double cyclesPerLoop(uint8_t quaternionLoops)
+{
+    StaticHackflight h;
+    hf::LinuxBoard board;
+    hf::LinuxReceiver rc(CHANNEL_MAP);
+    hf::MixerQuadXAP mixer;
+    hf::RatePid ratePid(0.05f, 0.00f, 0.00f, 0.10f, 0.01f);
+    LevelT levelPid(KP);
+
+    h.init(&board, &rc, &mixer);
+    h.addPidController(&levelPid);
+    h.addPidController(&ratePid);
+
+    rc.setChannel(5, -1);
+    h.update();
+    rc.setChannel(5, +1);
+    h.update();
+
+    // Best of a few passes, to keep other activity on the host out of the comparison
+    uint64_t best = UINT64_MAX;
+
+    for (uint8_t pass=0; pass<5; ++pass) {
+
+        uint64_t start = cycles();
+
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            float t = k * 1e-3f;
+            board.setGyrometer(0.1f*sinf(t), 0.1f*cosf(t), 0.01f);
+            if (k % quaternionLoops == 0) {
+                float q[4];
+                fromEuler(0.2f*sinf(t), 0.2f*cosf(t), t, q);
+                board.setQuaternion(q[0], q[1], q[2], q[3]);
+            }
+            if (k % 20 == 0) {
+                rc.setChannel(0, 0.2f);
+                rc.setChannel(1, 0.1f*sinf(t));
+            }
+            h.update();
+        }
+
+        uint64_t elapsed = cycles() - start;
+
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    return (double)best / ITERATIONS;
+}
+
+static void testTiming(void)
+{
+    printf("\nCycles per loop, HackflightCore on LinuxBoard\n");
+
+    printf("%-28s %10s %20s %10s\n", "Quaternion", "LevelPid", "QuaternionLevelPid", "Saved");
+
+    double saved[2] = {0};
+
+    const uint8_t rates[2] = {1, 5};
+
+    for (uint8_t k=0; k<2; ++k) {
+
+        double level = cyclesPerLoop<hf::LevelPid>(rates[k]);
+        double quat  = cyclesPerLoop<hf::QuaternionLevelPid>(rates[k]);
+
+        saved[k] = level - quat;
+
+        char label[40];
+        sprintf(label, k == 0 ? "Every loop" : "Every %d loops", rates[k]);
+
+        printf("%-28s %10.1f %20.1f %10.1f\n", label, level, quat, saved[k]);
+    }
+
+    check(saved[0] > 0, "Quaternion every loop: QuaternionLevelPid is cheaper");
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    testController();
+    testEulerOnRequest();
+    testTiming();
+
+    return finish();
+}
@@ -0,0 +1,67 @@
+/*
+   Helpers shared by the self-checking host programs
+
+   check() prints each result on a line of its own and counts the
+   failures, and finish() prints the verdict and gives the exit status.
+   cycles() reads the time-stamp counter where there is one, for timing
+   the code under test, and nanoseconds elsewhere.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static uint32_t failures = 0;
+
+// Width of the description column; programs with longer descriptions can widen it
+static int checkWidth = 60;
+
+static inline void check(bool ok, const char * what)
+{
+    printf("%-*s %s\n", checkWidth, what, ok ? "ok" : "FAILED");
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Prints the verdict, and returns the exit status for main()
+static inline int finish(void)
+{
+    printf("\n%s\n", failures ? "FAILED" : "All checks passed");
+
+    return failures ? 1 : 0;
+}
+
+// Time-stamp counter where there is one, nanoseconds elsewhere
+static inline uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
@@ -0,0 +1,333 @@
+/*
+   One headless simulated flight: Hackflight on a SimBoard, flown by a scripted pilot
+
+   The pilot arms the vehicle, holds altitude with the throttle stick, and
+   puts in a repeating sequence of roll, pitch, and yaw steps.  Optional
+   wind gusts and sensor noise come from their own seeded generators, so a
+   flight with a given set of gains and seeds is fully repeatable.  Each
+   instance is self-contained, so many can fly at once on separate threads.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+
+#include "hackflight.hpp"
+#include "boards/sim/simboard.hpp"
+#include "boards/sim/noise.hpp"
+#include "receivers/linux.hpp"
+#include "mixers/quadxap.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+#include "pidcontrollers/quatlevel.hpp"
+
+namespace hf {
+
+    class SimFlight {
+
+        public:
+
+            typedef struct {
+
+                float Kp;
+                float Ki;
+                float Kd;
+                float KpYaw;
+                float KiYaw;
+                float level;
+
+            } gains_t;
+
+            typedef struct {
+
+                float gyrometer;    // rad/sec, standard deviation
+                float quaternion;   // standard deviation of vector part
+                float gustTorque;   // N m, standard deviation
+                float gustForce;    // N, standard deviation
+
+            } noise_t;
+
+            typedef struct {
+
+                float trackingError;    // RMS roll/pitch angle error, degrees
+                float altitudeError;    // RMS, meters
+                float saturationTime;   // seconds with some motor at 0 or 1 while airborne
+                float settlingTime;     // mean seconds to settle after a stick step
+                float maxTilt;          // degrees
+                bool  crashed;
+
+            } metrics_t;
+
+        private:
+
+            // Pilot updates sticks at this rate, like a typical R/C link
+            static const uint16_t RECEIVER_HZ = 50;
+
+            static constexpr float TARGET_ALTITUDE = 2.0f;
+
+            // Time allowed for the initial climb before we start scoring
+            static constexpr float CLIMB_SECONDS = 5.0f;
+
+            // Bigger tilt than this means the vehicle has lost control
+            static constexpr float MAX_TILT_DEGREES = 60;
+
+            // Attitude is settled once within this many degrees of the demand
+            static constexpr float SETTLED_DEGREES = 2.0f;
+
+            // Matches LevelPid's conversion from demand to angle
+            static constexpr float MAX_ANGLE_DEGREES = 45;
+
+            // Gusts decay with this time constant, in seconds
+            static constexpr float GUST_TAU = 0.5f;
+
+            const uint8_t _channelMap[6] = {0, 1, 2, 3, 4, 5};
+
+            // Concrete types throughout, so board and receiver calls are dispatched statically
+            HackflightCore<SimBoard, LinuxReceiver, MixerQuadXAP, 2, 0> _h;
+            SimBoard _board;
+            LinuxReceiver _rc;
+            MixerQuadXAP _mixer;
+            RatePid _ratePid;
+#ifdef SITL_QUATERNION_LEVEL
+            QuaternionLevelPid _levelPid;
+#else
+            LevelPid _levelPid;
+#endif
+
+            noise_t _noise = {};
+            SimNoise _gusts;
+            float _gustTorque[3] = {0};
+            float _gustForce[3] = {0};
+
+            // Roll, pitch, and yaw steps, repeating every 20 seconds once the vehicle is at altitude
+            static void cyclicSticks(float t, float & roll, float & pitch, float & yaw)
+            {
+                roll = 0;
+                pitch = 0;
+                yaw = 0;
+
+                if (t < CLIMB_SECONDS) {
+                    return;
+                }
+
+                switch ((uint32_t)(t - CLIMB_SECONDS) % 20) {
+                    case 2:
+                        roll = +0.2f;
+                        break;
+                    case 5:
+                        roll = -0.2f;
+                        break;
+                    case 8:
+                        pitch = +0.2f;
+                        break;
+                    case 11:
+                        pitch = -0.2f;
+                        break;
+                    case 14:
+                        yaw = +0.2f;
+                        break;
+                }
+            }
+
+            // PD altitude hold on the throttle stick, using true altitude and climb rate
+            float throttleStick(void)
+            {
+                static constexpr float HOVER = 0.15f;
+                static constexpr float KP = 0.20f;
+                static constexpr float KD = 0.25f;
+
+                float climbRate = -dynamics().velocity[2];
+
+                float stick = HOVER + KP * (TARGET_ALTITUDE - dynamics().getAltitude()) - KD * climbRate;
+
+                // Stay above the throttle-down cutoff so the motors keep running
+                return Filter::constrainMinMax(stick, -0.8f, 1.0f);
+            }
+
+            // First-order Gauss-Markov gusts, updated at the receiver rate
+            void updateGusts(float dt)
+            {
+                if (_noise.gustTorque == 0 && _noise.gustForce == 0) {
+                    return;
+                }
+
+                float decay = expf(-dt / GUST_TAU);
+                float drive = sqrtf(1 - decay*decay);
+
+                for (uint8_t k=0; k<3; ++k) {
+                    _gustTorque[k] = decay * _gustTorque[k] + drive * _noise.gustTorque * _gusts.gaussian();
+                    _gustForce[k]  = decay * _gustForce[k]  + drive * _noise.gustForce  * _gusts.gaussian();
+                }
+
+                dynamics().setDisturbance(_gustTorque, _gustForce);
+            }
+
+        public:
+
+            SimFlight(const gains_t & gains)
+                : _rc(_channelMap),
+                  _ratePid(gains.Kp, gains.Ki, gains.Kd, gains.KpYaw, gains.KiYaw),
+                  _levelPid(gains.level)
+            {
+                _h.init(&_board, &_rc, &_mixer);
+                _h.addPidController(&_levelPid);
+                _h.addPidController(&_ratePid);
+            }
+
+            /**
+             * Adds wind gusts and sensor noise, each from its own seeded generator.  Call before fly().
+             */
+            void setNoise(const noise_t & noise, uint32_t disturbanceSeed, uint32_t noiseSeed)
+            {
+                _noise = noise;
+                _gusts.seed(disturbanceSeed);
+                _board.setNoise(noise.gyrometer, noise.quaternion, noiseSeed);
+            }
+
+            QuadrotorDynamics & dynamics(void)
+            {
+                return _board.dynamics;
+            }
+
+            SimBoard & board(void)
+            {
+                return _board;
+            }
+
+            void fly(float seconds, uint16_t loopHz, metrics_t & metrics)
+            {
+                uint32_t loopUsec = 1000000 / loopHz;
+                uint32_t loops = (uint32_t)(seconds * loopHz);
+                uint32_t receiverLoops = loopHz / RECEIVER_HZ;
+                if (receiverLoops == 0) {
+                    receiverLoops = 1;
+                }
+
+                // Aux2 down, then up with throttle down, to arm
+                _rc.setChannel(5, -1);
+                _h.update();
+                _rc.setChannel(5, +1);
+                _h.update();
+
+                double trackingSquared = 0;
+                double altitudeSquared = 0;
+                uint32_t scoredLoops = 0;
+                uint32_t saturatedLoops = 0;
+
+                // Settling-time bookkeeping: time of latest stick change, and of latest unsettled sample
+                float lastRoll = 0;
+                float lastPitch = 0;
+                float stepTime = -1;
+                float unsettledTime = -1;
+                float settlingTotal = 0;
+                uint32_t settlingCount = 0;
+
+                metrics.maxTilt = 0;
+                metrics.crashed = false;
+
+                float maxAngle = Filter::deg2rad(MAX_ANGLE_DEGREES);
+
+                for (uint32_t k=0; k<loops; ++k) {
+
+                    _board.step(loopUsec);
+
+                    float t = k / (float)loopHz;
+
+                    if (k % receiverLoops == 0) {
+
+                        float roll = 0, pitch = 0, yaw = 0;
+                        cyclicSticks(t, roll, pitch, yaw);
+
+                        // New step: close out the previous one
+                        if (roll != lastRoll || pitch != lastPitch) {
+                            if (stepTime >= 0) {
+                                settlingTotal += (unsettledTime > stepTime ? unsettledTime : stepTime) - stepTime;
+                                settlingCount++;
+                            }
+                            stepTime = t;
+                            unsettledTime = t;
+                            lastRoll = roll;
+                            lastPitch = pitch;
+                        }
+
+                        _rc.setChannel(0, throttleStick());
+                        _rc.setChannel(1, roll);
+                        _rc.setChannel(2, pitch);
+                        _rc.setChannel(3, yaw);
+
+                        updateGusts(receiverLoops / (float)loopHz);
+                    }
+
+                    _h.update();
+
+                    QuadrotorDynamics & d = dynamics();
+
+                    // Tilt from vertical, using third row of rotation matrix
+                    float qw = d.quaternion[0];
+                    float qx = d.quaternion[1];
+                    float qy = d.quaternion[2];
+                    float qz = d.quaternion[3];
+                    float tilt = Filter::rad2deg(acosf(Filter::constrainAbs(qw*qw - qx*qx - qy*qy + qz*qz, 1)));
+                    if (tilt > metrics.maxTilt) {
+                        metrics.maxTilt = tilt;
+                    }
+
+                    if (tilt > MAX_TILT_DEGREES || (t > CLIMB_SECONDS && !d.isAirborne())) {
+                        metrics.crashed = true;
+                        break;
+                    }
+
+                    if (t < CLIMB_SECONDS) {
+                        continue;
+                    }
+
+                    // Compare true attitude with the angle that LevelPid is being asked for
+                    float euler[3] = {0};
+                    Quaternion::computeEulerAngles(qw, qx, qy, qz, euler);
+                    const demands_t & demands = _rc.getCurrentDemands();
+                    float rollError  = Filter::rad2deg(demands.roll  * 2 * maxAngle - euler[0]);
+                    float pitchError = Filter::rad2deg(demands.pitch * 2 * maxAngle - euler[1]);
+                    trackingSquared += rollError*rollError + pitchError*pitchError;
+                    if (fabs(rollError) > SETTLED_DEGREES || fabs(pitchError) > SETTLED_DEGREES) {
+                        unsettledTime = t;
+                    }
+
+                    float altitudeError = TARGET_ALTITUDE - d.getAltitude();
+                    altitudeSquared += altitudeError * altitudeError;
+
+                    for (uint8_t j=0; j<QuadrotorDynamics::NMOTORS; ++j) {
+                        float m = d.getMotor(j);
+                        if (m <= 0 || m >= 1) {
+                            saturatedLoops++;
+                            break;
+                        }
+                    }
+
+                    scoredLoops++;
+                }
+
+                metrics.trackingError  = scoredLoops ? sqrt(trackingSquared / (2 * scoredLoops)) : 0;
+                metrics.altitudeError  = scoredLoops ? sqrt(altitudeSquared / scoredLoops) : 0;
+                metrics.saturationTime = saturatedLoops / (float)loopHz;
+                metrics.settlingTime   = settlingCount ? settlingTotal / settlingCount : 0;
+            }
+
+    }; // class SimFlight
+
+} // namespace hf
@@ -0,0 +1,78 @@
+/*
+   Lockstep software-in-the-loop simulation of Hackflight
+
+   SimBoard advances a rigid-body quadcopter model by one loop period, then
+   Hackflight::update() runs once on the new sensor readings.  A scripted
+   pilot holds altitude with the throttle stick and puts in a sequence of
+   roll, pitch and yaw steps, so the run exercises the whole receiver /
+   PID / mixer chain.  Reports how much faster than real time the
+   simulation ran, along with some simple tracking statistics.
+
+   Usage: sitl [SECONDS [LOOP_HZ]]
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "simflight.hpp"
+
+static const float DEFAULT_SECONDS = 600;
+static const uint16_t DEFAULT_LOOP_HZ = 1000;
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char ** argv)
+{
+    float duration = argc > 1 ? atof(argv[1]) : DEFAULT_SECONDS;
+    uint16_t loopHz = argc > 2 ? atoi(argv[2]) : DEFAULT_LOOP_HZ;
+
+    hf::SimFlight::gains_t gains = {0.05f, 0.00f, 0.00f, 0.10f, 0.01f, 0.20f};
+
+    hf::SimFlight flight(gains);
+
+    hf::SimFlight::metrics_t metrics = {};
+
+    double start = seconds();
+
+    flight.fly(duration, loopHz, metrics);
+
+    double elapsed = seconds() - start;
+
+    hf::QuadrotorDynamics & dynamics = flight.dynamics();
+
+    printf("Simulated %.1f sec at %u Hz in %.3f sec wall time (%.0fx real time, %.1f ns/loop)\n",
+            duration, loopHz, elapsed, duration / elapsed, 1e9 * elapsed / (duration * loopHz));
+
+    printf("Armed: %s   Airborne: %s\n", flight.board().isArmed() ? "yes" : "no", dynamics.isAirborne() ? "yes" : "no");
+
+    printf("Final position (NED, m): %+7.3f %+7.3f %+7.3f\n", dynamics.position[0], dynamics.position[1], dynamics.position[2]);
+
+    printf("RMS tracking error: %.2f deg   Settling time: %.2f sec   Max tilt: %.1f deg\n",
+            metrics.trackingError, metrics.settlingTime, metrics.maxTilt);
+
+    printf("RMS altitude error: %.3f m   Motor saturation: %.2f sec\n", metrics.altitudeError, metrics.saturationTime);
+
+    return metrics.crashed ? 1 : 0;
+}
@@ -0,0 +1,444 @@
+/*
+   Attitude accuracy and cost of SoftwareQuaternionBoard's split estimator
+
+   Simulates a 1 kHz IMU on a vehicle maneuvering while its frame vibrates
+   in a coning motion.  Tracks the attitude with the whole Madgwick
+   update run on every sample, every second sample, and every fifth
+   sample, and with SoftwareQuaternionBoard, which integrates every
+   gyrometer sample and corrects with the averaged accelerometer every
+   fifth sample, with and without coning correction.  Reports the RMS and
+   worst attitude error and the best-of-ten cycles per gyrometer sample
+   for each.  Checks that the split estimator is more accurate than the
+   whole update every second or fifth sample, and within 10% of the whole
+   update on every sample.  The only timing check is that it costs well
+   under the whole update on every sample, since the split and every
+   second sample cost about the same.  Exits with a nonzero status on any
+   failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "boards/softquat.hpp"
+
+#include "selfcheck.hpp"
+
+static const double DT = 0.001;
+static const uint32_t PERIOD_USEC = 1000;
+static const uint32_t SAMPLES = 20000;
+
+// Truth is integrated this many times per gyrometer sample
+static const uint32_t SUBSTEPS = 20;
+
+// Same divisor as the board's default
+static const uint8_t DIVISOR = 5;
+
+// Errors count only after the filters have settled
+static const uint32_t SETTLE = 2000;
+
+// Uniform in [lo, hi], repeatable across runs
+static float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+typedef struct {
+
+    float a[3];     // Gs
+    float g[3];     // radians per second, averaged over the sample period like a real gyrometer's
+    double q[4];    // true attitude at the end of the sample period
+
+} sample_t;
+
+// Maneuvering, plus a 40 Hz coning vibration about the roll and pitch axes
+static void bodyRates(double t, double w[3])
+{
+    static const double CONING_HZ = 40;
+    static const double CONING_RATE = 4;
+
+    w[0] = 1.5 * sin(2 * M_PI * 0.5 * t) + CONING_RATE * cos(2 * M_PI * CONING_HZ * t);
+    w[1] = 1.0 * sin(2 * M_PI * 0.3 * t + 1) + CONING_RATE * sin(2 * M_PI * CONING_HZ * t);
+    w[2] = 0.5 * sin(2 * M_PI * 0.2 * t + 2);
+}
+
+// Gravity in the body frame, q* (0, 0, 1) q
+static void gravity(const double q[4], float a[3])
+{
+    a[0] = 2 * (q[1] * q[3] - q[0] * q[2]);
+    a[1] = 2 * (q[2] * q[3] + q[0] * q[1]);
+    a[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
+
+static void simulate(sample_t samples[])
+{
+    double q[4] = {1, 0, 0, 0};
+
+    double h = DT / SUBSTEPS;
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        sample_t & s = samples[k];
+
+        double sum[3] = {0, 0, 0};
+
+        // Midpoint rule for the truth, fine enough that its own error doesn't matter
+        for (uint32_t j=0; j<SUBSTEPS; ++j) {
+
+            double w[3];
+            bodyRates((k * SUBSTEPS + j + 0.5) * h, w);
+
+            double qw = q[0], qx = q[1], qy = q[2], qz = q[3];
+            double hh = h / 2;
+            q[0] = qw + hh * (-qx * w[0] - qy * w[1] - qz * w[2]);
+            q[1] = qx + hh * ( qw * w[0] + qy * w[2] - qz * w[1]);
+            q[2] = qy + hh * ( qw * w[1] - qx * w[2] + qz * w[0]);
+            q[3] = qz + hh * ( qw * w[2] + qx * w[1] - qy * w[0]);
+            double norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+            for (uint8_t i=0; i<4; ++i) {
+                q[i] /= norm;
+            }
+
+            for (uint8_t i=0; i<3; ++i) {
+                sum[i] += w[i];
+            }
+        }
+
+        gravity(q, s.a);
+
+        for (uint8_t i=0; i<3; ++i) {
+
+            // Motor vibration and noise on the accelerometer, a little noise on the gyrometer
+            s.a[i] += 0.3f * sinf(2 * M_PI * 170 * k * DT + i) + uniform(-0.05f, +0.05f);
+            s.g[i] = sum[i] / SUBSTEPS + uniform(-0.005f, +0.005f);
+        }
+
+        for (uint8_t i=0; i<4; ++i) {
+            s.q[i] = q[i];
+        }
+    }
+}
+
+// Angle in degrees between two attitudes
+static double angleBetween(float qw, float qx, float qy, float qz, const double q[4])
+{
+    double dot = qw * q[0] + qx * q[1] + qy * q[2] + qz * q[3];
+    double norm = sqrt(qw * qw + qx * qx + qy * qy + qz * qz);
+    double c = fabs(dot) / norm;
+    return 2 * acos(c > 1 ? 1 : c) * 180 / M_PI;
+}
+
+class Errors {
+
+    private:
+
+        double _sumsq = 0;
+        double _worst = 0;
+        uint32_t _count = 0;
+
+    public:
+
+        void add(double error)
+        {
+            _sumsq += error * error;
+            _worst = error > _worst ? error : _worst;
+            _count++;
+        }
+
+        double rms(void)
+        {
+            return sqrt(_sumsq / _count);
+        }
+
+        double worst(void)
+        {
+            return _worst;
+        }
+};
+
+// The board, reading its IMU from the simulation
+class TestBoard : public hf::SoftwareQuaternionBoard {
+
+    private:
+
+        const sample_t * _sample = NULL;
+
+    protected:
+
+        virtual bool imuReady(void) override
+        {
+            return true;
+        }
+
+        virtual void imuReadAccelGyro(void) override
+        {
+            _ax = _sample->a[0];
+            _ay = _sample->a[1];
+            _az = _sample->a[2];
+
+            // The board expects degrees per second
+            _gx = hf::Filter::rad2deg(_sample->g[0]);
+            _gy = hf::Filter::rad2deg(_sample->g[1]);
+            _gz = hf::Filter::rad2deg(_sample->g[2]);
+        }
+
+    public:
+
+        void setSample(const sample_t & sample)
+        {
+            _sample = &sample;
+        }
+
+        // The attitude as of the last correction
+        float qw = 1;
+        float qx = 0;
+        float qy = 0;
+        float qz = 0;
+};
+
+static void report(const char * name, Errors & errors, double cyclesPerSample)
+{
+    printf("%-40s %6.3f deg RMS %6.3f deg worst %7.1f cycles/sample\n", name, errors.rms(), errors.worst(), cyclesPerSample);
+}
+
+// The board as it was: the whole Madgwick update on every divisor-th call, with the latest readings
+class LegacyBoard {
+
+    private:
+
+        uint8_t _divisor = 0;
+        uint8_t _quatCycleCount = 0;
+        uint64_t _quaternionUsec = 0;
+
+        const sample_t * _sample = NULL;
+
+        float _ax = 0;
+        float _ay = 0;
+        float _az = 0;
+        float _gx = 0;
+        float _gy = 0;
+        float _gz = 0;
+
+        hf::MadgwickQuaternionFilter6DOF _quaternionFilter =
+            hf::MadgwickQuaternionFilter6DOF(sqrtf(3.0f / 4.0f) * hf::Filter::deg2rad(40), 0);
+
+    public:
+
+        LegacyBoard(uint8_t divisor)
+        {
+            _divisor = divisor;
+        }
+
+        void setSample(const sample_t & sample)
+        {
+            _sample = &sample;
+        }
+
+        bool getGyrometer(float & gx, float & gy, float & gz)
+        {
+            _ax = _sample->a[0];
+            _ay = _sample->a[1];
+            _az = _sample->a[2];
+            _gx = hf::Filter::deg2rad(hf::Filter::rad2deg(_sample->g[0]));
+            _gy = hf::Filter::deg2rad(hf::Filter::rad2deg(_sample->g[1]));
+            _gz = hf::Filter::deg2rad(hf::Filter::rad2deg(_sample->g[2]));
+
+            gx = hf::Filter::round2(_gx);
+            gy = hf::Filter::round2(_gy);
+            gz = hf::Filter::round2(_gz);
+
+            return true;
+        }
+
+        bool getQuaternion(float & qw, float & qx, float & qy, float & qz, uint64_t usec)
+        {
+            _quatCycleCount = (_quatCycleCount + 1) % _divisor;
+
+            if (_quatCycleCount == 0) {
+
+                float deltat = hf::Timebase::elapsed(_quaternionUsec, usec);
+                _quaternionUsec = usec;
+
+                _quaternionFilter.update(_ax, _ay, _az, _gx, _gy, _gz, deltat);
+
+                qw = _quaternionFilter.q1;
+                qx = _quaternionFilter.q2;
+                qy = _quaternionFilter.q3;
+                qz = _quaternionFilter.q4;
+
+                return true;
+            }
+
+            return false;
+        }
+
+        float qw = 1;
+        float qx = 0;
+        float qy = 0;
+        float qz = 0;
+};
+
+// The old board, updating every divisor-th sample.  With errors, tracks the attitude error after each
+// update; without, just runs.
+static void runWhole(const sample_t samples[], uint8_t divisor, Errors * errors=NULL)
+{
+    LegacyBoard board(divisor);
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        const sample_t & s = samples[k];
+
+        board.setSample(s);
+
+        uint64_t usec = (uint64_t)(k + 1) * PERIOD_USEC;
+
+        float gx, gy, gz;
+        board.getGyrometer(gx, gy, gz);
+        bool updated = board.getQuaternion(board.qw, board.qx, board.qy, board.qz, usec);
+
+        if (errors && updated && k > SETTLE) {
+            errors->add(angleBetween(board.qw, board.qx, board.qy, board.qz, s.q));
+        }
+    }
+
+    // Keep the compiler from discarding the work
+    if (board.qw > 1e30) {
+        printf("%f\n", board.qw);
+    }
+}
+
+// The board: every sample integrated, corrected every DIVISOR samples
+static void runSplit(const sample_t samples[], bool coning, Errors * errors=NULL)
+{
+    TestBoard board;
+    board.setCorrectionDivisor(DIVISOR);
+    if (coning) {
+        board.useConingCorrection();
+    }
+
+    for (uint32_t k=0; k<SAMPLES; ++k) {
+
+        const sample_t & s = samples[k];
+
+        board.setSample(s);
+
+        uint64_t usec = (uint64_t)(k + 1) * PERIOD_USEC;
+
+        float gx, gy, gz;
+        board.getGyrometer(gx, gy, gz, usec);
+        bool corrected = board.getQuaternion(board.qw, board.qx, board.qy, board.qz, usec);
+
+        // Same sampling of the error as the whole update every DIVISOR samples
+        if (errors && corrected && k > SETTLE) {
+            errors->add(angleBetween(board.qw, board.qx, board.qy, board.qz, s.q));
+        }
+    }
+
+    if (board.qw > 1e30) {
+        printf("%f\n", board.qw);
+    }
+}
+
+// A divisor of zero corrects every sample, and no quaternion comes out before the first sample
+static bool zeroDivisorSafe(const sample_t samples[])
+{
+    TestBoard board;
+    board.setCorrectionDivisor(0);
+
+    if (board.getQuaternion(board.qw, board.qx, board.qy, board.qz, 0)) {
+        return false;
+    }
+
+    for (uint32_t k=0; k<SETTLE; ++k) {
+
+        board.setSample(samples[k]);
+
+        uint64_t usec = (uint64_t)(k + 1) * PERIOD_USEC;
+
+        float gx, gy, gz;
+        board.getGyrometer(gx, gy, gz, usec);
+
+        if (!board.getQuaternion(board.qw, board.qx, board.qy, board.qz, usec) ||
+                !std::isfinite(board.qw) || !std::isfinite(board.qx) ||
+                !std::isfinite(board.qy) || !std::isfinite(board.qz)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Cycles per sample for a run, best of several so that the host OS doesn't count against it
+template <typename F>
+static double timeRun(F run)
+{
+    double best = 1e30;
+
+    for (uint8_t j=0; j<10; ++j) {
+        uint64_t start = cycles();
+        run();
+        double perSample = (double)(cycles() - start) / SAMPLES;
+        best = perSample < best ? perSample : best;
+    }
+
+    return best;
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    checkWidth = 72;
+
+    static sample_t samples[SAMPLES];
+    simulate(samples);
+
+    Errors everySample, everySecond, everyFifth, split, coning;
+
+    runWhole(samples, 1, &everySample);
+    runWhole(samples, 2, &everySecond);
+    runWhole(samples, DIVISOR, &everyFifth);
+    runSplit(samples, false, &split);
+    runSplit(samples, true, &coning);
+
+    double everySampleCycles = timeRun([&]() { runWhole(samples, 1); });
+    double everySecondCycles = timeRun([&]() { runWhole(samples, 2); });
+    double everyFifthCycles = timeRun([&]() { runWhole(samples, DIVISOR); });
+    double splitCycles = timeRun([&]() { runSplit(samples, false); });
+    double coningCycles = timeRun([&]() { runSplit(samples, true); });
+
+    report("Whole update every sample", everySample, everySampleCycles);
+    report("Whole update every second sample", everySecond, everySecondCycles);
+    report("Whole update every fifth sample", everyFifth, everyFifthCycles);
+    report("Split, corrected every fifth sample", split, splitCycles);
+    report("Split, with coning correction", coning, coningCycles);
+
+    printf("\n");
+
+    check(split.rms() < everyFifth.rms() / 2, "Split estimator at least twice as accurate as every fifth sample");
+    check(split.rms() < everySecond.rms(), "Split estimator more accurate than every second sample");
+    check(split.rms() < 1.1 * everySample.rms(), "Split estimator within 10% of every sample");
+    check(splitCycles < 0.75 * everySampleCycles, "Split estimator costs under 3/4 of every sample");
+    check(coning.rms() < split.rms(), "Coning correction improves accuracy under coning motion");
+    check(zeroDivisorSafe(samples), "Divisor of zero corrects every sample, nothing before the first");
+
+    return finish();
+}
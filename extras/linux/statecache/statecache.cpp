@@ -0,0 +1,242 @@
+/*
+   Self-check and timing for StateCache
+
+   Checks the Euler angles, rotation matrix, tilt cosine, and heading sine
+   and cosine that StateCache derives from the quaternion against the same
+   values computed directly, over a grid of attitudes.  Checks that the
+   version numbers count writes, that a derived value follows a new
+   quaternion or trim, and that copies between cores carry what has already
+   been derived.  Then times three readers of the Euler angles per
+   quaternion update through the cache, against each computing them for
+   itself.  Exits with a nonzero status on any failure.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "datatypes.hpp"
+#include "qmath.hpp"
+
+#include "selfcheck.hpp"
+
+static const uint32_t ITERATIONS = 200000;
+
+// Unit quaternion for roll, pitch, and yaw about x, y, and z
+static void fromEuler(float roll, float pitch, float yaw, float q[4])
+{
+    float cr = cosf(roll/2),  sr = sinf(roll/2);
+    float cp = cosf(pitch/2), sp = sinf(pitch/2);
+    float cy = cosf(yaw/2),   sy = sinf(yaw/2);
+
+    q[0] = cr*cp*cy + sr*sp*sy;
+    q[1] = sr*cp*cy - cr*sp*sy;
+    q[2] = cr*sp*cy + sr*cp*sy;
+    q[3] = cr*cp*sy - sr*sp*cy;
+}
+
+static void testDerived(void)
+{
+    printf("Derived values\n");
+
+    hf::StateCache cache;
+    cache.reset();
+
+    float worstEuler = 0;
+    float worstRotation = 0;
+    float worstTilt = 0;
+    float worstYaw = 0;
+
+    for (int16_t r=-60; r<=60; r+=15) {
+        for (int16_t p=-60; p<=60; p+=15) {
+            for (int16_t y=-180; y<180; y+=30) {
+
+                float q[4] = {0};
+                fromEuler(r * M_PI/180, p * M_PI/180, y * M_PI/180, q);
+
+                cache.setQuaternion(q[0], q[1], q[2], q[3]);
+
+                // Euler angles, as the quaternion sensor used to compute them
+                float euler[3] = {0};
+                hf::StateCache::computeEulerAngles(q[0], q[1], q[2], q[3], euler);
+                if (euler[2] < 0) {
+                    euler[2] += 2*M_PI;
+                }
+                const float * cached = cache.getEulerAngles();
+                for (uint8_t k=0; k<3; ++k) {
+                    worstEuler = fmaxf(worstEuler, fabsf(cached[k] - euler[k]));
+                }
+
+                float R[3][3] = {{0}};
+                hf::qmath::quaternion_t qt = {q[0], q[1], q[2], q[3]};
+                hf::qmath::toRotationMatrix(qt, R);
+                const hf::StateCache::matrix_t & Rc = cache.getRotationMatrix();
+                for (uint8_t i=0; i<3; ++i) {
+                    for (uint8_t j=0; j<3; ++j) {
+                        worstRotation = fmaxf(worstRotation, fabsf(Rc[i][j] - R[i][j]));
+                    }
+                }
+
+                worstTilt = fmaxf(worstTilt, fabsf(cache.getTiltCosine() - cosf(r * M_PI/180) * cosf(p * M_PI/180)));
+
+                float s = 0, c = 0;
+                cache.getYaw(s, c);
+                worstYaw = fmaxf(worstYaw, fmaxf(fabsf(s - sinf(y * M_PI/180)), fabsf(c - cosf(y * M_PI/180))));
+            }
+        }
+    }
+
+    char what[100];
+
+    sprintf(what, "Euler angles same as computed directly (%.1e)", worstEuler);
+    check(worstEuler == 0, what);
+
+    sprintf(what, "Rotation matrix same as computed directly (%.1e)", worstRotation);
+    check(worstRotation == 0, what);
+
+    sprintf(what, "Tilt cosine is cos(roll)*cos(pitch), within %.1e", worstTilt);
+    check(worstTilt < 1e-5f, what);
+
+    sprintf(what, "Heading sine and cosine within %.1e", worstYaw);
+    check(worstYaw < 1e-5f, what);
+}
+
+static void testVersions(void)
+{
+    printf("\nVersions\n");
+
+    hf::state_t state = {};
+    hf::StateCache & cache = state.cache;
+    cache.reset();
+
+    uint32_t q0 = cache.getQuaternionVersion();
+    uint32_t g0 = cache.getAngularVelocityVersion();
+    uint32_t l0 = cache.getLocationVersion();
+
+    const float * euler = cache.getEulerAngles();
+    check(euler[0] == 0 && euler[1] == 0 && euler[2] == 0, "Level after reset()");
+
+    cache.setQuaternion(cosf(0.1f), sinf(0.1f), 0, 0);
+    cache.setAngularVelocity(1, 2, 3);
+    cache.setLocation(2, 1.5f);
+    cache.setLocation(0, 0.5f);
+
+    check(cache.getQuaternionVersion() == q0 + 1 && cache.getAngularVelocityVersion() == g0 + 1 &&
+            cache.getLocationVersion() == l0 + 2, "Versions count writes");
+
+    check(fabsf(cache.getEulerAngles()[0] - 0.2f) < 1e-3f, "Euler angles follow a new quaternion");
+
+    float roll = cache.getEulerAngles()[0];
+    cache.setRollPitchTrim(0.05f, -0.02f);
+    check(cache.getEulerAngles()[0] == roll + 0.05f, "Euler angles follow a new trim");
+
+    // What the comms core gets from the control core, and the other way round
+    hf::state_t comms = {};
+    comms.cache.reset();
+    comms.cache.setLocation(2, 3.0f);
+    comms.cache.copyAttitude(cache);
+
+    check(comms.cache.getQuaternionVersion() == cache.getQuaternionVersion() &&
+            comms.cache.getAngularVelocity()[2] == 3 && comms.cache.getLocation()[2] == 3.0f,
+            "copyAttitude() takes attitude and rates, not location");
+    check(comms.cache.getEulerAngles()[0] == cache.getEulerAngles()[0], "  and the Euler angles derived from them");
+
+    cache.copyLocation(comms.cache);
+    check(cache.getLocation()[2] == 3.0f && cache.getLocationVersion() == comms.cache.getLocationVersion(),
+            "copyLocation() takes location");
+}
+
+// A reader that works out the Euler angles for itself, the way each module used to
+static float readDirect(const float q[4])
+{
+    float euler[3] = {0};
+    hf::StateCache::computeEulerAngles(q[0], q[1], q[2], q[3], euler);
+    return euler[0] + euler[1] + euler[2];
+}
+
+static float readCached(hf::StateCache & cache)
+{
+    const float * euler = cache.getEulerAngles();
+    return euler[0] + euler[1] + euler[2];
+}
+
+static void testTiming(void)
+{
+    printf("\nThree readers of the Euler angles per quaternion update\n");
+
+    hf::StateCache cache;
+    cache.reset();
+
+    float sum = 0;
+
+    uint64_t bestDirect = UINT64_MAX;
+    uint64_t bestCached = UINT64_MAX;
+
+    for (uint8_t pass=0; pass<5; ++pass) {
+
+        uint64_t start = cycles();
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            float q[4] = {0};
+            fromEuler(0.2f * sinf(k * 1e-3f), 0.1f, 0, q);
+            cache.setQuaternion(q[0], q[1], q[2], q[3]);
+            for (uint8_t j=0; j<3; ++j) {
+                sum += readDirect(cache.getQuaternion());
+            }
+        }
+        uint64_t elapsed = cycles() - start;
+        bestDirect = elapsed < bestDirect ? elapsed : bestDirect;
+
+        start = cycles();
+        for (uint32_t k=0; k<ITERATIONS; ++k) {
+            float q[4] = {0};
+            fromEuler(0.2f * sinf(k * 1e-3f), 0.1f, 0, q);
+            cache.setQuaternion(q[0], q[1], q[2], q[3]);
+            for (uint8_t j=0; j<3; ++j) {
+                sum += readCached(cache);
+            }
+        }
+        elapsed = cycles() - start;
+        bestCached = elapsed < bestCached ? elapsed : bestCached;
+    }
+
+    double direct = (double)bestDirect / ITERATIONS;
+    double cached = (double)bestCached / ITERATIONS;
+
+    printf("%-40s %8.1f cycles/update\n", "Each reader computes them", direct);
+    printf("%-40s %8.1f cycles/update\n", "Read through StateCache", cached);
+
+    check(cached < direct, "StateCache is cheaper");
+
+    // Keep the compiler from discarding the work
+    if (sum > 1e30) {
+        printf("%f\n", sum);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    testDerived();
+    testVersions();
+    testTiming();
+
+    return finish();
+}
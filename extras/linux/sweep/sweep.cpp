@@ -0,0 +1,295 @@
+/*
+   Monte Carlo sweep of PID gains over many simulated flights
+
+   Each run draws RatePid and LevelPid gains from the ranges below, plus a
+   wind-gust seed and a sensor-noise seed, and flies the SimFlight
+   scenario headless.  Runs are spread over all cores with a work-stealing
+   pool.  Everything a run uses is derived from its index, so results do
+   not depend on the thread count or on which thread flew which run.
+
+   Usage: sweep [RUNS [SECONDS [THREADS [OUTFILE]]]]
+
+   The output file starts with a header_t, followed by one record_t per
+   run, in run order (see below; all fields little-endian).
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "../sitl/simflight.hpp"
+#include "workpool.hpp"
+
+static const uint32_t DEFAULT_RUNS = 1000;
+static const float DEFAULT_SECONDS = 30;
+static const uint16_t LOOP_HZ = 1000;
+
+static const char * DEFAULT_OUTFILE = "sweep.dat";
+
+// Gain ranges: {minimum, maximum}
+static const float KP_RANGE[2]     = {0.02f,  0.30f};
+static const float KI_RANGE[2]     = {0.00f,  0.01f};
+static const float KD_RANGE[2]     = {0.00f,  0.05f};
+static const float KP_YAW_RANGE[2] = {0.05f,  0.30f};
+static const float KI_YAW_RANGE[2] = {0.00f,  0.05f};
+static const float LEVEL_RANGE[2]  = {0.10f,  1.00f};
+
+// Same noise and gust strength for every run; only the seeds differ
+static const hf::SimFlight::noise_t NOISE = {
+    0.01f,  // gyrometer, rad/sec
+    0.002f, // quaternion
+    0.002f, // gust torque, N m
+    0.2f    // gust force, N
+};
+
+// Seeds each run's generators from its index
+static const uint32_t GAIN_SEED        = 0x13579BDF;
+static const uint32_t DISTURBANCE_SEED = 0x2468ACE0;
+static const uint32_t NOISE_SEED       = 0x0F1E2D3C;
+
+typedef struct {
+
+    char     magic[8];      // "HFSWEEP1"
+    uint32_t recordSize;    // bytes
+    uint32_t runs;
+    float    seconds;       // simulated per run
+    uint32_t loopHz;
+
+} header_t;
+
+typedef struct {
+
+    uint32_t run;
+    uint32_t disturbanceSeed;
+    uint32_t noiseSeed;
+    uint32_t crashed;
+
+    hf::SimFlight::gains_t gains;
+
+    float trackingError;    // degrees RMS
+    float altitudeError;    // meters RMS
+    float saturationTime;   // seconds
+    float settlingTime;     // seconds
+    float maxTilt;          // degrees
+
+} record_t;
+
+static_assert(sizeof(record_t) == 60, "record_t must be packed");
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Spreads consecutive run indices across the generator's state space
+static uint32_t hash(uint32_t x, uint32_t seed)
+{
+    x ^= seed;
+    x ^= x >> 16;
+    x *= 0x7FEB352D;
+    x ^= x >> 15;
+    x *= 0x846CA68B;
+    x ^= x >> 16;
+    return x;
+}
+
+static float draw(hf::SimNoise & rng, const float range[2])
+{
+    return rng.uniform(range[0], range[1]);
+}
+
+static void fly(uint32_t run, float duration, record_t & record)
+{
+    hf::SimNoise rng(hash(run, GAIN_SEED));
+
+    record.run = run;
+    record.disturbanceSeed = hash(run, DISTURBANCE_SEED);
+    record.noiseSeed = hash(run, NOISE_SEED);
+
+    record.gains.Kp    = draw(rng, KP_RANGE);
+    record.gains.Ki    = draw(rng, KI_RANGE);
+    record.gains.Kd    = draw(rng, KD_RANGE);
+    record.gains.KpYaw = draw(rng, KP_YAW_RANGE);
+    record.gains.KiYaw = draw(rng, KI_YAW_RANGE);
+    record.gains.level = draw(rng, LEVEL_RANGE);
+
+    hf::SimFlight flight(record.gains);
+    flight.setNoise(NOISE, record.disturbanceSeed, record.noiseSeed);
+
+    hf::SimFlight::metrics_t metrics = {};
+    flight.fly(duration, LOOP_HZ, metrics);
+
+    record.crashed        = metrics.crashed;
+    record.trackingError  = metrics.trackingError;
+    record.altitudeError  = metrics.altitudeError;
+    record.saturationTime = metrics.saturationTime;
+    record.settlingTime   = metrics.settlingTime;
+    record.maxTilt        = metrics.maxTilt;
+}
+
+static bool write(const char * filename, const std::vector<record_t> & records, float duration)
+{
+    FILE * fp = fopen(filename, "wb");
+
+    if (!fp) {
+        return false;
+    }
+
+    header_t header = {};
+    memcpy(header.magic, "HFSWEEP1", 8);
+    header.recordSize = sizeof(record_t);
+    header.runs = records.size();
+    header.seconds = duration;
+    header.loopHz = LOOP_HZ;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(records.data(), sizeof(record_t), records.size(), fp) == records.size();
+
+    return fclose(fp) == 0 && ok;
+}
+
+static void printRecord(const record_t & r)
+{
+    printf("%6u  %5.3f %6.4f %5.3f %5.3f %6.4f %5.3f  %7.2f %7.3f %7.2f %7.2f\n",
+            r.run, r.gains.Kp, r.gains.Ki, r.gains.Kd, r.gains.KpYaw, r.gains.KiYaw, r.gains.level,
+            r.trackingError, r.altitudeError, r.saturationTime, r.settlingTime);
+}
+
+static void usage(FILE * fp, const char * name)
+{
+    fprintf(fp, "Usage: %s [RUNS [SECONDS [THREADS [OUTFILE]]]]\n", name);
+    fprintf(fp, "  RUNS     flights to simulate, a positive integer (default %u)\n", DEFAULT_RUNS);
+    fprintf(fp, "  SECONDS  length of each flight, a positive number (default %.0f)\n", DEFAULT_SECONDS);
+    fprintf(fp, "  THREADS  worker threads, a positive integer (default: one per core)\n");
+    fprintf(fp, "  OUTFILE  binary results file (default %s)\n", DEFAULT_OUTFILE);
+}
+
+// A positive integer that fits in 32 bits, with nothing after it
+static bool parseCount(const char * s, uint32_t & value)
+{
+    // strtoul() would take a minus sign and wrap the value around
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+
+    char * end = NULL;
+    errno = 0;
+    unsigned long n = strtoul(s, &end, 10);
+
+    if (errno != 0 || *end != 0 || n == 0 || n > UINT32_MAX) {
+        return false;
+    }
+
+    value = (uint32_t)n;
+
+    return true;
+}
+
+// A positive, finite number, with nothing after it
+static bool parseSeconds(const char * s, float & value)
+{
+    char * end = NULL;
+    errno = 0;
+    float x = strtof(s, &end);
+
+    if (end == s || errno != 0 || *end != 0 || !std::isfinite(x) || x <= 0) {
+        return false;
+    }
+
+    value = x;
+
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+        usage(stdout, argv[0]);
+        return 0;
+    }
+
+    uint32_t runs = DEFAULT_RUNS;
+    float duration = DEFAULT_SECONDS;
+    uint32_t threads = std::thread::hardware_concurrency();
+    const char * outfile = argc > 4 ? argv[4] : DEFAULT_OUTFILE;
+
+    if (argc > 5 ||
+            (argc > 1 && !parseCount(argv[1], runs)) ||
+            (argc > 2 && !parseSeconds(argv[2], duration)) ||
+            (argc > 3 && !parseCount(argv[3], threads))) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    std::vector<record_t> records(runs);
+
+    hf::WorkPool pool(threads);
+
+    double start = seconds();
+
+    // Each job writes only its own record, so no locking is needed
+    pool.run(runs, [&](uint32_t run) { fly(run, duration, records[run]); });
+
+    double elapsed = seconds() - start;
+
+    if (!write(outfile, records, duration)) {
+        fprintf(stderr, "Unable to write %s\n", outfile);
+        return 1;
+    }
+
+    uint32_t crashes = 0;
+    for (const record_t & r : records) {
+        crashes += r.crashed;
+    }
+
+    printf("%u runs of %.0f sec on %u threads in %.2f sec: %.1f runs/sec, %.0fx real time, %u steals, %u crashes\n",
+            runs, duration, pool.getThreadCount(), elapsed, runs / elapsed, runs * duration / elapsed,
+            pool.getSteals(), crashes);
+
+    printf("Wrote %s\n", outfile);
+
+    // Best runs by tracking error, among those that didn't crash
+    std::vector<record_t> best;
+    for (const record_t & r : records) {
+        if (!r.crashed) {
+            best.push_back(r);
+        }
+    }
+
+    std::sort(best.begin(), best.end(),
+            [](const record_t & a, const record_t & b) { return a.trackingError < b.trackingError; });
+
+    printf("\n%6s  %5s %6s %5s %5s %6s %5s  %7s %7s %7s %7s\n",
+            "Run", "Kp", "Ki", "Kd", "KpYaw", "KiYaw", "Level", "Track", "Alt", "Sat", "Settle");
+
+    for (uint32_t k=0; k<best.size() && k<5; ++k) {
+        printRecord(best[k]);
+    }
+
+    return 0;
+}
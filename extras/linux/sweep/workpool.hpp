@@ -0,0 +1,166 @@
+/*
+   Work-stealing thread pool for running many independent jobs
+
+   Jobs are numbered 0..N-1 and dealt out in contiguous blocks, one deque
+   per worker.  A worker takes jobs from the back of its own deque; when
+   that runs dry it steals from the front of another worker's deque, so
+   a worker that draws a batch of slow jobs doesn't hold up the rest.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hf {
+
+    class WorkPool {
+
+        private:
+
+            typedef struct {
+
+                std::mutex lock;
+                std::deque<uint32_t> jobs;
+                uint32_t steals;
+
+            } worker_t;
+
+            std::vector<worker_t> _workers;
+
+            bool popOwn(worker_t & worker, uint32_t & job)
+            {
+                std::lock_guard<std::mutex> guard(worker.lock);
+
+                if (worker.jobs.empty()) {
+                    return false;
+                }
+
+                job = worker.jobs.back();
+                worker.jobs.pop_back();
+                return true;
+            }
+
+            bool steal(uint32_t thief, uint32_t & job)
+            {
+                uint32_t n = _workers.size();
+
+                // Start with the next worker over so thieves spread out
+                for (uint32_t k=1; k<n; ++k) {
+
+                    worker_t & victim = _workers[(thief + k) % n];
+
+                    std::lock_guard<std::mutex> guard(victim.lock);
+
+                    if (!victim.jobs.empty()) {
+                        job = victim.jobs.front();
+                        victim.jobs.pop_front();
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            void work(uint32_t index, const std::function<void(uint32_t)> & fun)
+            {
+                worker_t & worker = _workers[index];
+
+                uint32_t job = 0;
+
+                while (true) {
+
+                    if (popOwn(worker, job)) {
+                        fun(job);
+                    }
+
+                    // Jobs never spawn more jobs, so once every deque is empty we're done
+                    else if (steal(index, job)) {
+                        worker.steals++;
+                        fun(job);
+                    }
+
+                    else {
+                        break;
+                    }
+                }
+            }
+
+        public:
+
+            WorkPool(uint32_t threads)
+                : _workers(threads > 0 ? threads : 1)
+            {
+            }
+
+            uint32_t getThreadCount(void)
+            {
+                return _workers.size();
+            }
+
+            // Total number of jobs taken from another worker's deque during the last run()
+            uint32_t getSteals(void)
+            {
+                uint32_t total = 0;
+                for (worker_t & worker : _workers) {
+                    total += worker.steals;
+                }
+                return total;
+            }
+
+            /**
+             * Calls fun(job) for job = 0..count-1 across all threads, returning once every job is done.
+             * fun must be safe to call concurrently for different jobs.
+             */
+            void run(uint32_t count, const std::function<void(uint32_t)> & fun)
+            {
+                uint32_t n = _workers.size();
+
+                // Deal out contiguous blocks; worker k pops its block from the back
+                for (uint32_t k=0; k<n; ++k) {
+                    worker_t & worker = _workers[k];
+                    worker.jobs.clear();
+                    worker.steals = 0;
+                    for (uint32_t job=k*count/n; job<(k+1)*count/n; ++job) {
+                        worker.jobs.push_back(job);
+                    }
+                }
+
+                std::vector<std::thread> threads;
+
+                for (uint32_t k=1; k<n; ++k) {
+                    threads.push_back(std::thread(&WorkPool::work, this, k, std::cref(fun)));
+                }
+
+                // The calling thread is worker 0
+                work(0, fun);
+
+                for (std::thread & thread : threads) {
+                    thread.join();
+                }
+            }
+
+    }; // class WorkPool
+
+} // namespace hf
@@ -23,17 +23,20 @@
 #include <stdarg.h>
 #include <stdint.h>
 
+#include "datatypes.hpp"
+
 namespace hf {
 
     class Board {
 
-        friend class Hackflight;
+        friend class Dispatch;
         friend class Gyrometer;
         friend class Quaternion;
         friend class Accelerometer;
         friend class Barometer;
         friend class Debugger;
         friend class Mixer;
+        friend class Profiler;
 
         protected:
 
@@ -56,7 +59,26 @@ namespace hf {
             virtual bool  getQuaternion(float & qw, float & qx, float & qy, float & qz) = 0;
             virtual bool  getGyrometer(float & gx, float & gy, float & gz) = 0;
             virtual void  writeMotor(uint8_t index, float value) = 0;
-            virtual float getTime(void) = 0;
+
+            // Override this if your board can set all its motors in one timer or DMA update, so they change
+            // at the same instant.  Otherwise each motor is written in turn.
+            virtual void  writeMotors(const float * values, uint8_t count)
+            {
+                for (uint8_t i = 0; i < count; i++) {
+                    writeMotor(i, values[i]);
+                }
+            }
+
+            // Override this to return true if your motors need a value every loop, as DShot ESCs do.
+            // Otherwise the mixer writes them only when a value changes.
+            virtual bool  motorsNeedRefresh(void) { return false; }
+
+            // Free-running microsecond counter; may wrap, since Hackflight extends it to 64 bits (see Timebase)
+            virtual uint32_t getMicros(void) = 0;
+
+            // Override this if your board queues gyrometer samples from a data-ready interrupt (see SpscRing).
+            // Return the oldest queued sample, or false when the queue is empty.
+            virtual bool popGyrometer(gyroSample_t & sample) { (void)sample; return false; }
 
             //------------------------- Support for additional surface-mount sensors -------------------------------------
             virtual bool  getAccelerometer(float & ax, float & ay, float & az) { (void)ax; (void)ay; (void)az; return false; }
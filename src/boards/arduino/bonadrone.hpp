@@ -80,12 +80,12 @@ namespace hf {
 
             virtual bool  getQuaternion(float & qw, float & qx, float & qy, float & qz) override 
             {
-                return SoftwareQuaternionBoard::getQuaternion(qw, qx, qy, qz, getTime());
+                return SoftwareQuaternionBoard::getQuaternion(qw, qx, qy, qz, getMicros64());
             }
 
             virtual bool  getGyrometer(float & gx, float & gy, float & gz) override
             {
-                return SoftwareQuaternionBoard::getGyrometer(gx, gy, gz);
+                return SoftwareQuaternionBoard::getGyrometer(gx, gy, gz, getMicros64());
             }
 
             virtual bool imuReady(void) override
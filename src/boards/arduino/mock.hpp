@@ -28,7 +28,9 @@ namespace hf {
 
         private:
 
-            float _time = 0;
+            static constexpr uint32_t UPDATE_PERIOD_USEC = 10000;
+
+            uint64_t _usec = 0;
 
             // motionless and sligthly off-level
             float _qw = 0.90f;
@@ -48,10 +50,10 @@ namespace hf {
                 qy = _qy;
                 qz = _qz;
 
-                float time = getTime();
+                uint64_t usec = getMicros64();
 
-                if (time-_time > .01) {
-                    _time = time;
+                if (usec - _usec > UPDATE_PERIOD_USEC) {
+                    _usec = usec;
                     return true;
                 }
 
@@ -64,10 +66,10 @@ namespace hf {
                 gy = _gy;
                 gz = _gz;
 
-                float time = getTime();
+                uint64_t usec = getMicros64();
 
-                if (time-_time > .01) {
-                    _time = time;
+                if (usec - _usec > UPDATE_PERIOD_USEC) {
+                    _usec = usec;
                     return true;
                 }
 
@@ -103,7 +105,7 @@ namespace hf {
 
                 // Set up to receive telemetry over Serial1
                 Serial1.begin(115200);
-                _time = 0;
+                _usec = 0;
             }
 
     }; // class MockBoard
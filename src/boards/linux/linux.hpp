@@ -0,0 +1,267 @@
+/*
+   Board subclass for running Hackflight natively on a Linux workstation
+
+   Supports benchmarking, profiling and regression-testing the core
+   algorithm with the normal host toolchain.  IMU data, serial bytes and
+   (via LinuxReceiver) stick values are injected by the calling program;
+   motor values are stored where the program can read them back.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <time.h>
+
+#include "filters.hpp"
+#include "spscring.hpp"
+#include "boards/realboard.hpp"
+
+// Provide the micros(), delay() declared by RealBoard for non-Arduino boards
+extern "C" {
+
+    uint32_t micros(void)
+    {
+        static struct timespec _start;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (_start.tv_sec == 0 && _start.tv_nsec == 0) {
+            _start = now;
+        }
+
+        return (uint32_t)((now.tv_sec - _start.tv_sec) * 1000000 + (now.tv_nsec - _start.tv_nsec) / 1000);
+    }
+
+    void delay(uint32_t msec)
+    {
+        struct timespec ts;
+        ts.tv_sec  = msec / 1000;
+        ts.tv_nsec = (msec % 1000) * 1000000;
+        nanosleep(&ts, NULL);
+    }
+
+} // extern "C"
+
+namespace hf {
+
+    class LinuxBoard : public RealBoard {
+
+        // Supports static dispatch from HackflightCore
+        friend class Dispatch;
+
+        private:
+
+            static const uint8_t MAXMOTORS = 20;
+
+            // Matches the unsigned-byte indexing used for wraparound below
+            static const uint16_t SERIAL_BUFSIZE = 256;
+
+            // Most recently injected IMU values, plus flags saying whether they're new
+            float _qw = 1;
+            float _qx = 0;
+            float _qy = 0;
+            float _qz = 0;
+            float _gx = 0;
+            float _gy = 0;
+            float _gz = 0;
+            float _ax = 0;
+            float _ay = 0;
+            float _az = 0;
+
+            bool _gotQuaternion = false;
+            bool _gotGyrometer = false;
+            bool _gotAccelerometer = false;
+
+            // Samples queued by gyrometerInterrupt(), plus a count of samples lost to a full queue
+            SpscRing<gyroSample_t, 16> _gyroQueue;
+            uint32_t _gyroDropped = 0;
+
+            float _motors[MAXMOTORS] = {0};
+
+            bool _led = false;
+
+            // Serial bytes sent to the board, and bytes the board has sent back
+            uint8_t _rxbuf[SERIAL_BUFSIZE] = {0};
+            uint8_t _rxhead = 0;
+            uint8_t _rxtail = 0;
+            uint8_t _txbuf[SERIAL_BUFSIZE] = {0};
+            uint8_t _txhead = 0;
+            uint8_t _txtail = 0;
+
+        protected:
+
+            virtual void setLed(bool isOn) override
+            {
+                _led = isOn;
+            }
+
+            virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz) override
+            {
+                qw = _qw;
+                qx = _qx;
+                qy = _qy;
+                qz = _qz;
+
+                bool result = _gotQuaternion;
+                _gotQuaternion = false;
+                return result;
+            }
+
+            virtual bool getGyrometer(float & gx, float & gy, float & gz) override
+            {
+                gx = _gx;
+                gy = _gy;
+                gz = _gz;
+
+                bool result = _gotGyrometer;
+                _gotGyrometer = false;
+                return result;
+            }
+
+            virtual bool popGyrometer(gyroSample_t & sample) override
+            {
+                return _gyroQueue.pop(sample);
+            }
+
+            virtual bool getAccelerometer(float & ax, float & ay, float & az) override
+            {
+                ax = _ax;
+                ay = _ay;
+                az = _az;
+
+                bool result = _gotAccelerometer;
+                _gotAccelerometer = false;
+                return result;
+            }
+
+            virtual void writeMotor(uint8_t index, float value) override
+            {
+                _motors[index] = value;
+            }
+
+            virtual void writeMotors(const float * values, uint8_t count) override
+            {
+                for (uint8_t i = 0; i < count; i++) {
+                    _motors[i] = values[i];
+                }
+            }
+
+            virtual uint8_t serialNormalAvailable(void) override
+            {
+                return (uint8_t)(_rxhead - _rxtail);
+            }
+
+            virtual uint8_t serialNormalRead(void) override
+            {
+                return _rxbuf[_rxtail++];
+            }
+
+            virtual void serialNormalWrite(uint8_t c) override
+            {
+                _txbuf[_txhead++] = c;
+            }
+
+        public:
+
+            LinuxBoard(void)
+            {
+                // No LED to flash on a workstation, so we skip RealBoard::init()
+                _led = false;
+            }
+
+            void setQuaternion(float qw, float qx, float qy, float qz)
+            {
+                _qw = qw;
+                _qx = qx;
+                _qy = qy;
+                _qz = qz;
+                _gotQuaternion = true;
+            }
+
+            void setGyrometer(float gx, float gy, float gz)
+            {
+                _gx = gx;
+                _gy = gy;
+                _gz = gz;
+                _gotGyrometer = true;
+            }
+
+            /**
+             * Stands in for a gyro data-ready interrupt handler: timestamps the sample and queues it.
+             * May be called from one thread other than the one running Hackflight.
+             */
+            void gyrometerInterrupt(float gx, float gy, float gz)
+            {
+                gyroSample_t sample = {gx, gy, gz, micros()};
+
+                if (!_gyroQueue.push(sample)) {
+                    __atomic_add_fetch(&_gyroDropped, 1, __ATOMIC_RELAXED);
+                }
+            }
+
+            uint32_t getGyrometerDropped(void)
+            {
+                return __atomic_load_n(&_gyroDropped, __ATOMIC_RELAXED);
+            }
+
+            void setAccelerometer(float ax, float ay, float az)
+            {
+                _ax = ax;
+                _ay = ay;
+                _az = az;
+                _gotAccelerometer = true;
+            }
+
+            float getMotor(uint8_t index)
+            {
+                return _motors[index];
+            }
+
+            bool getLed(void)
+            {
+                return _led;
+            }
+
+            // Queues a byte as though it had arrived over the serial port
+            void serialInject(uint8_t c)
+            {
+                _rxbuf[_rxhead++] = c;
+            }
+
+            // Returns true and a byte if the board has written one to the serial port
+            bool serialCollect(uint8_t & c)
+            {
+                if (_txhead == _txtail) {
+                    return false;
+                }
+
+                c = _txbuf[_txtail++];
+
+                return true;
+            }
+
+    }; // class LinuxBoard
+
+    void Board::outbuf(char * buf)
+    {
+        fputs(buf, stdout);
+    }
+
+} // namespace hf
@@ -23,6 +23,7 @@
 #include "board.hpp"
 #include "debugger.hpp"
 #include "datatypes.hpp"
+#include "timebase.hpp"
 
 // Support delay(), micros() on non-Arduino boards
 #ifndef ARDUINO
@@ -40,12 +41,19 @@ namespace hf {
 
         private:
 
-            static constexpr float   LED_STARTUP_FLASH_SECONDS = 1.0;
-            static constexpr uint8_t LED_STARTUP_FLASH_COUNT   = 20;
-            static constexpr float   LED_SLOWFLASH_SECONDS     = 0.25;
+            static constexpr float    LED_STARTUP_FLASH_SECONDS = 1.0;
+            static constexpr uint8_t  LED_STARTUP_FLASH_COUNT   = 20;
+            static constexpr uint32_t LED_SLOWFLASH_USEC        = 250000;
 
             bool _shouldFlash = false;
 
+            // Supports slow LED flashing
+            bool _flashState = false;
+            uint64_t _flashUsec = 0;
+
+            // Board-side 64-bit time, for use on the control core only
+            Timebase _timebase;
+
             // Supports MSP over wireless protcols like Bluetooth
             bool _useSerialTelemetry = false;
 
@@ -72,9 +80,15 @@ namespace hf {
                 _shouldFlash = false;
             }
 
-            float getTime(void)
+            uint32_t getMicros(void)
+            {
+                return micros();
+            }
+
+            // Current time on a 64-bit timebase, for timing done by the board itself
+            uint64_t getMicros64(void)
             {
-                return micros() / 1.e6f;
+                return _timebase.update(micros());
             }
 
             void delaySeconds(float sec)
@@ -147,15 +161,12 @@ namespace hf {
             {
                 if (shouldflash) {
 
-                    static float _time;
-                    static bool state;
-
-                    float time = getTime();
+                    uint64_t usec = getMicros64();
 
-                    if (time-_time > LED_SLOWFLASH_SECONDS) {
-                        state = !state;
-                        setLed(state);
-                        _time = time;
+                    if (usec - _flashUsec > LED_SLOWFLASH_USEC) {
+                        _flashState = !_flashState;
+                        setLed(_flashState);
+                        _flashUsec = usec;
                     }
                 }
 
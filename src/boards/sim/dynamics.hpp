@@ -0,0 +1,264 @@
+/*
+   Rigid-body dynamics for an X-configuration quadcopter
+
+   Uses the ArduPilot motor numbering of MixerQuadXAP:
+
+    3cw   1ccw
+       \ /
+        ^
+       / \
+    2ccw  4cw
+
+   World frame is North-East-Down; body frame is Forward-Right-Down, so
+   body angular velocities and the attitude quaternion follow the sign
+   conventions that Board expects for gyrometer and quaternion.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+
+#include "filters.hpp"
+
+namespace hf {
+
+    class QuadrotorDynamics {
+
+        public:
+
+            static const uint8_t NMOTORS = 4;
+
+            typedef struct {
+
+                float mass;         // kg
+                float arm;          // m, center to motor
+                float Ixx;          // kg m^2
+                float Iyy;
+                float Izz;
+                float kT;           // N / (rad/s)^2, thrust per motor
+                float kQ;           // N m / (rad/s)^2, drag torque per motor
+                float maxOmega;     // rad/s, motor speed at value 1
+                float motorTau;     // s, first-order motor spin-up time constant
+                float linearDrag;   // N / (m/s)
+
+            } params_t;
+
+            // A 500-gram, 200-millimeter quad with a thrust-to-weight ratio of about 3
+            static params_t defaultParams(void)
+            {
+                params_t params = { 0.5f, 0.1f, 2.5e-3f, 2.5e-3f, 4.5e-3f, 1.0e-6f, 1.6e-8f, 2000.f, 0.02f, 0.1f };
+                return params;
+            }
+
+        private:
+
+            static constexpr float G = 9.80665f;
+
+            // Motor positions in body frame (x forward, y right), and yaw torque signs (CCW props push body CW = +)
+            const float MOTOR_X[NMOTORS]   = { +1, -1, +1, -1 };
+            const float MOTOR_Y[NMOTORS]   = { +1, -1, -1, +1 };
+            const float MOTOR_DIR[NMOTORS] = { +1, +1, -1, -1 };
+
+            params_t _p;
+
+            // Motor arm projected onto body axes for a 45-degree X frame
+            float _armxy = 0;
+
+            float _motorValues[NMOTORS] = {0};
+            float _omegas[NMOTORS] = {0};
+
+            // Extra torque (body) and force (world) applied from outside, e.g. wind gusts
+            float _disturbanceTorque[3] = {0};
+            float _disturbanceForce[3] = {0};
+
+            bool _airborne = false;
+
+        public:
+
+            // World frame
+            float position[3] = {0};
+            float velocity[3] = {0};
+
+            // Attitude (rotates body-frame vectors into world frame), and body angular velocity
+            float quaternion[4] = {1, 0, 0, 0};
+            float angularVel[3] = {0};
+
+            // Body-frame specific force (what an accelerometer reads), in Gs
+            float accel[3] = {0, 0, -1};
+
+            QuadrotorDynamics(const params_t & params)
+            {
+                _p = params;
+                _armxy = _p.arm / sqrtf(2.f);
+            }
+
+            QuadrotorDynamics(void)
+                : QuadrotorDynamics(defaultParams())
+            {
+            }
+
+            void reset(void)
+            {
+                for (uint8_t k=0; k<3; ++k) {
+                    position[k] = 0;
+                    velocity[k] = 0;
+                    angularVel[k] = 0;
+                    _disturbanceTorque[k] = 0;
+                    _disturbanceForce[k] = 0;
+                }
+
+                quaternion[0] = 1;
+                quaternion[1] = 0;
+                quaternion[2] = 0;
+                quaternion[3] = 0;
+
+                for (uint8_t k=0; k<NMOTORS; ++k) {
+                    _motorValues[k] = 0;
+                    _omegas[k] = 0;
+                }
+
+                _airborne = false;
+            }
+
+            void setMotor(uint8_t index, float value)
+            {
+                _motorValues[index] = Filter::constrainMinMax(value, 0, 1);
+            }
+
+            void setDisturbance(const float torque[3], const float force[3])
+            {
+                for (uint8_t k=0; k<3; ++k) {
+                    _disturbanceTorque[k] = torque[k];
+                    _disturbanceForce[k] = force[k];
+                }
+            }
+
+            float getMotor(uint8_t index)
+            {
+                return _motorValues[index];
+            }
+
+            bool isAirborne(void)
+            {
+                return _airborne;
+            }
+
+            // Altitude above ground is negative of NED down position
+            float getAltitude(void)
+            {
+                return -position[2];
+            }
+
+            void update(float dt)
+            {
+                // Motor spin-up, then thrust and drag torque
+                float thrust = 0;
+                float torque[3] = {_disturbanceTorque[0], _disturbanceTorque[1], _disturbanceTorque[2]};
+                float alpha = dt / (_p.motorTau + dt);
+                for (uint8_t k=0; k<NMOTORS; ++k) {
+                    _omegas[k] += alpha * (_motorValues[k] * _p.maxOmega - _omegas[k]);
+                    float w2 = _omegas[k] * _omegas[k];
+                    float t = _p.kT * w2;
+                    thrust    += t;
+                    torque[0] -= MOTOR_Y[k] * _armxy * t;
+                    torque[1] += MOTOR_X[k] * _armxy * t;
+                    torque[2] += MOTOR_DIR[k] * _p.kQ * w2;
+                }
+
+                // Euler's equation for a diagonal inertia tensor
+                float p = angularVel[0];
+                float q = angularVel[1];
+                float r = angularVel[2];
+                angularVel[0] += dt * (torque[0] - (_p.Izz - _p.Iyy) * q * r) / _p.Ixx;
+                angularVel[1] += dt * (torque[1] - (_p.Ixx - _p.Izz) * p * r) / _p.Iyy;
+                angularVel[2] += dt * (torque[2] - (_p.Iyy - _p.Ixx) * p * q) / _p.Izz;
+
+                // Integrate quaternion: qdot = q * (0, omega) / 2
+                float qw = quaternion[0];
+                float qx = quaternion[1];
+                float qy = quaternion[2];
+                float qz = quaternion[3];
+                p = angularVel[0];
+                q = angularVel[1];
+                r = angularVel[2];
+                float h = 0.5f * dt;
+                quaternion[0] = qw + h * (-qx*p - qy*q - qz*r);
+                quaternion[1] = qx + h * ( qw*p + qy*r - qz*q);
+                quaternion[2] = qy + h * ( qw*q - qx*r + qz*p);
+                quaternion[3] = qz + h * ( qw*r + qx*q - qy*p);
+                float norm = 1.f / sqrtf(quaternion[0]*quaternion[0] + quaternion[1]*quaternion[1] +
+                        quaternion[2]*quaternion[2] + quaternion[3]*quaternion[3]);
+                for (uint8_t k=0; k<4; ++k) {
+                    quaternion[k] *= norm;
+                }
+
+                // Thrust acts along body -z; rotate into world frame with third column of body-to-world matrix
+                qw = quaternion[0];
+                qx = quaternion[1];
+                qy = quaternion[2];
+                qz = quaternion[3];
+                float bz[3] = { 2*(qx*qz + qw*qy), 2*(qy*qz - qw*qx), qw*qw - qx*qx - qy*qy + qz*qz };
+
+                float force[3];
+                for (uint8_t k=0; k<3; ++k) {
+                    force[k] = -thrust * bz[k] - _p.linearDrag * velocity[k] + _disturbanceForce[k];
+                }
+
+                // Body-frame specific force: thrust and drag only, in Gs
+                accel[0] = 0;
+                accel[1] = 0;
+                accel[2] = -thrust / (_p.mass * G);
+
+                float accelWorld[3] = {force[0] / _p.mass, force[1] / _p.mass, force[2] / _p.mass + G};
+
+                // Stay on the ground until thrust exceeds weight
+                if (!_airborne && accelWorld[2] >= 0) {
+                    for (uint8_t k=0; k<3; ++k) {
+                        velocity[k] = 0;
+                        angularVel[k] = 0;
+                    }
+                    accel[2] = -1;
+                    return;
+                }
+
+                for (uint8_t k=0; k<3; ++k) {
+                    velocity[k] += dt * accelWorld[k];
+                    position[k] += dt * velocity[k];
+                }
+
+                _airborne = true;
+
+                // Landed
+                if (position[2] > 0) {
+                    position[2] = 0;
+                    for (uint8_t k=0; k<3; ++k) {
+                        velocity[k] = 0;
+                        angularVel[k] = 0;
+                    }
+                    quaternion[0] = 1;
+                    quaternion[1] = 0;
+                    quaternion[2] = 0;
+                    quaternion[3] = 0;
+                    _airborne = false;
+                }
+            }
+
+    }; // class QuadrotorDynamics
+
+} // namespace hf
@@ -0,0 +1,100 @@
+/*
+   Small, seedable pseudo-random source for simulated sensor noise and disturbances
+
+   Uses xorshift32, so each simulated vehicle can carry its own generator
+   and runs are repeatable regardless of how they are scheduled.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+namespace hf {
+
+    class SimNoise {
+
+        private:
+
+            uint32_t _state = 1;
+
+            // Second Box-Muller output, saved for the next call
+            float _spare = 0;
+            bool _haveSpare = false;
+
+        public:
+
+            SimNoise(uint32_t value=1)
+            {
+                seed(value);
+            }
+
+            void seed(uint32_t value)
+            {
+                // Xorshift gets stuck at zero
+                _state = value ? value : 0x9E3779B9;
+                _haveSpare = false;
+            }
+
+            uint32_t next(void)
+            {
+                _state ^= _state << 13;
+                _state ^= _state >> 17;
+                _state ^= _state << 5;
+                return _state;
+            }
+
+            // Uniform in [0,1)
+            float uniform(void)
+            {
+                return (next() >> 8) / 16777216.f;
+            }
+
+            // Uniform in [lo,hi)
+            float uniform(float lo, float hi)
+            {
+                return lo + (hi - lo) * uniform();
+            }
+
+            // Zero mean, unit variance
+            float gaussian(void)
+            {
+                if (_haveSpare) {
+                    _haveSpare = false;
+                    return _spare;
+                }
+
+                float u = 0;
+                while (u == 0) {
+                    u = uniform();
+                }
+                float v = uniform();
+
+                float r = sqrtf(-2 * logf(u));
+                float a = 2 * (float)M_PI * v;
+
+                _spare = r * sinf(a);
+                _haveSpare = true;
+
+                return r * cosf(a);
+            }
+
+    }; // class SimNoise
+
+} // namespace hf
@@ -0,0 +1,183 @@
+/*
+   Board subclass for lockstep software-in-the-loop simulation
+
+   A QuadrotorDynamics model stands in for the vehicle: each call to step()
+   advances a virtual clock, integrates the physics using the most recent
+   motor values, and makes fresh gyrometer, quaternion and accelerometer
+   readings available.  Nothing here depends on wall-clock time, so the
+   simulation runs as fast as the host can go.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "board.hpp"
+#include "boards/sim/dynamics.hpp"
+#include "boards/sim/noise.hpp"
+
+namespace hf {
+
+    class SimBoard : public Board {
+
+        // Supports static dispatch from HackflightCore
+        friend class Dispatch;
+
+        private:
+
+            // Virtual clock
+            uint64_t _usec = 0;
+
+            bool _gotQuaternion = false;
+            bool _gotGyrometer = false;
+            bool _gotAccelerometer = false;
+
+            bool _armed = false;
+
+            // Optional white noise on gyrometer (rad/sec) and quaternion (vector part)
+            SimNoise _noise;
+            float _gyroNoise = 0;
+            float _quatNoise = 0;
+
+        protected:
+
+            virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz) override
+            {
+                qw = dynamics.quaternion[0];
+                qx = dynamics.quaternion[1];
+                qy = dynamics.quaternion[2];
+                qz = dynamics.quaternion[3];
+
+                if (_quatNoise > 0) {
+                    qx += _quatNoise * _noise.gaussian();
+                    qy += _quatNoise * _noise.gaussian();
+                    qz += _quatNoise * _noise.gaussian();
+                    float norm = 1.f / sqrtf(qw*qw + qx*qx + qy*qy + qz*qz);
+                    qw *= norm;
+                    qx *= norm;
+                    qy *= norm;
+                    qz *= norm;
+                }
+
+                bool result = _gotQuaternion;
+                _gotQuaternion = false;
+                return result;
+            }
+
+            virtual bool getGyrometer(float & gx, float & gy, float & gz) override
+            {
+                gx = dynamics.angularVel[0];
+                gy = dynamics.angularVel[1];
+                gz = dynamics.angularVel[2];
+
+                if (_gyroNoise > 0) {
+                    gx += _gyroNoise * _noise.gaussian();
+                    gy += _gyroNoise * _noise.gaussian();
+                    gz += _gyroNoise * _noise.gaussian();
+                }
+
+                bool result = _gotGyrometer;
+                _gotGyrometer = false;
+                return result;
+            }
+
+            // Board convention is the negative of body-frame specific force
+            virtual bool getAccelerometer(float & ax, float & ay, float & az) override
+            {
+                ax = -dynamics.accel[0];
+                ay = -dynamics.accel[1];
+                az = -dynamics.accel[2];
+
+                bool result = _gotAccelerometer;
+                _gotAccelerometer = false;
+                return result;
+            }
+
+            virtual void writeMotor(uint8_t index, float value) override
+            {
+                dynamics.setMotor(index, value);
+            }
+
+            virtual uint32_t getMicros(void) override
+            {
+                return (uint32_t)_usec;
+            }
+
+            virtual void showArmedStatus(bool armed) override
+            {
+                _armed = armed;
+            }
+
+        public:
+
+            QuadrotorDynamics dynamics;
+
+            SimBoard(void)
+            {
+            }
+
+            SimBoard(const QuadrotorDynamics::params_t & params)
+                : dynamics(params)
+            {
+            }
+
+            /**
+             * Advances the virtual clock and the vehicle by the specified number of microseconds, and
+             * makes new sensor readings available.
+             */
+            void step(uint32_t usec)
+            {
+                _usec += usec;
+
+                dynamics.update(usec / 1e6f);
+
+                _gotQuaternion = true;
+                _gotGyrometer = true;
+                _gotAccelerometer = true;
+            }
+
+            /**
+             * Adds zero-mean Gaussian noise with the given standard deviations to the gyrometer and to
+             * the vector part of the quaternion.  The seed makes runs repeatable.
+             */
+            void setNoise(float gyroStddev, float quatStddev, uint32_t seed)
+            {
+                _gyroNoise = gyroStddev;
+                _quatNoise = quatStddev;
+                _noise.seed(seed);
+            }
+
+            uint64_t getSimMicros(void)
+            {
+                return _usec;
+            }
+
+            bool isArmed(void)
+            {
+                return _armed;
+            }
+
+    }; // class SimBoard
+
+    void Board::outbuf(char * buf)
+    {
+        fputs(buf, stdout);
+    }
+
+} // namespace hf
@@ -21,6 +21,7 @@
 #pragma once
 
 #include "filters.hpp"
+#include "timebase.hpp"
 #include "realboard.hpp"
 
 #include <math.h>
@@ -35,11 +36,19 @@ namespace hf {
             const float GYRO_MEAS_ERROR_DEG = 40.f;
             const float GYRO_MEAS_DRIFT_DEG =  0.f;
 
-            // Update quaternion after this number of gyro updates
-            const uint8_t QUATERNION_DIVISOR = 5;
+            // Every gyrometer sample is integrated into the quaternion, but the accelerometer correction
+            // runs only after this many samples, on their average
+            uint8_t _correctionDivisor = 5;
 
-            // Supports computing quaternion after a certain number of IMU readings
-            uint8_t _quatCycleCount = 0;
+            // Gyrometer samples since the last correction, and their summed accelerometer readings
+            uint8_t _sampleCount = 0;
+            float _axSum = 0;
+            float _aySum = 0;
+            float _azSum = 0;
+
+            // Times of the last gyrometer sample and the last correction
+            uint64_t _gyrometerUsec = 0;
+            uint64_t _correctionUsec = 0;
 
             // Params passed to Madgwick quaternion constructor
             const float _beta = sqrtf(3.0f / 4.0f) * Filter::deg2rad(GYRO_MEAS_ERROR_DEG);
@@ -56,7 +65,11 @@ namespace hf {
 
             // Quaternion support: even though MPU9250 has a magnetometer, we keep it simple for now by 
             // using a 6DOF fiter (accel, gyro)
+#ifdef HACKFLIGHT_FIXED_POINT
+            FixedMadgwickQuaternionFilter6DOF _quaternionFilter = FixedMadgwickQuaternionFilter6DOF(_beta, _zeta);
+#else
             MadgwickQuaternionFilter6DOF _quaternionFilter = MadgwickQuaternionFilter6DOF(_beta, _zeta);
+#endif
 
             virtual bool imuReady(void) = 0;
 
@@ -64,7 +77,25 @@ namespace hf {
 
         public:
 
-            bool getGyrometer(float & gx, float & gy, float & gz)
+            /**
+             * Sets how many gyrometer samples go by between accelerometer corrections of the quaternion
+             * (default 5, at least 1).  Each sample is integrated into the quaternion regardless.
+             */
+            void setCorrectionDivisor(uint8_t divisor)
+            {
+                _correctionDivisor = divisor > 0 ? divisor : 1;
+            }
+
+            /**
+             * Integrates gyrometer samples with coning correction; see
+             * MadgwickQuaternionFilter6DOF::useConingCorrection().
+             */
+            void useConingCorrection(void)
+            {
+                _quaternionFilter.useConingCorrection();
+            }
+
+            bool getGyrometer(float & gx, float & gy, float & gz, uint64_t usec)
             {
                 // Read acceleromter Gs, gyrometer degrees/sec
                 if (imuReady()) {
@@ -76,6 +107,21 @@ namespace hf {
                     _gy = Filter::deg2rad(_gy);
                     _gz = Filter::deg2rad(_gz);
 
+                    // Integrate the sample into the quaternion; the first one only starts the clock
+                    if (_gyrometerUsec > 0) {
+                        _quaternionFilter.propagate(_gx, _gy, _gz, Timebase::elapsed(_gyrometerUsec, usec));
+                    }
+                    else {
+                        _correctionUsec = usec;
+                    }
+                    _gyrometerUsec = usec;
+
+                    // Accumulate the accelerometer for the next correction
+                    _axSum += _ax;
+                    _aySum += _ay;
+                    _azSum += _az;
+                    _sampleCount++;
+
                     // Round to two decimal places
                     gx = Filter::round2(_gx);
                     gy = Filter::round2(_gy);
@@ -87,20 +133,30 @@ namespace hf {
                 return false;
             }
 
-            bool getQuaternion(float & qw, float & qx, float & qy, float & qz, float time)
+            bool getQuaternion(float & qw, float & qx, float & qy, float & qz, uint64_t usec)
             {
-                // Update quaternion after some number of IMU readings
-                _quatCycleCount = (_quatCycleCount + 1) % QUATERNION_DIVISOR;
+                // The gyrometer samples' own timestamps pace the corrections
+                (void)usec;
+
+                // Nothing to correct toward until a gyrometer sample has come in
+                if (_sampleCount == 0) {
+                    return false;
+                }
+
+                // Correct the quaternion once enough gyrometer samples have been integrated
+                if (_sampleCount >= _correctionDivisor) {
 
-                if (_quatCycleCount == 0) {
+                    // Step size is the time spanned by those samples
+                    float deltat = Timebase::elapsed(_correctionUsec, _gyrometerUsec);
+                    _correctionUsec = _gyrometerUsec;
 
-                    // Set integration time by time elapsed since last filter update
-                    static float _time;
-                    float deltat = time - _time;
-                    _time = time;
+                    // Correct toward the average accelerometer reading over those samples
+                    _quaternionFilter.correct(_axSum / _sampleCount, _aySum / _sampleCount, _azSum / _sampleCount, deltat);
 
-                    // Run the quaternion on the IMU values acquired in imuReadAccelGyro()                   
-                    _quaternionFilter.update(_ax, _ay, _az, _gx, _gy, _gz, deltat); 
+                    _axSum = 0;
+                    _aySum = 0;
+                    _azSum = 0;
+                    _sampleCount = 0;
 
                     // Copy the quaternion back out
                     qw = _quaternionFilter.q1;
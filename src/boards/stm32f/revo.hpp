@@ -92,6 +92,11 @@ class Revo : public hf::RealBoard, public hf::SoftwareQuaternionBoard {
             motor_write(index, value);
         }
 
+        virtual void writeMotors(const float * values, uint8_t count) override
+        {
+            motor_write_all(values, count);
+        }
+
         virtual void reboot(void) override
         {
             systemResetToBootloader();
@@ -99,12 +104,12 @@ class Revo : public hf::RealBoard, public hf::SoftwareQuaternionBoard {
 
         virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz) override
         {
-            return SoftwareQuaternionBoard::getQuaternion(qw, qx, qy, qz, getTime());
+            return SoftwareQuaternionBoard::getQuaternion(qw, qx, qy, qz, getMicros64());
         }
 
         virtual bool getGyrometer(float & gx, float & gy, float & gz) override
         {
-            return SoftwareQuaternionBoard::getGyrometer(gx, gy, gz);
+            return SoftwareQuaternionBoard::getGyrometer(gx, gy, gz, getMicros64());
         }
 
         virtual uint8_t serialNormalAvailable(void) override
@@ -81,6 +81,11 @@ class Stm32FBoard : public hf::RealBoard, public hf::SoftwareQuaternionBoard  {
             motor_write(index, value);
         }
 
+        void writeMotors(const float * values, uint8_t count)
+        {
+            motor_write_all(values, count);
+        }
+
         void reboot(void)
         {
             systemResetToBootloader();
@@ -88,12 +93,12 @@ class Stm32FBoard : public hf::RealBoard, public hf::SoftwareQuaternionBoard  {
 
         bool getQuaternion(float & qw, float & qx, float & qy, float & qz)
         {
-            return SoftwareQuaternionBoard::getQuaternion(qw, qx, qy, qz, getTime());
+            return SoftwareQuaternionBoard::getQuaternion(qw, qx, qy, qz, getMicros64());
         }
 
         bool getGyrometer(float & gx, float & gy, float & gz)
         {
-            return SoftwareQuaternionBoard::getGyrometer(gx, gy, gz);
+            return SoftwareQuaternionBoard::getGyrometer(gx, gy, gz, getMicros64());
         }
 
         uint8_t serialNormalAvailable(void)
@@ -71,6 +71,16 @@ extern "C" {
         pwmWriteMotor(index, MOTOR_MIN + value*(MOTOR_MAX-MOTOR_MIN));
     }
 
+    // Sets every channel's compare value, then starts the pulses on all of them in one timer update
+    void motor_write_all(const float * values, uint8_t count)
+    {
+        for (uint8_t index = 0; index < count; index++) {
+            pwmWriteMotor(index, MOTOR_MIN + values[index]*(MOTOR_MAX-MOTOR_MIN));
+        }
+
+        pwmCompleteMotorUpdate(count);
+    }
+
     void brushed_motors_init(uint8_t m1, uint8_t m2, uint8_t m3, uint8_t m4)
     {
         motors_init(BRUSHED_PWM_RATE, BRUSHED_IDLE_PULSE, PWM_TYPE_BRUSHED, true, m1, m2, m3, m4);
@@ -20,6 +20,10 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include "statecache.hpp"
+
 namespace hf {
 
     enum {
@@ -41,13 +45,23 @@ namespace hf {
 
         bool  armed;
 
-        float location[3];
-        float rotation[3]; 
-        float angularVel[3]; 
+        // Quaternion, angular velocity, and location, and what's derived from them
+        StateCache cache;
+
         float bodyAccel[3]; 
         float bodyVel[3]; 
         float inertialVel[3]; 
 
     } state_t;
 
+    // Gyrometer reading timestamped by the interrupt handler that collected it
+    typedef struct {
+
+        float    x;
+        float    y;
+        float    z;
+        uint32_t usec;  // Board::getMicros() counter at the interrupt
+
+    } gyroSample_t;
+
 } // namespace hf
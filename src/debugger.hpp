@@ -33,7 +33,7 @@ namespace hf {
 
     class Debugger {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         private:
 
@@ -0,0 +1,303 @@
+/*
+   Compile-time dispatch of Board and Receiver calls
+
+   Each call comes in two forms.  Given a pointer to the abstract Board or
+   Receiver, it is an ordinary virtual call.  Given a pointer to a concrete
+   class, it names that class's override directly, so there is no vtable
+   lookup and the compiler is free to inline it.  Overload resolution picks
+   the right form from the static type of the pointer, which is how
+   HackflightCore<BoardT, ReceiverT, MixerT> avoids virtual calls when it
+   is instantiated on concrete classes.
+
+   A concrete Board or Receiver class used this way must declare Dispatch
+   as a friend, since the methods it overrides are protected.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "board.hpp"
+#include "receiver.hpp"
+
+namespace hf {
+
+    class Dispatch {
+
+        public:
+
+            //------------------------------------------- Board --------------------------------------------------------
+
+            static bool getQuaternion(Board * board, float & qw, float & qx, float & qy, float & qz)
+            {
+                return board->getQuaternion(qw, qx, qy, qz);
+            }
+
+            template <typename BoardT>
+            static bool getQuaternion(BoardT * board, float & qw, float & qx, float & qy, float & qz)
+            {
+                return board->BoardT::getQuaternion(qw, qx, qy, qz);
+            }
+
+            static bool getGyrometer(Board * board, float & gx, float & gy, float & gz)
+            {
+                return board->getGyrometer(gx, gy, gz);
+            }
+
+            template <typename BoardT>
+            static bool getGyrometer(BoardT * board, float & gx, float & gy, float & gz)
+            {
+                return board->BoardT::getGyrometer(gx, gy, gz);
+            }
+
+            static bool popGyrometer(Board * board, gyroSample_t & sample)
+            {
+                return board->popGyrometer(sample);
+            }
+
+            template <typename BoardT>
+            static bool popGyrometer(BoardT * board, gyroSample_t & sample)
+            {
+                return board->BoardT::popGyrometer(sample);
+            }
+
+            static void writeMotor(Board * board, uint8_t index, float value)
+            {
+                board->writeMotor(index, value);
+            }
+
+            template <typename BoardT>
+            static void writeMotor(BoardT * board, uint8_t index, float value)
+            {
+                board->BoardT::writeMotor(index, value);
+            }
+
+            static void writeMotors(Board * board, const float * values, uint8_t count)
+            {
+                board->writeMotors(values, count);
+            }
+
+            template <typename BoardT>
+            static void writeMotors(BoardT * board, const float * values, uint8_t count)
+            {
+                writeMotors(board, &BoardT::writeMotors, values, count);
+            }
+
+            static bool motorsNeedRefresh(Board * board)
+            {
+                return board->motorsNeedRefresh();
+            }
+
+            template <typename BoardT>
+            static bool motorsNeedRefresh(BoardT * board)
+            {
+                return board->BoardT::motorsNeedRefresh();
+            }
+
+            static uint32_t getMicros(Board * board)
+            {
+                return board->getMicros();
+            }
+
+            template <typename BoardT>
+            static uint32_t getMicros(BoardT * board)
+            {
+                return board->BoardT::getMicros();
+            }
+
+            static uint8_t serialAvailableBytes(Board * board)
+            {
+                return board->serialAvailableBytes();
+            }
+
+            template <typename BoardT>
+            static uint8_t serialAvailableBytes(BoardT * board)
+            {
+                return board->BoardT::serialAvailableBytes();
+            }
+
+            static uint8_t serialReadByte(Board * board)
+            {
+                return board->serialReadByte();
+            }
+
+            template <typename BoardT>
+            static uint8_t serialReadByte(BoardT * board)
+            {
+                return board->BoardT::serialReadByte();
+            }
+
+            static void serialWriteByte(Board * board, uint8_t c)
+            {
+                board->serialWriteByte(c);
+            }
+
+            template <typename BoardT>
+            static void serialWriteByte(BoardT * board, uint8_t c)
+            {
+                board->BoardT::serialWriteByte(c);
+            }
+
+            static void adjustGyrometer(Board * board, float & gx, float & gy, float & gz)
+            {
+                board->adjustGyrometer(gx, gy, gz);
+            }
+
+            template <typename BoardT>
+            static void adjustGyrometer(BoardT * board, float & gx, float & gy, float & gz)
+            {
+                board->BoardT::adjustGyrometer(gx, gy, gz);
+            }
+
+            static void adjustQuaternion(Board * board, float & qw, float & qx, float & qy, float & qz)
+            {
+                board->adjustQuaternion(qw, qx, qy, qz);
+            }
+
+            template <typename BoardT>
+            static void adjustQuaternion(BoardT * board, float & qw, float & qx, float & qy, float & qz)
+            {
+                board->BoardT::adjustQuaternion(qw, qx, qy, qz);
+            }
+
+            static void adjustRollAndPitch(Board * board, float & roll, float & pitch)
+            {
+                board->adjustRollAndPitch(roll, pitch);
+            }
+
+            template <typename BoardT>
+            static void adjustRollAndPitch(BoardT * board, float & roll, float & pitch)
+            {
+                board->BoardT::adjustRollAndPitch(roll, pitch);
+            }
+
+            static void reboot(Board * board)
+            {
+                board->reboot();
+            }
+
+            template <typename BoardT>
+            static void reboot(BoardT * board)
+            {
+                board->BoardT::reboot();
+            }
+
+            static void showArmedStatus(Board * board, bool armed)
+            {
+                board->showArmedStatus(armed);
+            }
+
+            template <typename BoardT>
+            static void showArmedStatus(BoardT * board, bool armed)
+            {
+                board->BoardT::showArmedStatus(armed);
+            }
+
+            static void flashLed(Board * board, bool shouldflash)
+            {
+                board->flashLed(shouldflash);
+            }
+
+            template <typename BoardT>
+            static void flashLed(BoardT * board, bool shouldflash)
+            {
+                board->BoardT::flashLed(shouldflash);
+            }
+
+            //------------------------------------------ Receiver ------------------------------------------------------
+
+            static bool gotNewFrame(Receiver * receiver)
+            {
+                return receiver->gotNewFrame();
+            }
+
+            template <typename ReceiverT>
+            static bool gotNewFrame(ReceiverT * receiver)
+            {
+                return receiver->ReceiverT::gotNewFrame();
+            }
+
+            static void readRawvals(Receiver * receiver)
+            {
+                receiver->readRawvals();
+            }
+
+            template <typename ReceiverT>
+            static void readRawvals(ReceiverT * receiver)
+            {
+                receiver->ReceiverT::readRawvals();
+            }
+
+            static bool lostSignal(Receiver * receiver)
+            {
+                return receiver->lostSignal();
+            }
+
+            template <typename ReceiverT>
+            static bool lostSignal(ReceiverT * receiver)
+            {
+                return receiver->ReceiverT::lostSignal();
+            }
+
+            static uint8_t getAux1State(Receiver * receiver)
+            {
+                return receiver->getAux1State();
+            }
+
+            template <typename ReceiverT>
+            static uint8_t getAux1State(ReceiverT * receiver)
+            {
+                return receiver->ReceiverT::getAux1State();
+            }
+
+            static uint8_t getAux2State(Receiver * receiver)
+            {
+                return receiver->getAux2State();
+            }
+
+            template <typename ReceiverT>
+            static uint8_t getAux2State(ReceiverT * receiver)
+            {
+                return receiver->ReceiverT::getAux2State();
+            }
+
+        private:
+
+            // A concrete board that overrides writeMotors()
+            template <typename BoardT, typename OverriderT>
+            static void writeMotors(BoardT * board, void (OverriderT::*)(const float *, uint8_t),
+                    const float * values, uint8_t count)
+            {
+                board->BoardT::writeMotors(values, count);
+            }
+
+            // One that doesn't: Board's fallback would write each motor through the vtable, so write them
+            // through the board's own writeMotor() here instead
+            template <typename BoardT>
+            static void writeMotors(BoardT * board, void (Board::*)(const float *, uint8_t),
+                    const float * values, uint8_t count)
+            {
+                for (uint8_t i = 0; i < count; i++) {
+                    board->BoardT::writeMotor(i, values[i]);
+                }
+            }
+
+    }; // class Dispatch
+
+} // namespace hf
@@ -0,0 +1,434 @@
+/*
+   Dynamic notch filter that tracks motor-noise peaks in the gyrometer
+
+   Gyro samples are averaged down to an analysis rate a little above twice
+   the highest frequency of interest and kept in a 64-sample window per
+   axis.  Each axis in turn is Hann-windowed and run through a real FFT
+   (a 32-point complex radix-2 FFT plus a split step), the strongest
+   one to three peaks in the band are located to a fraction of a bin by
+   parabolic interpolation, and that axis's notches are moved toward
+   them.
+
+   None of this happens all at once.  The analysis is broken into steps
+   (load the window, one step per butterfly stage, compute the spectrum,
+   find the peaks, retune the notches) and apply() does at most one step
+   per call, so the worst-case cost added to any pass through the loop is
+   one step, not a whole FFT.  The largest step touches 64 samples.  When
+   built with HACKFLIGHT_PROFILE, the cost per call is reported in the
+   loop timing as its own stage.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "gyrofilter.hpp"
+
+namespace hf {
+
+    class DynamicNotch {
+
+        public:
+
+            static const uint8_t MAXPEAKS = 3;
+
+            enum {
+                STEP_WINDOW,
+                STEP_BUTTERFLY,
+                STEP_SPECTRUM = STEP_BUTTERFLY + 5, // log2 of the 32-point complex FFT
+                STEP_PEAKS,
+                STEP_TUNE,
+                STEP_COUNT
+            };
+
+        private:
+
+            // Real samples per window, and points in the complex FFT that does the work
+            static const uint8_t FFT_SIZE = 64;
+            static const uint8_t HALF     = FFT_SIZE / 2;
+
+            // A peak must stand this far above the mean power in the band
+            static constexpr float PEAK_RATIO = 3;
+
+            // Fraction of the way each update moves a notch toward its peak
+            static constexpr float SMOOTHING = 0.5f;
+
+            uint8_t _peaks = 1;
+            float _minHz = 0;
+            float _maxHz = 0;
+
+            // One notch stage per peak, tuned separately on each axis
+            GyroFilter _notches;
+
+            bool _configured = false;
+
+            // Averaging down to the analysis rate
+            uint16_t _decimation = 1;
+            uint16_t _decimationCount = 0;
+            float _sums[3] = {0};
+
+            // Most recent samples for each axis; _windowIndex is the oldest
+            float _window[3][FFT_SIZE] = {};
+            uint8_t _windowIndex = 0;
+            uint8_t _windowCount = 0;
+
+            // Tables, computed once
+            float _hann[FFT_SIZE];
+            float _cos[HALF];
+            float _sin[HALF];
+
+            // Work in progress on the current axis
+            uint8_t _axis = 0;
+            uint8_t _step = STEP_WINDOW;
+            float _re[HALF];
+            float _im[HALF];
+            float _power[HALF];
+            float _found[MAXPEAKS];
+            uint8_t _foundCount = 0;
+
+            // Analysis band in bins, and bin width
+            uint8_t _minBin = 1;
+            uint8_t _maxBin = 0;
+            float _binHz = 0;
+
+            float _centers[3][MAXPEAKS] = {};
+
+            static uint8_t bitReverse(uint8_t n)
+            {
+                uint8_t r = 0;
+                for (uint8_t k=1; k<HALF; k<<=1) {
+                    r = (r << 1) | (n & 1);
+                    n >>= 1;
+                }
+                return r;
+            }
+
+            void configure(void)
+            {
+                float sampleHz = _notches.getSampleRate();
+
+                _decimation = sampleHz > 2 * _maxHz ? (uint16_t)(sampleHz / (2 * _maxHz)) : 1;
+
+                _binHz = sampleHz / _decimation / FFT_SIZE;
+
+                // Interpolation needs a bin on either side of a peak
+                float minBin = ceilf(_minHz / _binHz);
+                float maxBin = floorf(_maxHz / _binHz);
+                _minBin = minBin < 1 ? 1 : (uint8_t)minBin;
+                _maxBin = maxBin > HALF-2 ? HALF-2 : (uint8_t)maxBin;
+
+                _configured = true;
+            }
+
+            void collect(float gx, float gy, float gz)
+            {
+                _sums[0] += gx;
+                _sums[1] += gy;
+                _sums[2] += gz;
+
+                if (++_decimationCount < _decimation) {
+                    return;
+                }
+
+                for (uint8_t k=0; k<3; ++k) {
+                    _window[k][_windowIndex] = _sums[k] / _decimation;
+                    _sums[k] = 0;
+                }
+
+                _decimationCount = 0;
+
+                _windowIndex = (_windowIndex + 1) % FFT_SIZE;
+
+                if (_windowCount < FFT_SIZE) {
+                    _windowCount++;
+                }
+            }
+
+            // Copies the window, oldest first, into the FFT input as complex pairs in bit-reversed order
+            void loadWindow(void)
+            {
+                const float * window = _window[_axis];
+
+                for (uint8_t k=0; k<HALF; ++k) {
+                    uint8_t j = bitReverse(k);
+                    uint8_t n = 2 * k;
+                    _re[j] = window[(_windowIndex + n) % FFT_SIZE] * _hann[n];
+                    _im[j] = window[(_windowIndex + n + 1) % FFT_SIZE] * _hann[n+1];
+                }
+            }
+
+            // One radix-2 decimation-in-time stage
+            void butterflies(uint8_t stage)
+            {
+                uint8_t half = 1 << stage;
+                uint8_t size = half << 1;
+                uint8_t stride = FFT_SIZE / size;
+
+                for (uint8_t start=0; start<HALF; start+=size) {
+                    for (uint8_t j=0; j<half; ++j) {
+                        float wr = _cos[j*stride];
+                        float wi = -_sin[j*stride];
+                        uint8_t a = start + j;
+                        uint8_t b = a + half;
+                        float tr = wr * _re[b] - wi * _im[b];
+                        float ti = wr * _im[b] + wi * _re[b];
+                        _re[b] = _re[a] - tr;
+                        _im[b] = _im[a] - ti;
+                        _re[a] += tr;
+                        _im[a] += ti;
+                    }
+                }
+            }
+
+            // Unpacks the real FFT from the complex one, for the bins we look at
+            void spectrum(void)
+            {
+                for (uint8_t k=_minBin-1; k<=_maxBin+1; ++k) {
+
+                    uint8_t m = (HALF - k) % HALF;
+
+                    float er = 0.5f * (_re[k] + _re[m]);
+                    float ei = 0.5f * (_im[k] - _im[m]);
+                    float odr = 0.5f * (_im[k] + _im[m]);
+                    float odi = -0.5f * (_re[k] - _re[m]);
+
+                    float xr = er + _cos[k] * odr + _sin[k] * odi;
+                    float xi = ei + _cos[k] * odi - _sin[k] * odr;
+
+                    _power[k] = xr * xr + xi * xi;
+                }
+            }
+
+            void findPeaks(void)
+            {
+                float mean = 0;
+                for (uint8_t k=_minBin; k<=_maxBin; ++k) {
+                    mean += _power[k];
+                }
+                mean /= (_maxBin - _minBin + 1);
+
+                // Strongest local maxima, strongest first
+                uint8_t bins[MAXPEAKS];
+                _foundCount = 0;
+
+                for (uint8_t k=_minBin; k<=_maxBin; ++k) {
+
+                    float p = _power[k];
+
+                    if (p <= PEAK_RATIO * mean || p <= _power[k-1] || p < _power[k+1]) {
+                        continue;
+                    }
+
+                    // Slot to fill: the next free one, or the weakest if it's weaker than this one
+                    uint8_t j = _foundCount;
+                    if (j < _peaks) {
+                        _foundCount++;
+                    }
+                    else if (p > _power[bins[j-1]]) {
+                        --j;
+                    }
+                    else {
+                        continue;
+                    }
+
+                    while (j > 0 && _power[bins[j-1]] < p) {
+                        bins[j] = bins[j-1];
+                        --j;
+                    }
+                    bins[j] = k;
+                }
+
+                // Fractional bin from a parabola through the peak and its neighbors
+                for (uint8_t j=0; j<_foundCount; ++j) {
+                    uint8_t k = bins[j];
+                    float left = _power[k-1];
+                    float right = _power[k+1];
+                    float offset = 0.5f * (left - right) / (left - 2 * _power[k] + right);
+                    _found[j] = (k + offset) * _binHz;
+                }
+
+                // Lowest frequency first, so each notch tends to stay with the same peak
+                for (uint8_t j=1; j<_foundCount; ++j) {
+                    float f = _found[j];
+                    uint8_t i = j;
+                    while (i > 0 && _found[i-1] > f) {
+                        _found[i] = _found[i-1];
+                        --i;
+                    }
+                    _found[i] = f;
+                }
+            }
+
+            void tuneNotches(void)
+            {
+                for (uint8_t k=0; k<_foundCount; ++k) {
+
+                    float & center = _centers[_axis][k];
+
+                    center = center == 0 ? _found[k] : center + SMOOTHING * (_found[k] - center);
+
+                    if (center < _minHz) {
+                        center = _minHz;
+                    }
+
+                    if (center > _maxHz) {
+                        center = _maxHz;
+                    }
+
+                    _notches.tune(k, _axis, center);
+                }
+            }
+
+            void step(void)
+            {
+                if (_step == STEP_WINDOW) {
+                    loadWindow();
+                }
+
+                else if (_step < STEP_SPECTRUM) {
+                    butterflies(_step - STEP_BUTTERFLY);
+                }
+
+                else if (_step == STEP_SPECTRUM) {
+                    spectrum();
+                }
+
+                else if (_step == STEP_PEAKS) {
+                    findPeaks();
+                }
+
+                else {
+                    tuneNotches();
+                }
+
+                if (++_step == STEP_COUNT) {
+                    _step = STEP_WINDOW;
+                    _axis = (_axis + 1) % 3;
+                }
+            }
+
+        public:
+
+            /**
+             * Tracks up to MAXPEAKS peaks between minHz and maxHz, with notches of the given Q.
+             */
+            DynamicNotch(uint8_t peaks=1, float minHz=80, float maxHz=400, float q=3.5f)
+            {
+                _peaks = peaks < 1 ? 1 : peaks > MAXPEAKS ? MAXPEAKS : peaks;
+                _minHz = minHz;
+                _maxHz = maxHz;
+
+                // Notches start out passing everything, until there's a peak to put them on
+                for (uint8_t k=0; k<_peaks; ++k) {
+                    _notches.addNotch(0, q);
+                }
+
+                for (uint8_t k=0; k<FFT_SIZE; ++k) {
+                    _hann[k] = 0.5f * (1 - cosf(2 * M_PI * k / FFT_SIZE));
+                }
+
+                for (uint8_t k=0; k<HALF; ++k) {
+                    _cos[k] = cosf(2 * M_PI * k / FFT_SIZE);
+                    _sin[k] = sinf(2 * M_PI * k / FFT_SIZE);
+                }
+            }
+
+            /**
+             * Sets the gyro sample rate.  With no rate, the rate is measured over the first half second
+             * of samples passed to apply().
+             */
+            void begin(float sampleHz=0)
+            {
+                _configured = false;
+
+                _decimationCount = 0;
+                _windowIndex = 0;
+                _windowCount = 0;
+                _axis = 0;
+                _step = STEP_WINDOW;
+
+                for (uint8_t k=0; k<3; ++k) {
+                    _sums[k] = 0;
+                    for (uint8_t j=0; j<MAXPEAKS; ++j) {
+                        _centers[k][j] = 0;
+                    }
+                }
+
+                _notches.begin(sampleHz);
+
+                if (_notches.ready()) {
+                    configure();
+                }
+            }
+
+            /**
+             * Filters one sample in place, and does at most one step of the analysis; usec is its time on
+             * Hackflight's timebase.
+             */
+            void apply(float & gx, float & gy, float & gz, uint64_t usec)
+            {
+                if (!_configured) {
+
+                    // Passes samples through while it measures the sample rate
+                    _notches.apply(gx, gy, gz, usec);
+
+                    if (_notches.ready()) {
+                        configure();
+                    }
+
+                    return;
+                }
+
+                // Analyze the signal before it's notched, so the peaks are still there to find
+                collect(gx, gy, gz);
+
+                if (_windowCount == FFT_SIZE && _minBin <= _maxBin) {
+                    step();
+                }
+
+                _notches.apply(gx, gy, gz, usec);
+            }
+
+            bool ready(void)
+            {
+                return _configured;
+            }
+
+            // Current center of a notch, or zero if it hasn't found a peak yet
+            float getCenter(uint8_t axis, uint8_t peak)
+            {
+                return axis < 3 && peak < MAXPEAKS ? _centers[axis][peak] : 0;
+            }
+
+            // Width of an FFT bin at the analysis rate
+            float getResolution(void)
+            {
+                return _binHz;
+            }
+
+            // Loop passes needed to analyze all three axes once
+            static uint8_t stepsPerUpdate(void)
+            {
+                return 3 * STEP_COUNT;
+            }
+
+    }; // class DynamicNotch
+
+} // namespace hf
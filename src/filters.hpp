@@ -23,6 +23,9 @@
 #include <math.h>
 #include <stdint.h>
 
+#include "fixedpoint.hpp"
+#include "qmath.hpp"
+
 #ifndef M_PI
 static const float M_PI = 3.141593;
 #endif
@@ -55,6 +58,11 @@ namespace hf {
                 return degrees * M_PI / 180;
             }
 
+            static float rad2deg(float radians)
+            {
+                return radians * 180 / M_PI;
+            }
+
 
             static float round2(float val)
             {
@@ -125,6 +133,20 @@ namespace hf {
                 q3 = 0;
                 q4 = 0;
             }
+
+            qmath::quaternion_t get(void)
+            {
+                qmath::quaternion_t q = {q1, q2, q3, q4};
+                return q;
+            }
+
+            void set(const qmath::quaternion_t & q)
+            {
+                q1 = q.w;
+                q2 = q.x;
+                q3 = q.y;
+                q4 = q.z;
+            }
     };
 
     class MadgwickQuaternionFilter : public QuaternionFilter {
@@ -150,10 +172,8 @@ namespace hf {
             // Adapted from https://github.com/kriswiner/MPU9250/blob/master/quaternionFilters.ino
             void update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float deltat)
             {
-                float norm;
                 float hx, hy, _2bx, _2bz;
                 float s1, s2, s3, s4;
-                float qDot1, qDot2, qDot3, qDot4;
 
                 // Auxiliary variables to avoid repeated arithmetic
                 float _2q1mx;
@@ -179,21 +199,9 @@ namespace hf {
                 float q3q4 = q3 * q4;
                 float q4q4 = q4 * q4;
 
-                // Normalise accelerometer measurement
-                norm = sqrtf(ax * ax + ay * ay + az * az);
-                if (norm == 0.0f) return; // handle NaN
-                norm = 1.0f/norm;
-                ax *= norm;
-                ay *= norm;
-                az *= norm;
-
-                // Normalise magnetometer measurement
-                norm = sqrtf(mx * mx + my * my + mz * mz);
-                if (norm == 0.0f) return; // handle NaN
-                norm = 1.0f/norm;
-                mx *= norm;
-                my *= norm;
-                mz *= norm;
+                // Normalise accelerometer and magnetometer measurements
+                if (!qmath::normalize(ax, ay, az)) return; // handle NaN
+                if (!qmath::normalize(mx, my, mz)) return;
 
                 // Reference direction of Earth's magnetic field
                 _2q1mx = 2.0f * q1 * mx;
@@ -232,26 +240,22 @@ namespace hf {
                     _2bx * q2 * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
 
                 // Normalize step magnitude
-                norm = sqrtf(s1 * s1 + s2 * s2 + s3 * s3 + s4 * s4);    
-                norm = 1.0f/norm;
-                s1 *= norm;
-                s2 *= norm;
-                s3 *= norm;
-                s4 *= norm;
+                qmath::quaternion_t step = {s1, s2, s3, s4};
+                qmath::normalize(step);
 
                 // Compute rate of change of quaternion
-                qDot1 = 0.5f * (-q2 * gx - q3 * gy - q4 * gz) - _beta * s1;
-                qDot2 = 0.5f * (q1 * gx + q3 * gz - q4 * gy) - _beta * s2;
-                qDot3 = 0.5f * (q1 * gy - q2 * gz + q4 * gx) - _beta * s3;
-                qDot4 = 0.5f * (q1 * gz + q2 * gy - q3 * gx) - _beta * s4;
+                qmath::quaternion_t q = get();
+                qmath::quaternion_t qDot = qmath::rate(q, gx, gy, gz);
 
                 // Integrate to yield quaternion
-                q1 += qDot1 * deltat;
-                q2 += qDot2 * deltat;
-                q3 += qDot3 * deltat;
-                q4 += qDot4 * deltat;
-                norm = sqrtf(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);    // normalise quaternion
-                norm = 1.0f/norm;
+                q.w += (qDot.w - _beta * step.w) * deltat;
+                q.x += (qDot.x - _beta * step.x) * deltat;
+                q.y += (qDot.y - _beta * step.y) * deltat;
+                q.z += (qDot.z - _beta * step.z) * deltat;
+
+                // Normalise quaternion
+                qmath::normalize(q);
+                set(q);
             }
     }; // class MadgwickQuaternionFilter9DOF 
 
@@ -261,38 +265,28 @@ namespace hf {
 
             float _zeta = 0;
 
-        public:
+            // Gyro bias error
+            float _gbiasx = 0;
+            float _gbiasy = 0;
+            float _gbiasz = 0;
 
-            MadgwickQuaternionFilter6DOF(float beta, float zeta) 
-                : MadgwickQuaternionFilter(beta) 
-            { 
-                _zeta = zeta;
-            }
+            // Coning correction needs the rotation over the previous gyro sample
+            bool _coning = false;
+            float _thetax = 0;
+            float _thetay = 0;
+            float _thetaz = 0;
 
-            // Adapted from https://github.com/kriswiner/MPU6050/blob/master/quaternionFilter.ino
-            void update(float ax, float ay, float az, float gx, float gy, float gz, float deltat)
+            // Normalized gradient of the error between measured gravity and gravity as the quaternion sees it
+            bool gradient(float ax, float ay, float az, qmath::quaternion_t & hatDot)
             {
-                static float gbiasx, gbiasy, gbiasz;        // gyro bias error
-
                 // Auxiliary variables to avoid repeated arithmetic
-                float _halfq1 = 0.5f * q1;
-                float _halfq2 = 0.5f * q2;
-                float _halfq3 = 0.5f * q3;
-                float _halfq4 = 0.5f * q4;
                 float _2q1 = 2.0f * q1;
                 float _2q2 = 2.0f * q2;
                 float _2q3 = 2.0f * q3;
                 float _2q4 = 2.0f * q4;
-                //float _2q1q3 = 2.0f * q1 * q3;
-                //float _2q3q4 = 2.0f * q3 * q4;
 
                 // Normalise accelerometer measurement
-                float norm = sqrt(ax * ax + ay * ay + az * az);
-                if (norm == 0.0f) return; // handle NaN
-                norm = 1.0f/norm;
-                ax *= norm;
-                ay *= norm;
-                az *= norm;
+                if (!qmath::normalize(ax, ay, az)) return false; // handle NaN
 
                 // Compute the objective function and Jacobian
                 float f1 = _2q2 * q4 - _2q1 * q3 - ax;
@@ -306,54 +300,370 @@ namespace hf {
                 float J_33 = 2.0f * J_11or24;
 
                 // Compute the gradient (matrix multiplication)
-                float hatDot1 = J_14or21 * f2 - J_11or24 * f1;
-                float hatDot2 = J_12or23 * f1 + J_13or22 * f2 - J_32 * f3;
-                float hatDot3 = J_12or23 * f2 - J_33 *f3 - J_13or22 * f1;
-                float hatDot4 = J_14or21 * f1 + J_11or24 * f2;
+                hatDot.w = J_14or21 * f2 - J_11or24 * f1;
+                hatDot.x = J_12or23 * f1 + J_13or22 * f2 - J_32 * f3;
+                hatDot.y = J_12or23 * f2 - J_33 *f3 - J_13or22 * f1;
+                hatDot.z = J_14or21 * f1 + J_11or24 * f2;
 
                 // Normalize the gradient
-                norm = sqrt(hatDot1 * hatDot1 + hatDot2 * hatDot2 + hatDot3 * hatDot3 + hatDot4 * hatDot4);
-                hatDot1 /= norm;
-                hatDot2 /= norm;
-                hatDot3 /= norm;
-                hatDot4 /= norm;
+                qmath::normalize(hatDot);
+
+                return true;
+            }
+
+            void updateBias(const qmath::quaternion_t & hatDot, float deltat)
+            {
+                float _2q1 = 2.0f * q1;
+                float _2q2 = 2.0f * q2;
+                float _2q3 = 2.0f * q3;
+                float _2q4 = 2.0f * q4;
 
                 // Compute estimated gyroscope biases
-                float gerrx = _2q1 * hatDot2 - _2q2 * hatDot1 - _2q3 * hatDot4 + _2q4 * hatDot3;
-                float gerry = _2q1 * hatDot3 + _2q2 * hatDot4 - _2q3 * hatDot1 - _2q4 * hatDot2;
-                float gerrz = _2q1 * hatDot4 - _2q2 * hatDot3 + _2q3 * hatDot2 - _2q4 * hatDot1;
+                float gerrx = _2q1 * hatDot.x - _2q2 * hatDot.w - _2q3 * hatDot.z + _2q4 * hatDot.y;
+                float gerry = _2q1 * hatDot.y + _2q2 * hatDot.z - _2q3 * hatDot.w - _2q4 * hatDot.x;
+                float gerrz = _2q1 * hatDot.z - _2q2 * hatDot.y + _2q3 * hatDot.x - _2q4 * hatDot.w;
+
+                _gbiasx += gerrx * deltat * _zeta;
+                _gbiasy += gerry * deltat * _zeta;
+                _gbiasz += gerrz * deltat * _zeta;
+            }
+
+        public:
+
+            MadgwickQuaternionFilter6DOF(float beta, float zeta) 
+                : MadgwickQuaternionFilter(beta) 
+            { 
+                _zeta = zeta;
+            }
+
+            /**
+             * Makes propagate() integrate each sample as a rotation vector, corrected for coning, instead
+             * of a first-order step.  Worth it when the vehicle vibrates about more than one axis at once.
+             */
+            void useConingCorrection(void)
+            {
+                _coning = true;
+            }
+
+            // Adapted from https://github.com/kriswiner/MPU6050/blob/master/quaternionFilter.ino
+            void update(float ax, float ay, float az, float gx, float gy, float gz, float deltat)
+            {
+                qmath::quaternion_t hatDot;
+                if (!gradient(ax, ay, az, hatDot)) return;
 
                 // Compute and remove gyroscope biases
-                gbiasx += gerrx * deltat * _zeta;
-                gbiasy += gerry * deltat * _zeta;
-                gbiasz += gerrz * deltat * _zeta;
-                gx -= gbiasx;
-                gy -= gbiasy;
-                gz -= gbiasz;
+                updateBias(hatDot, deltat);
+                gx -= _gbiasx;
+                gy -= _gbiasy;
+                gz -= _gbiasz;
 
                 // Compute the quaternion derivative
-                float qDot1 = -_halfq2 * gx - _halfq3 * gy - _halfq4 * gz;
-                float qDot2 =  _halfq1 * gx + _halfq3 * gz - _halfq4 * gy;
-                float qDot3 =  _halfq1 * gy - _halfq2 * gz + _halfq4 * gx;
-                float qDot4 =  _halfq1 * gz + _halfq2 * gy - _halfq3 * gx;
+                qmath::quaternion_t q = get();
+                qmath::quaternion_t qDot = qmath::rate(q, gx, gy, gz);
 
                 // Compute then integrate estimated quaternion derivative
-                q1 += (qDot1 -(_beta * hatDot1)) * deltat;
-                q2 += (qDot2 -(_beta * hatDot2)) * deltat;
-                q3 += (qDot3 -(_beta * hatDot3)) * deltat;
-                q4 += (qDot4 -(_beta * hatDot4)) * deltat;
+                q.w += (qDot.w -(_beta * hatDot.w)) * deltat;
+                q.x += (qDot.x -(_beta * hatDot.x)) * deltat;
+                q.y += (qDot.y -(_beta * hatDot.y)) * deltat;
+                q.z += (qDot.z -(_beta * hatDot.z)) * deltat;
 
                 // Normalize the quaternion
-                norm = sqrt(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);    // normalise quaternion
-                norm = 1.0f/norm;
-                q1 *= norm;
-                q2 *= norm;
-                q3 *= norm;
-                q4 *= norm;
+                qmath::normalize(q);
+                set(q);
+            }
+
+            /**
+             * The gyrometer half of update(): integrates one sample, less the estimated bias, into the
+             * attitude.  Cheap enough to run on every sample.
+             */
+            void propagate(float gx, float gy, float gz, float deltat)
+            {
+                gx -= _gbiasx;
+                gy -= _gbiasy;
+                gz -= _gbiasz;
+
+                qmath::quaternion_t q = get();
+
+                if (_coning) {
+
+                    // Rotation over this sample, plus a twelfth of its cross product with the previous one
+                    float tx = gx * deltat;
+                    float ty = gy * deltat;
+                    float tz = gz * deltat;
+                    float dx = tx + (_thetay * tz - _thetaz * ty) * (1 / 12.f);
+                    float dy = ty + (_thetaz * tx - _thetax * tz) * (1 / 12.f);
+                    float dz = tz + (_thetax * ty - _thetay * tx) * (1 / 12.f);
+                    _thetax = tx;
+                    _thetay = ty;
+                    _thetaz = tz;
+
+                    // Quaternion for that rotation vector, by the series for cos(a/2) and sin(a/2)/a; a
+                    // sample's rotation is small enough that the next terms vanish in float
+                    float a2 = dx * dx + dy * dy + dz * dz;
+                    float c = 1 - a2 * (1 / 8.f);
+                    float s = 0.5f - a2 * (1 / 48.f);
+                    qmath::quaternion_t dq = {c, s * dx, s * dy, s * dz};
+
+                    q = qmath::multiply(q, dq);
+                }
+
+                else {
+                    qmath::quaternion_t qDot = qmath::rate(q, gx, gy, gz);
+                    q.w += qDot.w * deltat;
+                    q.x += qDot.x * deltat;
+                    q.y += qDot.y * deltat;
+                    q.z += qDot.z * deltat;
+                }
+
+                // One sample moves q only slightly off unit length
+                qmath::renormalize(q);
+                set(q);
+            }
+
+            /**
+             * The accelerometer half of update(): one gradient-descent step toward the measured gravity,
+             * scaled by the time since the last correction, which also updates the gyro bias estimate.
+             * Can run at a fraction of the gyrometer rate.
+             */
+            void correct(float ax, float ay, float az, float deltat)
+            {
+                qmath::quaternion_t hatDot;
+                if (!gradient(ax, ay, az, hatDot)) return;
+
+                updateBias(hatDot, deltat);
+
+                qmath::quaternion_t q = get();
+                q.w -= _beta * hatDot.w * deltat;
+                q.x -= _beta * hatDot.x * deltat;
+                q.y -= _beta * hatDot.y * deltat;
+                q.z -= _beta * hatDot.z * deltat;
+
+                qmath::normalize(q);
+                set(q);
             }
 
     }; // class MadgwickQuaternionFilter6DOF
 
+    // The same filter in fixed point, for boards without an FPU
+    class FixedMadgwickQuaternionFilter6DOF : public MadgwickQuaternionFilter {
+
+        private:
+
+            q24_t _fixedBeta;
+            q24_t _fixedZeta;
+
+            // Gyro bias error
+            q24_t _gbiasx;
+            q24_t _gbiasy;
+            q24_t _gbiasz;
+
+            // Quaternion; q1, q2, q3, q4 get a float copy after each update
+            q24_t _q[4];
+
+            // Coning correction needs the rotation over the previous gyro sample
+            bool _coning = false;
+            q24_t _theta[3];
+
+            // Series coefficients for coning correction, converted once
+            q24_t _twelfth;
+            q24_t _fortyEighth;
+
+            // Normalized gradient of the error between measured gravity and gravity as the quaternion sees it
+            bool gradient(float ax, float ay, float az, q24_t hatDot[4])
+            {
+                const q24_t one = q24_t::fromInt(1);
+
+                q24_t & fq1 = _q[0];
+                q24_t & fq2 = _q[1];
+                q24_t & fq3 = _q[2];
+                q24_t & fq4 = _q[3];
+
+                // Auxiliary variables to avoid repeated arithmetic
+                q24_t _2q1 = fq1 * 2;
+                q24_t _2q2 = fq2 * 2;
+                q24_t _2q3 = fq3 * 2;
+                q24_t _2q4 = fq4 * 2;
+
+                // Normalise accelerometer measurement
+                q24_t a[3] = {q24_t(ax), q24_t(ay), q24_t(az)};
+                if (!q24_t::normalize(a, 3)) return false; // handle NaN
+
+                // Compute the objective function and Jacobian
+                q24_t f1 = _2q2 * fq4 - _2q1 * fq3 - a[0];
+                q24_t f2 = _2q1 * fq2 + _2q3 * fq4 - a[1];
+                q24_t f3 = one - _2q2 * fq2 - _2q3 * fq3 - a[2];
+                q24_t J_11or24 = _2q3;
+                q24_t J_12or23 = _2q4;
+                q24_t J_13or22 = _2q1;
+                q24_t J_14or21 = _2q2;
+                q24_t J_32 = J_14or21 * 2;
+                q24_t J_33 = J_11or24 * 2;
+
+                // Compute the gradient (matrix multiplication)
+                hatDot[0] = J_14or21 * f2 - J_11or24 * f1;
+                hatDot[1] = J_12or23 * f1 + J_13or22 * f2 - J_32 * f3;
+                hatDot[2] = J_12or23 * f2 - J_33 *f3 - J_13or22 * f1;
+                hatDot[3] = J_14or21 * f1 + J_11or24 * f2;
+
+                // Normalize the gradient; a zero gradient needs no correction
+                q24_t::normalize(hatDot, 4);
+
+                return true;
+            }
+
+            void updateBias(const q24_t hatDot[4], q24_t dt)
+            {
+                q24_t _2q1 = _q[0] * 2;
+                q24_t _2q2 = _q[1] * 2;
+                q24_t _2q3 = _q[2] * 2;
+                q24_t _2q4 = _q[3] * 2;
+
+                // Compute estimated gyroscope biases
+                q24_t gerrx = _2q1 * hatDot[1] - _2q2 * hatDot[0] - _2q3 * hatDot[3] + _2q4 * hatDot[2];
+                q24_t gerry = _2q1 * hatDot[2] + _2q2 * hatDot[3] - _2q3 * hatDot[0] - _2q4 * hatDot[1];
+                q24_t gerrz = _2q1 * hatDot[3] - _2q2 * hatDot[2] + _2q3 * hatDot[1] - _2q4 * hatDot[0];
+
+                _gbiasx += gerrx * dt * _fixedZeta;
+                _gbiasy += gerry * dt * _fixedZeta;
+                _gbiasz += gerrz * dt * _fixedZeta;
+            }
+
+            void publish(void)
+            {
+                q1 = _q[0].toFloat();
+                q2 = _q[1].toFloat();
+                q3 = _q[2].toFloat();
+                q4 = _q[3].toFloat();
+            }
+
+            // Normalizes the quaternion and publishes a float copy
+            void finish(void)
+            {
+                q24_t::normalize(_q, 4);
+                publish();
+            }
+
+        public:
+
+            FixedMadgwickQuaternionFilter6DOF(float beta, float zeta) 
+                : MadgwickQuaternionFilter(beta) 
+            { 
+                _fixedBeta = q24_t(beta);
+                _fixedZeta = q24_t(zeta);
+                _q[0] = q24_t::fromInt(1);
+                _twelfth = q24_t(1 / 12.f);
+                _fortyEighth = q24_t(1 / 48.f);
+            }
+
+            void useConingCorrection(void)
+            {
+                _coning = true;
+            }
+
+            void update(float ax, float ay, float az, float gx, float gy, float gz, float deltat)
+            {
+                q24_t & fq1 = _q[0];
+                q24_t & fq2 = _q[1];
+                q24_t & fq3 = _q[2];
+                q24_t & fq4 = _q[3];
+
+                q24_t hatDot[4];
+                if (!gradient(ax, ay, az, hatDot)) return;
+
+                // Compute and remove gyroscope biases
+                q24_t dt(deltat);
+                updateBias(hatDot, dt);
+                q24_t fgx = q24_t(gx) - _gbiasx;
+                q24_t fgy = q24_t(gy) - _gbiasy;
+                q24_t fgz = q24_t(gz) - _gbiasz;
+
+                // Auxiliary variables to avoid repeated arithmetic
+                q24_t _halfq1 = fq1 >> 1;
+                q24_t _halfq2 = fq2 >> 1;
+                q24_t _halfq3 = fq3 >> 1;
+                q24_t _halfq4 = fq4 >> 1;
+
+                // Compute the quaternion derivative
+                q24_t qDot1 = -_halfq2 * fgx - _halfq3 * fgy - _halfq4 * fgz;
+                q24_t qDot2 =  _halfq1 * fgx + _halfq3 * fgz - _halfq4 * fgy;
+                q24_t qDot3 =  _halfq1 * fgy - _halfq2 * fgz + _halfq4 * fgx;
+                q24_t qDot4 =  _halfq1 * fgz + _halfq2 * fgy - _halfq3 * fgx;
+
+                // Compute then integrate estimated quaternion derivative
+                fq1 += (qDot1 -(_fixedBeta * hatDot[0])) * dt;
+                fq2 += (qDot2 -(_fixedBeta * hatDot[1])) * dt;
+                fq3 += (qDot3 -(_fixedBeta * hatDot[2])) * dt;
+                fq4 += (qDot4 -(_fixedBeta * hatDot[3])) * dt;
+
+                finish();
+            }
+
+            void propagate(float gx, float gy, float gz, float deltat)
+            {
+                q24_t dt(deltat);
+
+                // Rotation over this sample
+                q24_t t[3] = {(q24_t(gx) - _gbiasx) * dt, (q24_t(gy) - _gbiasy) * dt, (q24_t(gz) - _gbiasz) * dt};
+
+                const q24_t one = q24_t::fromInt(1);
+
+                q24_t dq[4] = {one, t[0] >> 1, t[1] >> 1, t[2] >> 1};
+
+                if (_coning) {
+
+                    q24_t d[3] = {
+                        t[0] + (_theta[1] * t[2] - _theta[2] * t[1]) * _twelfth,
+                        t[1] + (_theta[2] * t[0] - _theta[0] * t[2]) * _twelfth,
+                        t[2] + (_theta[0] * t[1] - _theta[1] * t[0]) * _twelfth
+                    };
+
+                    _theta[0] = t[0];
+                    _theta[1] = t[1];
+                    _theta[2] = t[2];
+
+                    q24_t a2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+                    q24_t s = (one >> 1) - a2 * _fortyEighth;
+
+                    dq[0] = one - (a2 >> 3);
+                    dq[1] = s * d[0];
+                    dq[2] = s * d[1];
+                    dq[3] = s * d[2];
+                }
+
+                // q dq
+                q24_t r[4] = {
+                    _q[0] * dq[0] - _q[1] * dq[1] - _q[2] * dq[2] - _q[3] * dq[3],
+                    _q[0] * dq[1] + _q[1] * dq[0] + _q[2] * dq[3] - _q[3] * dq[2],
+                    _q[0] * dq[2] - _q[1] * dq[3] + _q[2] * dq[0] + _q[3] * dq[1],
+                    _q[0] * dq[3] + _q[1] * dq[2] - _q[2] * dq[1] + _q[3] * dq[0]
+                };
+
+                // One sample moves q only slightly off unit length, so one Newton step brings it back
+                q24_t scale = one + ((one - (r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + r[3] * r[3])) >> 1);
+                for (uint8_t k=0; k<4; ++k) {
+                    _q[k] = r[k] * scale;
+                }
+
+                publish();
+            }
+
+            void correct(float ax, float ay, float az, float deltat)
+            {
+                q24_t hatDot[4];
+                if (!gradient(ax, ay, az, hatDot)) return;
+
+                q24_t dt(deltat);
+                updateBias(hatDot, dt);
+
+                for (uint8_t k=0; k<4; ++k) {
+                    _q[k] -= _fixedBeta * hatDot[k] * dt;
+                }
+
+                finish();
+            }
+
+    }; // class FixedMadgwickQuaternionFilter6DOF
+
     class MahonyQuaternionFilter9DOF : public QuaternionFilter {
 
         private:
@@ -377,11 +687,9 @@ namespace hf {
             // Adapted from https://github.com/kriswiner/MPU9250/blob/master/quaternionFilters.ino
             void update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float deltat)
             {
-                float norm;
                 float hx, hy, bx, bz;
                 float vx, vy, vz, wx, wy, wz;
                 float ex, ey, ez;
-                float pa, pb, pc;
 
                 // Auxiliary variables to avoid repeated arithmetic
                 float q1q1 = q1 * q1;
@@ -395,21 +703,9 @@ namespace hf {
                 float q3q4 = q3 * q4;
                 float q4q4 = q4 * q4;   
 
-                // Normalise accelerometer measurement
-                norm = sqrtf(ax * ax + ay * ay + az * az);
-                if (norm == 0.0f) return; // handle NaN
-                norm = 1.0f / norm;        // use reciprocal for division
-                ax *= norm;
-                ay *= norm;
-                az *= norm;
-
-                // Normalise magnetometer measurement
-                norm = sqrtf(mx * mx + my * my + mz * mz);
-                if (norm == 0.0f) return; // handle NaN
-                norm = 1.0f / norm;        // use reciprocal for division
-                mx *= norm;
-                my *= norm;
-                mz *= norm;
+                // Normalise accelerometer and magnetometer measurements
+                if (!qmath::normalize(ax, ay, az)) return; // handle NaN
+                if (!qmath::normalize(mx, my, mz)) return;
 
                 // Reference direction of Earth's magnetic field
                 hx = 2.0f * mx * (0.5f - q3q3 - q4q4) + 2.0f * my * (q2q3 - q1q4) + 2.0f * mz * (q2q4 + q1q3);
@@ -448,21 +744,16 @@ namespace hf {
                 gz = gz + Kp * ez + Ki * _eInt[2];
 
                 // Integrate rate of change of quaternion
-                pa = q2;
-                pb = q3;
-                pc = q4;
-                q1 = q1 + (-q2 * gx - q3 * gy - q4 * gz) * (0.5f * deltat);
-                q2 = pa + (q1 * gx + pb * gz - pc * gy) * (0.5f * deltat);
-                q3 = pb + (q1 * gy - pa * gz + pc * gx) * (0.5f * deltat);
-                q4 = pc + (q1 * gz + pa * gy - pb * gx) * (0.5f * deltat);
+                qmath::quaternion_t q = get();
+                qmath::quaternion_t qDot = qmath::rate(q, gx, gy, gz);
+                q.w += qDot.w * deltat;
+                q.x += qDot.x * deltat;
+                q.y += qDot.y * deltat;
+                q.z += qDot.z * deltat;
 
                 // Normalise quaternion
-                norm = sqrtf(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);
-                norm = 1.0f / norm;
-                q1 *= norm;
-                q2 *= norm;
-                q3 *= norm;
-                q4 *= norm;
+                qmath::normalize(q);
+                set(q);
             }
 
     }; // class MahonyQuaternionFilter
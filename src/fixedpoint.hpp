@@ -0,0 +1,250 @@
+/*
+   Saturating fixed-point arithmetic for boards without an FPU
+
+   Fixed<T, FRAC> stores a number as a signed integer T with FRAC fraction
+   bits.  Sums, differences, and products are computed in the next wider
+   integer type and clamped to T's range instead of wrapping, so overflow
+   degrades gracefully the way it does in float, and products round to
+   nearest.  Conversions to and from float happen only where a value
+   enters or leaves a kernel.
+
+   Two formats cover the control path:
+
+     q15_t: 16 bits, [-1, +1), for values that never leave that range;
+            products need only a 32-bit multiply
+
+     q24_t: 32 bits, [-128, +128), with 24 fraction bits (about seven
+            decimal digits), for rates, gains, and quaternion arithmetic
+
+   Build with HACKFLIGHT_FIXED_POINT defined to run the PID controllers,
+   mixer, receiver expo curves, and software quaternion filter in fixed
+   point.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    // Wider type for intermediate results, and the limits to clamp them to
+    template <typename T>
+    struct FixedTraits;
+
+    template <>
+    struct FixedTraits<int16_t> {
+
+        typedef int32_t wide_t;
+
+        static const int16_t MIN = INT16_MIN;
+        static const int16_t MAX = INT16_MAX;
+    };
+
+    template <>
+    struct FixedTraits<int32_t> {
+
+        typedef int64_t wide_t;
+
+        static const int32_t MIN = INT32_MIN;
+        static const int32_t MAX = INT32_MAX;
+    };
+
+    template <typename T, uint8_t FRAC>
+    class Fixed {
+
+        private:
+
+            typedef typename FixedTraits<T>::wide_t wide_t;
+
+            static const T MIN = FixedTraits<T>::MIN;
+            static const T MAX = FixedTraits<T>::MAX;
+
+            static const wide_t ONE = (wide_t)1 << FRAC;
+
+            T _raw = 0;
+
+            static T saturate(int64_t x)
+            {
+                return x > MAX ? MAX : x < MIN ? MIN : (T)x;
+            }
+
+            // Digit-by-digit square root, starting from the highest even bit at or below x's top bit
+            static uint64_t isqrt(uint64_t x)
+            {
+                uint64_t result = 0;
+                uint64_t bit = (uint64_t)1 << ((63 - __builtin_clzll(x)) & ~1);
+
+                while (bit) {
+                    if (x >= result + bit) {
+                        x -= result + bit;
+                        result = (result >> 1) + bit;
+                    }
+                    else {
+                        result >>= 1;
+                    }
+                    bit >>= 2;
+                }
+
+                return result;
+            }
+
+        public:
+
+            Fixed(void) { }
+
+            // Explicit, so that a float can't slip into a fixed-point kernel unnoticed
+            explicit Fixed(float x)
+            {
+                float scaled = x * ONE;
+
+                _raw = scaled >= MAX ? MAX : scaled <= MIN ? MIN : (T)(scaled + (scaled < 0 ? -0.5f : 0.5f));
+            }
+
+            static Fixed fromRaw(T raw)
+            {
+                Fixed f;
+                f._raw = raw;
+                return f;
+            }
+
+            static Fixed fromInt(int32_t k)
+            {
+                return fromRaw(saturate((int64_t)k * ONE));
+            }
+
+            T toRaw(void) const
+            {
+                return _raw;
+            }
+
+            float toFloat(void) const
+            {
+                return _raw * (1.0f / ONE);
+            }
+
+            Fixed operator+(Fixed b) const
+            {
+                return fromRaw(saturate((wide_t)_raw + b._raw));
+            }
+
+            Fixed operator-(Fixed b) const
+            {
+                return fromRaw(saturate((wide_t)_raw - b._raw));
+            }
+
+            Fixed operator-(void) const
+            {
+                return fromRaw(saturate(-(wide_t)_raw));
+            }
+
+            Fixed operator*(Fixed b) const
+            {
+                wide_t product = (wide_t)_raw * b._raw;
+                return fromRaw(saturate((product + (ONE >> 1)) >> FRAC));
+            }
+
+            // Multiplying by a small integer, like a mixer direction, needs no rescaling
+            Fixed operator*(int32_t k) const
+            {
+                return fromRaw(saturate((int64_t)_raw * k));
+            }
+
+            Fixed operator/(Fixed b) const
+            {
+                if (b._raw == 0) {
+                    return fromRaw(_raw < 0 ? MIN : MAX);
+                }
+
+                return fromRaw(saturate((wide_t)_raw * ONE / b._raw));
+            }
+
+            // Halving, quartering, and so on
+            Fixed operator>>(uint8_t bits) const
+            {
+                return fromRaw(_raw >> bits);
+            }
+
+            Fixed & operator+=(Fixed b)
+            {
+                return *this = *this + b;
+            }
+
+            Fixed & operator-=(Fixed b)
+            {
+                return *this = *this - b;
+            }
+
+            Fixed & operator*=(Fixed b)
+            {
+                return *this = *this * b;
+            }
+
+            bool operator<(Fixed b) const  { return _raw <  b._raw; }
+            bool operator>(Fixed b) const  { return _raw >  b._raw; }
+            bool operator<=(Fixed b) const { return _raw <= b._raw; }
+            bool operator>=(Fixed b) const { return _raw >= b._raw; }
+            bool operator==(Fixed b) const { return _raw == b._raw; }
+            bool operator!=(Fixed b) const { return _raw != b._raw; }
+
+            static Fixed constrainMinMax(Fixed val, Fixed min, Fixed max)
+            {
+                return val < min ? min : val > max ? max : val;
+            }
+
+            static Fixed constrainAbs(Fixed val, Fixed max)
+            {
+                return constrainMinMax(val, -max, max);
+            }
+
+            /**
+             * Scales a vector to unit length in place.  The sum of squares is taken in 64 bits, so
+             * components anywhere in the format's range are safe.  Returns false, leaving the vector
+             * unchanged, if it is all zeros.
+             */
+            static bool normalize(Fixed v[], uint8_t n)
+            {
+                // Quarter each square so that four of them can't overflow
+                uint64_t sum = 0;
+                for (uint8_t k=0; k<n; ++k) {
+                    int64_t r = v[k]._raw;
+                    sum += (uint64_t)(r * r) >> 2;
+                }
+
+                if (sum == 0) {
+                    return false;
+                }
+
+                int64_t norm = 2 * (int64_t)isqrt(sum);
+
+                // One division for the reciprocal, then a multiply per component
+                int64_t reciprocal = (int64_t)ONE * ONE / norm;
+
+                for (uint8_t k=0; k<n; ++k) {
+                    v[k]._raw = saturate(((int64_t)v[k]._raw * reciprocal + (ONE >> 1)) >> FRAC);
+                }
+
+                return true;
+            }
+
+    }; // class Fixed
+
+    typedef Fixed<int16_t, 15> q15_t;
+    typedef Fixed<int32_t, 24> q24_t;
+
+} // namespace hf
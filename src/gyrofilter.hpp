@@ -0,0 +1,297 @@
+/*
+   Gyrometer filter chain: PT1, biquad lowpass, and biquad notch stages
+
+   Every stage is a biquad in Direct Form II transposed (a PT1 is a biquad
+   with its second-order terms zeroed), and each stage filters all three
+   axes at once.  Coefficients and state are stored as a structure of
+   arrays, one lane per axis, padded to four lanes so the inner loop maps
+   onto a single SIMD register where the compiler can vectorize it.
+
+   Stages are listed at startup with their cutoff frequencies.  The
+   coefficients depend on the gyro sample rate, so they are computed in
+   begin(), either from a rate you pass in or, by default, from the rate
+   measured over the first half second of samples; until then, samples
+   pass through unfiltered.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "filters.hpp"
+#include "timebase.hpp"
+
+namespace hf {
+
+    class GyroFilter {
+
+        public:
+
+            static const uint8_t MAXSTAGES = 4;
+
+        private:
+
+            // Three axes, padded to four
+            static const uint8_t LANES = 4;
+
+            // How long to measure the sample rate when none is given
+            static const uint32_t MEASURE_USEC = 500000;
+
+            static constexpr float BUTTERWORTH_Q = 0.7071068f;
+
+            typedef enum {
+
+                STAGE_PT1,
+                STAGE_LOWPASS,
+                STAGE_NOTCH
+
+            } stageType_t;
+
+            typedef struct {
+
+                stageType_t type;
+                float       hz;     // cutoff, or center for notch
+                float       q;      // unused for PT1
+
+            } stageSpec_t;
+
+            // Normalized so that a0 = 1
+            typedef struct {
+
+                float b0;
+                float b1;
+                float b2;
+                float a1;
+                float a2;
+
+            } coefficients_t;
+
+            typedef struct {
+
+                float b0[LANES];
+                float b1[LANES];
+                float b2[LANES];
+                float a1[LANES];
+                float a2[LANES];
+
+                float z1[LANES];
+                float z2[LANES];
+
+            } stage_t;
+
+            stageSpec_t _specs[MAXSTAGES];
+            stage_t _stages[MAXSTAGES];
+            uint8_t _count = 0;
+
+            bool _ready = false;
+
+            float _sampleHz = 0;
+
+            // Sample-rate measurement
+            uint64_t _measureStart = 0;
+            uint32_t _measureCount = 0;
+
+            bool add(stageType_t type, float hz, float q)
+            {
+                if (_count == MAXSTAGES) {
+                    return false;
+                }
+
+                _specs[_count].type = type;
+                _specs[_count].hz = hz;
+                _specs[_count].q = q;
+                _count++;
+
+                return true;
+            }
+
+            // Leaves the lane's filter state alone, so retuning a running stage doesn't reset it
+            static void setLane(stage_t & stage, uint8_t lane, const coefficients_t & c)
+            {
+                stage.b0[lane] = c.b0;
+                stage.b1[lane] = c.b1;
+                stage.b2[lane] = c.b2;
+                stage.a1[lane] = c.a1;
+                stage.a2[lane] = c.a2;
+            }
+
+            static coefficients_t computeCoefficients(stageType_t type, float hz, float q, float sampleHz)
+            {
+                // A cutoff at or above Nyquist can't be realized, so the stage just passes samples through
+                if (hz <= 0 || hz >= sampleHz / 2) {
+                    coefficients_t c = {1, 0, 0, 0, 0};
+                    return c;
+                }
+
+                if (type == STAGE_PT1) {
+                    float rc = 1 / (2 * M_PI * hz);
+                    float dt = 1 / sampleHz;
+                    float k = dt / (rc + dt);
+                    coefficients_t c = {k, 0, 0, k-1, 0};
+                    return c;
+                }
+
+                // Biquads from the Audio EQ Cookbook (R. Bristow-Johnson)
+                float w0 = 2 * M_PI * hz / sampleHz;
+                float cs = cosf(w0);
+                float alpha = sinf(w0) / (2 * q);
+                float a0 = 1 + alpha;
+
+                if (type == STAGE_LOWPASS) {
+                    float b = (1 - cs) / 2;
+                    coefficients_t c = {b/a0, 2*b/a0, b/a0, -2*cs/a0, (1-alpha)/a0};
+                    return c;
+                }
+
+                // STAGE_NOTCH
+                coefficients_t c = {1/a0, -2*cs/a0, 1/a0, -2*cs/a0, (1-alpha)/a0};
+                return c;
+            }
+
+            // All axes through one stage
+            static void run(stage_t & s, float x[LANES])
+            {
+                for (uint8_t k=0; k<LANES; ++k) {
+                    float y = s.b0[k] * x[k] + s.z1[k];
+                    s.z1[k] = s.b1[k] * x[k] - s.a1[k] * y + s.z2[k];
+                    s.z2[k] = s.b2[k] * x[k] - s.a2[k] * y;
+                    x[k] = y;
+                }
+            }
+
+        public:
+
+            /**
+             * First-order lowpass.  Returns false if there are already MAXSTAGES stages.
+             */
+            bool addPt1(float cutoffHz)
+            {
+                return add(STAGE_PT1, cutoffHz, 0);
+            }
+
+            /**
+             * Second-order lowpass; the default Q gives a Butterworth response.
+             */
+            bool addLowpass(float cutoffHz, float q=BUTTERWORTH_Q)
+            {
+                return add(STAGE_LOWPASS, cutoffHz, q);
+            }
+
+            /**
+             * Notch; higher Q gives a narrower notch.
+             */
+            bool addNotch(float centerHz, float q)
+            {
+                return add(STAGE_NOTCH, centerHz, q);
+            }
+
+            /**
+             * Computes coefficients for the given sample rate.  With no rate, the rate is measured
+             * over the first half second of samples passed to apply().
+             */
+            void begin(float sampleHz=0)
+            {
+                _ready = false;
+                _measureCount = 0;
+
+                if (sampleHz > 0) {
+
+                    for (uint8_t k=0; k<_count; ++k) {
+                        const stageSpec_t & spec = _specs[k];
+                        coefficients_t c = computeCoefficients(spec.type, spec.hz, spec.q, sampleHz);
+                        stage_t & stage = _stages[k];
+                        for (uint8_t j=0; j<LANES; ++j) {
+                            setLane(stage, j, c);
+                            stage.z1[j] = 0;
+                            stage.z2[j] = 0;
+                        }
+                    }
+
+                    _sampleHz = sampleHz;
+                    _ready = true;
+                }
+            }
+
+            /**
+             * Moves one axis (0, 1, 2 = x, y, z) of a stage to a new cutoff or center frequency, keeping its
+             * filter state so the output doesn't jump.  Call after the filter is ready; zero makes that axis of
+             * the stage pass samples through.
+             */
+            void tune(uint8_t index, uint8_t axis, float hz)
+            {
+                if (!_ready || index >= _count || axis >= 3) {
+                    return;
+                }
+
+                const stageSpec_t & spec = _specs[index];
+
+                setLane(_stages[index], axis, computeCoefficients(spec.type, hz, spec.q, _sampleHz));
+            }
+
+            /**
+             * Filters one sample in place; usec is its time on Hackflight's timebase.
+             */
+            void apply(float & gx, float & gy, float & gz, uint64_t usec)
+            {
+                if (!_ready) {
+
+                    if (_measureCount == 0) {
+                        _measureStart = usec;
+                    }
+
+                    else if (usec - _measureStart >= MEASURE_USEC) {
+                        begin(_measureCount / Timebase::elapsed(_measureStart, usec));
+                    }
+
+                    _measureCount++;
+
+                    return;
+                }
+
+                float x[LANES] = {gx, gy, gz, 0};
+
+                for (uint8_t k=0; k<_count; ++k) {
+                    run(_stages[k], x);
+                }
+
+                gx = x[0];
+                gy = x[1];
+                gz = x[2];
+            }
+
+            bool ready(void)
+            {
+                return _ready;
+            }
+
+            // Sample rate the coefficients were computed for
+            float getSampleRate(void)
+            {
+                return _sampleHz;
+            }
+
+            uint8_t count(void)
+            {
+                return _count;
+            }
+
+    }; // class GyroFilter
+
+} // namespace hf
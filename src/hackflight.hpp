@@ -27,123 +27,280 @@
 #include "receiver.hpp"
 #include "datatypes.hpp"
 #include "pidcontroller.hpp"
+#include "scheduler.hpp"
+#include "profiler.hpp"
+#include "dispatch.hpp"
+#include "registry.hpp"
+#include "seqlock.hpp"
+#include "timebase.hpp"
+#include "gyrofilter.hpp"
+#include "dynamicnotch.hpp"
 #include "sensors/surfacemount/gyrometer.hpp"
 #include "sensors/surfacemount/quaternion.hpp"
 #include "sensors/mspsensor.hpp"
 
+// Capacity of the Hackflight class's PID controller and optional sensor lists; define before including to override
+#ifndef HACKFLIGHT_MAXPIDS
+#define HACKFLIGHT_MAXPIDS 4
+#endif
+#ifndef HACKFLIGHT_MAXSENSORS
+#define HACKFLIGHT_MAXSENSORS 4
+#endif
+
 namespace hf {
 
-    class Hackflight : public MspParser {
+    /**
+     * Core algorithm, with board, receiver, and mixer types as template parameters.  Instantiated on
+     * concrete classes, calls to them are resolved at compile time (see Dispatch); instantiated on
+     * Board, Receiver, and Mixer themselves, it makes ordinary virtual calls, which is what the
+     * Hackflight class below does.  MAXPIDS and MAXSENSORS set how many PID controllers and optional
+     * sensors can be added.
+     */
+    template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS>
+    class HackflightCore : public MspParser {
 
         private: 
 
             static constexpr float MAX_ARMING_ANGLE_DEGREES = 25.0f;
 
-            // Passed to Hackflight::init() for a particular build
-            Board      * _board = NULL;
-            Receiver   * _receiver = NULL;
-            Mixer      * _mixer = NULL;
+            // Passed to init() for a particular build
+            BoardT     * _board = NULL;
+            ReceiverT  * _receiver = NULL;
+            MixerT     * _mixer = NULL;
 
             // Supports periodic ad-hoc debugging
             Debugger _debugger;
 
+            // Per-stage loop timing; compiles to nothing unless HACKFLIGHT_PROFILE is defined
+            Profiler _profiler;
+
             // PID controllers
-            PidController * _pid_controllers[256] = {NULL};
-            uint8_t _pid_controller_count = 0;
+            Registry<PidController *, MAXPIDS> _pidControllers;
 
             // Mandatory sensors on the board
             Gyrometer _gyrometer;
             Quaternion _quaternion; // not really a sensor, but we treat it like one!
 
+            // Optional filtering of gyrometer values before they reach the PID controllers
+            GyroFilter * _gyroFilter = NULL;
+            DynamicNotch * _dynamicNotch = NULL;
+
             // Additional sensors 
-            Sensor * _sensors[256] = {NULL};
-            uint8_t _sensor_count = 0;
+            typedef struct {
+
+                Sensor * sensor;
+                uint32_t period;    // usec; 0 to poll on every update
+                uint64_t next;      // usec
+
+            } polledSensor_t;
+
+            Registry<polledSensor_t, MAXSENSORS> _sensors;
+
+            // Time of the current pass through the gyro/PID/mixer chain and quaternion, and through the
+            // receiver, serial comms, and optional sensors; one per core when running dual-core
+            Timebase _controlClock;
+            Timebase _commsClock;
 
             // Vehicle state
             state_t _state;
 
+            // What the gyro/PID/mixer chain needs from the receiver, GCS, and failsafe logic
+            typedef struct {
+
+                demands_t demands;            // from receiver, before scaling
+                float     demandScale;
+                float     motorsDisarmed[4];  // for motor testing from GCS
+                uint32_t  frame;              // counts receiver frames
+                bool      failsafe;
+                bool      throttleDown;
+                uint8_t   auxState;
+
+            } command_t;
+
+            command_t _command;
+
             // Demands sent to mixer
             demands_t _demands;
 
+            // The gyro/PID/mixer chain works on these: _state and _command, unless running dual-core
+            state_t   * _controlState = &_state;
+            command_t * _controlCommand = &_command;
+
+            // Last receiver frame passed to PID controllers
+            uint32_t _controlFrame = 0;
+
+            // Dual-core mode: the control core's own state and command, and the snapshots passed between cores
+            typedef struct {
+
+                state_t   state;
+                command_t command;
+
+            } commsSnapshot_t;
+
+            bool _dualCore = false;
+            state_t _dualState;
+            command_t _dualCommand;
+            Seqlock<state_t> _controlSnapshot;          // written by control core
+            Seqlock<commsSnapshot_t> _commsSnapshot;    // written by comms core
+
             // Safety
             bool _safeToArm = false;
             bool _failsafe = false;
 
-            // Support for headless mode
-            float _yawInitial = 0;
+            // Support for headless mode: heading at arming
+            float _yawInitialSine = 0;
+            float _yawInitialCosine = 1;
+
+            // Optional rate-monotonic scheduling; otherwise we poll everything on each update
+            Scheduler _scheduler;
+            bool _useScheduler = false;
+
+            // Scheduler task priorities: shorter period gets higher priority (lower number)
+            static const uint8_t PRIORITY_GYROMETER  = 0;
+            static const uint8_t PRIORITY_QUATERNION = 1;
+            static const uint8_t PRIORITY_RECEIVER   = 2;
+            static const uint8_t PRIORITY_SENSORS    = 3;
+            static const uint8_t PRIORITY_SERIAL     = 4;
 
             bool safeAngle(uint8_t axis)
             {
-                return fabs(_state.rotation[axis]) < Filter::deg2rad(MAX_ARMING_ANGLE_DEGREES);
+                return fabs(_state.cache.getEulerAngles()[axis]) < Filter::deg2rad(MAX_ARMING_ANGLE_DEGREES);
             }
 
             void checkQuaternion(void)
             {
-                // Some quaternion filters may need to know the current time
-                float time = _board->getTime();
+                uint32_t probe = _profiler.start();
 
                 // If quaternion data ready
-                if (_quaternion.ready(time)) {
+                if (Dispatch::getQuaternion(_board, _quaternion._w, _quaternion._x, _quaternion._y, _quaternion._z)) {
 
                     // Adjust quaternion values based on IMU orientation
-                    _board->adjustQuaternion(_quaternion._w, _quaternion._x, _quaternion._y, _quaternion._z);
+                    Dispatch::adjustQuaternion(_board, _quaternion._w, _quaternion._x, _quaternion._y, _quaternion._z);
 
-                    // Update state with new quaternion to yield Euler angles
-                    _quaternion.modifyState(_state, time);
+                    // Update state with new quaternion; Euler angles follow from it when something asks for them
+                    _quaternion.modifyState(*_controlState, _controlClock.now());
 
                     // Adjust Euler angles to compensate for sloppy IMU mounting
-                    _board->adjustRollAndPitch(_state.rotation[0], _state.rotation[1]);
+                    float rollTrim = 0;
+                    float pitchTrim = 0;
+                    Dispatch::adjustRollAndPitch(_board, rollTrim, pitchTrim);
+                    _controlState->cache.setRollPitchTrim(rollTrim, pitchTrim);
+
+                    _profiler.stop(Profiler::STAGE_QUATERNION, probe);
 
-                    // Synch serial comms to quaternion check
-                    doSerialComms();
+                    // Synch serial comms to quaternion check, unless the scheduler or the other core runs them
+                    if (!_useScheduler && !_dualCore) {
+                        doSerialComms();
+                    }
                 }
             }
 
             void checkGyrometer(void)
             {
-                // Some gyrometers may need to know the current time
-                float time = _board->getTime();
+                bool gotSample = false;
+
+                // Process every sample queued by a gyro interrupt, each with its own timestamp
+                gyroSample_t sample;
+                while (Dispatch::popGyrometer(_board, sample)) {
+                    _gyrometer._x = sample.x;
+                    _gyrometer._y = sample.y;
+                    _gyrometer._z = sample.z;
+                    processGyrometer(_controlClock.extend(sample.usec));
+                    gotSample = true;
+                }
+
+                // Otherwise, poll the gyrometer
+                if (!gotSample) {
+
+                    if (!Dispatch::getGyrometer(_board, _gyrometer._x, _gyrometer._y, _gyrometer._z)) {
+                        return;
+                    }
+
+                    processGyrometer(_controlClock.now());
+                }
+
+                // Use updated demands to run motors
+                if (_controlState->armed && !_controlCommand->failsafe && !_controlCommand->throttleDown) {
+                    uint32_t probe = _profiler.start();
+                    _mixer->runArmed(_board, _demands);
+                    _profiler.stop(Profiler::STAGE_MIXER, probe);
+                }
+
+                // Otherwise write the stopped or disarmed values, so that motors needing a value every loop get one
+                // in every state; the mixer skips the write when nothing has changed for the others
+                else {
+                    if (_controlState->armed) {
+                        _mixer->runStopped(_board);
+                    }
+                    else {
+                        runDisarmed();
+                    }
+                }
+            }
+
+            // Runs state update and PID controllers on one gyrometer sample
+            void processGyrometer(uint64_t usec)
+            {
+                uint32_t probe = _profiler.start();
 
-                // If gyrometer data ready
-                if (_gyrometer.ready(time)) {
+                // Adjust gyrometer values based on IMU orientation
+                Dispatch::adjustGyrometer(_board, _gyrometer._x, _gyrometer._y, _gyrometer._z);
 
-                    // Adjust gyrometer values based on IMU orientation
-                    _board->adjustGyrometer(_gyrometer._x, _gyrometer._y, _gyrometer._z);
+                if (_gyroFilter) {
+                    _gyroFilter->apply(_gyrometer._x, _gyrometer._y, _gyrometer._z, usec);
+                }
 
-                    // Update state with gyro rates
-                    _gyrometer.modifyState(_state, time);
+                // Timed on its own as well, to show the cost of its time-sliced analysis
+                if (_dynamicNotch) {
+                    uint32_t notchProbe = _profiler.start();
+                    _dynamicNotch->apply(_gyrometer._x, _gyrometer._y, _gyrometer._z, usec);
+                    _profiler.stop(Profiler::STAGE_DYNAMICNOTCH, notchProbe);
+                }
 
-                    // For PID control, start with demands from receiver, scaling roll/pitch/yaw by constant
-                    _demands.throttle = _receiver->demands.throttle;
-                    _demands.roll     = _receiver->demands.roll  * _receiver->_demandScale;
-                    _demands.pitch    = _receiver->demands.pitch * _receiver->_demandScale;
-                    _demands.yaw      = _receiver->demands.yaw   * _receiver->_demandScale;
+                // Update state with gyro rates
+                _gyrometer.modifyState(*_controlState, usec);
 
-                    // Sync PID controllers to gyro update
-                    runPidControllers();
+                _profiler.stop(Profiler::STAGE_GYROMETER, probe);
 
-                    // Use updated demands to run motors
-                    if (_state.armed && !_failsafe && !_receiver->throttleIsDown()) {
-                        _mixer->runArmed(_demands);
+                command_t * command = _controlCommand;
+
+                // Update PID controllers with each new receiver frame
+                if (command->frame != _controlFrame) {
+                    for (uint8_t k=0; k<_pidControllers.count(); ++k) {
+                        _pidControllers[k]->updateReceiver(command->demands, command->throttleDown);
                     }
+                    _controlFrame = command->frame;
                 }
+
+                // For PID control, start with demands from receiver, scaling roll/pitch/yaw by constant
+                _demands.throttle = command->demands.throttle;
+                _demands.roll     = command->demands.roll  * command->demandScale;
+                _demands.pitch    = command->demands.pitch * command->demandScale;
+                _demands.yaw      = command->demands.yaw   * command->demandScale;
+
+                // Sync PID controllers to gyro update
+                runPidControllers();
             }
 
             void runPidControllers(void)
             {
                 // Each PID controllers is associated with at least one auxiliary switch state
-                uint8_t auxState = _receiver->getAux1State();
+                uint8_t auxState = _controlCommand->auxState;
 
                 // Some PID controllers should cause LED to flash when they're active
                 bool shouldFlash = false;
 
-                for (uint8_t k=0; k<_pid_controller_count; ++k) {
+                for (uint8_t k=0; k<_pidControllers.count(); ++k) {
 
-                    PidController * pidController = _pid_controllers[k];
+                    PidController * pidController = _pidControllers[k];
 
                     if (pidController->auxState <= auxState) {
 
-                        pidController->modifyDemands(_state, _demands); 
+                        uint32_t probe = _profiler.start();
+
+                        pidController->modifyDemands(*_controlState, _demands); 
+
+                        _profiler.stop(Profiler::STAGE_PID+k, probe);
 
                         if (pidController->shouldFlashLed()) {
                             shouldFlash = true;
@@ -152,95 +309,207 @@ namespace hf {
                 }
 
                 // Flash LED for certain PID controllers
-                _board->flashLed(shouldFlash);
+                Dispatch::flashLed(_board, shouldFlash);
+            }
+
+            // Receiver demands, turned by the change in heading since arming if headless
+            void computeDemands(void)
+            {
+                float c = 1;
+                float s = 0;
+
+                if (_receiver->headless) {
+                    float yawSine = 0;
+                    float yawCosine = 1;
+                    _state.cache.getYaw(yawSine, yawCosine);
+                    c = yawCosine * _yawInitialCosine + yawSine * _yawInitialSine;
+                    s = yawSine * _yawInitialCosine - yawCosine * _yawInitialSine;
+                }
+
+                _receiver->computeDemands(c, s);
             }
 
             void checkReceiver(void)
             {
                 // Sync failsafe to receiver
-                if (_receiver->lostSignal() && _state.armed) {
-                    _mixer->cutMotors();
+                if (Dispatch::lostSignal(_receiver) && _state.armed) {
+                    cutMotors();
                     _state.armed = false;
                     _failsafe = true;
-                    _board->showArmedStatus(false);
+                    _command.failsafe = true;
+                    Dispatch::showArmedStatus(_board, false);
                     return;
                 }
 
                 // Check whether receiver data is available
-                if (!_receiver->getDemands(_state.rotation[AXIS_YAW] - _yawInitial)) return;
+                uint32_t probe = _profiler.start();
+                if (!Dispatch::gotNewFrame(_receiver)) return;
+                Dispatch::readRawvals(_receiver);
+                computeDemands();
+                _profiler.stop(Profiler::STAGE_RECEIVER, probe);
 
-                // Update PID controllers with receiver demands
-                for (uint8_t k=0; k<_pid_controller_count; ++k) {
-                    _pid_controllers[k]->updateReceiver(_receiver->demands, _receiver->throttleIsDown());
-                }
+                // Pass the new frame on to the gyro/PID/mixer chain
+                updateCommand();
+                _command.frame++;
 
                 // Disarm
-                if (_state.armed && !_receiver->getAux2State()) {
+                if (_state.armed && !Dispatch::getAux2State(_receiver)) {
                     _state.armed = false;
                 } 
 
                 // Avoid arming if aux2 switch down on startup
                 if (!_safeToArm) {
-                    _safeToArm = !_receiver->getAux2State();
+                    _safeToArm = !Dispatch::getAux2State(_receiver);
                 }
 
                 // Arm (after lots of safety checks!)
-                if (_safeToArm && !_state.armed && _receiver->throttleIsDown() && _receiver->getAux2State() && 
-                        !_failsafe && safeAngle(AXIS_ROLL) && safeAngle(AXIS_PITCH)) {
-                    _state.armed = true;
-                    _yawInitial = _state.rotation[AXIS_YAW]; // grab yaw for headless mode
+                if (_safeToArm && !_state.armed && _receiver->throttleIsDown() && Dispatch::getAux2State(_receiver) && 
+                        !_failsafe) {
+                    if (safeAngle(AXIS_ROLL) && safeAngle(AXIS_PITCH)) {
+                        _state.armed = true;
+                        _state.cache.getYaw(_yawInitialSine, _yawInitialCosine); // grab yaw for headless mode
+                    }
                 }
 
                 // Cut motors on throttle-down
                 if (_state.armed && _receiver->throttleIsDown()) {
-                    _mixer->cutMotors();
+                    cutMotors();
                 }
 
                 // Set LED based on arming status
-                _board->showArmedStatus(_state.armed);
+                Dispatch::showArmedStatus(_board, _state.armed);
 
             } // checkReceiver
 
             void doSerialComms(void)
             {
-                while (_board->serialAvailableBytes() > 0) {
+                uint32_t probe = _profiler.start();
+
+                while (Dispatch::serialAvailableBytes(_board) > 0) {
 
-                    if (MspParser::parse(_board->serialReadByte())) {
-                        _board->reboot(); // parser returns true when reboot requested
+                    if (MspParser::parse(Dispatch::serialReadByte(_board))) {
+                        Dispatch::reboot(_board); // parser returns true when reboot requested
                     }
                 }
 
                 while (MspParser::availableBytes() > 0) {
-                    _board->serialWriteByte(MspParser::readByte());
+                    Dispatch::serialWriteByte(_board, MspParser::readByte());
                 }
 
-                // Support motor testing from GCS
-                if (!_state.armed) {
-                    _mixer->runDisarmed();
-                }
+                _profiler.stop(Profiler::STAGE_SERIAL, probe);
             }
 
             void checkOptionalSensors(void)
             {
-                for (uint8_t k=0; k<_sensor_count; ++k) {
-                    Sensor * sensor = _sensors[k];
-                    float time = _board->getTime();
-                    if (sensor->ready(time)) {
-                        sensor->modifyState(_state, time);
+                uint64_t usec = _commsClock.now();
+
+                for (uint8_t k=0; k<_sensors.count(); ++k) {
+
+                    polledSensor_t & entry = _sensors[k];
+
+                    // Skip sensors whose polling period hasn't come around yet
+                    if (entry.period > 0) {
+                        if (usec < entry.next) {
+                            continue;
+                        }
+                        entry.next += entry.period;
+                        if (usec >= entry.next) {
+                            entry.next = usec + entry.period;
+                        }
+                    }
+
+                    Sensor * sensor = entry.sensor;
+                    if (sensor->ready(usec)) {
+                        sensor->modifyState(_state, usec);
                     }
                 }
             }
 
-            void add_sensor(Sensor * sensor)
+            void updateCommand(void)
+            {
+                _command.demands = _receiver->demands;
+                _command.demandScale = _receiver->_demandScale;
+                _command.failsafe = _failsafe;
+                _command.throttleDown = _receiver->throttleIsDown();
+                _command.auxState = Dispatch::getAux1State(_receiver);
+            }
+
+            void runDisarmed(void)
+            {
+                for (uint8_t k=0; k<4; ++k) {
+                    _mixer->motorsDisarmed[k] = _controlCommand->motorsDisarmed[k];
+                }
+
+                _mixer->runDisarmed(_board);
+            }
+
+            // Running dual-core, the control core stops the motors itself once it sees the new state
+            void cutMotors(void)
+            {
+                if (!_dualCore) {
+                    _mixer->cutMotors(_board);
+                }
+            }
+
+            // Takes the time sample for a pass through the gyro/PID/mixer chain and quaternion
+            void sampleControlClock(void)
+            {
+                _controlClock.update(Dispatch::getMicros(_board));
+            }
+
+            // Takes the time sample for a pass through the receiver, serial comms, and optional sensors
+            void sampleCommsClock(void)
+            {
+                _commsClock.update(Dispatch::getMicros(_board));
+            }
+
+            // Trampolines for scheduler tasks and clock
+
+            static void gyrometerTask(void * hf)
+            {
+                ((HackflightCore *)hf)->sampleControlClock();
+                ((HackflightCore *)hf)->checkGyrometer();
+            }
+
+            static void quaternionTask(void * hf)
+            {
+                ((HackflightCore *)hf)->sampleControlClock();
+                ((HackflightCore *)hf)->checkQuaternion();
+            }
+
+            static void receiverTask(void * hf)
+            {
+                ((HackflightCore *)hf)->checkReceiver();
+            }
+
+            static void sensorsTask(void * hf)
+            {
+                ((HackflightCore *)hf)->sampleCommsClock();
+                ((HackflightCore *)hf)->checkOptionalSensors();
+            }
+
+            static void serialTask(void * hf)
+            {
+                ((HackflightCore *)hf)->doSerialComms();
+            }
+
+            static uint32_t schedulerClock(void * hf)
             {
-                _sensors[_sensor_count++] = sensor;
+                return Dispatch::getMicros(((HackflightCore *)hf)->_board);
             }
 
-            void add_sensor(SurfaceMountSensor * sensor, Board * board) 
+            void publishComms(void)
             {
-                add_sensor(sensor);
+                commsSnapshot_t snapshot;
+                snapshot.state = _state;
+                snapshot.command = _command;
+                _commsSnapshot.write(snapshot);
+            }
 
-                sensor->board = board;
+            // Zero Hz is a period of zero, which runs a task in the background and a sensor on every update
+            static uint32_t hz2usec(uint16_t hz)
+            {
+                return hz > 0 ? 1000000 / hz : 0;
             }
 
         protected:
@@ -253,7 +522,7 @@ namespace hf {
                 variometer = 0;
                 positionX = 0;
                 positionY = 0;
-                heading = -_state.rotation[AXIS_YAW]; // NB: Angle negated for remote visualization
+                heading = -_state.cache.getEulerAngles()[AXIS_YAW]; // NB: Angle negated for remote visualization
                 velocityForward = 0;
                 velocityRightward = 0;
             }
@@ -282,22 +551,48 @@ namespace hf {
 
             virtual void handle_ATTITUDE_RADIANS_Request(float & roll, float & pitch, float & yaw) override
             {
-                roll  = _state.rotation[AXIS_ROLL];
-                pitch = _state.rotation[AXIS_PITCH];
-                yaw   = _state.rotation[AXIS_YAW];
+                const float * euler = _state.cache.getEulerAngles();
+                roll  = euler[AXIS_ROLL];
+                pitch = euler[AXIS_PITCH];
+                yaw   = euler[AXIS_YAW];
+            }
+
+            virtual void handle_LOOP_TIMING_Request(int32_t & stage, int32_t & count, int32_t & minimum, int32_t & maximum, 
+                    int32_t & meanNsec, int32_t & h0, int32_t & h1, int32_t & h2, int32_t & h3, int32_t & h4, int32_t & h5, 
+                    int32_t & h6, int32_t & h7) override
+            {
+                uint8_t index = 0;
+                const Profiler::stage_t * s = _profiler.nextReport(index);
+
+                // Profiling disabled: send zeros
+                if (!s) return;
+
+                stage    = index;
+                count    = s->count;
+                minimum  = s->count ? s->minimum : 0;
+                maximum  = s->maximum;
+                meanNsec = s->count ? (int32_t)(1000 * s->total / s->count) : 0;
+                h0 = s->histogram[0];
+                h1 = s->histogram[1];
+                h2 = s->histogram[2];
+                h3 = s->histogram[3];
+                h4 = s->histogram[4];
+                h5 = s->histogram[5];
+                h6 = s->histogram[6];
+                h7 = s->histogram[7];
             }
 
             virtual void handle_SET_MOTOR_NORMAL(float  m1, float  m2, float  m3, float  m4) override
             {
-                _mixer->motorsDisarmed[0] = m1;
-                _mixer->motorsDisarmed[1] = m2;
-                _mixer->motorsDisarmed[2] = m3;
-                _mixer->motorsDisarmed[3] = m4;
+                _command.motorsDisarmed[0] = m1;
+                _command.motorsDisarmed[1] = m2;
+                _command.motorsDisarmed[2] = m3;
+                _command.motorsDisarmed[3] = m4;
             }
 
         public:
 
-            void init(Board * board, Receiver * receiver, Mixer * mixer, bool armed=false)
+            void init(BoardT * board, ReceiverT * receiver, MixerT * mixer, bool armed=false)
             {  
                 // Store the essentials
                 _board    = board;
@@ -307,15 +602,24 @@ namespace hf {
                 // Ad-hoc debugging support
                 _debugger.init(board);
 
+                // Loop timing support
+                _profiler.init(board);
+
                 // Support for mandatory sensors
-                add_sensor(&_quaternion, board);
-                add_sensor(&_gyrometer, board);
+                _quaternion.board = board;
+                _gyrometer.board = board;
 
                 // Support adding new sensors and PID controllers
-                _sensor_count = 0;
+                _sensors.clear();
+                _pidControllers.clear();
+
+                // No gyro filtering unless asked for
+                _gyroFilter = NULL;
+                _dynamicNotch = NULL;
 
-                // Initialize state
+                // Initialize state, level until the first quaternion arrives
                 memset(&_state, 0, sizeof(state_t));
+                _state.cache.reset();
 
                 // Support safety override by simulator
                 _state.armed = armed;
@@ -326,28 +630,176 @@ namespace hf {
                 // Initialize the receiver
                 _receiver->begin();
 
-                // Tell the mixer which board to use
-                _mixer->board = board; 
-
                 // Setup failsafe
                 _failsafe = false;
 
+                // Start the gyro/PID/mixer chain with the receiver's initial values
+                memset(&_command, 0, sizeof(command_t));
+                updateCommand();
+                _controlFrame = 0;
+
+                // Default to polling on a single core
+                _useScheduler = false;
+                _dualCore = false;
+                _controlState = &_state;
+                _controlCommand = &_command;
+
             } // init
 
-            void addSensor(Sensor * sensor) 
+            /**
+             * Adds an optional sensor, polled at the specified rate, or on every update if the rate is zero.
+             * Call after init().  Returns false if there are already MAXSENSORS sensors.
+             */
+            bool addSensor(Sensor * sensor, uint16_t hz=0) 
             {
-                add_sensor(sensor);
+                polledSensor_t entry;
+                entry.sensor = sensor;
+                entry.period = hz2usec(hz);
+                entry.next = _commsClock.update(Dispatch::getMicros(_board));
+
+                return _sensors.add(entry);
             }
 
-            void addPidController(PidController * pidController, uint8_t auxState=0) 
+            /**
+             * Returns false if there are already MAXPIDS controllers.
+             */
+            bool addPidController(PidController * pidController, uint8_t auxState=0) 
             {
                 pidController->auxState = auxState;
 
-                _pid_controllers[_pid_controller_count++] = pidController;
+                return _pidControllers.add(pidController);
+            }
+
+            /**
+             * Filters gyrometer values before the PID controllers see them.  Call after init(), and after
+             * adding stages to the filter; unless you've already called the filter's begin() with the gyro
+             * sample rate, the rate is measured over the first half second of samples.
+             */
+            void setGyroFilter(GyroFilter * filter)
+            {
+                _gyroFilter = filter;
+            }
+
+            /**
+             * Adds notches that follow the strongest noise peaks in the gyrometer, after any filter from
+             * setGyroFilter().  Call after init().
+             */
+            void setDynamicNotch(DynamicNotch * notch)
+            {
+                _dynamicNotch = notch;
+            }
+
+            /**
+             * Runs the gyro/PID/mixer chain, quaternion, receiver, and optional sensors as periodic tasks at
+             * the specified rates, with serial comms in the leftover time.  A rate of zero runs that task
+             * in the leftover time too.  Call after init().
+             */
+            void useScheduler(uint16_t gyrometerHz=1000, uint16_t quaternionHz=500, uint16_t receiverHz=100, uint16_t sensorsHz=100)
+            {
+                _scheduler.init(schedulerClock, this);
+
+                _scheduler.addTask("gyrometer",  gyrometerTask,  this, hz2usec(gyrometerHz),  PRIORITY_GYROMETER);
+                _scheduler.addTask("quaternion", quaternionTask, this, hz2usec(quaternionHz), PRIORITY_QUATERNION);
+                _scheduler.addTask("receiver",   receiverTask,   this, hz2usec(receiverHz),   PRIORITY_RECEIVER);
+                _scheduler.addTask("sensors",    sensorsTask,    this, hz2usec(sensorsHz),    PRIORITY_SENSORS);
+                _scheduler.addTask("serial",     serialTask,     this, 0,                     PRIORITY_SERIAL);
+
+                _scheduler.start();
+
+                _useScheduler = true;
+            }
+
+            Scheduler * getScheduler(void)
+            {
+                return &_scheduler;
+            }
+
+            Profiler * getProfiler(void)
+            {
+                return &_profiler;
+            }
+
+            /**
+             * Splits the loop across two cores, or two threads: updateControl() on one runs the
+             * gyro/PID/mixer chain and the quaternion, and updateComms() on the other handles the
+             * receiver, serial comms, and optional sensors.  The cores exchange state and receiver
+             * demands through seqlock snapshots, so neither ever waits on the other.  Call after init()
+             * and after adding PID controllers and sensors, and then call updateControl() and
+             * updateComms() instead of update().
+             */
+            void useDualCore(void)
+            {
+                _dualState = _state;
+                _dualCommand = _command;
+
+                _controlState = &_dualState;
+                _controlCommand = &_dualCommand;
+
+                _controlSnapshot.write(_dualState);
+                publishComms();
+
+                _dualCore = true;
+            }
+
+            // Control core, dual-core mode
+            void updateControl(void)
+            {
+                // Get the latest receiver demands, arming, and sensor values; if the comms core is
+                // in the middle of publishing them, keep what we have rather than wait
+                commsSnapshot_t snapshot;
+                if (_commsSnapshot.tryRead(snapshot)) {
+
+                    _dualCommand = snapshot.command;
+
+                    _dualState.armed = snapshot.state.armed;
+
+                    _dualState.cache.copyLocation(snapshot.state.cache);
+
+                    for (uint8_t k=0; k<3; ++k) {
+                        _dualState.bodyAccel[k]   = snapshot.state.bodyAccel[k];
+                        _dualState.bodyVel[k]     = snapshot.state.bodyVel[k];
+                        _dualState.inertialVel[k] = snapshot.state.inertialVel[k];
+                    }
+                }
+
+                sampleControlClock();
+
+                checkGyrometer();
+                checkQuaternion();
+
+                _controlSnapshot.write(_dualState);
+            }
+
+            // Comms core, dual-core mode
+            void updateComms(void)
+            {
+                // Get the latest attitude and rates from the control core
+                state_t snapshot;
+                if (_controlSnapshot.tryRead(snapshot)) {
+                    _state.cache.copyAttitude(snapshot.cache);
+                }
+
+                sampleCommsClock();
+
+                checkReceiver();
+                doSerialComms();
+                checkOptionalSensors();
+
+                publishComms();
             }
 
             void update(void)
             {
+                if (_useScheduler) {
+                    _scheduler.run();
+                    return;
+                }
+
+                // One time sample for the whole pass
+                uint32_t counter = Dispatch::getMicros(_board);
+                _controlClock.update(counter);
+                _commsClock.update(counter);
+
                 // Grab control signal if available
                 checkReceiver();
 
@@ -359,6 +811,14 @@ namespace hf {
                 checkOptionalSensors();
             } 
 
+    }; // class HackflightCore
+
+    /**
+     * The usual way to run Hackflight: every board, receiver, and mixer call goes through the
+     * virtual interface, so one build can work with any combination of them.
+     */
+    class Hackflight : public HackflightCore<Board, Receiver, Mixer, HACKFLIGHT_MAXPIDS, HACKFLIGHT_MAXSENSORS> {
+
     }; // class Hackflight
 
 } // namespace
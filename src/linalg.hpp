@@ -0,0 +1,192 @@
+/*
+   Simple linear algebra support
+
+   Matrices are sized at compile time, so each one takes exactly the memory
+   its shape needs, the loops over it have constant bounds the compiler can
+   unroll, and multiplying matrices whose shapes don't match is a compile
+   error rather than a silent overrun.  A symmetric matrix can be kept in
+   half the space, as its upper triangle.
+
+   Copyright (c) 2018 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "debugger.hpp"
+
+namespace hf {
+
+    namespace linalg {
+
+        template <uint8_t ROWS, uint8_t COLS>
+        class Matrix {
+
+            private:
+
+                float _vals[ROWS][COLS];
+
+            public:
+
+                Matrix(void)
+                {
+                    zero();
+                }
+
+                float get(uint8_t j, uint8_t k) const
+                {
+                    return _vals[j][k];
+                }
+
+                void set(uint8_t j, uint8_t k, float val)
+                {
+                    _vals[j][k] = val;
+                }
+
+                void zero(void)
+                {
+                    for (uint8_t j=0; j<ROWS; ++j) {
+                        for (uint8_t k=0; k<COLS; ++k) {
+                            _vals[j][k] = 0;
+                        }
+                    }
+                }
+
+                void dump(void) const
+                {
+                    for (uint8_t j=0; j<ROWS; ++j) {
+                        for (uint8_t k=0; k<COLS; ++k) {
+                            Debugger::printf("%+2.2f ", _vals[j][k]);
+                        }
+                        Debugger::printf("\n");
+                    }
+                }
+
+        };  // class Matrix
+
+        // Symmetric matrix, storing only the upper triangle, row by row
+        template <uint8_t DIM>
+        class SymmetricMatrix {
+
+            public:
+
+                static const uint16_t SIZE = DIM * (DIM + 1) / 2;
+
+            private:
+
+                float _vals[SIZE];
+
+                // Offset of (j,k), for j <= k, in the packed upper triangle
+                static uint16_t index(uint8_t j, uint8_t k)
+                {
+                    return j * DIM - j * (j - 1) / 2 + k - j;
+                }
+
+            public:
+
+                SymmetricMatrix(void)
+                {
+                    zero();
+                }
+
+                float get(uint8_t j, uint8_t k) const
+                {
+                    return j <= k ? _vals[index(j, k)] : _vals[index(k, j)];
+                }
+
+                // Sets both (j,k) and (k,j)
+                void set(uint8_t j, uint8_t k, float val)
+                {
+                    _vals[j <= k ? index(j, k) : index(k, j)] = val;
+                }
+
+                // The upper triangle in row order: (0,0), (0,1), ... (0,DIM-1), (1,1), ...
+                float * packed(void)
+                {
+                    return _vals;
+                }
+
+                const float * packed(void) const
+                {
+                    return _vals;
+                }
+
+                void zero(void)
+                {
+                    for (uint16_t k=0; k<SIZE; ++k) {
+                        _vals[k] = 0;
+                    }
+                }
+
+        };  // class SymmetricMatrix
+
+        // at = a'
+        template <uint8_t ROWS, uint8_t COLS>
+        void trans(const Matrix<ROWS,COLS> & a, Matrix<COLS,ROWS> & at)
+        {
+            for (uint8_t j=0; j<ROWS; ++j) {
+                for (uint8_t k=0; k<COLS; ++k) {
+                    at.set(k, j, a.get(j, k));
+                }
+            }
+        }
+
+        // c = a b; c must not be a or b
+        template <uint8_t ROWS, uint8_t INNER, uint8_t COLS>
+        void mult(const Matrix<ROWS,INNER> & a, const Matrix<INNER,COLS> & b, Matrix<ROWS,COLS> & c)
+        {
+            for (uint8_t i=0; i<ROWS; ++i) {
+                for (uint8_t j=0; j<COLS; ++j) {
+                    float sum = 0;
+                    for (uint8_t k=0; k<INNER; ++k) {
+                        sum += a.get(i, k) * b.get(k, j);
+                    }
+                    c.set(i, j, sum);
+                }
+            }
+        }
+
+        // c = a b', without forming b'; c must not be a or b
+        template <uint8_t ROWS, uint8_t INNER, uint8_t COLS>
+        void multTransposed(const Matrix<ROWS,INNER> & a, const Matrix<COLS,INNER> & b, Matrix<ROWS,COLS> & c)
+        {
+            for (uint8_t i=0; i<ROWS; ++i) {
+                for (uint8_t j=0; j<COLS; ++j) {
+                    float sum = 0;
+                    for (uint8_t k=0; k<INNER; ++k) {
+                        sum += a.get(i, k) * b.get(j, k);
+                    }
+                    c.set(i, j, sum);
+                }
+            }
+        }
+
+        // c = u v for column u and row v
+        template <uint8_t ROWS, uint8_t COLS>
+        void outer(const Matrix<ROWS,1> & u, const Matrix<1,COLS> & v, Matrix<ROWS,COLS> & c)
+        {
+            for (uint8_t i=0; i<ROWS; ++i) {
+                for (uint8_t j=0; j<COLS; ++j) {
+                    c.set(i, j, u.get(i, 0) * v.get(0, j));
+                }
+            }
+        }
+
+    } // namespace linalg
+
+} // namespace hf
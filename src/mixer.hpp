@@ -1,135 +1,502 @@
-/*
-   Mixer class
-
-   Copyright (c) 2018 Simon D. Levy
-
-   This file is part of Hackflight.
-
-   Hackflight is free software: you can redistribute it and/or modify
-   it under the terms of the GNU General Public License as published by
-   the Free Software Foundation, either version 3 of the License, or
-   (at your option) any later version.
-
-   Hackflight is distributed in the hope that it will be useful,
-   but WITHOUT ANY WARRANTY; without even the implied warranty of
-   MEReceiverHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-   GNU General Public License for more details.
-   You should have received a copy of the GNU General Public License
-   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
- */
-
-#pragma once
-
-#include "filters.hpp"
-
-namespace hf {
-
-    class Mixer {
-
-        friend class Hackflight;
-        friend class MspParser;
-        friend class RealBoard;
-
-        private:
-
-            // Custom mixer data per motor
-            typedef struct motorMixer_t {
-                int8_t throttle; // T
-                int8_t roll; 	 // A
-                int8_t pitch;	 // E
-                int8_t yaw;	     // R
-            } motorMixer_t;
-
-            // Arbitrary
-            static const uint8_t MAXMOTORS = 20;
-
-            float _motorsPrev[MAXMOTORS] = {0};
-
-            void writeMotor(uint8_t index, float value)
-            {
-                // Avoid sending the motor the same value over and over
-                if (_motorsPrev[index] != value) {
-                    board->writeMotor(index,value);
-                }
-
-                _motorsPrev[index] = value;
-            }
-
-        protected:
-
-            Board * board;
-
-            motorMixer_t motorDirections[MAXMOTORS];
-
-            Mixer(uint8_t _nmotors)
-            {
-                nmotors = _nmotors;
-
-                // set disarmed, previous motor values
-                for (uint8_t i = 0; i < nmotors; i++) {
-                    motorsDisarmed[i] = 0;
-                    _motorsPrev[i] = 0;
-                }
-
-            }
-
-            // These are also use by MSP
-            float  motorsDisarmed[MAXMOTORS];
-            uint8_t nmotors;
-
-            void runArmed(demands_t demands)
-            {
-                // Map throttle demand from [-1,+1] to [0,1]
-                demands.throttle = (demands.throttle + 1) / 2;
-
-                float motors[MAXMOTORS];
-
-                for (uint8_t i = 0; i < nmotors; i++) {
-
-                    motors[i] = 
-                        (demands.throttle * motorDirections[i].throttle + 
-                         demands.roll     * motorDirections[i].roll +     
-                         demands.pitch    * motorDirections[i].pitch +   
-                         demands.yaw      * motorDirections[i].yaw);      
-                }
-
-                float maxMotor = motors[0];
-
-                for (uint8_t i = 1; i < nmotors; i++)
-                    if (motors[i] > maxMotor)
-                        maxMotor = motors[i];
-
-                for (uint8_t i = 0; i < nmotors; i++) {
-
-                    // This is a way to still have good gyro corrections if at least one motor reaches its max
-                    if (maxMotor > 1) {
-                        motors[i] -= maxMotor - 1;
-                    }
-
-                    // Keep motor values in interval [0,1]
-                    motors[i] = Filter::constrainMinMax(motors[i], 0, 1);
-                }
-
-                for (uint8_t i = 0; i < nmotors; i++) {
-                    writeMotor(i, motors[i]);
-                }
-            }
-
-            // This is how we can spin the motors from the GCS
-            void runDisarmed(void)
-            {
-                for (uint8_t i = 0; i < nmotors; i++) {
-                    writeMotor(i, motorsDisarmed[i]);
-                }
-            }
-
-            void cutMotors(void)
-            {
-                for (uint8_t i = 0; i < nmotors; i++) {
-                    board->writeMotor(i, 0);
-                }
-            }
-
-    }; // class Mixer
-
-} // namespace
+/*
+   Mixer classes
+
+   Mixer is what Hackflight sees: it keeps the motor count and the values
+   for spinning the motors from the GCS, and writes the motors from the
+   demands through the mix() that each kind of mixer provides.
+   MatrixMixer<NMOTORS> is the usual kind.  It keeps the roll, pitch, and
+   yaw column of each motor as floats, set once by the subclass for a
+   particular frame, so each pass through the mixer is a single
+   matrix-vector product: four motors at a time with SSE or NEON, and
+   otherwise a loop whose length the compiler knows and can unroll.
+
+   The result is desaturated airmode-style.  If the roll, pitch, and yaw
+   asked for need more than the full range of a motor, they are all
+   scaled down together, so the vehicle still turns the way it was told,
+   only more slowly; then the throttle is moved as little as it takes to
+   fit every motor into [0,1], so low throttle keeps full attitude
+   authority and high throttle gives up thrust rather than control.
+
+   Copyright (c) 2018 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MEReceiverHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "filters.hpp"
+#include "fixedpoint.hpp"
+#include "dispatch.hpp"
+#include "mixers/geometry.hpp"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace hf {
+
+    class Mixer {
+
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
+        friend class MspParser;
+        friend class RealBoard;
+
+        protected:
+
+            // Arbitrary
+            static const uint8_t MAXMOTORS = 20;
+
+        private:
+
+            float _motorsPrev[MAXMOTORS] = {0};
+
+        protected:
+
+            // Writes all the motors in one call, so a board that can will change them at the same instant
+            template <typename BoardT>
+            void writeMotors(BoardT * board, const float * values)
+            {
+                // Avoid sending the motors the same values over and over, unless they need them
+                bool changed = Dispatch::motorsNeedRefresh(board);
+                for (uint8_t i = 0; i < nmotors; i++) {
+                    changed = changed || _motorsPrev[i] != values[i];
+                    _motorsPrev[i] = values[i];
+                }
+
+                if (changed) {
+                    Dispatch::writeMotors(board, values, nmotors);
+                }
+            }
+
+            Mixer(uint8_t _nmotors)
+            {
+                nmotors = _nmotors;
+
+                // set disarmed, previous motor values
+                for (uint8_t i = 0; i < nmotors; i++) {
+                    motorsDisarmed[i] = 0;
+                    _motorsPrev[i] = 0;
+                }
+
+            }
+
+            // These are also use by MSP
+            float  motorsDisarmed[MAXMOTORS];
+            uint8_t nmotors;
+
+            // Motor values in [0,1] for the demands, with throttle in [-1,+1]
+            virtual void mix(const demands_t & demands, float motors[]) = 0;
+
+            // Same as mix(), in fixed point
+            virtual void mixFixed(const demands_t & demands, float motors[]) = 0;
+
+            // Board type is a template parameter so that motor writes can be dispatched statically
+            template <typename BoardT>
+            void runArmed(BoardT * board, const demands_t & demands)
+            {
+                float motors[MAXMOTORS];
+
+#ifdef HACKFLIGHT_FIXED_POINT
+                mixFixed(demands, motors);
+#else
+                mix(demands, motors);
+#endif
+
+                writeMotors(board, motors);
+            }
+
+            // This is how we can spin the motors from the GCS
+            template <typename BoardT>
+            void runDisarmed(BoardT * board)
+            {
+                writeMotors(board, motorsDisarmed);
+            }
+
+            // Keeps the motors stopped, writing them only when they need it
+            template <typename BoardT>
+            void runStopped(BoardT * board)
+            {
+                float zeros[MAXMOTORS] = {0};
+
+                writeMotors(board, zeros);
+            }
+
+            // Stops the motors right away, whatever they were last sent
+            template <typename BoardT>
+            void cutMotors(BoardT * board)
+            {
+                float zeros[MAXMOTORS] = {0};
+
+                Dispatch::writeMotors(board, zeros, nmotors);
+
+                for (uint8_t i = 0; i < nmotors; i++) {
+                    _motorsPrev[i] = 0;
+                }
+            }
+
+    }; // class Mixer
+
+    template <uint8_t NMOTORS>
+    class MatrixMixer : public Mixer {
+
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
+
+        static_assert(NMOTORS > 0 && NMOTORS <= MAXMOTORS, "Motor count out of range");
+
+        private:
+
+            // Motors rounded up to a whole number of four-lane SIMD registers
+            static const uint8_t LANES = (NMOTORS + 3) & ~3;
+
+            // Mixing matrix by column, with the lanes past the last motor copying the first motor, so
+            // that they never change the smallest or largest motor value
+            alignas(16) float _roll[LANES];
+            alignas(16) float _pitch[LANES];
+            alignas(16) float _yaw[LANES];
+
+            // Throttle column, and its reciprocal for desaturating; all ones unless the frame is lopsided
+            float _throttle[NMOTORS];
+            float _inverseThrottle[NMOTORS];
+            bool _uniformThrottle = true;
+
+            // The same matrix in fixed point
+            q24_t _fixedThrottle[NMOTORS];
+            q24_t _fixedInverseThrottle[NMOTORS];
+            q24_t _fixedRoll[NMOTORS];
+            q24_t _fixedPitch[NMOTORS];
+            q24_t _fixedYaw[NMOTORS];
+
+            // Scale for the roll, pitch, and yaw, and throttle to add, that fit every motor into [0,1]
+            static void desaturate(float lo, float hi, float throttle, float & scale, float & shifted)
+            {
+                float range = hi - lo;
+
+                scale = 1;
+
+                if (range > 1) {
+                    scale = 1 / range;
+                    lo *= scale;
+                    hi *= scale;
+                }
+
+                shifted = Filter::constrainMinMax(throttle, -lo, 1 - hi);
+            }
+
+            // Same as the mix() below for a matrix whose motors take different shares of the throttle: each
+            // motor's roll, pitch, and yaw is measured against its own share when fitting them into [0,1]
+            void mixWeighted(const demands_t & demands, float throttle, float motors[])
+            {
+                float rpy[NMOTORS];
+                float lo = 0;
+
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    rpy[i] = demands.roll * _roll[i] + demands.pitch * _pitch[i] + demands.yaw * _yaw[i];
+                    float r = rpy[i] * _inverseThrottle[i];
+                    lo = (i == 0 || r < lo) ? r : lo;
+                }
+
+                // Largest scale at which some throttle fits every motor
+                float scale = 1;
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    float d = rpy[i] * _inverseThrottle[i] - lo;
+                    if (d * scale > _inverseThrottle[i]) {
+                        scale = _inverseThrottle[i] / d;
+                    }
+                }
+
+                float hi = 0;
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    float h = _inverseThrottle[i] - rpy[i] * _inverseThrottle[i] * scale;
+                    hi = (i == 0 || h < hi) ? h : hi;
+                }
+
+                throttle = Filter::constrainMinMax(throttle, -lo * scale, hi);
+
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    motors[i] = Filter::constrainMinMax(throttle * _throttle[i] + rpy[i] * scale, 0, 1);
+                }
+            }
+
+        protected:
+
+            /**
+             * Sets one motor's row of the mixing matrix.  Its throttle share should be in (0,1].
+             */
+            void setMotorDirection(uint8_t index, float throttle, float roll, float pitch, float yaw)
+            {
+                _throttle[index] = throttle;
+                _inverseThrottle[index] = 1 / throttle;
+                _roll[index] = roll;
+                _pitch[index] = pitch;
+                _yaw[index] = yaw;
+
+                _uniformThrottle = true;
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    _uniformThrottle = _uniformThrottle && _throttle[i] == 1;
+                }
+
+                _fixedThrottle[index] = q24_t(throttle);
+                _fixedInverseThrottle[index] = q24_t(1 / throttle);
+                _fixedRoll[index] = q24_t(roll);
+                _fixedPitch[index] = q24_t(pitch);
+                _fixedYaw[index] = q24_t(yaw);
+
+                if (index == 0) {
+                    for (uint8_t i = NMOTORS; i < LANES; i++) {
+                        _roll[i] = roll;
+                        _pitch[i] = pitch;
+                        _yaw[i] = yaw;
+                    }
+                }
+            }
+
+            /**
+             * Sets one motor's row of the mixing matrix, for a motor that takes the whole throttle demand.
+             */
+            void setMotorDirection(uint8_t index, float roll, float pitch, float yaw)
+            {
+                setMotorDirection(index, 1, roll, pitch, yaw);
+            }
+
+            /**
+             * Sets the whole mixing matrix, as computed from the frame by geometry::matrix().
+             */
+            void setMotorDirections(const geometry::matrix_t<NMOTORS> & matrix)
+            {
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    setMotorDirection(i, matrix.throttle[i], matrix.roll[i], matrix.pitch[i], matrix.yaw[i]);
+                }
+            }
+
+            /**
+             * One motor's row of the mixing matrix.
+             */
+            void getMotorDirection(uint8_t index, float & throttle, float & roll, float & pitch, float & yaw) const
+            {
+                throttle = _throttle[index];
+                roll = _roll[index];
+                pitch = _pitch[index];
+                yaw = _yaw[index];
+            }
+
+            MatrixMixer(void)
+                : Mixer(NMOTORS)
+            {
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    _throttle[i] = 1;
+                }
+
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    setMotorDirection(i, 0, 0, 0);
+                }
+            }
+
+            virtual void mix(const demands_t & demands, float motors[]) override
+            {
+                // Map throttle demand from [-1,+1] to [0,1]
+                float throttle = (demands.throttle + 1) / 2;
+
+                if (!_uniformThrottle) {
+                    mixWeighted(demands, throttle, motors);
+                    return;
+                }
+
+                float scale = 0;
+                float shifted = 0;
+
+#if defined(__SSE__)
+                __m128 roll = _mm_set1_ps(demands.roll);
+                __m128 pitch = _mm_set1_ps(demands.pitch);
+                __m128 yaw = _mm_set1_ps(demands.yaw);
+
+                // Roll, pitch, and yaw for each motor, and the smallest and largest of them
+                __m128 rpy[LANES/4];
+                for (uint8_t k = 0; k < LANES/4; k++) {
+                    __m128 v = _mm_mul_ps(_mm_load_ps(&_roll[4*k]), roll);
+                    v = _mm_add_ps(v, _mm_mul_ps(_mm_load_ps(&_pitch[4*k]), pitch));
+                    v = _mm_add_ps(v, _mm_mul_ps(_mm_load_ps(&_yaw[4*k]), yaw));
+                    rpy[k] = v;
+                }
+
+                __m128 lo = rpy[0];
+                __m128 hi = rpy[0];
+                for (uint8_t k = 1; k < LANES/4; k++) {
+                    lo = _mm_min_ps(lo, rpy[k]);
+                    hi = _mm_max_ps(hi, rpy[k]);
+                }
+                lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2,3,0,1)));
+                lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1,0,3,2)));
+                hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2,3,0,1)));
+                hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1,0,3,2)));
+
+                desaturate(_mm_cvtss_f32(lo), _mm_cvtss_f32(hi), throttle, scale, shifted);
+
+                // Throttle first, then the scaled demands, so that an unsaturated mix rounds as it always has
+                roll = _mm_mul_ps(roll, _mm_set1_ps(scale));
+                pitch = _mm_mul_ps(pitch, _mm_set1_ps(scale));
+                yaw = _mm_mul_ps(yaw, _mm_set1_ps(scale));
+                alignas(16) float out[LANES];
+                for (uint8_t k = 0; k < LANES/4; k++) {
+                    __m128 v = _mm_add_ps(_mm_set1_ps(shifted), _mm_mul_ps(_mm_load_ps(&_roll[4*k]), roll));
+                    v = _mm_add_ps(v, _mm_mul_ps(_mm_load_ps(&_pitch[4*k]), pitch));
+                    v = _mm_add_ps(v, _mm_mul_ps(_mm_load_ps(&_yaw[4*k]), yaw));
+
+                    // Keep motor values in interval [0,1] against rounding
+                    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1));
+                    _mm_store_ps(&out[4*k], v);
+                }
+#elif defined(__ARM_NEON)
+                // Roll, pitch, and yaw for each motor, and the smallest and largest of them
+                float32x4_t rpy[LANES/4];
+                for (uint8_t k = 0; k < LANES/4; k++) {
+                    float32x4_t v = vmulq_n_f32(vld1q_f32(&_roll[4*k]), demands.roll);
+                    v = vmlaq_n_f32(v, vld1q_f32(&_pitch[4*k]), demands.pitch);
+                    v = vmlaq_n_f32(v, vld1q_f32(&_yaw[4*k]), demands.yaw);
+                    rpy[k] = v;
+                }
+
+                float32x4_t lo = rpy[0];
+                float32x4_t hi = rpy[0];
+                for (uint8_t k = 1; k < LANES/4; k++) {
+                    lo = vminq_f32(lo, rpy[k]);
+                    hi = vmaxq_f32(hi, rpy[k]);
+                }
+                float32x2_t lo2 = vpmin_f32(vget_low_f32(lo), vget_high_f32(lo));
+                float32x2_t hi2 = vpmax_f32(vget_low_f32(hi), vget_high_f32(hi));
+                lo2 = vpmin_f32(lo2, lo2);
+                hi2 = vpmax_f32(hi2, hi2);
+
+                desaturate(vget_lane_f32(lo2, 0), vget_lane_f32(hi2, 0), throttle, scale, shifted);
+
+                // Throttle first, then the scaled demands, so that an unsaturated mix rounds as it always has
+                float roll = demands.roll * scale;
+                float pitch = demands.pitch * scale;
+                float yaw = demands.yaw * scale;
+                alignas(16) float out[LANES];
+                for (uint8_t k = 0; k < LANES/4; k++) {
+                    float32x4_t v = vmlaq_n_f32(vdupq_n_f32(shifted), vld1q_f32(&_roll[4*k]), roll);
+                    v = vmlaq_n_f32(v, vld1q_f32(&_pitch[4*k]), pitch);
+                    v = vmlaq_n_f32(v, vld1q_f32(&_yaw[4*k]), yaw);
+
+                    // Keep motor values in interval [0,1] against rounding
+                    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0)), vdupq_n_f32(1));
+                    vst1q_f32(&out[4*k], v);
+                }
+#else
+                // Roll, pitch, and yaw for each motor, and the smallest and largest of them
+                float out[NMOTORS];
+                float lo = 0;
+                float hi = 0;
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    out[i] = demands.roll * _roll[i] + demands.pitch * _pitch[i] + demands.yaw * _yaw[i];
+                    lo = (i == 0 || out[i] < lo) ? out[i] : lo;
+                    hi = (i == 0 || out[i] > hi) ? out[i] : hi;
+                }
+
+                desaturate(lo, hi, throttle, scale, shifted);
+
+                // Throttle first, then the scaled demands, so that an unsaturated mix rounds as it always has
+                float roll = demands.roll * scale;
+                float pitch = demands.pitch * scale;
+                float yaw = demands.yaw * scale;
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    out[i] = shifted + roll * _roll[i] + pitch * _pitch[i] + yaw * _yaw[i];
+
+                    // Keep motor values in interval [0,1] against rounding
+                    out[i] = Filter::constrainMinMax(out[i], 0, 1);
+                }
+#endif
+
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    motors[i] = out[i];
+                }
+            }
+
+            virtual void mixFixed(const demands_t & demands, float motors[]) override
+            {
+                const q24_t one = q24_t::fromInt(1);
+
+                // Map throttle demand from [-1,+1] to [0,1]
+                q24_t throttle = (q24_t(demands.throttle) + one) >> 1;
+                q24_t roll(demands.roll);
+                q24_t pitch(demands.pitch);
+                q24_t yaw(demands.yaw);
+
+                // Roll, pitch, and yaw for each motor, and the smallest of them against its throttle share
+                q24_t rpy[NMOTORS];
+                q24_t lo;
+
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    rpy[i] = roll * _fixedRoll[i] + pitch * _fixedPitch[i] + yaw * _fixedYaw[i];
+                    q24_t r = rpy[i] * _fixedInverseThrottle[i];
+                    lo = (i == 0 || r < lo) ? r : lo;
+                }
+
+                // Scale roll, pitch, and yaw together if no throttle would fit them all
+                bool scaled = false;
+                q24_t scale = one;
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    q24_t d = rpy[i] * _fixedInverseThrottle[i] - lo;
+                    if (d * scale > _fixedInverseThrottle[i]) {
+                        scale = _fixedInverseThrottle[i] / d;
+                        scaled = true;
+                    }
+                }
+
+                if (scaled) {
+                    lo *= scale;
+                    for (uint8_t i = 0; i < NMOTORS; i++) {
+                        rpy[i] *= scale;
+                    }
+                }
+
+                // Then move the throttle as little as it takes to fit every motor
+                q24_t hi;
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    q24_t h = _fixedInverseThrottle[i] - rpy[i] * _fixedInverseThrottle[i];
+                    hi = (i == 0 || h < hi) ? h : hi;
+                }
+
+                throttle = q24_t::constrainMinMax(throttle, -lo, hi);
+
+                for (uint8_t i = 0; i < NMOTORS; i++) {
+                    q24_t motor = rpy[i] + throttle * _fixedThrottle[i];
+                    motors[i] = q24_t::constrainMinMax(motor, q24_t(), one).toFloat();
+                }
+            }
+
+            // Hides Mixer::runArmed(), so that a HackflightCore built on a particular mixer mixes without
+            // a virtual call
+            template <typename BoardT>
+            void runArmed(BoardT * board, const demands_t & demands)
+            {
+                float motors[NMOTORS];
+
+#ifdef HACKFLIGHT_FIXED_POINT
+                MatrixMixer::mixFixed(demands, motors);
+#else
+                MatrixMixer::mix(demands, motors);
+#endif
+
+                writeMotors(board, motors);
+            }
+
+    }; // class MatrixMixer
+
+} // namespace
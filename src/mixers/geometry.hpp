@@ -0,0 +1,279 @@
+/*
+   Mixing matrices computed at compile time from the layout of the motors
+
+   Each motor is given by the angle of its arm in degrees clockwise from
+   the nose, seen from above; the length of the arm; the way its propeller
+   spins; and, relative to the other motors, the thrust it makes and the
+   reaction torque that comes with it.  From these, geometry::matrix()
+   builds the matrix that takes each motor's thrust to the thrust, roll,
+   pitch, and yaw moments on the vehicle, and returns its pseudo-inverse,
+   which gives the motor speeds for a demand with the least total effort.
+   Each column is scaled so that its largest entry is 1, the range the
+   stick demands expect.
+
+   Everything is done in constexpr functions of a single expression, as
+   C++11 requires, so a matrix assigned to a constexpr variable costs
+   nothing at run time.  A layout that can't produce one of the four
+   (all propellers spinning the same way, say) makes a singular matrix,
+   and the division by its zero determinant stops the compile.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    namespace geometry {
+
+        // Propeller spin seen from above, which is also the sign of the motor's yaw column: a positive yaw
+        // demand speeds up the CW motors and slows down the CCW ones
+        static constexpr float CW  = +1;
+        static constexpr float CCW = -1;
+
+        typedef struct {
+
+            float angle;    // degrees clockwise from the nose
+            float arm;      // distance from the center of mass, in any unit
+            float spin;     // CW or CCW
+            float thrust;   // thrust per unit command, relative to the other motors
+            float torque;   // reaction torque per unit command, relative to the other motors
+
+        } motor_t;
+
+        /**
+         * A motor with the same propeller as the others.
+         */
+        constexpr motor_t motor(float angle, float arm, float spin)
+        {
+            return motor_t {angle, arm, spin, 1, 1};
+        }
+
+        template <uint8_t NMOTORS>
+        struct matrix_t {
+
+            float throttle[NMOTORS];
+            float roll[NMOTORS];
+            float pitch[NMOTORS];
+            float yaw[NMOTORS];
+        };
+
+        // What's left of an exact zero after the trigonometry, relative to the largest entry
+        static constexpr double ROUNDING = 1e-9;
+
+        // 4x4 matrix, as a literal type
+        struct square_t {
+
+            double m[4][4];
+        };
+
+        //------------------------------------------------------------------------------------------------
+        // Trigonometry, in degrees
+
+        constexpr double PI = 3.14159265358979323846;
+
+        // x^k/k! and the rest of the series for sin(x), to well past double precision for |x| <= pi
+        constexpr double series(double x2, double term, uint8_t k)
+        {
+            return k > 29 ? 0 : term - series(x2, term * x2 / ((k+1) * (k+2)), k+2);
+        }
+
+        constexpr double reduce(double degrees)
+        {
+            return degrees > 180 ? reduce(degrees - 360) : degrees < -180 ? reduce(degrees + 360) : degrees;
+        }
+
+        constexpr double sine(double degrees)
+        {
+            return series((reduce(degrees) * PI / 180) * (reduce(degrees) * PI / 180), reduce(degrees) * PI / 180, 1);
+        }
+
+        constexpr double cosine(double degrees)
+        {
+            return sine(degrees + 90);
+        }
+
+        constexpr double absolute(double x)
+        {
+            return x < 0 ? -x : x;
+        }
+
+        constexpr double greater(double a, double b)
+        {
+            return a > b ? a : b;
+        }
+
+        //------------------------------------------------------------------------------------------------
+        // Effectiveness: row 0 thrust, 1 roll right, 2 pitch forward, 3 yaw right, for one unit on motor i
+
+        constexpr double effect(const motor_t & m, uint8_t row)
+        {
+            // A motor on the right rolls the vehicle left, and one at the front pitches it back
+            return
+                row == 0 ? m.thrust :
+                row == 1 ? -m.thrust * m.arm * sine(m.angle) :
+                row == 2 ? -m.thrust * m.arm * cosine(m.angle) :
+                m.spin * m.torque;
+        }
+
+        template <uint8_t NMOTORS>
+        constexpr double effect(const motor_t (&motors)[NMOTORS], uint8_t row, uint8_t i)
+        {
+            return effect(motors[i], row);
+        }
+
+        // Entry (r,c) of B B', summed from motor i on
+        template <uint8_t NMOTORS>
+        constexpr double gram(const motor_t (&motors)[NMOTORS], uint8_t r, uint8_t c, uint8_t i)
+        {
+            return i == NMOTORS ? 0 : effect(motors, r, i) * effect(motors, c, i) + gram(motors, r, c, i+1);
+        }
+
+        template <uint8_t NMOTORS>
+        constexpr double gram(const motor_t (&motors)[NMOTORS], uint8_t r, uint8_t c)
+        {
+            return gram(motors, r, c, 0);
+        }
+
+        template <uint8_t NMOTORS>
+        constexpr square_t gram(const motor_t (&motors)[NMOTORS])
+        {
+            return square_t {{
+                { gram(motors, 0, 0), gram(motors, 0, 1), gram(motors, 0, 2), gram(motors, 0, 3) },
+                { gram(motors, 1, 0), gram(motors, 1, 1), gram(motors, 1, 2), gram(motors, 1, 3) },
+                { gram(motors, 2, 0), gram(motors, 2, 1), gram(motors, 2, 2), gram(motors, 2, 3) },
+                { gram(motors, 3, 0), gram(motors, 3, 1), gram(motors, 3, 2), gram(motors, 3, 3) }
+            }};
+        }
+
+        //------------------------------------------------------------------------------------------------
+        // Inverse of a 4x4 matrix by cofactors
+
+        // The k-th of the three indices other than x
+        constexpr uint8_t skip(uint8_t k, uint8_t x)
+        {
+            return k < x ? k : k + 1;
+        }
+
+        // Determinant of a with row r and column c taken out
+        constexpr double minor(const square_t & a, uint8_t r, uint8_t c)
+        {
+            return
+                a.m[skip(0,r)][skip(0,c)] * (a.m[skip(1,r)][skip(1,c)] * a.m[skip(2,r)][skip(2,c)] -
+                                             a.m[skip(1,r)][skip(2,c)] * a.m[skip(2,r)][skip(1,c)]) -
+                a.m[skip(0,r)][skip(1,c)] * (a.m[skip(1,r)][skip(0,c)] * a.m[skip(2,r)][skip(2,c)] -
+                                             a.m[skip(1,r)][skip(2,c)] * a.m[skip(2,r)][skip(0,c)]) +
+                a.m[skip(0,r)][skip(2,c)] * (a.m[skip(1,r)][skip(0,c)] * a.m[skip(2,r)][skip(1,c)] -
+                                             a.m[skip(1,r)][skip(1,c)] * a.m[skip(2,r)][skip(0,c)]);
+        }
+
+        constexpr double cofactor(const square_t & a, uint8_t r, uint8_t c)
+        {
+            return ((r + c) % 2 ? -1 : +1) * minor(a, r, c);
+        }
+
+        constexpr double determinant(const square_t & a)
+        {
+            return a.m[0][0] * cofactor(a, 0, 0) + a.m[0][1] * cofactor(a, 0, 1) +
+                   a.m[0][2] * cofactor(a, 0, 2) + a.m[0][3] * cofactor(a, 0, 3);
+        }
+
+        constexpr double inverse(const square_t & a, double det, uint8_t r, uint8_t c)
+        {
+            return cofactor(a, c, r) / det;
+        }
+
+        constexpr square_t inverse(const square_t & a, double det)
+        {
+            return square_t {{
+                { inverse(a, det, 0, 0), inverse(a, det, 0, 1), inverse(a, det, 0, 2), inverse(a, det, 0, 3) },
+                { inverse(a, det, 1, 0), inverse(a, det, 1, 1), inverse(a, det, 1, 2), inverse(a, det, 1, 3) },
+                { inverse(a, det, 2, 0), inverse(a, det, 2, 1), inverse(a, det, 2, 2), inverse(a, det, 2, 3) },
+                { inverse(a, det, 3, 0), inverse(a, det, 3, 1), inverse(a, det, 3, 2), inverse(a, det, 3, 3) }
+            }};
+        }
+
+        constexpr square_t inverse(const square_t & a)
+        {
+            return inverse(a, determinant(a));
+        }
+
+        //------------------------------------------------------------------------------------------------
+        // Pseudo-inverse B' (B B')^-1, column by column
+
+        template <uint8_t NMOTORS>
+        constexpr double pseudoInverse(const motor_t (&motors)[NMOTORS], const square_t & g, uint8_t i, uint8_t c)
+        {
+            return effect(motors, 0, i) * g.m[0][c] + effect(motors, 1, i) * g.m[1][c] +
+                   effect(motors, 2, i) * g.m[2][c] + effect(motors, 3, i) * g.m[3][c];
+        }
+
+        // Largest magnitude in column c, from motor i on
+        template <uint8_t NMOTORS>
+        constexpr double largest(const motor_t (&motors)[NMOTORS], const square_t & g, uint8_t c, uint8_t i)
+        {
+            return i == NMOTORS ? 0 : greater(absolute(pseudoInverse(motors, g, i, c)), largest(motors, g, c, i+1));
+        }
+
+        constexpr float snap(double x)
+        {
+            return absolute(x) < ROUNDING ? 0 : (float)x;
+        }
+
+        template <uint8_t NMOTORS>
+        constexpr float entry(const motor_t (&motors)[NMOTORS], const square_t & g, uint8_t i, uint8_t c)
+        {
+            return snap(pseudoInverse(motors, g, i, c) / largest(motors, g, c, 0));
+        }
+
+        // Index lists for filling the columns, which C++11 doesn't have
+        template <uint8_t... I>
+        struct indices { };
+
+        template <uint8_t N, uint8_t... I>
+        struct makeIndices : makeIndices<N-1, N-1, I...> { };
+
+        template <uint8_t... I>
+        struct makeIndices<0, I...> {
+            typedef indices<I...> type;
+        };
+
+        template <uint8_t NMOTORS, uint8_t... I>
+        constexpr matrix_t<NMOTORS> matrix(const motor_t (&motors)[NMOTORS], const square_t & g, indices<I...>)
+        {
+            return matrix_t<NMOTORS> {
+                { entry(motors, g, I, 0)... },
+                { entry(motors, g, I, 1)... },
+                { entry(motors, g, I, 2)... },
+                { entry(motors, g, I, 3)... }
+            };
+        }
+
+        /**
+         * Throttle, roll, pitch, and yaw for each motor, each column scaled to a largest entry of 1.
+         */
+        template <uint8_t NMOTORS>
+        constexpr matrix_t<NMOTORS> matrix(const motor_t (&motors)[NMOTORS])
+        {
+            return matrix(motors, inverse(gram(motors)), typename makeIndices<NMOTORS>::type());
+        }
+
+    } // namespace geometry
+
+} // namespace hf
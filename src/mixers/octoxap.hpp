@@ -7,9 +7,9 @@
                    
              ^      
                    
-    6CW           8CCW
+    6CCW          8CW
                    
-        2CCW   4CW
+        2CW    4CCW
  
    Copyright (c) 2019 Simon D. Levy
 
@@ -32,26 +32,32 @@
 
 #include "board.hpp"
 #include "mixer.hpp"
+#include "mixers/geometry.hpp"
 #include "datatypes.hpp"
 
 namespace hf {
 
-    class MixerOctoXAP : public Mixer {
+    class MixerOctoXAP : public MatrixMixer<8> {
 
         public:
 
             MixerOctoXAP(void) 
-                : Mixer(8)
             {
-                //                     Th  RR  PF  YR
-                motorDirections[0] = { +1, -1, -1, +1 }; // 1
-                motorDirections[1] = { +1, +1, +1, +1 }; // 2    
-                motorDirections[2] = { +1, -1, -1, -1 }; // 3 
-                motorDirections[3] = { +1, -1, +1, -1 }; // 4 
-                motorDirections[4] = { +1, +1, -1, -1 }; // 5 
-                motorDirections[5] = { +1, +1, +1, -1 }; // 6 
-                motorDirections[6] = { +1, +1, -1, +1 }; // 7  
-                motorDirections[7] = { +1, -1, +1, +1 }; // 8 
+                // Arm angle clockwise from the nose, arm length, propeller spin
+                static constexpr geometry::motor_t motors[8] = {
+                    geometry::motor( +22.5, 1, geometry::CW),   // 1
+                    geometry::motor(-157.5, 1, geometry::CW),   // 2
+                    geometry::motor( +67.5, 1, geometry::CCW),  // 3
+                    geometry::motor(+157.5, 1, geometry::CCW),  // 4
+                    geometry::motor( -22.5, 1, geometry::CCW),  // 5
+                    geometry::motor(-112.5, 1, geometry::CCW),  // 6
+                    geometry::motor( -67.5, 1, geometry::CW),   // 7
+                    geometry::motor(+112.5, 1, geometry::CW)    // 8
+                };
+
+                static constexpr geometry::matrix_t<8> matrix = geometry::matrix(motors);
+
+                setMotorDirections(matrix);
             }
     };
 
@@ -31,22 +31,28 @@
 
 #include "board.hpp"
 #include "mixer.hpp"
+#include "mixers/geometry.hpp"
 #include "datatypes.hpp"
 
 namespace hf {
 
-    class MixerQuadPlusAP : public Mixer {
+    class MixerQuadPlusAP : public MatrixMixer<4> {
 
         public:
 
             MixerQuadPlusAP(void) 
-                : Mixer(4)
             {
-                //                     Th  RR  PF  YR
-                motorDirections[0] = { +1,  0, -1, +1 };    // 1 front
-                motorDirections[1] = { +1, -1,  0, -1 };    // 2 right
-                motorDirections[2] = { +1,  0, +1, +1 };    // 3 rear
-                motorDirections[3] = { +1, +1,  0, -1 };    // 4 left
+                // Arm angle clockwise from the nose, arm length, propeller spin
+                static constexpr geometry::motor_t motors[4] = {
+                    geometry::motor(    0, 1, geometry::CW),    // 1 front
+                    geometry::motor(  +90, 1, geometry::CCW),   // 2 right
+                    geometry::motor(  180, 1, geometry::CW),    // 3 rear
+                    geometry::motor(  -90, 1, geometry::CCW)    // 4 left
+                };
+
+                static constexpr geometry::matrix_t<4> matrix = geometry::matrix(motors);
+
+                setMotorDirections(matrix);
             }
     };
 
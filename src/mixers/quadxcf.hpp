@@ -28,22 +28,28 @@
 
 #include "board.hpp"
 #include "mixer.hpp"
+#include "mixers/geometry.hpp"
 #include "datatypes.hpp"
 
 namespace hf {
 
-    class MixerQuadXCF : public Mixer {
+    class MixerQuadXCF : public MatrixMixer<4> {
 
         public:
 
             MixerQuadXCF(void) 
-                : Mixer(4)
             {
-                //                     Th  RR  PF  YR
-                motorDirections[0] = { +1, -1, +1, +1 };    // 1 right rear
-                motorDirections[1] = { +1, -1, -1, -1 };    // 2 right front
-                motorDirections[2] = { +1, +1, +1, -1 };    // 3 left rear
-                motorDirections[3] = { +1, +1, -1, +1 };    // 4 left front
+                // Arm angle clockwise from the nose, arm length, propeller spin
+                static constexpr geometry::motor_t motors[4] = {
+                    geometry::motor( +135, 1, geometry::CW),    // 1 right rear
+                    geometry::motor(  +45, 1, geometry::CCW),   // 2 right front
+                    geometry::motor( -135, 1, geometry::CCW),   // 3 left rear
+                    geometry::motor(  -45, 1, geometry::CW)     // 4 left front
+                };
+
+                static constexpr geometry::matrix_t<4> matrix = geometry::matrix(motors);
+
+                setMotorDirections(matrix);
             }
     };
 
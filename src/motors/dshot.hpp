@@ -0,0 +1,319 @@
+/*
+   DShot frame encoding, and output to the motors once per control loop
+
+   A DShot frame is sixteen bits, most significant first: an eleven-bit
+   value, a bit asking the ESC for telemetry, and a four-bit checksum.
+   Values 48 through 2047 are throttle, and 0 through 47 are commands
+   such as beeping or reversing the motor.  Each bit is a high pulse
+   followed by a low one, 3/8 of the bit period high for a zero and 3/4
+   for a one, at 150, 300, 600, or 1200 kilobits per second.
+
+   DShot works out those pulses once, in timer ticks, for each of the
+   sixteen values of a four-bit nibble, so encoding a frame is four table
+   lookups instead of a loop over the bits.  Each pulse pair is packed the
+   way the ESP32's RMT peripheral takes it: high duration in bits 0-14,
+   high level in bit 15, low duration in bits 16-30, and low level in
+   bit 31.
+
+   DShotOutput<RmtT> sends the frames for all the motors, encoding them
+   all first and then handing them to the RMT channels one after another,
+   whenever the mixer writes the motors.  So each control loop sends one
+   frame per motor, right after the mix, rather than a separate task
+   sending frames on its own schedule.  writeMotor() only sets one motor's
+   value; writeMotors() and flush() send.  RmtT is any class with
+
+     bool init(uint8_t channel, uint8_t pin, float tickNanoseconds)
+     void write(uint8_t channel, const uint32_t * items, uint8_t count)
+
+   which is Esp32Rmt on the ESP32, and can be a fake on other hosts.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    class DShot {
+
+        public:
+
+            // Kilobits per second
+            typedef enum {
+
+                DSHOT150  = 150,
+                DSHOT300  = 300,
+                DSHOT600  = 600,
+                DSHOT1200 = 1200
+
+            } speed_t;
+
+            // Values below MIN, which the ESC acts on only with the motor stopped
+            typedef enum {
+
+                MOTOR_STOP              = 0,
+                BEEP1                   = 1,
+                BEEP2                   = 2,
+                BEEP3                   = 3,
+                BEEP4                   = 4,
+                BEEP5                   = 5,
+                ESC_INFO                = 6,
+                SPIN_DIRECTION_1        = 7,
+                SPIN_DIRECTION_2        = 8,
+                MODE_3D_OFF             = 9,
+                MODE_3D_ON              = 10,
+                SETTINGS_REQUEST        = 11,
+                SAVE_SETTINGS           = 12,
+                SPIN_DIRECTION_NORMAL   = 20,
+                SPIN_DIRECTION_REVERSED = 21,
+                LED0_ON                 = 22,
+                LED1_ON                 = 23,
+                LED2_ON                 = 24,
+                LED3_ON                 = 25,
+                LED0_OFF                = 26,
+                LED1_OFF                = 27,
+                LED2_OFF                = 28,
+                LED3_OFF                = 29
+
+            } command_t;
+
+            static const uint16_t MIN = 48;
+            static const uint16_t MAX = 2047;
+
+            static const uint8_t BITS = 16;
+
+        private:
+
+            // Pulse pairs for each nibble, most significant bit first
+            uint32_t _nibbles[16][4];
+
+            uint16_t _bitTicks;
+
+            static uint32_t item(uint16_t highTicks, uint16_t lowTicks)
+            {
+                return (uint32_t)highTicks | (1UL << 15) | ((uint32_t)lowTicks << 16);
+            }
+
+        public:
+
+            DShot(speed_t speed, float tickNanoseconds)
+            {
+                float bit = 1e6f / ((uint16_t)speed * tickNanoseconds);
+
+                _bitTicks = (uint16_t)(bit + 0.5f);
+
+                uint16_t zeroHigh = (uint16_t)(bit * 3 / 8 + 0.5f);
+                uint16_t oneHigh  = (uint16_t)(bit * 3 / 4 + 0.5f);
+
+                for (uint8_t n=0; n<16; ++n) {
+                    for (uint8_t k=0; k<4; ++k) {
+                        bool one = n & (0x8 >> k);
+                        _nibbles[n][k] = one ? item(oneHigh, _bitTicks - oneHigh) : item(zeroHigh, _bitTicks - zeroHigh);
+                    }
+                }
+            }
+
+            /**
+             * Value, telemetry bit, and checksum.
+             */
+            static uint16_t frame(uint16_t value, bool telemetry)
+            {
+                uint16_t packet = (value << 1) | (telemetry ? 1 : 0);
+
+                uint16_t checksum = (packet ^ (packet >> 4) ^ (packet >> 8)) & 0xf;
+
+                return (packet << 4) | checksum;
+            }
+
+            /**
+             * Throttle value for a motor value in [0,1].
+             */
+            static uint16_t throttle(float value)
+            {
+                value = value < 0 ? 0 : value > 1 ? 1 : value;
+
+                return MIN + (uint16_t)(value * (MAX-MIN));
+            }
+
+            /**
+             * Frames in a row to send a command: ten for anything that changes the ESC's settings, which
+             * it acts on only after six in a row, with some to spare; one otherwise.
+             */
+            static uint8_t repeats(command_t command)
+            {
+                return (command >= SPIN_DIRECTION_1 && command <= SAVE_SETTINGS) ||
+                    command == SPIN_DIRECTION_NORMAL || command == SPIN_DIRECTION_REVERSED ? 10 : 1;
+            }
+
+            void encode(uint16_t frame, uint32_t items[BITS]) const
+            {
+                for (uint8_t k=0; k<4; ++k) {
+
+                    const uint32_t * nibble = _nibbles[(frame >> (12 - 4*k)) & 0xf];
+
+                    items[4*k]   = nibble[0];
+                    items[4*k+1] = nibble[1];
+                    items[4*k+2] = nibble[2];
+                    items[4*k+3] = nibble[3];
+                }
+            }
+
+            uint16_t getBitTicks(void) const
+            {
+                return _bitTicks;
+            }
+
+    }; // class DShot
+
+    template <typename RmtT>
+    class DShotOutput {
+
+        public:
+
+            static const uint8_t MAX_MOTORS = 8;
+
+        protected:
+
+            RmtT _rmt;
+
+            DShot _dshot;
+
+            float _tickNanoseconds;
+
+            uint8_t _pins[MAX_MOTORS] = {0};
+            uint8_t _motorCount = 0;
+
+            // Latest frame for each motor, kept until writeMotors() or flush() sends them all
+            uint16_t _frames[MAX_MOTORS] = {0};
+
+            // Command waiting to go out in place of the throttle, and how many more times to send it
+            uint16_t _commands[MAX_MOTORS] = {0};
+            uint8_t  _commandRepeats[MAX_MOTORS] = {0};
+
+            void send(void)
+            {
+                uint32_t items[MAX_MOTORS][DShot::BITS];
+
+                // Encode them all before sending any, so the frames go out as close together as they can
+                for (uint8_t k=0; k<_motorCount; ++k) {
+
+                    uint16_t frame = _frames[k];
+
+                    if (_commandRepeats[k] > 0) {
+                        frame = DShot::frame(_commands[k], true);
+                        _commandRepeats[k]--;
+                    }
+
+                    _dshot.encode(frame, items[k]);
+                }
+
+                for (uint8_t k=0; k<_motorCount; ++k) {
+                    _rmt.write(k, items[k], DShot::BITS);
+                }
+            }
+
+        public:
+
+            DShotOutput(DShot::speed_t speed, float tickNanoseconds=12.5)
+                : _dshot(speed, tickNanoseconds)
+            {
+                _tickNanoseconds = tickNanoseconds;
+
+                for (uint8_t k=0; k<MAX_MOTORS; ++k) {
+                    _frames[k] = DShot::frame(DShot::MIN, false);
+                }
+            }
+
+            void addMotor(uint8_t pin)
+            {
+                _pins[_motorCount++] = pin;
+            }
+
+            bool begin(void)
+            {
+                for (uint8_t k=0; k<_motorCount; ++k) {
+                    if (!_rmt.init(k, _pins[k], _tickNanoseconds)) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            /**
+             * Sets the value for one motor, to go out with the next frame; call flush() after the last one.
+             */
+            void writeMotor(uint8_t index, float value)
+            {
+                _frames[index] = DShot::frame(DShot::throttle(value), false);
+            }
+
+            /**
+             * Sends one frame to every motor.  Call this once per control loop, as the board's writeMotors().
+             */
+            void writeMotors(const float * values, uint8_t count)
+            {
+                for (uint8_t k=0; k<count; ++k) {
+                    _frames[k] = DShot::frame(DShot::throttle(values[k]), false);
+                }
+
+                send();
+            }
+
+            /**
+             * Sends one frame to every motor with the values they already have.
+             */
+            void flush(void)
+            {
+                send();
+            }
+
+            /**
+             * Sends a command to a motor in place of its throttle, over as many frames as the ESC needs
+             * to act on it.
+             */
+            void command(uint8_t index, DShot::command_t command)
+            {
+                _commands[index] = command;
+                _commandRepeats[index] = DShot::repeats(command);
+            }
+
+            bool commandPending(uint8_t index) const
+            {
+                return _commandRepeats[index] > 0;
+            }
+
+            RmtT & getRmt(void)
+            {
+                return _rmt;
+            }
+
+            const RmtT & getRmt(void) const
+            {
+                return _rmt;
+            }
+
+            const DShot & getEncoder(void) const
+            {
+                return _dshot;
+            }
+
+    }; // class DShotOutput
+
+} // namespace hf
@@ -1,5 +1,7 @@
 /*
-   ESP32 Arduino code for DSHOT600 protocol
+   ESP32 Arduino code for DSHOT600 protocol, sending one frame per motor each time the mixer writes
+   the motors (see dshot.hpp).  A board using it should call writeMotors() from its own writeMotors(),
+   and return true from motorsNeedRefresh() so that the ESCs get a frame every loop in every state.
 
    Copyright (c) 2019 Simon D. Levy
 
@@ -29,133 +31,68 @@
 #pragma once
 
 #include <stdint.h>
-#include <stdarg.h>
 
 #include "esp32-hal.h"
 
+#include "motors/dshot.hpp"
+
 namespace hf {
 
-    class Esp32DShot600 {
+    // RMT channels through the ESP32 Arduino core, for DShotOutput
+    class Esp32Rmt {
 
         private:
 
-            static const uint8_t MAX_MOTORS = 10;
-
-            // XXX idle value should be calibrated for each motor
-            static constexpr uint16_t MIN = 48;
-            static constexpr uint16_t MAX = 2047;
-
-            typedef struct {
+            // The ESP32 has eight
+            static const uint8_t MAX_CHANNELS = 8;
 
-                rmt_data_t dshotPacket[16];
-                rmt_obj_t * rmt_send;
-                uint16_t outputValue;
-                bool requestTelemetry;
-                uint8_t receivedBytes;
-                uint8_t pin;
+            rmt_obj_t * _channels[MAX_CHANNELS] = {};
 
-            } motor_t;
-
-            motor_t _motors[MAX_MOTORS] = {};
-
-            uint8_t _motorCount = 0;
+        public:
 
-            static void coreTask(void * params)
+            bool init(uint8_t channel, uint8_t pin, float tickNanoseconds)
             {
+                if ((_channels[channel] = rmtInit(pin, true, RMT_MEM_64)) == NULL) {
+                    return false;
+                }
 
-                Esp32DShot600 * dshot = (Esp32DShot600 *)params;
-
-                while (true) {
-
-                    for (uint8_t k=0; k<dshot->_motorCount; ++k) {
-                        dshot->outputOne(&dshot->_motors[k]);
-                    }
+                rmtSetTick(_channels[channel], tickNanoseconds);
 
-                    delay(1);
-                } 
+                return true;
             }
 
-            void outputOne(motor_t * motor)
+            void write(uint8_t channel, const uint32_t * items, uint8_t count)
             {
-                uint16_t packet = (motor->outputValue << 1) /* | (motor->telemetry ? 1 : 0) */ ;
-
-                // https://github.com/betaflight/betaflight/blob/09b52975fbd8f6fcccb22228745d1548b8c3daab/src/main/drivers/pwm_output.c#L523
-                int csum = 0;
-                int csum_data = packet;
-                for (int i = 0; i < 3; i++) {
-                    csum ^=  csum_data;
-                    csum_data >>= 4;
-                }
-                csum &= 0xf;
-                packet = (packet << 4) | csum;
-
-                // durations are for dshot600
-                // https://blck.mn/2016/11/dshot-the-new-kid-on-the-block/
-                // Bit length (total timing period) is 1.67 microseconds (T0H + T0L or T1H + T1L).
-                // For a bit to be 1, the pulse width is 1250 nanoseconds (T1H – time the pulse is high for a bit value of ONE)
-                // For a bit to be 0, the pulse width is 625 nanoseconds (T0H – time the pulse is high for a bit value of ZERO)
-                for (int i = 0; i < 16; i++) {
-                    if (packet & 0x8000) {
-                        motor->dshotPacket[i].level0 = 1;
-                        motor->dshotPacket[i].duration0 = 100;
-                        motor->dshotPacket[i].level1 = 0;
-                        motor->dshotPacket[i].duration1 = 34;
-                    } else {
-                        motor->dshotPacket[i].level0 = 1;
-                        motor->dshotPacket[i].duration0 = 50;
-                        motor->dshotPacket[i].level1 = 0;
-                        motor->dshotPacket[i].duration1 = 84;
-                    }
-                    packet <<= 1;
-                }
+                // rmt_data_t is a union over the same 32 bits that DShot packs
+                rmtWrite(_channels[channel], (rmt_data_t *)items, count);
+            }
 
-                rmtWrite(motor->rmt_send, motor->dshotPacket, 16);
+    }; // class Esp32Rmt
 
-            } // outputOne
+    class Esp32DShot600 : public DShotOutput<Esp32Rmt> {
 
         public:
 
             Esp32DShot600(void)
+                : DShotOutput<Esp32Rmt>(DShot::DSHOT600, 12.5) // 12.5ns sample rate
             {
-                _motorCount = 0;
-            }
-
-            void addMotor(uint8_t pin)
-            {
-                _motors[_motorCount++].pin = pin;
             }
 
             bool begin(void)
             {
-                for (uint8_t k=0; k<_motorCount; ++k) {
-
-                    motor_t * motor = &_motors[k];
-
-                    if ((motor->rmt_send = rmtInit(motor->pin, true, RMT_MEM_64)) == NULL) {
-                        return false;
-                    }
-
-                    rmtSetTick(motor->rmt_send, 12.5); // 12.5ns sample rate
-
-                    // Output disarm signal while esc initialises
-                    motor->outputValue = MIN;
-                    while (millis() < 3500) {
-                        outputOne(motor);
-                        delay(1);  
-                    }
+                if (!DShotOutput<Esp32Rmt>::begin()) {
+                    return false;
                 }
 
-                TaskHandle_t Task;
-                xTaskCreatePinnedToCore(coreTask, "Task", 10000, this, 1, &Task, 0); 
+                // Output disarm signal while ESCs initialise
+                while (millis() < 3500) {
+                    flush();
+                    delay(1);  
+                }
 
                 return true;
             }
 
-            void writeMotor(uint8_t index, float value)
-            {
-                _motors[index].outputValue = MIN + (uint16_t)(value * (MAX-MIN));
-            }
-
     }; // class Esp32DShot600
 
 } // namespace hf
@@ -311,6 +311,39 @@ namespace hf {
                         serialize8(_checksum);
                         } break;
 
+                    case 123:
+                    {
+                        int32_t stage = 0;
+                        int32_t count = 0;
+                        int32_t minimum = 0;
+                        int32_t maximum = 0;
+                        int32_t meanNsec = 0;
+                        int32_t h0 = 0;
+                        int32_t h1 = 0;
+                        int32_t h2 = 0;
+                        int32_t h3 = 0;
+                        int32_t h4 = 0;
+                        int32_t h5 = 0;
+                        int32_t h6 = 0;
+                        int32_t h7 = 0;
+                        handle_LOOP_TIMING_Request(stage, count, minimum, maximum, meanNsec, h0, h1, h2, h3, h4, h5, h6, h7);
+                        prepareToSendInts(13);
+                        sendInt(stage);
+                        sendInt(count);
+                        sendInt(minimum);
+                        sendInt(maximum);
+                        sendInt(meanNsec);
+                        sendInt(h0);
+                        sendInt(h1);
+                        sendInt(h2);
+                        sendInt(h3);
+                        sendInt(h4);
+                        sendInt(h5);
+                        sendInt(h6);
+                        sendInt(h7);
+                        serialize8(_checksum);
+                        } break;
+
                     case 213:
                     {
                         float vx = 0;
@@ -407,6 +440,23 @@ namespace hf {
                 (void)yaw;
             }
 
+            virtual void handle_LOOP_TIMING_Request(int32_t & stage, int32_t & count, int32_t & minimum, int32_t & maximum, int32_t & meanNsec, int32_t & h0, int32_t & h1, int32_t & h2, int32_t & h3, int32_t & h4, int32_t & h5, int32_t & h6, int32_t & h7)
+            {
+                (void)stage;
+                (void)count;
+                (void)minimum;
+                (void)maximum;
+                (void)meanNsec;
+                (void)h0;
+                (void)h1;
+                (void)h2;
+                (void)h3;
+                (void)h4;
+                (void)h5;
+                (void)h6;
+                (void)h7;
+            }
+
             virtual void handle_SET_VELOCITY_SETPOINTS(float  vx, float  vy, float  vz, float  yaw_rate)
             {
                 (void)vx;
@@ -534,6 +584,45 @@ namespace hf {
                 return 18;
             }
 
+            static uint8_t serialize_LOOP_TIMING_Request(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 123;
+                bytes[5] = 123;
+
+                return 6;
+            }
+
+            static uint8_t serialize_LOOP_TIMING(uint8_t bytes[], int32_t  stage, int32_t  count, int32_t  minimum, int32_t  maximum, int32_t  meanNsec, int32_t  h0, int32_t  h1, int32_t  h2, int32_t  h3, int32_t  h4, int32_t  h5, int32_t  h6, int32_t  h7)
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 62;
+                bytes[3] = 52;
+                bytes[4] = 123;
+
+                memcpy(&bytes[5], &stage, sizeof(int32_t));
+                memcpy(&bytes[9], &count, sizeof(int32_t));
+                memcpy(&bytes[13], &minimum, sizeof(int32_t));
+                memcpy(&bytes[17], &maximum, sizeof(int32_t));
+                memcpy(&bytes[21], &meanNsec, sizeof(int32_t));
+                memcpy(&bytes[25], &h0, sizeof(int32_t));
+                memcpy(&bytes[29], &h1, sizeof(int32_t));
+                memcpy(&bytes[33], &h2, sizeof(int32_t));
+                memcpy(&bytes[37], &h3, sizeof(int32_t));
+                memcpy(&bytes[41], &h4, sizeof(int32_t));
+                memcpy(&bytes[45], &h5, sizeof(int32_t));
+                memcpy(&bytes[49], &h6, sizeof(int32_t));
+                memcpy(&bytes[53], &h7, sizeof(int32_t));
+
+                bytes[57] = CRC8(&bytes[3], 54);
+
+                return 58;
+            }
+
             static uint8_t serialize_SET_VELOCITY_SETPOINTS(uint8_t bytes[], float  vx, float  vy, float  vz, float  yaw_rate)
             {
                 bytes[0] = 36;
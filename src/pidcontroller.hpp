@@ -22,12 +22,13 @@
 
 #include "datatypes.hpp"
 #include "filters.hpp"
+#include "fixedpoint.hpp"
 
 namespace hf {
 
     class PidController {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         protected:
 
@@ -44,7 +45,7 @@ namespace hf {
     };  // class PidController
 
     // PID controller for a single degree of freedom
-    class Pid {
+    class FloatPid {
 
         private: 
 
@@ -124,7 +125,92 @@ namespace hf {
                 _previousTime = 0;
             }
 
-    };  // class Pid
+    };  // class FloatPid
+
+    // The same controller in fixed point, for boards without an FPU
+    class FixedPid {
+
+        private: 
+
+            // PID constants
+            q24_t _Kp;
+            q24_t _Ki;
+            q24_t _Kd;
+
+            // Accumulated values
+            q24_t _lastError;
+            q24_t _errorI;
+            q24_t _deltaError1;
+            q24_t _deltaError2;
+
+            // Prevents integral windup
+            q24_t _windupMax;
+
+        public:
+
+            void init(const float Kp, const float Ki, const float Kd, const float windupMax=0.4) 
+            {
+                // Set constants
+                _Kp = q24_t(Kp);
+                _Ki = q24_t(Ki);
+                _Kd = q24_t(Kd);
+                _windupMax = q24_t(windupMax);
+
+                // Initialize error integral, previous value
+                reset();
+            }
+
+            float compute(float target, float actual)
+            {
+                // Compute error as scaled target minus actual
+                q24_t error = q24_t(target) - q24_t(actual);
+
+                // Compute P term
+                q24_t pterm = error * _Kp;
+
+                // Compute I term
+                q24_t iterm;
+                if (_Ki > q24_t()) { // optimization
+                    _errorI = q24_t::constrainAbs(_errorI + error, _windupMax); // avoid integral windup
+                    iterm =  _errorI * _Ki;
+                }
+
+                // Compute D term
+                q24_t dterm;
+                if (_Kd > q24_t()) { // optimization
+                    q24_t deltaError = error - _lastError;
+                    dterm = (_deltaError1 + _deltaError2 + deltaError) * _Kd; 
+                    _deltaError2 = _deltaError1;
+                    _deltaError1 = deltaError;
+                    _lastError = error;
+                }
+
+                return (pterm + iterm + dterm).toFloat();
+            }
+
+            void updateReceiver(demands_t & demands, bool throttleIsDown)
+            {
+                (void)demands; 
+
+                // When landed, reset integral component of PID
+                if (throttleIsDown) {
+                    reset();
+                }
+            }
+
+            void reset(void)
+            {
+                _errorI = q24_t();
+                _lastError = q24_t();
+            }
+
+    };  // class FixedPid
+
+#ifdef HACKFLIGHT_FIXED_POINT
+    typedef FixedPid Pid;
+#else
+    typedef FloatPid Pid;
+#endif
 
     // Velocity-based PID controller
     class VelocityPid : public Pid {
@@ -28,7 +28,7 @@ namespace hf {
 
     class AltitudeHoldPid : public PidController {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         private: 
 
@@ -48,7 +48,7 @@ namespace hf {
 
             void modifyDemands(state_t & state, demands_t & demands)
             {
-                float altitude = state.location[2];
+                float altitude = state.cache.getLocation()[2];
 
                 // Run the velocity-based PID controller, using position-based PID controller output inside deadband, throttle-stick
                 // proportion outside.  
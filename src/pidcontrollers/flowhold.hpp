@@ -27,7 +27,7 @@ namespace hf {
 
     class FlowHoldPid : public PidController {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         private: 
 
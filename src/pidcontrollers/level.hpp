@@ -72,8 +72,10 @@ namespace hf {
 
             void modifyDemands(state_t & state, demands_t & demands)
             {
-                demands.roll  = _rollPid.compute(demands.roll, state.rotation[0]); 
-                demands.pitch = _pitchPid.compute(demands.pitch, state.rotation[1]);
+                const float * euler = state.cache.getEulerAngles();
+
+                demands.roll  = _rollPid.compute(demands.roll, euler[0]); 
+                demands.pitch = _pitchPid.compute(demands.pitch, euler[1]);
             }
 
     };  // class LevelPid
@@ -0,0 +1,140 @@
+/*
+   PID controller for Level mode, working directly from the quaternion
+
+   Does the same job as LevelPid, but takes the attitude error from the
+   quaternion instead of from Euler angles, so Hackflight can skip the
+   atan2/asin/atan2 conversion on every quaternion update.  The tilt part
+   of the vehicle's attitude (its rotation with yaw taken out) is compared
+   with the tilt asked for by the roll and pitch demands, and the roll and
+   pitch components of the rotation between the two are the errors.  For
+   small errors these match LevelPid's Euler-angle differences; for large
+   ones the error is 2*sin(angle/2) rather than the angle, and doesn't
+   depend on heading.
+
+   The board's roll and pitch trim from adjustRollAndPitch() is taken off
+   the demanded tilt, so the vehicle levels where LevelPid would level it
+   and where safeAngle() checks it for arming.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+
+#include "datatypes.hpp"
+#include "pidcontroller.hpp"
+#include "qmath.hpp"
+
+namespace hf {
+
+    class QuaternionLevelPid : public PidController {
+
+        private:
+
+            static constexpr float MAX_ANGLE_DEGREES = 45;
+
+            // Maximum roll pitch demand is +/-0.5, so to convert demand to angle we multiply by this amount
+            const float _demandMultiplier = 2 * Filter::deg2rad(MAX_ANGLE_DEGREES);
+
+            Pid _rollPid;
+            Pid _pitchPid;
+
+            // Demanded tilt as a quaternion with no z component, recomputed only when the demands or trim change
+            float _lastRollDemand = 0;
+            float _lastPitchDemand = 0;
+            float _lastRollTrim = 0;
+            float _lastPitchTrim = 0;
+            float _tilt[3] = {1, 0, 0};
+
+            void updateTarget(float rollDemand, float pitchDemand, float rollTrim, float pitchTrim)
+            {
+                // Rotation vector about body x and y, less the trim that LevelPid sees in the Euler angles; our
+                // pitch is the negative of the usual one
+                float rx = +(rollDemand  * _demandMultiplier - rollTrim);
+                float ry = -(pitchDemand * _demandMultiplier - pitchTrim);
+
+                float angle = sqrtf(rx*rx + ry*ry);
+
+                // sin(angle/2)/angle, which goes to 1/2 for no tilt
+                float s = angle > 1e-6f ? sinf(angle/2) / angle : 0.5f;
+
+                _tilt[0] = cosf(angle/2);
+                _tilt[1] = s * rx;
+                _tilt[2] = s * ry;
+
+                _lastRollDemand = rollDemand;
+                _lastPitchDemand = pitchDemand;
+                _lastRollTrim = rollTrim;
+                _lastPitchTrim = pitchTrim;
+            }
+
+        protected:
+
+            void modifyDemands(state_t & state, demands_t & demands)
+            {
+                float rollTrim = state.cache.getRollTrim();
+                float pitchTrim = state.cache.getPitchTrim();
+
+                if (demands.roll != _lastRollDemand || demands.pitch != _lastPitchDemand ||
+                        rollTrim != _lastRollTrim || pitchTrim != _lastPitchTrim) {
+                    updateTarget(demands.roll, demands.pitch, rollTrim, pitchTrim);
+                }
+
+                const float * q = state.cache.getQuaternion();
+
+                float qw = q[0];
+                float qx = q[1];
+                float qy = q[2];
+                float qz = q[3];
+
+                // Tilt of the vehicle: q with its rotation about z factored out, (n, tx/n, ty/n, 0)
+                float n2 = qw*qw + qz*qz;
+                float tx = qw*qx + qy*qz;
+                float ty = qw*qy - qx*qz;
+
+                // Upside down, the tilt axis is undefined; any will do
+                float rn = qmath::rsqrt(n2 > 1e-6f ? n2 : 1e-6f);
+
+                // Rotation from vehicle tilt to demanded tilt, times n
+                float ew = n2*_tilt[0] + tx*_tilt[1] + ty*_tilt[2];
+                float ex = n2*_tilt[1] - tx*_tilt[0];
+                float ey = n2*_tilt[2] - ty*_tilt[0];
+
+                // Twice the vector part approximates the rotation vector; take the shorter way round
+                float scale = (ew < 0 ? -2 : +2) * rn;
+
+                demands.roll  = _rollPid.compute(+scale * ex, 0);
+                demands.pitch = _pitchPid.compute(-scale * ey, 0);
+            }
+
+        public:
+
+            QuaternionLevelPid(float rollLevelP, float pitchLevelP)
+            {
+                _rollPid.init(rollLevelP, 0, 0);
+                _pitchPid.init(pitchLevelP, 0, 0);
+            }
+
+            QuaternionLevelPid(float rollPitchLevelP)
+                : QuaternionLevelPid(rollPitchLevelP, rollPitchLevelP)
+            {
+            }
+
+    };  // class QuaternionLevelPid
+
+} // namespace hf
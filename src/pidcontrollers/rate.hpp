@@ -84,9 +84,11 @@ namespace hf {
 
             void modifyDemands(state_t & state, demands_t & demands)
             {
-                demands.roll  = _rollPid.compute(demands.roll,  state.angularVel[0]);
-                demands.pitch = _pitchPid.compute(demands.pitch, state.angularVel[1]);
-                demands.yaw   = _yawPid.compute(demands.yaw, state.angularVel[2]);
+                const float * angularVel = state.cache.getAngularVelocity();
+
+                demands.roll  = _rollPid.compute(demands.roll,  angularVel[0]);
+                demands.pitch = _pitchPid.compute(demands.pitch, angularVel[1]);
+                demands.yaw   = _yawPid.compute(demands.yaw, angularVel[2]);
 
                 // Prevent "yaw jump" during correction
                 demands.yaw = Filter::constrainAbs(demands.yaw, 0.1 + fabs(demands.yaw));
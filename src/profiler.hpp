@@ -0,0 +1,184 @@
+/*
+   Per-stage loop timing instrumentation
+
+   Build with HACKFLIGHT_PROFILE defined to collect minimum, maximum, mean,
+   and a power-of-two histogram of the time spent in each stage of the
+   control loop.  Without it, every method is an empty inline and the
+   probes compile to nothing.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "board.hpp"
+
+namespace hf {
+
+    class Profiler {
+
+        public:
+
+            // Only the first few PID controllers get their own stage
+            static const uint8_t MAXPIDS = 4;
+
+            enum {
+                STAGE_RECEIVER,
+                STAGE_GYROMETER,
+                STAGE_QUATERNION,
+                STAGE_MIXER,
+                STAGE_SERIAL,
+                STAGE_DYNAMICNOTCH, // also counted in STAGE_GYROMETER
+                STAGE_PID,
+                STAGE_COUNT = STAGE_PID + MAXPIDS
+            };
+
+            // Bin k>0 holds durations in [2^(k-1), 2^k) usec; bin 0 holds zero; last bin is open-ended
+            static const uint8_t HISTOGRAM_BINS = 8;
+
+            typedef struct {
+
+                uint32_t count;
+                uint32_t minimum;
+                uint32_t maximum;
+                uint64_t total;
+                uint32_t histogram[HISTOGRAM_BINS];
+
+            } stage_t;
+
+#ifdef HACKFLIGHT_PROFILE
+
+        private:
+
+            Board * _board = NULL;
+
+            stage_t _stages[STAGE_COUNT] = {};
+
+            // Stage to send on next MSP request
+            uint8_t _reportStage = 0;
+
+            static uint8_t bin(uint32_t usec)
+            {
+                uint8_t k = 0;
+                while (usec > 0 && k < HISTOGRAM_BINS-1) {
+                    usec >>= 1;
+                    ++k;
+                }
+                return k;
+            }
+
+        public:
+
+            void init(Board * board)
+            {
+                _board = board;
+
+                for (uint8_t k=0; k<STAGE_COUNT; ++k) {
+                    stage_t & stage = _stages[k];
+                    stage.count = 0;
+                    stage.minimum = UINT32_MAX;
+                    stage.maximum = 0;
+                    stage.total = 0;
+                    for (uint8_t j=0; j<HISTOGRAM_BINS; ++j) {
+                        stage.histogram[j] = 0;
+                    }
+                }
+
+                _reportStage = 0;
+            }
+
+            uint32_t start(void)
+            {
+                return _board->getMicros();
+            }
+
+            void stop(uint8_t index, uint32_t start)
+            {
+                if (index >= STAGE_COUNT) {
+                    return;
+                }
+
+                uint32_t usec = _board->getMicros() - start;
+
+                stage_t & stage = _stages[index];
+
+                stage.count++;
+                stage.total += usec;
+
+                if (usec < stage.minimum) {
+                    stage.minimum = usec;
+                }
+
+                if (usec > stage.maximum) {
+                    stage.maximum = usec;
+                }
+
+                stage.histogram[bin(usec)]++;
+            }
+
+            const stage_t * getStage(uint8_t index)
+            {
+                return index < STAGE_COUNT ? &_stages[index] : NULL;
+            }
+
+            // Cycles through the stages, one per call
+            const stage_t * nextReport(uint8_t & index)
+            {
+                index = _reportStage;
+                _reportStage = (_reportStage + 1) % STAGE_COUNT;
+                return &_stages[index];
+            }
+
+#else
+
+        public:
+
+            void init(Board * board)
+            {
+                (void)board;
+            }
+
+            uint32_t start(void)
+            {
+                return 0;
+            }
+
+            void stop(uint8_t index, uint32_t start)
+            {
+                (void)index;
+                (void)start;
+            }
+
+            const stage_t * getStage(uint8_t index)
+            {
+                (void)index;
+                return NULL;
+            }
+
+            const stage_t * nextReport(uint8_t & index)
+            {
+                index = 0;
+                return NULL;
+            }
+
+#endif
+
+    }; // class Profiler
+
+} // namespace hf
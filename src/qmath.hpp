@@ -0,0 +1,448 @@
+/*
+   Quaternion and vector kernels shared by the attitude filters and estimators
+
+   Quaternions are stored w, x, y, z in a 16-byte-aligned quaternion_t, so
+   that a SIMD unit can load one in a single instruction.  Each kernel has a
+   plain scalar version and, where it pays off, versions for:
+
+     sse:  x86 with SSE
+     neon: ARM with NEON (Cortex-A, including the Raspberry Pi)
+     dsp:  Cortex-M4F and M7, whose single-lane FPU has fused multiply-add
+           but slow square root and divide; every output is one chain of
+           multiply-accumulates and no kernel divides
+
+   The unqualified qmath::multiply(), normalize(), and so on use dsp on a
+   Cortex-M4F or M7 and scalar elsewhere.  The filters compute their
+   quaternions one component at a time, and moving those into a vector
+   register costs more than the SIMD arithmetic saves, so sse and neon are
+   used only if you define HACKFLIGHT_QMATH_SIMD; they pay off for
+   quaternions that stay in memory between operations.  Define
+   HACKFLIGHT_FAST_RSQRT to replace 1/sqrtf() in the normalizations with
+   an estimate refined by Newton's method, which is accurate to about one
+   part in 10^6 and much cheaper where square root and divide are slow.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace hf {
+
+    namespace qmath {
+
+        typedef struct alignas(16) {
+
+            float w;
+            float x;
+            float y;
+            float z;
+
+        } quaternion_t;
+
+        /**
+         * Estimates 1/sqrt(x) from the bits of x, then refines the estimate with two steps of Newton's
+         * method, for a relative error under 5e-6.
+         */
+        inline float fastRsqrt(float x)
+        {
+            uint32_t i;
+            memcpy(&i, &x, 4);
+            i = 0x5f375a86 - (i >> 1);
+
+            float y;
+            memcpy(&y, &i, 4);
+
+            float halfx = 0.5f * x;
+            y *= 1.5f - halfx * y * y;
+            y *= 1.5f - halfx * y * y;
+
+            return y;
+        }
+
+        inline float rsqrt(float x)
+        {
+#ifdef HACKFLIGHT_FAST_RSQRT
+            return fastRsqrt(x);
+#else
+            return 1.0f / sqrtf(x);
+#endif
+        }
+
+        /**
+         * Scales a vector to unit length in place.  Returns false, leaving the vector unchanged, if it
+         * is all zeros.  Three lanes don't fill a SIMD register usefully, so all targets share this one.
+         */
+        inline bool normalize(float & x, float & y, float & z)
+        {
+            float sumsq = x * x + y * y + z * z;
+
+            if (sumsq == 0) {
+                return false;
+            }
+
+            float r = rsqrt(sumsq);
+            x *= r;
+            y *= r;
+            z *= r;
+
+            return true;
+        }
+
+        /**
+         * Brings a quaternion that is already close to unit length, like one just advanced by a single
+         * gyrometer sample, back to unit length with one Newton step toward 1/|q|: no square root or
+         * divide, and the error left is the square of the error before.
+         */
+        inline void renormalize(quaternion_t & q)
+        {
+            float r = 1.5f - 0.5f * (q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+            q.w *= r;
+            q.x *= r;
+            q.y *= r;
+            q.z *= r;
+        }
+
+        /**
+         * Rotates body-frame vector v into the world frame, as q v q*, without building a rotation
+         * matrix: t = 2 (u x v), v' = v + w t + u x t, where u is the vector part of q.
+         */
+        inline void rotate(const quaternion_t & q, const float v[3], float out[3])
+        {
+            float tx = 2 * (q.y * v[2] - q.z * v[1]);
+            float ty = 2 * (q.z * v[0] - q.x * v[2]);
+            float tz = 2 * (q.x * v[1] - q.y * v[0]);
+
+            out[0] = v[0] + q.w * tx + q.y * tz - q.z * ty;
+            out[1] = v[1] + q.w * ty + q.z * tx - q.x * tz;
+            out[2] = v[2] + q.w * tz + q.x * ty - q.y * tx;
+        }
+
+        /**
+         * The matrix that rotates body-frame vectors into the world frame, for a unit quaternion.
+         */
+        inline void toRotationMatrix(const quaternion_t & q, float R[3][3])
+        {
+            float xx = q.x * q.x;
+            float yy = q.y * q.y;
+            float zz = q.z * q.z;
+            float wx = q.w * q.x;
+            float wy = q.w * q.y;
+            float wz = q.w * q.z;
+            float xy = q.x * q.y;
+            float xz = q.x * q.z;
+            float yz = q.y * q.z;
+
+            R[0][0] = 1 - 2 * (yy + zz);
+            R[0][1] = 2 * (xy - wz);
+            R[0][2] = 2 * (xz + wy);
+
+            R[1][0] = 2 * (xy + wz);
+            R[1][1] = 1 - 2 * (xx + zz);
+            R[1][2] = 2 * (yz - wx);
+
+            R[2][0] = 2 * (xz - wy);
+            R[2][1] = 2 * (yz + wx);
+            R[2][2] = 1 - 2 * (xx + yy);
+        }
+
+        namespace scalar {
+
+            // Hamilton product a b: applying b, then a
+            inline quaternion_t multiply(const quaternion_t & a, const quaternion_t & b)
+            {
+                quaternion_t r;
+
+                r.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+                r.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+                r.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+                r.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+
+                return r;
+            }
+
+            // Time derivative of q under body rates g (radians per second): q (0, g) / 2
+            inline quaternion_t rate(const quaternion_t & q, float gx, float gy, float gz)
+            {
+                quaternion_t r;
+
+                r.w = 0.5f * (-q.x * gx - q.y * gy - q.z * gz);
+                r.x = 0.5f * ( q.w * gx + q.y * gz - q.z * gy);
+                r.y = 0.5f * ( q.w * gy - q.x * gz + q.z * gx);
+                r.z = 0.5f * ( q.w * gz + q.x * gy - q.y * gx);
+
+                return r;
+            }
+
+            inline bool normalize(quaternion_t & q)
+            {
+                float sumsq = q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z;
+
+                if (sumsq == 0) {
+                    return false;
+                }
+
+                float r = rsqrt(sumsq);
+                q.w *= r;
+                q.x *= r;
+                q.y *= r;
+                q.z *= r;
+
+                return true;
+            }
+
+        } // namespace scalar
+
+        namespace dsp {
+
+            // a b + c, fused into one rounding where the FPU can
+            inline float mac(float a, float b, float c)
+            {
+#if defined(__ARM_FEATURE_FMA) || defined(__FMA__)
+                return __builtin_fmaf(a, b, c);
+#else
+                return a * b + c;
+#endif
+            }
+
+            inline quaternion_t multiply(const quaternion_t & a, const quaternion_t & b)
+            {
+                quaternion_t r;
+
+                r.w = mac(a.w, b.w, mac(-a.x, b.x, mac(-a.y, b.y, -a.z * b.z)));
+                r.x = mac(a.w, b.x, mac( a.x, b.w, mac( a.y, b.z, -a.z * b.y)));
+                r.y = mac(a.w, b.y, mac(-a.x, b.z, mac( a.y, b.w,  a.z * b.x)));
+                r.z = mac(a.w, b.z, mac( a.x, b.y, mac(-a.y, b.x,  a.z * b.w)));
+
+                return r;
+            }
+
+            inline quaternion_t rate(const quaternion_t & q, float gx, float gy, float gz)
+            {
+                float hw = 0.5f * q.w;
+                float hx = 0.5f * q.x;
+                float hy = 0.5f * q.y;
+                float hz = 0.5f * q.z;
+
+                quaternion_t r;
+
+                r.w = mac(-hx, gx, mac(-hy, gy, -hz * gz));
+                r.x = mac( hw, gx, mac( hy, gz, -hz * gy));
+                r.y = mac( hw, gy, mac(-hx, gz,  hz * gx));
+                r.z = mac( hw, gz, mac( hx, gy, -hy * gx));
+
+                return r;
+            }
+
+            inline bool normalize(quaternion_t & q)
+            {
+                float sumsq = mac(q.w, q.w, mac(q.x, q.x, mac(q.y, q.y, q.z * q.z)));
+
+                if (sumsq == 0) {
+                    return false;
+                }
+
+                float r = rsqrt(sumsq);
+                q.w *= r;
+                q.x *= r;
+                q.y *= r;
+                q.z *= r;
+
+                return true;
+            }
+
+        } // namespace dsp
+
+#if defined(__SSE__)
+
+        namespace sse {
+
+            // Negates the lanes whose mask is -0
+            inline __m128 flip(__m128 v, __m128 mask)
+            {
+                return _mm_xor_ps(v, mask);
+            }
+
+            // Each lane of a b is a.w b plus a.x, a.y, a.z times b with its lanes swapped and signs flipped
+            inline __m128 multiply(__m128 a, __m128 b)
+            {
+                __m128 bx = flip(_mm_shuffle_ps(b, b, _MM_SHUFFLE(2,3,0,1)), _mm_set_ps(+0.f, -0.f, +0.f, -0.f));
+                __m128 by = flip(_mm_shuffle_ps(b, b, _MM_SHUFFLE(1,0,3,2)), _mm_set_ps(-0.f, +0.f, +0.f, -0.f));
+                __m128 bz = flip(_mm_shuffle_ps(b, b, _MM_SHUFFLE(0,1,2,3)), _mm_set_ps(+0.f, +0.f, -0.f, -0.f));
+
+                __m128 r = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0,0,0,0)), b);
+                r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1,1,1,1)), bx));
+                r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2,2,2,2)), by));
+                r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3,3,3,3)), bz));
+
+                return r;
+            }
+
+            inline quaternion_t multiply(const quaternion_t & a, const quaternion_t & b)
+            {
+                quaternion_t r;
+                _mm_store_ps(&r.w, multiply(_mm_load_ps(&a.w), _mm_load_ps(&b.w)));
+                return r;
+            }
+
+            inline quaternion_t rate(const quaternion_t & q, float gx, float gy, float gz)
+            {
+                quaternion_t r;
+                _mm_store_ps(&r.w, multiply(_mm_load_ps(&q.w), _mm_set_ps(0.5f * gz, 0.5f * gy, 0.5f * gx, 0)));
+                return r;
+            }
+
+            inline bool normalize(quaternion_t & q)
+            {
+                __m128 v = _mm_load_ps(&q.w);
+
+                // Sum of squares in every lane
+                __m128 sumsq = _mm_mul_ps(v, v);
+                sumsq = _mm_add_ps(sumsq, _mm_shuffle_ps(sumsq, sumsq, _MM_SHUFFLE(2,3,0,1)));
+                sumsq = _mm_add_ps(sumsq, _mm_shuffle_ps(sumsq, sumsq, _MM_SHUFFLE(1,0,3,2)));
+
+                if (_mm_cvtss_f32(sumsq) == 0) {
+                    return false;
+                }
+
+#ifdef HACKFLIGHT_FAST_RSQRT
+                // 12-bit hardware estimate, then one Newton step
+                __m128 r = _mm_rsqrt_ps(sumsq);
+                __m128 halfsumsq = _mm_mul_ps(_mm_set1_ps(0.5f), sumsq);
+                r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfsumsq, _mm_mul_ps(r, r))));
+#else
+                __m128 r = _mm_div_ps(_mm_set1_ps(1), _mm_sqrt_ps(sumsq));
+#endif
+
+                _mm_store_ps(&q.w, _mm_mul_ps(v, r));
+
+                return true;
+            }
+
+        } // namespace sse
+
+#endif
+
+#if defined(__ARM_NEON)
+
+        namespace neon {
+
+            inline float32x4_t multiply(float32x4_t a, float32x4_t b)
+            {
+                static const float SX[4] = {-1, +1, -1, +1};
+                static const float SY[4] = {-1, +1, +1, -1};
+                static const float SZ[4] = {-1, -1, +1, +1};
+
+                float32x4_t bx = vrev64q_f32(b);           // x w z y
+                float32x4_t by = vextq_f32(b, b, 2);       // y z w x
+                float32x4_t bz = vrev64q_f32(by);          // z y x w
+
+                float32x4_t r = vmulq_n_f32(b, vgetq_lane_f32(a, 0));
+                r = vmlaq_n_f32(r, vmulq_f32(bx, vld1q_f32(SX)), vgetq_lane_f32(a, 1));
+                r = vmlaq_n_f32(r, vmulq_f32(by, vld1q_f32(SY)), vgetq_lane_f32(a, 2));
+                r = vmlaq_n_f32(r, vmulq_f32(bz, vld1q_f32(SZ)), vgetq_lane_f32(a, 3));
+
+                return r;
+            }
+
+            inline quaternion_t multiply(const quaternion_t & a, const quaternion_t & b)
+            {
+                quaternion_t r;
+                vst1q_f32(&r.w, multiply(vld1q_f32(&a.w), vld1q_f32(&b.w)));
+                return r;
+            }
+
+            inline quaternion_t rate(const quaternion_t & q, float gx, float gy, float gz)
+            {
+                const float g[4] = {0, 0.5f * gx, 0.5f * gy, 0.5f * gz};
+
+                quaternion_t r;
+                vst1q_f32(&r.w, multiply(vld1q_f32(&q.w), vld1q_f32(g)));
+                return r;
+            }
+
+            inline bool normalize(quaternion_t & q)
+            {
+                float32x4_t v = vld1q_f32(&q.w);
+
+                // Sum of squares in both lanes
+                float32x4_t sq = vmulq_f32(v, v);
+                float32x2_t sumsq = vadd_f32(vget_low_f32(sq), vget_high_f32(sq));
+                sumsq = vpadd_f32(sumsq, sumsq);
+
+                if (vget_lane_f32(sumsq, 0) == 0) {
+                    return false;
+                }
+
+#ifdef HACKFLIGHT_FAST_RSQRT
+                // 8-bit hardware estimate, then two Newton steps
+                float32x2_t r = vrsqrte_f32(sumsq);
+                r = vmul_f32(r, vrsqrts_f32(vmul_f32(sumsq, r), r));
+                r = vmul_f32(r, vrsqrts_f32(vmul_f32(sumsq, r), r));
+                float scale = vget_lane_f32(r, 0);
+#else
+                float scale = 1.0f / sqrtf(vget_lane_f32(sumsq, 0));
+#endif
+
+                vst1q_f32(&q.w, vmulq_n_f32(v, scale));
+
+                return true;
+            }
+
+        } // namespace neon
+
+#endif
+
+#if defined(HACKFLIGHT_QMATH_SIMD) && defined(__SSE__)
+        namespace impl = sse;
+#elif defined(HACKFLIGHT_QMATH_SIMD) && defined(__ARM_NEON)
+        namespace impl = neon;
+#elif defined(__ARM_ARCH_7EM__) && defined(__ARM_FP)
+        namespace impl = dsp;
+#else
+        namespace impl = scalar;
+#endif
+
+        inline quaternion_t multiply(const quaternion_t & a, const quaternion_t & b)
+        {
+            return impl::multiply(a, b);
+        }
+
+        inline quaternion_t rate(const quaternion_t & q, float gx, float gy, float gz)
+        {
+            return impl::rate(q, gx, gy, gz);
+        }
+
+        inline bool normalize(quaternion_t & q)
+        {
+            return impl::normalize(q);
+        }
+
+    } // namespace qmath
+
+} // namespace hf
@@ -24,12 +24,14 @@
 #include <math.h>
 
 #include "datatypes.hpp"
+#include "fixedpoint.hpp"
 
 namespace hf {
 
     class Receiver {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
+        friend class Dispatch;
         friend class RealBoard;
         friend class MspParser;
 
@@ -54,7 +56,20 @@ namespace hf {
 
             float applyCyclicFunction(float command)
             {
+#ifdef HACKFLIGHT_FIXED_POINT
+                return rcFunFixed(q15_t(command), q15_t::fromRaw(CYCLIC_EXPO_FIXED), q15_t::fromRaw(CYCLIC_RATE_FIXED)).toFloat();
+#else
                 return rcFun(command, CYCLIC_EXPO, CYCLIC_RATE);
+#endif
+            }
+
+            float applyThrottleFunction(float command)
+            {
+#ifdef HACKFLIGHT_FIXED_POINT
+                return throttleFunFixed(q15_t(command)).toFloat();
+#else
+                return throttleFun(command);
+#endif
             }
 
             float makePositiveCommand(uint8_t channel)
@@ -62,6 +77,13 @@ namespace hf {
                 return fabs(rawvals[_channelMap[channel]]);
             }
 
+        protected: 
+
+            // The expo constants above as raw q15 values, for the fixed-point curves
+            static constexpr int16_t CYCLIC_EXPO_FIXED   = (int16_t)(0.65f * 32768 + 0.5f);
+            static constexpr int16_t CYCLIC_RATE_FIXED   = (int16_t)(0.90f * 32768 + 0.5f);
+            static constexpr int16_t THROTTLE_EXPO_FIXED = (int16_t)(0.20f * 32768 + 0.5f);
+
             static float rcFun(float x, float e, float r)
             {
                 return (1 + e*(x*x - 1)) * x * r;
@@ -76,7 +98,19 @@ namespace hf {
                 return (mid + tmp*(1-THROTTLE_EXPO + THROTTLE_EXPO * (tmp*tmp) / (y*y))) * 2 - 1;
             }
 
-        protected: 
+            // Same as rcFun(), with every intermediate inside [-1,+1]
+            static q15_t rcFunFixed(q15_t x, q15_t e, q15_t r)
+            {
+                q15_t one = q15_t::fromInt(1);
+                return (one + e*(x*x - one)) * x * r;
+            }
+
+            // throttleFun() simplifies to x(1 - e + e x^2), which is rcFun() with a rate of one
+            q15_t throttleFunFixed(q15_t x)
+            {
+                q15_t one = q15_t::fromInt(1);
+                return (one + q15_t::fromRaw(THROTTLE_EXPO_FIXED)*(x*x - one)) * x;
+            }
 
             // maximum number of channels that any receiver will send (of which we'll use six)
             static const uint8_t MAXCHAN = 8;
@@ -116,7 +150,7 @@ namespace hf {
             // Raw receiver values in [-1,+1]
             float rawvals[MAXCHAN] = {0};  
 
-            demands_t demands;
+            demands_t demands = {0, 0, 0, 0};
 
             float getRawval(uint8_t chan)
             {
@@ -142,14 +176,10 @@ namespace hf {
                 _demandScale = demandScale;
             }
 
-            bool getDemands(float yawAngle)
+            // Call after a new frame has arrived and raw channel values have been read, with the cosine and sine of
+            // the heading relative to the one at arming, for headless mode
+            void computeDemands(float yawCosine, float yawSine)
             {
-                // Wait till there's a new frame
-                if (!gotNewFrame()) return false;
-
-                // Read raw channel values
-                readRawvals();
-
                 // Convert raw [-1,+1] to absolute value
                 demands.roll  = makePositiveCommand(CHANNEL_ROLL);
                 demands.pitch = makePositiveCommand(CHANNEL_PITCH);
@@ -171,28 +201,23 @@ namespace hf {
 
                 // Support headless mode
                 if (headless) {
-                    float c = cos(yawAngle);
-                    float s = sin(yawAngle);
                     float p = demands.pitch;
                     float r = demands.roll;
                     
-                    demands.roll  = c*r - s*p;
+                    demands.roll  = yawCosine*r - yawSine*p;
                 }
 
                 // Yaw demand needs to be reversed
                 demands.yaw = -demands.yaw;
 
                 // Pass throttle demand through exponential function
-                demands.throttle = throttleFun(rawvals[_channelMap[CHANNEL_THROTTLE]]);
+                demands.throttle = applyThrottleFunction(rawvals[_channelMap[CHANNEL_THROTTLE]]);
 
                 // Store auxiliary switch state
                 _aux1State = getRawval(CHANNEL_AUX1) >= 0.0 ? (getRawval(CHANNEL_AUX1) > AUX_THRESHOLD ? 2 : 1) : 0;
                 _aux2State = getRawval(CHANNEL_AUX2) >= AUX_THRESHOLD ? 1 : 0;
 
-                // Got a new frame
-                return true;
-
-            }  // getDemands
+            }  // computeDemands
 
             bool throttleIsDown(void)
             {
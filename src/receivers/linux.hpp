@@ -0,0 +1,93 @@
+/*
+   Receiver subclass for running Hackflight natively on a Linux workstation
+
+   Channel values in [-1,+1] are injected by the calling program, which
+   makes it possible to script stick inputs for benchmarks and regression
+   tests.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "receiver.hpp"
+
+namespace hf {
+
+    class LinuxReceiver : public Receiver {
+
+        // Supports static dispatch from HackflightCore
+        friend class Dispatch;
+
+        private:
+
+            float _channels[MAXCHAN] = {0};
+
+            bool _gotNewFrame = false;
+
+            bool _lostSignal = false;
+
+        protected:
+
+            virtual bool gotNewFrame(void) override
+            {
+                bool result = _gotNewFrame;
+                _gotNewFrame = false;
+                return result;
+            }
+
+            virtual void readRawvals(void) override
+            {
+                for (uint8_t k=0; k<MAXCHAN; ++k) {
+                    rawvals[k] = _channels[k];
+                }
+            }
+
+            virtual bool lostSignal(void) override
+            {
+                return _lostSignal;
+            }
+
+        public:
+
+            LinuxReceiver(const uint8_t channelMap[6], float demandScale=1.0)
+                : Receiver(channelMap, demandScale)
+            {
+                // Start with throttle down
+                _channels[channelMap[CHANNEL_THROTTLE]] = -1;
+            }
+
+            void setChannel(uint8_t chan, float value)
+            {
+                _channels[chan] = value;
+                _gotNewFrame = true;
+            }
+
+            void setLostSignal(bool lost)
+            {
+                _lostSignal = lost;
+            }
+
+            // Lets the calling program see the demands it has produced, e.g. for tracking error
+            const demands_t & getCurrentDemands(void)
+            {
+                return demands;
+            }
+
+    }; // class LinuxReceiver
+
+} // namespace hf
@@ -0,0 +1,87 @@
+/*
+   Fixed-capacity list for sensors, PID controllers, and the like
+
+   Capacity is a template parameter, so the storage is exactly as big as
+   a build needs and nothing is allocated at run time.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    template <typename T, uint8_t CAPACITY>
+    class Registry {
+
+        private:
+
+            // Zero-length arrays aren't standard C++, so an empty registry still gets one slot
+            T _items[CAPACITY > 0 ? CAPACITY : 1];
+
+            uint8_t _count = 0;
+
+        public:
+
+            // Returns false if full
+            bool add(const T & item)
+            {
+                if (_count == CAPACITY) {
+                    return false;
+                }
+
+                _items[_count++] = item;
+
+                return true;
+            }
+
+            void clear(void)
+            {
+                _count = 0;
+            }
+
+            uint8_t count(void) const
+            {
+                return _count;
+            }
+
+            static uint8_t capacity(void)
+            {
+                return CAPACITY;
+            }
+
+            T & operator[](uint8_t index)
+            {
+                return _items[index];
+            }
+
+            // Support range-based for loops
+            T * begin(void)
+            {
+                return _items;
+            }
+
+            T * end(void)
+            {
+                return _items + _count;
+            }
+
+    }; // class Registry
+
+} // namespace hf
@@ -0,0 +1,227 @@
+/*
+   Rate-monotonic cooperative task scheduler
+
+   Tasks live in a static table sorted by priority.  Each call to run()
+   repeatedly runs the highest-priority task whose release time has
+   arrived, reusing each task's finish time as the time for the next
+   pick.  Tasks with a zero period are background tasks that run only
+   when no periodic task is due.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    class Scheduler {
+
+        public:
+
+            static const uint8_t MAXTASKS = 8;
+
+            typedef void (*taskfun_t)(void * context);
+
+            typedef struct {
+
+                const char * name;
+
+                taskfun_t fun;
+                void *    context;
+
+                uint32_t period;    // usec; 0 for background task
+                uint32_t deadline;  // usec after release
+                uint8_t  priority;  // lower number runs first
+
+                uint32_t release;   // usec
+
+                // Statistics
+                uint32_t runs;
+                uint32_t lateStarts;  // started after deadline had passed
+                uint32_t overruns;    // finished after deadline had passed
+                uint32_t maxLatency;  // usec from release to start
+                uint32_t maxDuration; // usec from start to finish
+
+            } task_t;
+
+        private:
+
+            task_t _tasks[MAXTASKS] = {};
+
+            uint8_t _taskCount = 0;
+
+            // Provides the current time in microseconds
+            uint32_t (*_clock)(void * context) = NULL;
+            void * _clockContext = NULL;
+
+            // Wraparound-safe check for whether time a is at or after time b
+            static bool reached(uint32_t a, uint32_t b)
+            {
+                return (int32_t)(a - b) >= 0;
+            }
+
+            // Returns finish time in usec
+            uint32_t runTask(task_t & task, uint32_t start)
+            {
+                uint32_t latency = start - task.release;
+
+                task.fun(task.context);
+
+                uint32_t finish = _clock(_clockContext);
+                uint32_t duration = finish - start;
+
+                task.runs++;
+
+                if (latency > task.maxLatency) {
+                    task.maxLatency = latency;
+                }
+
+                if (duration > task.maxDuration) {
+                    task.maxDuration = duration;
+                }
+
+                // Background tasks have no deadline
+                if (task.period > 0) {
+
+                    if (latency > task.deadline) {
+                        task.lateStarts++;
+                    }
+
+                    if (latency + duration > task.deadline) {
+                        task.overruns++;
+                    }
+                }
+
+                // Keep phase if we can; otherwise resynchronize to the present
+                task.release += task.period;
+                if (reached(start, task.release)) {
+                    task.release = start + task.period;
+                }
+
+                return finish;
+            }
+
+            // Returns index of highest-priority periodic task due at time usec, or -1 if none
+            int8_t nextDue(uint32_t usec)
+            {
+                for (uint8_t k=0; k<_taskCount; ++k) {
+                    task_t & task = _tasks[k];
+                    if (task.period > 0 && reached(usec, task.release)) {
+                        return k;
+                    }
+                }
+
+                return -1;
+            }
+
+        public:
+
+            void init(uint32_t (*clock)(void * context), void * clockContext)
+            {
+                _clock = clock;
+                _clockContext = clockContext;
+                _taskCount = 0;
+            }
+
+            /**
+             * Adds a task, keeping the table sorted by priority.  A zero deadline defaults to the period.
+             * Returns false if the table is full.
+             */
+            bool addTask(const char * name, taskfun_t fun, void * context, uint32_t period, uint8_t priority, uint32_t deadline=0)
+            {
+                if (_taskCount == MAXTASKS) {
+                    return false;
+                }
+
+                // Insertion sort on priority; equal priorities keep the order in which they were added
+                uint8_t k = _taskCount;
+                while (k > 0 && _tasks[k-1].priority > priority) {
+                    _tasks[k] = _tasks[k-1];
+                    --k;
+                }
+
+                task_t & task = _tasks[k];
+                task.name = name;
+                task.fun = fun;
+                task.context = context;
+                task.period = period;
+                task.deadline = deadline > 0 ? deadline : period;
+                task.priority = priority;
+                task.release = 0;
+                task.runs = 0;
+                task.lateStarts = 0;
+                task.overruns = 0;
+                task.maxLatency = 0;
+                task.maxDuration = 0;
+
+                _taskCount++;
+
+                return true;
+            }
+
+            void start(void)
+            {
+                uint32_t usec = _clock(_clockContext);
+
+                for (uint8_t k=0; k<_taskCount; ++k) {
+                    _tasks[k].release = usec;
+                }
+            }
+
+            void run(void)
+            {
+                uint32_t usec = _clock(_clockContext);
+
+                // Run due periodic tasks, highest priority first.  Bounding the number of passes keeps
+                // a task whose period is shorter than its execution time from starving the caller.
+                bool ranPeriodic = false;
+                for (uint8_t pass=0; pass<_taskCount; ++pass) {
+                    int8_t k = nextDue(usec);
+                    if (k < 0) {
+                        break;
+                    }
+                    usec = runTask(_tasks[k], usec);
+                    ranPeriodic = true;
+                }
+
+                // Background tasks use whatever time is left over
+                if (!ranPeriodic) {
+                    for (uint8_t k=0; k<_taskCount; ++k) {
+                        task_t & task = _tasks[k];
+                        if (task.period == 0) {
+                            task.release = usec;
+                            usec = runTask(task, usec);
+                        }
+                    }
+                }
+            }
+
+            uint8_t getTaskCount(void)
+            {
+                return _taskCount;
+            }
+
+            const task_t & getTask(uint8_t index)
+            {
+                return _tasks[index];
+            }
+
+    }; // class Scheduler
+
+} // namespace hf
@@ -20,19 +20,22 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include "datatypes.hpp"
 
 namespace hf {
 
     class Sensor {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         protected:
 
-        virtual void modifyState(state_t & state, float time) = 0;
+        // usec is the time of the current loop pass, on Hackflight's 64-bit microsecond timebase
+        virtual void modifyState(state_t & state, uint64_t usec) = 0;
 
-        virtual bool ready(float time) = 0;
+        virtual bool ready(uint64_t usec) = 0;
 
     };  // class Sensor
 
@@ -28,7 +28,7 @@ namespace hf {
 
     class MspSensor : public Sensor, MspParser {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         private:
 
@@ -42,9 +42,9 @@ namespace hf {
             _board = board;
         }
 
-        virtual bool ready(float time) override
+        virtual bool ready(uint64_t usec) override
         {
-            (void)time;
+            (void)usec;
 
             bool retval = false;
 
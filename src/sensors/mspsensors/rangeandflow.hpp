@@ -35,10 +35,10 @@ namespace hf {
 
         protected:
 
-        virtual void modifyState(state_t & state, float time)  override
+        virtual void modifyState(state_t & state, uint64_t usec)  override
         {
             (void)state;
-            (void)time;
+            (void)usec;
         }
 
         virtual void handle_SET_RANGE_AND_FLOW(int16_t  range, int16_t  flowx, int16_t  flowy) override
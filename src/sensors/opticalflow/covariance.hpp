@@ -0,0 +1,566 @@
+/*
+   Covariance storage and updates for the optical-flow EKF
+
+   FlowEkf does its covariance arithmetic through one of these classes,
+   chosen by its template argument:
+
+     DenseCovariance keeps the full matrix and does the Joseph-form update
+     (KH - I)P(KH - I)' + KRK' with two dense matrix products, then makes
+     the result symmetric and bounds it in another pass.
+
+     PackedCovariance keeps only the upper triangle.  For a scalar
+     measurement the same Joseph form is computed a row at a time, in
+     O(n^2): M = (I - KH)P = P - Ku' with u = PH', then M(I - KH)' + KRK'
+     = M - (MH')K' + KRK', taking MH' from M itself.  Expanding it all to
+     P - Ku' - uK' + sKK' instead would cancel the way P - uu'/s does.
+     The triangle is written back symmetric and bounded in the same pass.
+
+     UDCovariance keeps P factored as UDU', with U unit upper-triangular
+     and D diagonal, and updates the factors directly: Bierman's method for
+     a scalar measurement, and Thornton's weighted Gram-Schmidt for the
+     process model and the attitude rotation.  P stays symmetric and positive-definite by
+     construction, so nothing needs symmetrizing, and only D is bounded.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cmath>
+
+#include "linalg.hpp"
+
+namespace hf {
+
+    class Covariance {
+
+        protected:
+
+            // The bounds on the covariance, these shouldn't be hit, but sometimes are... why?
+            static constexpr float MAX_COVARIANCE = 100.f;
+            static constexpr float MIN_COVARIANCE = 1e-6f;
+
+            static float clamp(float p, bool diagonal)
+            {
+                if (std::isnan(p) || p > MAX_COVARIANCE) {
+                    return MAX_COVARIANCE;
+                }
+                if (diagonal && p < MIN_COVARIANCE) {
+                    return MIN_COVARIANCE;
+                }
+                return p;
+            }
+
+    };  // class Covariance
+
+    template <uint8_t DIM>
+    class DenseCovariance : public Covariance {
+
+        private:
+
+            linalg::Matrix<DIM,DIM> Pm;
+
+        public:
+
+            void reset(void)
+            {
+                Pm.zero();
+            }
+
+            float get(uint8_t i, uint8_t j) const
+            {
+                return Pm.get(i, j);
+            }
+
+            /**
+             * Adds q to the variance of state i, as process noise does.
+             */
+            void addVariance(uint8_t i, float q)
+            {
+                Pm.set(i, i, Pm.get(i, i) + q);
+            }
+
+            /**
+             * Returns HPH' + R, leaving PH' in PHTm.
+             */
+            float innovationVariance(const linalg::Matrix<1,DIM> & Hm, float R, linalg::Matrix<DIM,1> & PHTm) const
+            {
+                linalg::multTransposed(Pm, Hm, PHTm); // PH'
+
+                float HPHR = R; // HPH' + R
+                for (int i=0; i<DIM; i++) { // Add the element of HPH' to the above
+                    HPHR += Hm.get(0,i)*PHTm.get(i,0);
+                }
+
+                return HPHR;
+            }
+
+            /**
+             * Covariance after a scalar measurement with gain K, bounded.
+             */
+            void correct(const linalg::Matrix<1,DIM> & Hm, const linalg::Matrix<DIM,1> & Km,
+                    const linalg::Matrix<DIM,1> & PHTm, float HPHR, float R)
+            {
+                (void)PHTm;
+                (void)HPHR;
+
+                linalg::Matrix<DIM,DIM> KHIm;
+                linalg::outer(Km, Hm, KHIm); // KH
+                for (int i=0; i<DIM; i++) { 
+                    KHIm.set(i,i, KHIm.get(i,i)-1);// KH - I
+                }
+                linalg::Matrix<DIM,DIM> KHIPm;
+                linalg::mult(KHIm, Pm, KHIPm); // (KH - I)*P
+                linalg::multTransposed(KHIPm, KHIm, Pm); // (KH - I)*P*(KH - I)'
+
+                // add the measurement variance and ensure boundedness and symmetry
+                // TODO: Why would it hit the bounds? Needs to be investigated.
+                for (int i=0; i<DIM; i++) {
+                    for (int j=i; j<DIM; j++) {
+                        float v = Km.get(i,0) * R * Km.get(j,0);
+                        float p = clamp(0.5f*Pm.get(i,j) + 0.5f*Pm.get(j,i) + v, i==j); // add measurement noise
+                        Pm.set(i,j, p);
+                        Pm.set(j,i, p);
+                    }
+                }
+            }
+
+            /**
+             * APA', for the process model's A.
+             */
+            void propagate(const linalg::Matrix<DIM,DIM> & Am)
+            {
+                linalg::Matrix<DIM,DIM> APm;
+                linalg::mult(Am, Pm, APm); // AP
+                linalg::multTransposed(APm, Am, Pm); //APA'
+            }
+
+            /**
+             * APA', where A is the identity but for the 3x3 block a starting at (first,first).
+             */
+            void rotate(uint8_t first, const float a[3][3])
+            {
+                linalg::Matrix<DIM,DIM> Am;
+                for (uint8_t i=0; i<DIM; ++i) {
+                    if (i < first || i >= first+3) {
+                        Am.set(i, i, 1);
+                    }
+                }
+                for (uint8_t i=0; i<3; ++i) {
+                    for (uint8_t j=0; j<3; ++j) {
+                        Am.set(first+i, first+j, a[i][j]);
+                    }
+                }
+
+                linalg::Matrix<DIM,DIM> APm;
+                linalg::mult(Am, Pm, APm); // AP
+                linalg::multTransposed(APm, Am, Pm); //APA'
+            }
+
+            /**
+             * Enforces symmetry, and keeps the values bounded.
+             */
+            void bound(void)
+            {
+                for (int i=0; i<DIM; i++) {
+                    for (int j=i; j<DIM; j++) {
+                        float p = clamp(0.5f*Pm.get(i,j) + 0.5f*Pm.get(j,i), i==j);
+                        Pm.set(i, j, p);
+                        Pm.set(j, i, p);
+                    }
+                }
+            }
+
+    };  // class DenseCovariance
+
+    template <uint8_t DIM>
+    class PackedCovariance : public Covariance {
+
+        private:
+
+            linalg::SymmetricMatrix<DIM> Pm;
+
+        public:
+
+            void reset(void)
+            {
+                Pm.zero();
+            }
+
+            float get(uint8_t i, uint8_t j) const
+            {
+                return Pm.get(i, j);
+            }
+
+            void addVariance(uint8_t i, float q)
+            {
+                Pm.set(i, i, Pm.get(i, i) + q);
+            }
+
+            float innovationVariance(const linalg::Matrix<1,DIM> & Hm, float R, linalg::Matrix<DIM,1> & PHTm) const
+            {
+                const float * p = Pm.packed();
+
+                float u[DIM] = {0};
+
+                // Each entry of the triangle contributes to u[i] and, off the diagonal, to u[j]
+                for (uint8_t i=0; i<DIM; ++i) {
+                    float hi = Hm.get(0,i);
+                    u[i] += *p++ * hi;
+                    for (uint8_t j=i+1; j<DIM; ++j) {
+                        u[i] += *p * Hm.get(0,j);
+                        u[j] += *p * hi;
+                        p++;
+                    }
+                }
+
+                float HPHR = R;
+                for (uint8_t i=0; i<DIM; ++i) {
+                    PHTm.set(i, 0, u[i]);
+                    HPHR += Hm.get(0,i) * u[i];
+                }
+
+                return HPHR;
+            }
+
+            void correct(const linalg::Matrix<1,DIM> & Hm, const linalg::Matrix<DIM,1> & Km,
+                    const linalg::Matrix<DIM,1> & PHTm, float HPHR, float R)
+            {
+                (void)HPHR;
+
+                // (I - KH)P = P - Ku', in full
+                float m[DIM][DIM];
+                for (uint8_t i=0; i<DIM; ++i) {
+                    float ki = Km.get(i,0);
+                    for (uint8_t j=0; j<DIM; ++j) {
+                        m[i][j] = Pm.get(i,j) - ki*PHTm.get(j,0);
+                    }
+                }
+
+                // (I - KH)PH', from the product above rather than from u and s, so nothing cancels
+                float w[DIM];
+                for (uint8_t i=0; i<DIM; ++i) {
+                    float sum = 0;
+                    for (uint8_t k=0; k<DIM; ++k) {
+                        sum += m[i][k] * Hm.get(0,k);
+                    }
+                    w[i] = sum;
+                }
+
+                // (I - KH)P(I - KH)' + KRK' = M - wK' + RKK', made symmetric and bounded as it is written
+                // TODO: Why would it hit the bounds? Needs to be investigated.
+                float * p = Pm.packed();
+                for (uint8_t i=0; i<DIM; ++i) {
+                    float ki = Km.get(i,0);
+                    for (uint8_t j=i; j<DIM; ++j) {
+                        float kj = Km.get(j,0);
+                        float rk = R * ki * kj;
+                        float pij = m[i][j] - w[i]*kj + rk;
+                        float pji = m[j][i] - w[j]*ki + rk;
+                        *p++ = clamp(0.5f*pij + 0.5f*pji, i==j);
+                    }
+                }
+            }
+
+            void propagate(const linalg::Matrix<DIM,DIM> & Am)
+            {
+                // AP in full, then the upper triangle of (AP)A'
+                float ap[DIM][DIM];
+                for (uint8_t i=0; i<DIM; ++i) {
+                    for (uint8_t j=0; j<DIM; ++j) {
+                        float sum = 0;
+                        for (uint8_t k=0; k<DIM; ++k) {
+                            sum += Am.get(i,k) * Pm.get(k,j);
+                        }
+                        ap[i][j] = sum;
+                    }
+                }
+
+                float * p = Pm.packed();
+                for (uint8_t i=0; i<DIM; ++i) {
+                    for (uint8_t j=i; j<DIM; ++j) {
+                        float sum = 0;
+                        for (uint8_t k=0; k<DIM; ++k) {
+                            sum += ap[i][k] * Am.get(j,k);
+                        }
+                        *p++ = clamp(sum, i==j);
+                    }
+                }
+            }
+
+            void rotate(uint8_t first, const float a[3][3])
+            {
+                // Rows outside the block: P(i,block) a'
+                for (uint8_t i=0; i<DIM; ++i) {
+                    if (i >= first && i < first+3) {
+                        continue;
+                    }
+                    float pi[3] = {Pm.get(i,first), Pm.get(i,first+1), Pm.get(i,first+2)};
+                    for (uint8_t b=0; b<3; ++b) {
+                        Pm.set(i, first+b, clamp(a[b][0]*pi[0] + a[b][1]*pi[1] + a[b][2]*pi[2], false));
+                    }
+                }
+
+                // The block itself: a P(block,block) a'
+                float ap[3][3] = {{0}};
+                for (uint8_t i=0; i<3; ++i) {
+                    for (uint8_t j=0; j<3; ++j) {
+                        for (uint8_t k=0; k<3; ++k) {
+                            ap[i][j] += a[i][k] * Pm.get(first+k, first+j);
+                        }
+                    }
+                }
+                for (uint8_t i=0; i<3; ++i) {
+                    for (uint8_t j=i; j<3; ++j) {
+                        float p = ap[i][0]*a[j][0] + ap[i][1]*a[j][1] + ap[i][2]*a[j][2];
+                        Pm.set(first+i, first+j, clamp(p, i==j));
+                    }
+                }
+            }
+
+            // Every entry is symmetric by construction, and bounded as it is written
+            void bound(void)
+            {
+            }
+
+    };  // class PackedCovariance
+
+    template <uint8_t DIM>
+    class UDCovariance : public Covariance {
+
+        private:
+
+            static const uint16_t SIZE = DIM * (DIM + 1) / 2;
+
+            // U above the diagonal and D on it, packed column by column: (0,0), (0,1), (1,1), (0,2), ...
+            float _ud[SIZE];
+
+            static uint16_t index(uint8_t i, uint8_t j)
+            {
+                return j * (j + 1) / 2 + i;
+            }
+
+            // f = U'h, and g = Df
+            void project(const linalg::Matrix<1,DIM> & Hm, float f[DIM], float g[DIM]) const
+            {
+                const float * u = _ud;
+                for (uint8_t j=0; j<DIM; ++j) {
+                    float fj = Hm.get(0,j);
+                    for (uint8_t i=0; i<j; ++i) {
+                        fj += *u++ * Hm.get(0,i);
+                    }
+                    f[j] = fj;
+                    g[j] = *u++ * fj;
+                }
+            }
+
+            // Factors W diag(d) W' as UDU' by Thornton's modified weighted Gram-Schmidt, last row first
+            void factor(float w[DIM][DIM], const float d[DIM])
+            {
+                for (int8_t j=DIM-1; j>=0; --j) {
+
+                    float c[DIM];
+                    float dj = 0;
+                    for (uint8_t k=0; k<DIM; ++k) {
+                        c[k] = d[k] * w[j][k];
+                        dj += w[j][k] * c[k];
+                    }
+                    dj = clamp(dj, true);
+                    _ud[index(j, j)] = dj;
+
+                    for (uint8_t i=0; i<j; ++i) {
+                        float uij = 0;
+                        for (uint8_t k=0; k<DIM; ++k) {
+                            uij += w[i][k] * c[k];
+                        }
+                        uij /= dj;
+                        _ud[index(i, j)] = uij;
+                        for (uint8_t k=0; k<DIM; ++k) {
+                            w[i][k] -= uij * w[j][k];
+                        }
+                    }
+                }
+            }
+
+        public:
+
+            UDCovariance(void)
+            {
+                reset();
+            }
+
+            // U = I, D = 0
+            void reset(void)
+            {
+                for (uint16_t k=0; k<SIZE; ++k) {
+                    _ud[k] = 0;
+                }
+            }
+
+            // (UDU')ij, in O(n)
+            float get(uint8_t i, uint8_t j) const
+            {
+                if (i > j) {
+                    uint8_t t = i;
+                    i = j;
+                    j = t;
+                }
+
+                float p = 0;
+                for (uint8_t k=j; k<DIM; ++k) {
+                    const float * column = &_ud[index(0, k)];
+                    float uik = i == k ? 1 : column[i];
+                    float ujk = j == k ? 1 : column[j];
+                    p += uik * column[k] * ujk;
+                }
+
+                return p;
+            }
+
+            // UDU' + q e e' for the unit vector e along state i, by the Agee-Turner rank-one update
+            void addVariance(uint8_t i, float q)
+            {
+                float x[DIM] = {0};
+                x[i] = 1;
+
+                for (int8_t j=i; j>=0; --j) {
+                    float * column = &_ud[index(0, j)];
+                    float xj = x[j];
+                    float dj = column[j] + q * xj * xj;
+                    if (dj <= 0) {
+                        continue; // nothing to add along a direction with no variance
+                    }
+                    float beta = q * xj / dj;
+                    q *= column[j] / dj;
+                    column[j] = clamp(dj, true);
+                    for (uint8_t k=0; k<j; ++k) {
+                        x[k] -= xj * column[k];
+                        column[k] += beta * x[k];
+                    }
+                }
+            }
+
+            float innovationVariance(const linalg::Matrix<1,DIM> & Hm, float R, linalg::Matrix<DIM,1> & PHTm) const
+            {
+                float f[DIM];
+                float g[DIM];
+                project(Hm, f, g);
+
+                // PH' = Ug
+                float u[DIM];
+                const float * column = _ud;
+                for (uint8_t j=0; j<DIM; ++j) {
+                    u[j] = g[j];
+                    for (uint8_t i=0; i<j; ++i) {
+                        u[i] += column[i] * g[j];
+                    }
+                    column += j + 1;
+                }
+
+                float HPHR = R;
+                for (uint8_t j=0; j<DIM; ++j) {
+                    PHTm.set(j, 0, u[j]);
+                    HPHR += f[j] * g[j];
+                }
+
+                return HPHR;
+            }
+
+            // Bierman's update, which works out the same gain as it goes, so K is not needed
+            void correct(const linalg::Matrix<1,DIM> & Hm, const linalg::Matrix<DIM,1> & Km,
+                    const linalg::Matrix<DIM,1> & PHTm, float HPHR, float R)
+            {
+                (void)Km;
+                (void)PHTm;
+                (void)HPHR;
+
+                float f[DIM];
+                float g[DIM];
+                project(Hm, f, g);
+
+                float b[DIM];
+                float alpha = R;
+
+                float * u = _ud;
+                for (uint8_t j=0; j<DIM; ++j) {
+                    float beta = alpha;
+                    alpha += f[j] * g[j];
+                    float lambda = -f[j] / beta;
+                    for (uint8_t i=0; i<j; ++i) {
+                        float uij = *u;
+                        *u++ = uij + b[i] * lambda;
+                        b[i] += uij * g[j];
+                    }
+                    *u = clamp(*u * beta / alpha, true);
+                    u++;
+                    b[j] = g[j];
+                }
+            }
+
+            // Re-factors (AU) D (AU)'
+            void propagate(const linalg::Matrix<DIM,DIM> & Am)
+            {
+                float w[DIM][DIM];
+                float d[DIM];
+                for (uint8_t i=0; i<DIM; ++i) {
+                    d[i] = _ud[index(i, i)];
+                    for (uint8_t k=0; k<DIM; ++k) {
+                        const float * column = &_ud[index(0, k)];
+                        float sum = Am.get(i,k);
+                        for (uint8_t l=0; l<k; ++l) {
+                            sum += Am.get(i,l) * column[l];
+                        }
+                        w[i][k] = sum;
+                    }
+                }
+
+                factor(w, d);
+            }
+
+            void rotate(uint8_t first, const float a[3][3])
+            {
+                // W = AU, whose rows differ from U's only in the block
+                float w[DIM][DIM];
+                float d[DIM];
+                for (uint8_t i=0; i<DIM; ++i) {
+                    d[i] = _ud[index(i, i)];
+                    for (uint8_t k=0; k<DIM; ++k) {
+                        w[i][k] = i < k ? _ud[index(i, k)] : i == k ? 1 : 0;
+                    }
+                }
+                for (uint8_t b=0; b<3; ++b) {
+                    for (uint8_t k=first; k<DIM; ++k) {
+                        float wk = 0;
+                        for (uint8_t l=0; l<3; ++l) {
+                            uint8_t r = first + l;
+                            wk += a[b][l] * (r < k ? _ud[index(r, k)] : r == k ? 1 : 0);
+                        }
+                        w[first+b][k] = wk;
+                    }
+                }
+
+                factor(w, d);
+            }
+
+            // Symmetric and positive-definite by construction, with D bounded as it is written
+            void bound(void)
+            {
+            }
+
+    };  // class UDCovariance
+
+} // namespace hf
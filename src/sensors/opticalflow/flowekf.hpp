@@ -0,0 +1,489 @@
+/*
+   Extended Kalman Filter for velocity from an optical-flow sensor
+
+   Holds the estimator that the PMW3901 OpticalFlow sensor runs on each flow
+   reading, apart from the sensor itself, so that it can be run and checked
+   on any machine.  The template argument picks how the covariance is
+   stored and updated (covariance.hpp); by default, as a packed symmetric
+   matrix.
+
+   predict() runs the process model on each gyrometer and accelerometer
+   sample: it moves the state and attitude, which is cheap, and adds up
+   the time and rates.  The covariance is carried forward over all of that
+   time at once, just before the next correction, so each flow frame or
+   range reading costs one covariance propagation and its own update,
+   however many IMU samples came in between.
+
+   State estimation adapted from:
+
+    https://github.com/bitcraze/crazyflie-firmware/blob/master/src/modules/src/estimator_kalman.c
+
+    Copyright (c) 2018 Simon D. Levy
+
+    This file is part of Hackflight.
+
+    Hackflight is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Hackflight is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <math.h>
+
+#include "debugger.hpp"
+#include "filters.hpp"
+#include "qmath.hpp"
+#include "linalg.hpp"
+#include "covariance.hpp"
+
+namespace hf {
+
+    template <template <uint8_t> class CovarianceT = PackedCovariance>
+    class FlowEkf {
+
+        public:
+
+            // The quad's state, stored as a column vector
+            typedef enum
+            {
+                STATE_X,  // Position
+                STATE_Y, 
+                STATE_Z, 
+                STATE_PX, // Velocity
+                STATE_PY, 
+                STATE_PZ, 
+                STATE_D0, // Attitude error
+                STATE_D1, 
+                STATE_D2, 
+                STATE_DIM
+            } stateIdx_t;
+
+        private:
+
+            static constexpr float FLOW_SCALE    = 100.f;
+
+            static constexpr float MAX_POSITION   = 100.f; //meters
+            static constexpr float MAX_VELOCITY   = 10.f;  //meters per second
+
+            // A row of the measurement matrix, and the Kalman gain as a column
+            typedef linalg::Matrix<1,STATE_DIM> row_t;
+            typedef linalg::Matrix<STATE_DIM,1> column_t;
+
+            // The quad's attitude as a rotation matrix (used by the prediction, updated by the finalization)
+            float R[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
+
+            float S[STATE_DIM] = {0.f};
+
+            float _omegax_b = 0;
+            float _omegay_b = 0;
+            float _dx_g = 0;
+            float _dy_g = 0;
+            float _z_g = 0;
+            float _predictedNX = 0;
+            float _predictedNY = 0;
+            float _measuredNX = 0;
+            float _measuredNY = 0;
+
+            qmath::quaternion_t q = {1,0,0,0};
+
+            CovarianceT<STATE_DIM> _P;
+
+            static constexpr float STDDEV = 0.25f;
+
+            static constexpr float STDDEV_RANGE = 0.05f; // meters
+
+            static constexpr float GRAVITY = 9.81f;
+
+            // Process noise, as standard deviations of acceleration and gyrometer rate
+            static constexpr float PROC_NOISE_ACC_XY = 0.5f;
+            static constexpr float PROC_NOISE_ACC_Z  = 1.0f;
+            static constexpr float PROC_NOISE_GYRO   = 0.1f;
+
+            // Time and body rates since the covariance was last carried forward
+            float _pendingTime = 0;
+            float _pendingGyro[3] = {0};
+
+            // ~~~ Camera constants ~~~
+            // The angle of aperture is guessed from the raw data register and thankfully look to be symmetric
+            float Npix = 30.0;                      // [pixels] (same in x and y)
+            float thetapix = Filter::deg2rad(4.2f);
+
+            uint32_t count = 0;
+
+            static void checkNan(float x, const char * name, uint32_t count)
+            {
+                if (std::isnan(x)) {
+                    Debugger::printf("%s is NaN after %d steps\n", name, count);
+                    while (true) {
+                    }
+                }
+            }
+
+            // The covariance can't hold NaN, because every update replaces NaN with the upper bound
+            bool stateEstimatorAssertNotNaN() {
+
+                for(int i=0; i<STATE_DIM; i++) {
+                    if (std::isnan(S[i])) {
+                        reset();
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            void stateEstimatorFinalize(void)
+            {
+                // Incorporate the attitude error (Kalman filter state) with the attitude
+                float v0 = S[STATE_D0];
+                float v1 = S[STATE_D1];
+                float v2 = S[STATE_D2];
+
+                // Move attitude error into attitude if any of the angle errors are large enough
+                if ((fabsf(v0) > 0.1e-3f || fabsf(v1) > 0.1e-3f || fabsf(v2) > 0.1e-3f) && (fabsf(v0) < 10 && fabsf(v1) < 10 && fabsf(v2) < 10)) {
+
+                    float angle = sqrt(v0*v0 + v1*v1 + v2*v2);
+                    float ca = cos(angle / 2.0f);
+                    float sa = sin(angle / 2.0f);
+                    qmath::quaternion_t dq = {ca, sa * v0 / angle, sa * v1 / angle, sa * v2 / angle};
+
+                    // rotate the quad's attitude by the delta quaternion vector computed above,
+                    // normalize and store the result
+                    q = qmath::multiply(q, dq);
+                    qmath::normalize(q);
+
+                    /** Rotate the covariance, since we've rotated the body
+                     *
+                     * This comes from a second order approximation to:
+                     * Sigma_post = exps(-d) Sigma_pre exps(-d)'
+                     *            ~ (I + [[-d]] + [[-d]]^2 / 2) Sigma_pre (I + [[-d]] + [[-d]]^2 / 2)'
+                     * where d is the attitude error expressed as Rodriges parameters, ie. d = tan(|v|/2)*v/|v|
+                     *
+                     * As derived in "Covariance Correction Step for Kalman Filtering with an Attitude"
+                     * http://arc.aiaa.org/doi/abs/10.2514/1.G000848
+                     */
+
+                    float d0 = v0/2; // the attitude error vector (v0,v1,v2) is small,
+                    float d1 = v1/2; // so we use a first order approximation to d0 = tan(|v0|/2)*v0/|v0|
+                    float d2 = v2/2;
+
+                    // Matrix to rotate the attitude covariances once updated
+                    float a[3][3] = {
+                        { 1 - d1*d1/2 - d2*d2/2,  d2 + d0*d1/2,          -d1 + d0*d2/2},
+                        {-d2 + d0*d1/2,           1 - d0*d0/2 - d2*d2/2,  d0 + d1*d2/2},
+                        { d1 + d0*d2/2,          -d0 + d1*d2/2,           1 - d0*d0/2 - d1*d1/2}
+                    };
+
+                    _P.rotate(STATE_D0, a);
+                }
+
+                // convert the new attitude to a rotation matrix, such that we can rotate body-frame velocity and acc
+                qmath::toRotationMatrix(q, R);
+
+                // reset the attitude error
+                S[STATE_D0] = 0;
+                S[STATE_D1] = 0;
+                S[STATE_D2] = 0;
+
+                // constrain the states
+                for (int i=0; i<3; i++)
+                {
+                    if (S[STATE_X+i] < -MAX_POSITION) { S[STATE_X+i] = -MAX_POSITION; }
+                    else if (S[STATE_X+i] > MAX_POSITION) { S[STATE_X+i] = MAX_POSITION; }
+
+                    if (S[STATE_PX+i] < -MAX_VELOCITY) { S[STATE_PX+i] = -MAX_VELOCITY; }
+                    else if (S[STATE_PX+i] > MAX_VELOCITY) { S[STATE_PX+i] = MAX_VELOCITY; }
+                }
+
+                // enforce symmetry of the covariance matrix, and ensure the values stay bounded
+                _P.bound();
+            }
+
+            // Carries the covariance forward over the time predict() has covered since the last correction,
+            // with the mean body rates over that time
+            void stateEstimatorPropagate(void)
+            {
+                if (_pendingTime == 0) {
+                    return;
+                }
+
+                float dt = _pendingTime;
+
+                float gx = _pendingGyro[0] / dt;
+                float gy = _pendingGyro[1] / dt;
+                float gz = _pendingGyro[2] / dt;
+
+                // A = I + F dt, with F the Jacobian of the process model
+                linalg::Matrix<STATE_DIM,STATE_DIM> Am;
+
+                for (uint8_t i=0; i<3; ++i) {
+
+                    Am.set(STATE_X+i, STATE_X+i, 1);
+
+                    // position from body-frame velocity
+                    Am.set(STATE_X+i, STATE_PX, R[i][0]*dt);
+                    Am.set(STATE_X+i, STATE_PY, R[i][1]*dt);
+                    Am.set(STATE_X+i, STATE_PZ, R[i][2]*dt);
+
+                    // position from attitude error
+                    Am.set(STATE_X+i, STATE_D0, (S[STATE_PY]*R[i][2] - S[STATE_PZ]*R[i][1])*dt);
+                    Am.set(STATE_X+i, STATE_D1, (-S[STATE_PX]*R[i][2] + S[STATE_PZ]*R[i][0])*dt);
+                    Am.set(STATE_X+i, STATE_D2, (S[STATE_PX]*R[i][1] - S[STATE_PY]*R[i][0])*dt);
+                }
+
+                // body-frame velocity from body-frame velocity, through the rotation of the body
+                Am.set(STATE_PX,STATE_PX, 1);
+                Am.set(STATE_PY,STATE_PX, -gz*dt);
+                Am.set(STATE_PZ,STATE_PX, gy*dt);
+
+                Am.set(STATE_PX,STATE_PY, gz*dt);
+                Am.set(STATE_PY,STATE_PY, 1);
+                Am.set(STATE_PZ,STATE_PY, -gx*dt);
+
+                Am.set(STATE_PX,STATE_PZ, -gy*dt);
+                Am.set(STATE_PY,STATE_PZ, gx*dt);
+                Am.set(STATE_PZ,STATE_PZ, 1);
+
+                // body-frame velocity from attitude error, through gravity
+                Am.set(STATE_PY,STATE_D0, -GRAVITY*R[2][2]*dt);
+                Am.set(STATE_PZ,STATE_D0, GRAVITY*R[2][1]*dt);
+
+                Am.set(STATE_PX,STATE_D1, GRAVITY*R[2][2]*dt);
+                Am.set(STATE_PZ,STATE_D1, -GRAVITY*R[2][0]*dt);
+
+                Am.set(STATE_PX,STATE_D2, -GRAVITY*R[2][1]*dt);
+                Am.set(STATE_PY,STATE_D2, GRAVITY*R[2][0]*dt);
+
+                // attitude error from attitude error
+                float d0 = gx*dt/2;
+                float d1 = gy*dt/2;
+                float d2 = gz*dt/2;
+
+                Am.set(STATE_D0,STATE_D0,  1 - d1*d1/2 - d2*d2/2);
+                Am.set(STATE_D0,STATE_D1,  d2 + d0*d1/2);
+                Am.set(STATE_D0,STATE_D2, -d1 + d0*d2/2);
+
+                Am.set(STATE_D1,STATE_D0, -d2 + d0*d1/2);
+                Am.set(STATE_D1,STATE_D1,  1 - d0*d0/2 - d2*d2/2);
+                Am.set(STATE_D1,STATE_D2,  d0 + d1*d2/2);
+
+                Am.set(STATE_D2,STATE_D0,  d1 + d0*d2/2);
+                Am.set(STATE_D2,STATE_D1, -d0 + d1*d2/2);
+                Am.set(STATE_D2,STATE_D2, 1 - d0*d0/2 - d1*d1/2);
+
+                _P.propagate(Am);
+
+                // Process noise
+                float qxy = PROC_NOISE_ACC_XY*dt*dt;
+                float qz  = PROC_NOISE_ACC_Z*dt*dt;
+                float qvxy = PROC_NOISE_ACC_XY*dt;
+                float qvz  = PROC_NOISE_ACC_Z*dt;
+                float qatt = PROC_NOISE_GYRO*dt;
+                _P.addVariance(STATE_X,  qxy*qxy);
+                _P.addVariance(STATE_Y,  qxy*qxy);
+                _P.addVariance(STATE_Z,  qz*qz);
+                _P.addVariance(STATE_PX, qvxy*qvxy);
+                _P.addVariance(STATE_PY, qvxy*qvxy);
+                _P.addVariance(STATE_PZ, qvz*qvz);
+                _P.addVariance(STATE_D0, qatt*qatt);
+                _P.addVariance(STATE_D1, qatt*qatt);
+                _P.addVariance(STATE_D2, qatt*qatt);
+
+                _pendingTime = 0;
+                _pendingGyro[0] = 0;
+                _pendingGyro[1] = 0;
+                _pendingGyro[2] = 0;
+            }
+
+            void stateEstimatorScalarUpdate(const row_t & Hm, float error, float stdMeasNoise)
+            {
+                // ====== INNOVATION COVARIANCE ======
+
+                column_t PHTm;
+                float R = stdMeasNoise*stdMeasNoise;
+                float HPHR = _P.innovationVariance(Hm, R, PHTm); // HPH' + R
+
+                checkNan(HPHR, "HPHR", count++);
+
+                // ====== MEASUREMENT UPDATE ======
+                // Calculate the Kalman gain and perform the state update
+                column_t Km;
+                for (int i=0; i<STATE_DIM; i++) {
+                    Km.set(i,0, PHTm.get(i,0)/HPHR); // kalman gain = (PH' (HPH' + R )^-1)
+                    S[i] += Km.get(i,0) * error; // state update
+                }
+
+                // After a reset the covariance is zero, so PH' is too
+                if (stateEstimatorAssertNotNaN()) {
+                    PHTm.zero();
+                    HPHR = R;
+                }
+
+                // ====== COVARIANCE UPDATE ======
+                _P.correct(Hm, Km, PHTm, HPHR, R);
+            }
+
+        public:
+
+            void reset(void)
+            {
+                for (uint8_t j=0; j<STATE_DIM; ++j) {
+                    S[j] = 0;
+                }
+                _P.reset();
+
+                _pendingTime = 0;
+                _pendingGyro[0] = 0;
+                _pendingGyro[1] = 0;
+                _pendingGyro[2] = 0;
+            }
+
+            /**
+             * Runs the process model over dt seconds, given the body rates in radians per second and the
+             * accelerometer reading in Gs, both with z up.
+             */
+            void predict(float dt, const float gyro[3], const float accel[3])
+            {
+                float dt2 = dt*dt;
+
+                float ax = accel[0]*GRAVITY;
+                float ay = accel[1]*GRAVITY;
+                float az = accel[2]*GRAVITY;
+
+                // position, from body-frame velocity and acceleration rotated into the world frame
+                float dx = S[STATE_PX]*dt + ax*dt2/2;
+                float dy = S[STATE_PY]*dt + ay*dt2/2;
+                float dz = S[STATE_PZ]*dt + az*dt2/2;
+
+                S[STATE_X] += R[0][0]*dx + R[0][1]*dy + R[0][2]*dz;
+                S[STATE_Y] += R[1][0]*dx + R[1][1]*dy + R[1][2]*dz;
+                S[STATE_Z] += R[2][0]*dx + R[2][1]*dy + R[2][2]*dz - GRAVITY*dt2/2;
+
+                // body-frame velocity, from acceleration less gravity, and from the rotation of the body
+                float px = S[STATE_PX];
+                float py = S[STATE_PY];
+                float pz = S[STATE_PZ];
+
+                S[STATE_PX] += dt*(ax + gyro[2]*py - gyro[1]*pz - GRAVITY*R[2][0]);
+                S[STATE_PY] += dt*(ay - gyro[2]*px + gyro[0]*pz - GRAVITY*R[2][1]);
+                S[STATE_PZ] += dt*(az + gyro[1]*px - gyro[0]*py - GRAVITY*R[2][2]);
+
+                // attitude, by the rotation over dt
+                float vx = gyro[0]*dt;
+                float vy = gyro[1]*dt;
+                float vz = gyro[2]*dt;
+                float angle = sqrtf(vx*vx + vy*vy + vz*vz);
+                if (angle > 0) {
+                    float ca = cosf(angle / 2.0f);
+                    float sa = sinf(angle / 2.0f) / angle;
+                    qmath::quaternion_t dq = {ca, sa * vx, sa * vy, sa * vz};
+                    q = qmath::multiply(q, dq);
+                    qmath::normalize(q);
+                    qmath::toRotationMatrix(q, R);
+                }
+
+                _pendingTime += dt;
+                _pendingGyro[0] += gyro[0]*dt;
+                _pendingGyro[1] += gyro[1]*dt;
+                _pendingGyro[2] += gyro[2]*dt;
+            }
+
+            /**
+             * Corrects the velocity from the pixels counted by the flow sensor over deltaTime seconds,
+             * given the body rates about x and y.  The OpticalFlow sensor passes these as Hackflight's state
+             * carries them, with the pitch rate negated, unlike the rates it gives predict().
+             */
+            void correctFlow(float deltaTime, float dpixelx, float dpixely, float omegax, float omegay)
+            {
+                stateEstimatorPropagate();
+
+                //~~~ Body rates ~~~
+                // TODO check if this is feasible or if some filtering has to be done
+                _omegax_b = omegax;
+                _omegay_b = omegay;
+
+                _dx_g = S[STATE_PX];
+                _dy_g = S[STATE_PY];
+
+                // Saturate elevation in prediction and correction to avoid singularities
+                _z_g = S[STATE_Z] < 0.1f ?  0.1f : S[STATE_Z];
+
+                // ~~~ X velocity prediction and update ~~~
+                // predicts the number of accumulated pixels in the x-direction
+                float omegaFactor = 1.25f;
+                row_t Hx;
+                _predictedNX = (deltaTime * Npix / thetapix ) * ((_dx_g * R[2][2] / _z_g) - omegaFactor * _omegay_b);
+                _measuredNX = dpixelx * FLOW_SCALE;
+
+                // derive measurement equation with respect to dx (and z?)
+                Hx.set(0, STATE_Z,  (Npix * deltaTime / thetapix) * ((R[2][2] * _dx_g) / (-_z_g * _z_g)));
+                Hx.set(0, STATE_PX, (Npix * deltaTime / thetapix) * (R[2][2] / _z_g));
+
+                //First update
+                stateEstimatorScalarUpdate(Hx, _measuredNX-_predictedNX, STDDEV);
+
+                // ~~~ Y velocity prediction and update ~~~
+                row_t Hy;
+                _predictedNY = (deltaTime * Npix / thetapix ) * ((_dy_g * R[2][2] / _z_g) + omegaFactor * _omegax_b);
+                _measuredNY = dpixely * FLOW_SCALE;
+
+                // derive measurement equation with respect to dy (and z?)
+                Hy.set(0, STATE_Z,  (Npix * deltaTime / thetapix) * ((R[2][2] * _dy_g) / (-_z_g * _z_g)));
+                Hy.set(0, STATE_PY, (Npix * deltaTime / thetapix) * (R[2][2] / _z_g));
+
+                // Second update
+                stateEstimatorScalarUpdate(Hy, _measuredNY-_predictedNY, STDDEV);
+
+                stateEstimatorFinalize();
+            }
+
+            /**
+             * Corrects the altitude from a tilt-compensated rangefinder reading.
+             */
+            void correctRange(float z)
+            {
+                stateEstimatorPropagate();
+
+                row_t Hz;
+                Hz.set(0, STATE_Z, 1);
+
+                stateEstimatorScalarUpdate(Hz, z - S[STATE_Z], STDDEV_RANGE);
+
+                stateEstimatorFinalize();
+            }
+
+            /**
+             * Corrects the velocity from one flow frame with no process model, taking the altitude and
+             * climb rate as given.
+             */
+            void update(float deltaTime, float dpixelx, float dpixely, float omegax, float omegay, float z, float vz)
+            {
+                S[STATE_Z] = z;
+                S[STATE_PZ] = vz;
+
+                correctFlow(deltaTime, dpixelx, dpixely, omegax, omegay);
+            }
+
+            const float * getState(void) const
+            {
+                return S;
+            }
+
+            float getCovariance(uint8_t i, uint8_t j) const
+            {
+                return _P.get(i, j);
+            }
+
+    };  // class FlowEkf
+
+} // namespace hf
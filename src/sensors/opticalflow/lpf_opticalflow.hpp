@@ -28,6 +28,7 @@
 
 #include "sensor.hpp"
 #include "filters.hpp"
+#include "timebase.hpp"
 
 namespace hf {
 
@@ -35,7 +36,7 @@ namespace hf {
 
         private:
 
-            static constexpr float   UPDATE_PERIOD = .01f;
+            static const     uint32_t UPDATE_PERIOD_USEC = 10000;
             static const     uint8_t LPF_SIZE      = 64;
 
             // Use digital pin 10 for chip select
@@ -46,12 +47,12 @@ namespace hf {
             LowPassFilter _lpf_y = LowPassFilter(LPF_SIZE);
 
             // Track elapsed time for periodic readiness
-            float _previousTime = 0;
+            uint64_t _previousUsec = 0;
             float _deltaTime = 0;
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, uint64_t usec) override
             {
                 // Avoid time blips
                 if (_deltaTime > 0.02) return;
@@ -61,23 +62,27 @@ namespace hf {
                 _flowSensor.readMotionCount(&dpixelx, &dpixely);
 
                 // Scale readings by altitude, then low-pass filter them to get velocity
-                state.inertialVel[0] = _lpf_y.update(dpixely  * state.location[2] * _deltaTime);
-                state.inertialVel[1] = _lpf_x.update(-dpixelx * state.location[2] * _deltaTime);
+                const float * location = state.cache.getLocation();
+
+                state.inertialVel[0] = _lpf_y.update(dpixely  * location[2] * _deltaTime);
+                state.inertialVel[1] = _lpf_x.update(-dpixelx * location[2] * _deltaTime);
 
                 // Integrate velocity to get position
-                state.location[0] += state.inertialVel[0];
-                state.location[1] += state.inertialVel[1];
+                state.cache.setLocation(0, location[0] + state.inertialVel[0]);
+                state.cache.setLocation(1, location[1] + state.inertialVel[1]);
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(uint64_t usec) override
             {
-                _deltaTime = time - _previousTime; 
+                uint64_t elapsed = usec - _previousUsec;
+
+                _deltaTime = Timebase::seconds(elapsed);
 
-                bool result = _deltaTime > UPDATE_PERIOD;
+                bool result = elapsed > UPDATE_PERIOD_USEC;
 
                 if (result) {
 
-                    _previousTime = time;
+                    _previousUsec = usec;
                 }
 
                 return result;
@@ -97,7 +102,7 @@ namespace hf {
                 _lpf_x.init();
                 _lpf_y.init();
 
-                _previousTime = 0;
+                _previousUsec = 0;
 
             }
 
@@ -25,6 +25,7 @@
 
 #include "sensor.hpp"
 #include "filters.hpp"
+#include "timebase.hpp"
 
 namespace hf {
 
@@ -34,44 +35,46 @@ namespace hf {
 
             static constexpr float UPDATE_HZ = 25; // XXX should be using interrupt!
 
-            static constexpr float UPDATE_PERIOD = 1/UPDATE_HZ;
+            static constexpr uint32_t UPDATE_PERIOD_USEC = (uint32_t)(1e6 / UPDATE_HZ);
 
             float _distance = 0;
 
+            // Time of last accepted reading
+            uint64_t _readyUsec = 0;
+
+            // Previous values to support first-differencing
+            uint64_t _stateUsec = 0;
+            float _altitude = 0;
+
             LowPassFilter _lpf = LowPassFilter(20);
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, uint64_t usec) override
             {
-                // Previous values to support first-differencing
-                static float _time;
-                static float _altitude;
-
                 // Compensate for effect of pitch, roll on rangefinder reading
-                state.location[2] =  _distance * cos(state.rotation[0]) * cos(state.rotation[1]);
+                float altitude = _distance * state.cache.getTiltCosine();
+                state.cache.setLocation(2, altitude);
 
                 // Use first-differenced, low-pass-filtered altitude as variometer
-                state.inertialVel[2] = _lpf.update((state.location[2]-_altitude) / (time-_time));
+                state.inertialVel[2] = _lpf.update((altitude-_altitude) / Timebase::elapsed(_stateUsec, usec));
 
                 // Update first-difference values
-                _time = time;
-                _altitude = state.location[2];
+                _stateUsec = usec;
+                _altitude = altitude;
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(uint64_t usec) override
             {
                 float newDistance;
 
                 if (distanceAvailable(newDistance)) {
 
-                    static float _time;
-
-                    if (time-_time > UPDATE_PERIOD) {
+                    if (usec - _readyUsec > UPDATE_PERIOD_USEC) {
 
                         _distance = newDistance;
 
-                        _time = time; 
+                        _readyUsec = usec; 
 
                         return true;
                     }
@@ -27,7 +27,7 @@ namespace hf {
 
     class SurfaceMountSensor : public Sensor {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         protected:
 
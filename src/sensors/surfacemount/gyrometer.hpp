@@ -29,7 +29,7 @@ namespace hf {
 
     class Gyrometer : public SurfaceMountSensor {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         private:
 
@@ -39,19 +39,17 @@ namespace hf {
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, uint64_t usec) override
             {
-                (void)time;
+                (void)usec;
 
                 // NB: We negate gyro X, Y to simplify PID controller
-                state.angularVel[0] =  _x;
-                state.angularVel[1] = -_y;
-                state.angularVel[2] = -_z;
+                state.cache.setAngularVelocity(_x, -_y, -_z);
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(uint64_t usec) override
             {
-                (void)time;
+                (void)usec;
 
                 bool result = board->getGyrometer(_x, _y, _z);
 
@@ -35,7 +35,7 @@ namespace hf {
 
     class Magnetometer : public SurfaceMountSensor {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         private:
 
@@ -45,16 +45,16 @@ namespace hf {
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, uint64_t usec) override
             {
                 // Here is where you'd do sensor fusion
                 (void)state;
-                (void)time;
+                (void)usec;
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(uint64_t usec) override
             {
-                (void)time;
+                (void)usec;
 
                 return board->getMagnetometer(_uTs);
             }
@@ -33,7 +33,7 @@ namespace hf {
 
     class Quaternion : public SurfaceMountSensor {
 
-        friend class Hackflight;
+        template <typename BoardT, typename ReceiverT, typename MixerT, uint8_t MAXPIDS, uint8_t MAXSENSORS> friend class HackflightCore;
 
         private:
 
@@ -52,21 +52,16 @@ namespace hf {
                 _z = 0;
             }
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, uint64_t usec) override
             {
-                (void)time;
+                (void)usec;
 
-                computeEulerAngles(_w, _x, _y, _z, state.rotation);
-
-                // Convert heading from [-pi,+pi] to [0,2*pi]
-                if (state.rotation[2] < 0) {
-                    state.rotation[2] += 2*M_PI;
-                }
+                state.cache.setQuaternion(_w, _x, _y, _z);
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(uint64_t usec) override
             {
-                (void)time;
+                (void)usec;
 
                 return board->getQuaternion(_w, _x, _y, _z);
             }
@@ -76,13 +71,7 @@ namespace hf {
             // We make this public so we can use it in different sketches
             static void computeEulerAngles(float qw, float qx, float qy, float qz, float euler[3])
             {
-                euler[0] = atan2(2.0f*(qw*qx+qy*qz),qw*qw-qx*qx-qy*qy+qz*qz);
-                euler[1] =  asin(2.0f*(qx*qz-qw*qy));
-                euler[2] = atan2(2.0f*(qx*qy+qw*qz),qw*qw+qx*qx-qy*qy-qz*qz);
-
-                euler[0] = int(euler[0]*1000)/1000.0;
-                euler[1] = int(euler[1]*1000)/1000.0;
-                euler[2] = int(euler[2]*1000)/1000.0;
+                StateCache::computeEulerAngles(qw, qx, qy, qz, euler);
             }
 
     };  // class Quaternion
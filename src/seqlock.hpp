@@ -0,0 +1,114 @@
+/*
+   Sequence lock for sharing a snapshot between two cores or threads
+
+   One writer, any number of readers, and no mutexes: the writer bumps the
+   sequence number to odd before changing the data and back to even after,
+   and a reader that sees the number change (or sees it odd) across its copy
+   knows the copy may be torn and discards it.  The writer never waits; a
+   reader waits only if it chooses to retry.  The data is copied a word at a
+   time with GCC __atomic builtins, so a concurrent read is never undefined
+   behavior, just possibly stale.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace hf {
+
+    template <typename T>
+    class Seqlock {
+
+        static_assert(sizeof(T) % sizeof(uint32_t) == 0, "Seqlock data must be a whole number of 32-bit words");
+
+        private:
+
+            static const uint16_t WORDS = sizeof(T) / sizeof(uint32_t);
+
+            uint32_t _sequence = 0;
+
+            uint32_t _data[WORDS] = {0};
+
+        public:
+
+            /**
+             * Writer side.  Only one core or thread may write.
+             */
+            void write(const T & value)
+            {
+                uint32_t words[WORDS];
+                memcpy(words, &value, sizeof(T));
+
+                uint32_t sequence = __atomic_load_n(&_sequence, __ATOMIC_RELAXED);
+
+                // Odd sequence number tells readers a write is in progress
+                __atomic_store_n(&_sequence, sequence+1, __ATOMIC_RELAXED);
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+
+                for (uint16_t k=0; k<WORDS; ++k) {
+                    __atomic_store_n(&_data[k], words[k], __ATOMIC_RELAXED);
+                }
+
+                __atomic_store_n(&_sequence, sequence+2, __ATOMIC_RELEASE);
+            }
+
+            /**
+             * Reader side.  Returns false, leaving value unchanged, if a write overlapped the read.
+             */
+            bool tryRead(T & value)
+            {
+                uint32_t before = __atomic_load_n(&_sequence, __ATOMIC_ACQUIRE);
+
+                if (before & 1) {
+                    return false;
+                }
+
+                uint32_t words[WORDS];
+                for (uint16_t k=0; k<WORDS; ++k) {
+                    words[k] = __atomic_load_n(&_data[k], __ATOMIC_RELAXED);
+                }
+
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+                if (__atomic_load_n(&_sequence, __ATOMIC_RELAXED) != before) {
+                    return false;
+                }
+
+                memcpy(&value, words, sizeof(T));
+
+                return true;
+            }
+
+            // Retries until a read succeeds; fine when the writer is on another core or thread
+            void read(T & value)
+            {
+                while (!tryRead(value))
+                    ;
+            }
+
+            // Number of writes so far
+            uint32_t count(void)
+            {
+                return __atomic_load_n(&_sequence, __ATOMIC_ACQUIRE) / 2;
+            }
+
+    }; // class Seqlock
+
+} // namespace hf
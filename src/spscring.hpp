@@ -0,0 +1,102 @@
+/*
+   Wait-free single-producer / single-consumer ring buffer
+
+   Meant for passing data from an interrupt handler (the producer) to the
+   main loop (the consumer), or between two threads.  Neither side ever
+   blocks or disables interrupts.  Each index is written by only one side,
+   and the indices are single bytes, so loads and stores of them are atomic
+   on every target; GCC's __atomic builtins supply the ordering, without
+   needing <atomic>, which AVR lacks.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    template <typename T, uint8_t SIZE>
+    class SpscRing {
+
+        // Free-running byte counters must wrap at a multiple of SIZE
+        static_assert(SIZE > 0 && SIZE <= 128 && (SIZE & (SIZE-1)) == 0, "SpscRing size must be a power of two up to 128");
+
+        private:
+
+            T _items[SIZE];
+
+            uint8_t _head = 0; // next slot to write; written only by producer
+            uint8_t _tail = 0; // next slot to read; written only by consumer
+
+        public:
+
+            /**
+             * Producer side.  Returns false, leaving the ring unchanged, if the ring is full.
+             */
+            bool push(const T & item)
+            {
+                uint8_t head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+                uint8_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+
+                if ((uint8_t)(head - tail) == SIZE) {
+                    return false;
+                }
+
+                _items[head & (SIZE-1)] = item;
+
+                // Publish the item only after it has been written
+                __atomic_store_n(&_head, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+
+                return true;
+            }
+
+            /**
+             * Consumer side.  Returns false if the ring is empty.
+             */
+            bool pop(T & item)
+            {
+                uint8_t tail = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+                uint8_t head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+
+                if (head == tail) {
+                    return false;
+                }
+
+                item = _items[tail & (SIZE-1)];
+
+                // Free the slot only after it has been read
+                __atomic_store_n(&_tail, (uint8_t)(tail + 1), __ATOMIC_RELEASE);
+
+                return true;
+            }
+
+            // Either side; the answer may be out of date by the time the caller acts on it
+            uint8_t count(void)
+            {
+                return (uint8_t)(__atomic_load_n(&_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&_tail, __ATOMIC_ACQUIRE));
+            }
+
+            static uint8_t capacity(void)
+            {
+                return SIZE;
+            }
+
+    }; // class SpscRing
+
+} // namespace hf
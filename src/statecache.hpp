@@ -0,0 +1,327 @@
+/*
+   Versioned vehicle state with values derived from it on demand
+
+   Holds the quaternion, angular velocity, and location, each with a
+   version number that goes up every time it is set.  Euler angles, the
+   rotation matrix, the cosine of the tilt from vertical, and the sine and
+   cosine of the heading are computed from the quaternion the first time
+   something asks for them after it changes, and remembered until it
+   changes again, so each is computed at most once per quaternion update
+   however many modules read it, and not at all if none do.
+
+   StateCache has no constructor, so that state_t stays a plain struct that
+   can be cleared with memset and copied a word at a time between cores;
+   call reset() before using it.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "qmath.hpp"
+
+namespace hf {
+
+    class StateCache {
+
+        public:
+
+            typedef float matrix_t[3][3];
+
+        private:
+
+            // Primary values, each with a count of the times it has been set
+            float    _quaternion[4];  // w, x, y, z
+            float    _angularVel[3];
+            float    _location[3];
+            uint32_t _quaternionVersion;
+            uint32_t _angularVelVersion;
+            uint32_t _locationVersion;
+
+            // Added to Euler roll and pitch to compensate for sloppy IMU mounting
+            float _rollTrim;
+            float _pitchTrim;
+
+            // Derived from the quaternion, each stamped with the quaternion version it came from
+            float    _euler[3];
+            matrix_t _rotation;
+            float    _tiltCosine;
+            float    _yawSine;
+            float    _yawCosine;
+            uint32_t _eulerVersion;
+            uint32_t _rotationVersion;
+            uint32_t _tiltVersion;
+            uint32_t _yawVersion;
+
+        public:
+
+            /**
+             * Level, at rest at the origin, with nothing derived yet.
+             */
+            void reset(void)
+            {
+                setQuaternion(1, 0, 0, 0);
+
+                for (uint8_t k=0; k<3; ++k) {
+                    _angularVel[k] = 0;
+                    _location[k] = 0;
+                    _euler[k] = 0;
+                    for (uint8_t j=0; j<3; ++j) {
+                        _rotation[k][j] = 0;
+                    }
+                }
+
+                _tiltCosine = 0;
+                _yawSine = 0;
+                _yawCosine = 0;
+
+                _quaternionVersion = 1;
+                _angularVelVersion = 1;
+                _locationVersion = 1;
+
+                _rollTrim = 0;
+                _pitchTrim = 0;
+
+                _eulerVersion = 0;
+                _rotationVersion = 0;
+                _tiltVersion = 0;
+                _yawVersion = 0;
+            }
+
+            void setQuaternion(float qw, float qx, float qy, float qz)
+            {
+                _quaternion[0] = qw;
+                _quaternion[1] = qx;
+                _quaternion[2] = qy;
+                _quaternion[3] = qz;
+
+                _quaternionVersion++;
+            }
+
+            void setAngularVelocity(float x, float y, float z)
+            {
+                _angularVel[0] = x;
+                _angularVel[1] = y;
+                _angularVel[2] = z;
+
+                _angularVelVersion++;
+            }
+
+            void setLocation(uint8_t axis, float value)
+            {
+                _location[axis] = value;
+
+                _locationVersion++;
+            }
+
+            void setRollPitchTrim(float roll, float pitch)
+            {
+                if (roll != _rollTrim || pitch != _pitchTrim) {
+                    _rollTrim = roll;
+                    _pitchTrim = pitch;
+                    _eulerVersion = _quaternionVersion - 1;
+                }
+            }
+
+            float getRollTrim(void) const
+            {
+                return _rollTrim;
+            }
+
+            float getPitchTrim(void) const
+            {
+                return _pitchTrim;
+            }
+
+            const float * getQuaternion(void) const
+            {
+                return _quaternion;
+            }
+
+            const float * getAngularVelocity(void) const
+            {
+                return _angularVel;
+            }
+
+            const float * getLocation(void) const
+            {
+                return _location;
+            }
+
+            uint32_t getQuaternionVersion(void) const
+            {
+                return _quaternionVersion;
+            }
+
+            uint32_t getAngularVelocityVersion(void) const
+            {
+                return _angularVelVersion;
+            }
+
+            uint32_t getLocationVersion(void) const
+            {
+                return _locationVersion;
+            }
+
+            /**
+             * Roll, pitch, and heading in [0,2*pi], with the roll and pitch trim added.
+             */
+            const float * getEulerAngles(void)
+            {
+                if (_eulerVersion != _quaternionVersion) {
+
+                    computeEulerAngles(_quaternion[0], _quaternion[1], _quaternion[2], _quaternion[3], _euler);
+
+                    // Convert heading from [-pi,+pi] to [0,2*pi]
+                    if (_euler[2] < 0) {
+                        _euler[2] += 2*M_PI;
+                    }
+
+                    _euler[0] += _rollTrim;
+                    _euler[1] += _pitchTrim;
+
+                    _eulerVersion = _quaternionVersion;
+                }
+
+                return _euler;
+            }
+
+            /**
+             * Rotates body-frame vectors into the world frame.
+             */
+            const matrix_t & getRotationMatrix(void)
+            {
+                if (_rotationVersion != _quaternionVersion) {
+
+                    qmath::quaternion_t q = {_quaternion[0], _quaternion[1], _quaternion[2], _quaternion[3]};
+                    qmath::toRotationMatrix(q, _rotation);
+
+                    _rotationVersion = _quaternionVersion;
+                }
+
+                return _rotation;
+            }
+
+            /**
+             * Cosine of the angle between the body z axis and vertical, which is cos(roll)*cos(pitch).
+             */
+            float getTiltCosine(void)
+            {
+                if (_tiltVersion != _quaternionVersion) {
+
+                    const float * q = _quaternion;
+                    _tiltCosine = q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3];
+
+                    _tiltVersion = _quaternionVersion;
+                }
+
+                return _tiltCosine;
+            }
+
+            /**
+             * Sine and cosine of the heading, without computing the heading itself.
+             */
+            void getYaw(float & sine, float & cosine)
+            {
+                if (_yawVersion != _quaternionVersion) {
+
+                    const float * q = _quaternion;
+                    float s = 2 * (q[1]*q[2] + q[0]*q[3]);
+                    float c = q[0]*q[0] + q[1]*q[1] - q[2]*q[2] - q[3]*q[3];
+
+                    // Heading is undefined pointing straight up or down
+                    float n2 = s*s + c*c;
+                    if (n2 > 1e-12f) {
+                        float r = qmath::rsqrt(n2);
+                        _yawSine = s * r;
+                        _yawCosine = c * r;
+                    }
+                    else {
+                        _yawSine = 0;
+                        _yawCosine = 1;
+                    }
+
+                    _yawVersion = _quaternionVersion;
+                }
+
+                sine = _yawSine;
+                cosine = _yawCosine;
+            }
+
+            /**
+             * Takes the quaternion and angular velocity from another core's copy, along with anything
+             * already derived from them there.
+             */
+            void copyAttitude(const StateCache & other)
+            {
+                for (uint8_t k=0; k<4; ++k) {
+                    _quaternion[k] = other._quaternion[k];
+                }
+
+                for (uint8_t k=0; k<3; ++k) {
+                    _angularVel[k] = other._angularVel[k];
+                    _euler[k] = other._euler[k];
+                    for (uint8_t j=0; j<3; ++j) {
+                        _rotation[k][j] = other._rotation[k][j];
+                    }
+                }
+
+                _tiltCosine = other._tiltCosine;
+                _yawSine = other._yawSine;
+                _yawCosine = other._yawCosine;
+
+                _rollTrim = other._rollTrim;
+                _pitchTrim = other._pitchTrim;
+
+                _quaternionVersion = other._quaternionVersion;
+                _angularVelVersion = other._angularVelVersion;
+                _eulerVersion = other._eulerVersion;
+                _rotationVersion = other._rotationVersion;
+                _tiltVersion = other._tiltVersion;
+                _yawVersion = other._yawVersion;
+            }
+
+            /**
+             * Takes the location from another core's copy.
+             */
+            void copyLocation(const StateCache & other)
+            {
+                for (uint8_t k=0; k<3; ++k) {
+                    _location[k] = other._location[k];
+                }
+
+                _locationVersion = other._locationVersion;
+            }
+
+            // Roll, pitch, and yaw, truncated to milliradians
+            static void computeEulerAngles(float qw, float qx, float qy, float qz, float euler[3])
+            {
+                euler[0] = atan2(2.0f*(qw*qx+qy*qz),qw*qw-qx*qx-qy*qy+qz*qz);
+                euler[1] =  asin(2.0f*(qx*qz-qw*qy));
+                euler[2] = atan2(2.0f*(qx*qy+qw*qz),qw*qw+qx*qx-qy*qy-qz*qz);
+
+                euler[0] = int(euler[0]*1000)/1000.0;
+                euler[1] = int(euler[1]*1000)/1000.0;
+                euler[2] = int(euler[2]*1000)/1000.0;
+            }
+
+    }; // class StateCache
+
+} // namespace hf
@@ -0,0 +1,89 @@
+/*
+   Monotonic 64-bit microsecond timebase
+
+   Boards supply a 32-bit microsecond counter, which wraps after about 71
+   minutes, and float seconds lose sub-millisecond resolution after a few
+   hours.  A Timebase extends the counter to 64 bits by accumulating the
+   (wraparound-safe) difference between successive readings, so it stays
+   exact for as long as it is updated at least every half hour or so.
+   Time differences are taken in integer microseconds and converted to
+   float seconds only at the end.
+
+   A Timebase is not thread-safe; each core or thread that needs one should
+   have its own.
+
+   Copyright (c) 2019 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    class Timebase {
+
+        private:
+
+            uint32_t _counter = 0;  // last counter reading
+            uint64_t _usec = 0;     // the same moment on the 64-bit timebase
+
+            bool _started = false;
+
+        public:
+
+            /**
+             * Takes a new counter reading and returns it on the 64-bit timebase.
+             */
+            uint64_t update(uint32_t counter)
+            {
+                // The first reading can be anywhere in the counter's range
+                _usec = _started ? extend(counter) : counter;
+                _started = true;
+                _counter = counter;
+                return _usec;
+            }
+
+            /**
+             * Converts a counter reading taken near the last update() (e.g., an interrupt timestamp)
+             * to the 64-bit timebase, without advancing the timebase.
+             */
+            uint64_t extend(uint32_t counter) const
+            {
+                return _usec + (int32_t)(counter - _counter);
+            }
+
+            uint64_t now(void) const
+            {
+                return _usec;
+            }
+
+            // Converts a difference in microseconds to seconds
+            static float seconds(int64_t usec)
+            {
+                return usec / 1e6f;
+            }
+
+            // Seconds from start to end
+            static float elapsed(uint64_t start, uint64_t end)
+            {
+                return seconds((int64_t)(end - start));
+            }
+
+    }; // class Timebase
+
+} // namespace hf